@@ -11,11 +11,415 @@
 #define IO_CTRL_DEL 5
 #define IO_CTRL_CLE 6
 #define IO_CTRL_GET_DEF 7
+#define IO_CTRL_BAN_ADD 21      //arg: struct BanBatch *
+#define IO_CTRL_BAN_DEL 22      //arg: struct BanBatch *, ttl ignored
+#define IO_CTRL_BAN_FLUSH 23
+#define IO_CTRL_BAN_STAT 24     //arg: struct BanStat *
+#define IO_CTRL_IMAGE 25        //arg: struct RuleImageBuf *, replaces rules and default rule
+#define IO_CTRL_SCAN_STAT 26    //arg: struct ScanStat *
+#define IO_CTRL_MEM_STAT 27     //arg: struct MemStat *
+#define IO_CTRL_SHADOW_LOAD 28  //arg: struct ShadowLoad *, replaces the shadow rule set
+#define IO_CTRL_SHADOW_STAT 29  //arg: struct ShadowStat *
+#define IO_CTRL_SHADOW_PROMOTE 30   //shadow rule set replaces rules and default rule
+#define IO_CTRL_SHADOW_DROP 31
+#define IO_CTRL_CLS_ENGINE 32   //arg: enum ClsEngineId, recompiles the classifier
+#define IO_CTRL_FRAG_STAT 33    //arg: struct FragStat *
 
 //ioctrl ARGS
 #define IO_CTRL_PERMIT 11
 #define IO_CTRL_REJECT 12
 
+enum Rule{
+    RULE_PERMIT,  
+    RULE_REJECT,
+    RULE_QUEUE,     //hand to a userspace verdict program through NFQUEUE, rules only
+    RULE_REFUSE     //drop and answer with TCP RST or ICMP unreachable, rules only
+};
+
+enum PackageType {
+    PACKAGE_TYPE_ANY, //匹配所有类型
+    PACKAGE_TYPE_TCP,
+    PACKAGE_TYPE_UDP,
+    PACKAGE_TYPE_ICMP
+};
+
+//分别用于匹配任意IP 和 任意PORT
+enum {
+    IP_ANY, 
+    PORT_ANY
+};
+
+//rule in binary form, host byte order, used outside the kernel text parser
+struct RuleSpec {
+    unsigned char type;     //enum PackageType
+    unsigned char action;   //enum Rule
+    unsigned short reserved;
+    unsigned int srcip;
+    unsigned int srcmask;
+    unsigned int srcport;
+    unsigned int dstip;
+    unsigned int dstmask;
+    unsigned int dstport;
+};
+
+/*
+ * compiled classifier entry: one table per protocol (TCP/UDP/ICMP), each keeps
+ * the rules that may match that protocol in first-match order.
+ * a packet matches iff (field & mask) == value for all four fields,
+ * wildcards (IP_ANY/PORT_ANY, ICMP ports) have mask 0.
+ */
+#define CLS_PROTO_NUM 3
+
+struct ClsEntry {
+    unsigned int srcip;
+    unsigned int srcmask;
+    unsigned int dstip;
+    unsigned int dstmask;
+    unsigned short srcport;
+    unsigned short srcpmask;
+    unsigned short dstport;
+    unsigned short dstpmask;
+    unsigned int id;            //rule id (RuleNode.id); in an image, 0-based position in rule list
+    unsigned char action;       //enum Rule
+    unsigned char reserved[3];
+};
+
+/*
+ * classifier engines: auto picks array or tuple by rule set shape,
+ * list walks the rule list, array scans compiled tables in order,
+ * tuple hashes each distinct mask combination (tuple space search).
+ */
+enum ClsEngineId {
+    CLS_ENGINE_AUTO,
+    CLS_ENGINE_LIST,
+    CLS_ENGINE_ARRAY,
+    CLS_ENGINE_TUPLE,
+    CLS_ENGINE_NUM
+};
+
+#define CLS_ENGINE_NAMES { "auto", "list", "array", "tuple" }
+
+/*
+ * precompiled rule set image, produced by 'tinyfw_nf compile', loaded by the
+ * module at init (rule_image=<path>). host byte order.
+ * layout: header | struct RuleSpec[rule_count] | ClsEntry tables
+ * crc is crc32 (zlib) of the whole image with the crc field zeroed.
+ */
+#define RULE_IMAGE_MAGIC 0x74666269U    //"tfbi"
+#define RULE_IMAGE_VERSION 1
+
+struct RuleImageHeader {
+    unsigned int magic;
+    unsigned short version;
+    unsigned short header_size;
+    unsigned int total_size;
+    unsigned int crc;
+    unsigned int default_rule;      //enum Rule
+    unsigned int rule_count;
+    unsigned int rule_offset;       //struct RuleSpec[rule_count], first-match order
+    unsigned int entry_size;        //sizeof(struct ClsEntry)
+    unsigned int table_count[CLS_PROTO_NUM];
+    unsigned int table_offset[CLS_PROTO_NUM];
+};
+
+struct RuleImageBuf {
+    unsigned int size;
+    void *data;
+};
+
+//compiled classifier memory and update counters
+struct ClsStat {
+    unsigned long long version;         //version of the published classifier
+    unsigned long long entries;         //entries in published tables
+    unsigned long long chunks;          //chunks allocated, incl. versions waiting for RCU
+    unsigned long long slots;           //entry capacity of those chunks
+    unsigned long long bytes;           //chunks + spines
+    unsigned long long incremental;     //commits published by patching the previous version
+    unsigned long long rebuilds;        //commits published by a full compile
+    unsigned long long compactions;     //recompiles triggered by a low fill ratio
+    unsigned long long chunks_copied;   //chunks copied on write
+    unsigned long long engine;          //enum ClsEngineId of the published classifier
+    unsigned long long engine_mode;     //enum ClsEngineId requested, CLS_ENGINE_AUTO to select by shape
+    unsigned long long engine_bytes;    //memory of the published classifier
+    unsigned long long engine_switches; //recompiles because the selected engine changed
+    unsigned long long shapes;          //distinct mask combinations, summed over protocol tables
+    unsigned long long reach;           //entries a linear scan may compare, summed over tables
+    unsigned long long wildcard_rules;  //rules with a wildcard address or port
+    unsigned long long port_rules;      //rules with an exact port
+    unsigned long long prefilter_keys;  //exact host/port keys in the prefilter, 0 if there is none
+    unsigned long long prefilter_stale; //keys left by deleted rules
+    unsigned long long prefilter_bytes;
+    unsigned long long prefilter_protos;    //bit p: some rule applies to table p (TCP, UDP, ICMP)
+    unsigned long long prefilter_open;  //bit p: table p has a rule without exact field, always looked up
+    unsigned long long prefilter_rebuilds;  //recompiles because the prefilter went stale
+};
+
+//dynamic ban table
+struct BanEntry {
+    unsigned int ip;    //host byte order
+    unsigned int ttl;   //seconds, 0 for permanent
+};
+
+struct BanBatch {
+    unsigned int count;
+    struct BanEntry *entries;
+};
+
+struct BanStat {
+    unsigned int active;        //entries in table (expired ones wait for sweep)
+    unsigned int capacity;
+    unsigned long expired;      //entries reclaimed after ttl
+    unsigned long hits;         //packets dropped by ban table
+};
+
+//port scan detector
+struct ScanStat {
+    unsigned int active;        //sources seen within the current window
+    unsigned int blocked;       //sources being dropped
+    unsigned int capacity;      //slots in table
+    unsigned long detections;   //sources flagged as scanning
+    unsigned long drops;        //packets dropped from flagged sources
+    unsigned long evictions;    //live slots taken over by another source
+    unsigned long untracked;    //packets not tracked, all slots of the bucket blocked
+    unsigned long events_lost;  //detections not reported, event queue full
+};
+
+//verdicts of first TCP/UDP fragments, reused by the later fragments of the same datagram
+struct FragStat {
+    unsigned int capacity;      //entries per cpu, 0 if the cache is disabled
+    unsigned int cpus;
+    unsigned int live;          //entries not yet timed out, all cpus
+    unsigned int timeout_s;
+    unsigned long stored;       //first fragments whose verdict was cached
+    unsigned long hits;         //later fragments that reused a cached verdict
+    unsigned long orphans;      //later fragments without a cached verdict
+    unsigned long orphan_drops; //orphans dropped, see frag_orphan_drop
+    unsigned long evictions;    //live entries taken over by another datagram
+};
+
+//memory held by the module, bytes include slab/vmalloc object size; *_max 0 for no limit
+struct MemStat {
+    unsigned long long rule_nodes;      //incl. removed nodes waiting for RCU and private copies
+    unsigned long long rule_bytes;
+    unsigned long long rule_max;        //nodes
+    unsigned long long cls_chunks;      //incl. versions waiting for RCU
+    unsigned long long cls_bytes;
+    unsigned long long cls_max;         //bytes
+    unsigned long long ban_entries;
+    unsigned long long ban_bytes;       //entries + buckets
+    unsigned long long ban_max;         //entries
+    unsigned long long scan_slots;
+    unsigned long long scan_bytes;
+    unsigned long long frag_slots;      //all cpus
+    unsigned long long frag_bytes;
+    unsigned long long netns;           //network namespaces other than the host with their own rule set
+    unsigned long long netns_rules;     //rules of those namespaces, already counted in rule_nodes
+    unsigned long long netns_bytes;     //their rules and classifiers, already counted in rule/cls_bytes
+    unsigned long long stats_map_bytes;
+    unsigned long long io_bytes;        //ioctl/read buffer
+    unsigned long long total_bytes;
+};
+
+//shadow rule set, evaluated on sampled packets but never enforced
+#define SHADOW_PAIR_MAX 64
+
+struct ShadowLoad {
+    struct RuleImageBuf image;
+    unsigned int sample;        //evaluate 1 in sample packets
+};
+
+//verdict disagreements between a live rule and a shadow rule, id 0 for default rule
+struct ShadowPair {
+    unsigned int live_id;       //rule id as in dump
+    unsigned int shadow_id;     //position in the shadow rule set, 1-based
+    struct RuleSpec live;
+    struct RuleSpec shadow;
+    unsigned long long count;
+};
+
+struct ShadowStat {
+    unsigned int loaded;        //0 if no shadow rule set
+    unsigned int rules;
+    unsigned int default_rule;  //enum Rule
+    unsigned int sample;
+    unsigned int age;           //seconds since loaded
+    unsigned int pair_count;
+    unsigned long long samples;
+    unsigned long long disagreements;
+    unsigned long long live_ns;         //time spent classifying sampled packets
+    unsigned long long shadow_ns;
+    unsigned long long live_evaluated;  //rules compared for sampled packets
+    unsigned long long shadow_evaluated;
+    unsigned long long pairs_lost;      //disagreements of pairs not in pair[], table full
+    struct ShadowPair pair[SHADOW_PAIR_MAX];
+};
+
+//packet counters, one set per network namespace
+struct FilterStat {
+    unsigned long long packets;
+    unsigned long long accepted;
+    unsigned long long dropped;
+    unsigned long long rule_hits;       //packets matched by a rule
+    unsigned long long default_hits;    //packets fell through to default rule
+    unsigned long long banned;          //packets dropped by ban table
+    unsigned long long prefilter_bypass;    //packets the prefilter sent straight to default rule
+    unsigned long long prefilter_fp;    //false positives: let through by the prefilter, matched no rule
+    unsigned long long queued;          //packets handed to NFQUEUE, not counted in accepted/dropped
+    unsigned long long replies;         //'F' rule drops answered with RST/ICMP, counted in dropped
+    unsigned long long reply_drops;     //'F' rule drops left unanswered (rate limit, no route)
+};
+
+/*
+ * read-only statistics region, mmap /dev/myntfw to get it.
+ * 内核周期性刷新；读者先读 seq，若为奇数说明正在更新需重试，
+ * 拷贝完成后再次读取 seq，两次相同才是一致的快照。
+ */
+#define STATS_MAP_MAGIC 0x7466736dU     //"tfsm"
+
+struct StatsMapHeader {
+    unsigned int magic;
+    volatile unsigned int seq;
+    unsigned int generation;        //rule set generation of this snapshot
+    unsigned int rule_count;        //valid entries in rules[]
+    unsigned int rule_total;        //rules installed, may exceed capacity
+    unsigned int capacity;          //size of rules[]
+    unsigned int interval_ms;       //refresh interval
+    unsigned int reserved;
+    unsigned long long update_ns;   //monotonic time of snapshot
+    struct FilterStat global;
+    unsigned long long rules[0];    //hit count of each rule, in list order
+};
+
+/*
+ * generic netlink control channel
+ * 规则以嵌套的类型化属性传递，不再依赖文本解析；
+ * 事件通过多播组 TINYFW_GENL_MCGRP 广播。
+ * 命令作用于调用者所在 network namespace 的规则集；字符设备（ioctl）只管理初始（宿主）命名空间，
+ * 扫描检测、封禁表、影子规则集与后台优化也只用于宿主命名空间。
+ */
+#define TINYFW_GENL_NAME "tinyfw"
+#define TINYFW_GENL_VERSION 1
+#define TINYFW_GENL_MCGRP "events"
+
+/*
+ * conf --diff 的编辑数上限，超过时提交整体替换。内核按同一界限选择批量事务的执行方式：
+ * 不超过时在当前规则表上原地执行并增量更新分类器，否则在副本上执行后整体换入。
+ */
+#define DIFF_MAX_EDITS 2048
+
+enum TinyfwCmd {
+    TINYFW_CMD_UNSPEC,
+    TINYFW_CMD_ADD,         //A_RULE, [A_POS] insert before pos, 0/none for head
+    TINYFW_CMD_DEL,         //A_POS
+    TINYFW_CMD_REPLACE,     //A_POS, A_RULE
+    TINYFW_CMD_DUMP,        //dump, one message per rule
+    TINYFW_CMD_BATCH,       //A_COUNT, A_BATCH_OP * count, [A_GENERATION], [A_DEFAULT] applied atomically
+    TINYFW_CMD_GET_STATS,
+    TINYFW_CMD_EVT_GENERATION,  //multicast: rule set changed
+    TINYFW_CMD_EVT_THRESHOLD,   //multicast: drop rate above threshold
+    TINYFW_CMD_MOVE,        //batch only: A_POS, A_TO, keeps hit counters
+    TINYFW_CMD_OPTIMIZE,    //[A_DRY_RUN] reorder rules by hit count, reply A_COST_*, A_MOVED, host only
+    TINYFW_CMD_EVT_OPTIMIZED,   //multicast: background optimizer published a new order
+    TINYFW_CMD_EVT_SCAN,    //multicast: A_SRCIP flagged as scanning, A_PORTS, A_HOSTS, A_WINDOW, A_DROP
+    __TINYFW_CMD_MAX
+};
+#define TINYFW_CMD_MAX (__TINYFW_CMD_MAX - 1)
+
+enum TinyfwAttr {
+    TINYFW_A_UNSPEC,
+    TINYFW_A_RULE,          //nested TINYFW_RA_*
+    TINYFW_A_POS,           //u32, 1-based rule position
+    TINYFW_A_GENERATION,    //u32
+    TINYFW_A_BATCH,         //unused: a nest's 16-bit nla_len cannot hold a large batch
+    TINYFW_A_BATCH_OP,      //nested: A_OP, A_POS, [A_TO], [A_RULE], repeated top-level in CMD_BATCH
+    TINYFW_A_OP,            //u8, TINYFW_CMD_ADD/DEL/REPLACE/MOVE
+    TINYFW_A_STATS,         //nested TINYFW_SA_*
+    TINYFW_A_DEFAULT,       //u8, enum Rule
+    TINYFW_A_COUNT,         //u32, number of rules (of A_BATCH_OP in CMD_BATCH)
+    TINYFW_A_RATE,          //u64, events per second
+    TINYFW_A_THRESHOLD,     //u32
+    TINYFW_A_TO,            //u32, destination position of a move
+    TINYFW_A_DRY_RUN,       //flag, report only
+    TINYFW_A_COST_BEFORE,   //u64, avg rules evaluated per matched packet * 100
+    TINYFW_A_COST_AFTER,    //u64
+    TINYFW_A_MOVED,         //u32, rules whose position changed
+    TINYFW_A_APPLIED,       //u8, new order was published
+    TINYFW_A_CLS_STATS,     //nested TINYFW_CA_*
+    TINYFW_A_SRCIP,         //u32, host byte order
+    TINYFW_A_PORTS,         //u32, estimated distinct destination ports
+    TINYFW_A_HOSTS,         //u32, estimated distinct destination hosts
+    TINYFW_A_WINDOW,        //u32, seconds
+    TINYFW_A_DROP,          //u8, source is being dropped
+    TINYFW_A_NETNS,         //u8, 0 for the host (initial) network namespace, 1 for others
+    TINYFW_A_MEM_BYTES,     //u64, rules and classifier of this namespace's rule set
+    __TINYFW_A_MAX
+};
+#define TINYFW_A_MAX (__TINYFW_A_MAX - 1)
+
+enum TinyfwRuleAttr {
+    TINYFW_RA_UNSPEC,
+    TINYFW_RA_TYPE,         //u8, enum PackageType
+    TINYFW_RA_SRCIP,        //u32, host byte order
+    TINYFW_RA_SRCMASK,      //u32
+    TINYFW_RA_SRCPORT,      //u32
+    TINYFW_RA_DSTIP,        //u32
+    TINYFW_RA_DSTMASK,      //u32
+    TINYFW_RA_DSTPORT,      //u32
+    TINYFW_RA_ACTION,       //u8, enum Rule
+    TINYFW_RA_HITS,         //u64, dump only
+    TINYFW_RA_ID,           //u32, dump only, stable across moves
+    TINYFW_RA_REPLIES,      //u64, dump only, 'F' rule drops answered
+    TINYFW_RA_REPLY_DROPS,  //u64, dump only, 'F' rule drops left unanswered
+    __TINYFW_RA_MAX
+};
+#define TINYFW_RA_MAX (__TINYFW_RA_MAX - 1)
+
+enum TinyfwStatAttr {
+    TINYFW_SA_UNSPEC,
+    TINYFW_SA_PACKETS,      //u64, same order as struct FilterStat
+    TINYFW_SA_ACCEPTED,
+    TINYFW_SA_DROPPED,
+    TINYFW_SA_RULE_HITS,
+    TINYFW_SA_DEFAULT_HITS,
+    TINYFW_SA_BANNED,
+    TINYFW_SA_PREFILTER_BYPASS,
+    TINYFW_SA_PREFILTER_FP,
+    TINYFW_SA_QUEUED,
+    TINYFW_SA_REPLIES,
+    TINYFW_SA_REPLY_DROPS,
+    __TINYFW_SA_MAX
+};
+#define TINYFW_SA_MAX (__TINYFW_SA_MAX - 1)
+
+enum TinyfwClsAttr {
+    TINYFW_CA_UNSPEC,
+    TINYFW_CA_VERSION,      //u64, same order as struct ClsStat
+    TINYFW_CA_ENTRIES,
+    TINYFW_CA_CHUNKS,
+    TINYFW_CA_SLOTS,
+    TINYFW_CA_BYTES,
+    TINYFW_CA_INCREMENTAL,
+    TINYFW_CA_REBUILDS,
+    TINYFW_CA_COMPACTIONS,
+    TINYFW_CA_CHUNKS_COPIED,
+    TINYFW_CA_ENGINE,
+    TINYFW_CA_ENGINE_MODE,
+    TINYFW_CA_ENGINE_BYTES,
+    TINYFW_CA_ENGINE_SWITCHES,
+    TINYFW_CA_SHAPES,
+    TINYFW_CA_REACH,
+    TINYFW_CA_WILDCARD_RULES,
+    TINYFW_CA_PORT_RULES,
+    TINYFW_CA_PREFILTER_KEYS,
+    TINYFW_CA_PREFILTER_STALE,
+    TINYFW_CA_PREFILTER_BYTES,
+    TINYFW_CA_PREFILTER_PROTOS,
+    TINYFW_CA_PREFILTER_OPEN,
+    TINYFW_CA_PREFILTER_REBUILDS,
+    __TINYFW_CA_MAX
+};
+#define TINYFW_CA_MAX (__TINYFW_CA_MAX - 1)
+
 //inline void Debug(const char *DbgStr);
 
 #endif
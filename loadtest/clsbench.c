@@ -0,0 +1,220 @@
+// 分类器引擎对比：在用户态用内核的分类器源码，对同一规则集逐个引擎测量
+//
+// clsbench <conf file> [packets] [rounds] [seed]
+//     packets 默认 1000000，rounds 默认 5。报文一半由规则派生（通配部分随机），一半完全随机。
+//     对每个引擎打印编译耗时、占用内存、每包耗时（不用与用预过滤器，后者与 hook 相同）与平均比较次数
+//     （tuple 为探测的散列表数），并与 list 引擎（逐条遍历，原来的实现）的结果逐包比较，
+//     不一致时返回非0。预过滤器另打印大小、直接按默认规则处理的比例与假阳性率。
+//     开头打印规则集形态与自动选择的引擎，与内核 cls_engine=0 时的选择一致。
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common.h"
+#include "../myNetfilter_kernel/rule_list_manage.h"
+#include "../myNetfilter_kernel/classifier.h"
+#include "../myNetfilter_user/rule_spec.h"
+
+//rule_list_manage.c 提交规则集时通知 netlink 订阅者，这里不需要
+void NlNotifyGeneration(unsigned int generation) {
+}
+
+static double Now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int Rand32(void) {
+    return (unsigned int)random() << 16 ^ (unsigned int)random();
+}
+
+//按规则文件顺序构造私有规则表，规则编号为表中位置
+static int LoadRules(const char *path, struct RuleList *list) {
+    struct RuleSpecArray array;
+    struct RuleNode *rnode;
+    int i, fail;
+
+    memset(&array, 0, sizeof(array));
+    fail = RuleSpecLoadConf(path, &array);
+    if(fail < 0) {
+        printf("read %s FAILED!\n", path);
+        return -1;
+    }
+    if(fail > 0) {
+        printf("%d invalid lines skipped\n", fail);
+    }
+    memset(list, 0, sizeof(*list));
+    list->default_rule = RULE_PERMIT;
+    for(i = 0; i < array.count; ++i) {
+        rnode = RuleFromSpec(&array.rules[i]);
+        if(rnode == NULL) {
+            printf("invalid rule %d\n", i + 1);
+            return -1;
+        }
+        rnode->id = i + 1;
+        if(list->tail == NULL) {
+            list->head = rnode;
+        }
+        else {
+            list->tail->next = rnode;
+        }
+        list->tail = rnode;
+        ++list->length;
+    }
+    free(array.rules);
+    return 0;
+}
+
+//报文与 hook 中一样只有 TCP/UDP/ICMP；由规则派生时掩码以外的位与通配字段随机
+static void MakePackets(const struct RuleList *list, struct RuleNode *pkt, int count) {
+    const struct RuleNode **rules;
+    const struct RuleNode *rnode;
+    int i, n = 0;
+
+    rules = (const struct RuleNode **)malloc(sizeof(*rules) * (list->length + 1));
+    for(rnode = list->head; rnode != NULL; rnode = rnode->next) {
+        rules[n++] = rnode;
+    }
+    for(i = 0; i < count; ++i) {
+        memset(&pkt[i], 0, sizeof(pkt[i]));
+        pkt[i].type = PACKAGE_TYPE_TCP + random() % 3;
+        pkt[i].srcip = Rand32();
+        pkt[i].dstip = Rand32();
+        pkt[i].srcport = random() & 0xffff;
+        pkt[i].dstport = random() & 0xffff;
+        if(n == 0 || (i & 1)) {
+            continue;
+        }
+        rnode = rules[random() % n];
+        if(rnode->type != PACKAGE_TYPE_ANY) {
+            pkt[i].type = rnode->type;
+        }
+        if(rnode->srcip != IP_ANY) {
+            pkt[i].srcip = (rnode->srcip & rnode->srcmask) | (pkt[i].srcip & ~rnode->srcmask);
+        }
+        if(rnode->dstip != IP_ANY) {
+            pkt[i].dstip = (rnode->dstip & rnode->dstmask) | (pkt[i].dstip & ~rnode->dstmask);
+        }
+        if(rnode->srcport != PORT_ANY) {
+            pkt[i].srcport = rnode->srcport;
+        }
+        if(rnode->dstport != PORT_ANY) {
+            pkt[i].dstport = rnode->dstport;
+        }
+    }
+    free(rules);
+}
+
+int main(int argc, char *argv[]) {
+    const struct ClsEngine *engines[] = { &cls_list_engine, &cls_array_engine, &cls_tuple_engine };
+    const int nengine = sizeof(engines) / sizeof(engines[0]);
+    struct RuleList list;
+    struct ClsProfile prof;
+    struct Classifier *cls;
+    struct ClsPrefilter pf;
+    struct RuleNode *pkt, **expect, *match;
+    unsigned long long evaluated, bypass, fp;
+    unsigned int ev;
+    int packets = 1000000, rounds = 5, mismatch = 0, e, r, i, diff;
+    double start, build, lookup, filtered, pf_bypass = 0, pf_fp = 0;
+
+    if(argc < 2) {
+        printf("usage: clsbench <conf file> [packets] [rounds] [seed]\n");
+        return -1;
+    }
+    if(argc > 2) {
+        packets = atoi(argv[2]);
+    }
+    if(argc > 3) {
+        rounds = atoi(argv[3]);
+    }
+    srandom(argc > 4 ? atoi(argv[4]) : 1);
+    if(packets <= 0 || rounds <= 0 || RuleListInit() != 0 || LoadRules(argv[1], &list) != 0) {
+        return -1;
+    }
+    pkt = (struct RuleNode *)malloc(sizeof(struct RuleNode) * packets);
+    expect = (struct RuleNode **)malloc(sizeof(struct RuleNode *) * packets);
+    if(pkt == NULL || expect == NULL) {
+        printf("alloc packets FAILED!\n");
+        return -1;
+    }
+    MakePackets(&list, pkt, packets);
+
+    start = Now();
+    ClassifierProfile(&list, &prof);
+    build = Now() - start;
+    printf("rules %u, mask combinations %u, reachable entries %u, wildcard rules %u, port rules %u\n",
+           prof.rules, prof.shapes, prof.reach, prof.wildcard, prof.port_rules);
+    printf("profile %.3f ms, auto selects %s\n", build * 1e3, ClassifierSelect(&prof)->name);
+    printf("%-8s %10s %10s %10s %12s %14s %10s\n",
+           "engine", "build ms", "bytes", "ns/packet", "prefiltered", "evaluated/pkt", "mismatch");
+
+    for(e = 0; e < nengine; ++e) {
+        start = Now();
+        cls = ClassifierBuildEngine(&list, engines[e], &prof);
+        build = Now() - start;
+        if(cls == NULL) {
+            printf("%-8s build FAILED!\n", engines[e]->name);
+            continue;
+        }
+        evaluated = bypass = fp = 0;
+        diff = 0;
+        for(i = 0; i < packets; ++i) { //first pass checks the verdicts and counts comparisons
+            match = ClassifierLookup(cls, &pkt[i], &ev);
+            evaluated += ev;
+            if(e == 0) {
+                expect[i] = match;
+            }
+            else if(match != expect[i]) {
+                ++diff;
+            }
+            if(ClsPrefilterSkip(cls, &pkt[i])) {
+                diff += match != NULL;
+                ++bypass;
+            }
+            else if(match == NULL && ClsPrefilterCovers(cls, &pkt[i])) {
+                ++fp;
+            }
+        }
+        start = Now();
+        for(r = 0; r < rounds; ++r) {
+            for(i = 0; i < packets; ++i) {
+                match = ClassifierLookup(cls, &pkt[i], &ev);
+                __asm__ __volatile__("" : : "r"(match) : "memory");
+            }
+        }
+        lookup = Now() - start;
+        start = Now();
+        for(r = 0; r < rounds; ++r) {
+            for(i = 0; i < packets; ++i) {
+                match = ClsPrefilterSkip(cls, &pkt[i]) ? NULL : ClassifierLookup(cls, &pkt[i], &ev);
+                __asm__ __volatile__("" : : "r"(match) : "memory");
+            }
+        }
+        filtered = Now() - start;
+        printf("%-8s %10.3f %10lu %10.1f %12.1f %14.2f %10d\n", engines[e]->name, build * 1e3,
+               engines[e]->mem(cls), lookup * 1e9 / ((double)packets * rounds),
+               filtered * 1e9 / ((double)packets * rounds), (double)evaluated / packets, diff);
+        if(e == 0 && cls->prefilter != NULL) {
+            pf = *cls->prefilter;
+            pf_bypass = bypass * 100.0 / packets;
+            pf_fp = bypass + fp ? fp * 100.0 / (bypass + fp) : 0.0;
+        }
+        mismatch += diff;
+        ClassifierFree(cls);
+    }
+
+    if(pf_bypass != 0 || pf_fp != 0) {
+        printf("prefilter: %u keys, %lu bytes, protocols %#x (always looked up %#x), "
+               "%.2f%% bypassed, %.3f%% false positives\n",
+               pf.keys, pf.bytes, pf.protos, pf.open, pf_bypass, pf_fp);
+    }
+
+    return mismatch != 0;
+}
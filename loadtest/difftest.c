@@ -0,0 +1,219 @@
+// conf --diff 的编码检查：对若干规模的规则集计算差分并编码为 TINYFW_CMD_BATCH 消息，
+// 按内核的方式逐个解析顶层属性，检查
+//     属性恰好占满 nlmsg_len、各 nla_len 与实际长度一致、TINYFW_A_COUNT 等于操作数；
+//     解码出的操作依次作用于旧规则集后与新规则集相同；
+//     少量改动得到增量操作，而不是退化为整体替换；
+//     超过 nla_len 上限的嵌套属性被 NlNestEnd 拒绝。
+//
+// difftest [rules] [seed]
+//     rules 默认 10000。全部通过返回0，否则打印第一处错误并返回非0。
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include "../common.h"
+#include "../myNetfilter_user/genl_client.h"
+#include "../myNetfilter_user/rule_spec.h"
+#include "../myNetfilter_user/conf_diff.h"
+
+static unsigned int Rand32(void) {
+    return (unsigned int)random() << 16 ^ (unsigned int)random();
+}
+
+static void RandRule(struct RuleSpec *rule) {
+    int len = random() % 33;
+
+    memset(rule, 0, sizeof(*rule));
+    rule->type = random() % 4;
+    rule->action = random() % 2;
+    rule->srcmask = len ? ~0U << (32 - len) : 0;
+    rule->srcip = len ? Rand32() & rule->srcmask : IP_ANY;
+    rule->dstmask = 0xffffffff;
+    rule->dstip = Rand32();
+    rule->srcport = (random() & 1) ? PORT_ANY : random() & 0xffff;
+    rule->dstport = random() & 0xffff;
+}
+
+//与内核 RuleListInsertAt/DeleteAt/MoveAt 相同的位置语义
+static int ApplyOp(struct RuleSpec *rules, int *len, int op, unsigned int pos, unsigned int to,
+                   const struct RuleSpec *rule) {
+    struct RuleSpec temp;
+
+    switch(op) {
+        case TINYFW_CMD_ADD:
+            pos = pos < 1 ? 1 : (pos > (unsigned int)*len ? *len + 1 : pos);
+            memmove(&rules[pos], &rules[pos - 1], sizeof(*rules) * (*len - pos + 1));
+            rules[pos - 1] = *rule;
+            ++*len;
+            return 0;
+        case TINYFW_CMD_DEL:
+        case TINYFW_CMD_MOVE:
+            if(pos < 1 || pos > (unsigned int)*len) {
+                return -1;
+            }
+            temp = rules[pos - 1];
+            memmove(&rules[pos - 1], &rules[pos], sizeof(*rules) * (*len - pos));
+            --*len;
+            if(op == TINYFW_CMD_MOVE) {
+                return ApplyOp(rules, len, TINYFW_CMD_ADD, to, 0, &temp);
+            }
+            return 0;
+    }
+    return -1;
+}
+
+/* 编码 old -> new 的差分并逐字节解析检查，操作数不能超过 max_ops，返回0通过 */
+static int CheckDiff(const char *name, const struct RuleSpec *old_rules, int n,
+                     const struct RuleSpec *new_rules, int m, int max_ops) {
+    struct NlMsg msg;
+    struct nlmsghdr *nlh;
+    const struct nlattr *nla, *tb[TINYFW_A_MAX + 1];
+    struct DiffOp *ops;
+    struct RuleSpec *rules, rule;
+    int count, len = n, nop = 0, declared = -1, rem, iRet = -1;
+
+    if(DiffRules(old_rules, n, new_rules, m, &ops, &count) != 0) {
+        printf("%s: DiffRules FAILED!\n", name);
+        return -1;
+    }
+    rules = (struct RuleSpec *)malloc(sizeof(*rules) * (n + count + 1));
+    if(rules == NULL || NlMsgInit(&msg, GENL_ID_CTRL, 0, TINYFW_CMD_BATCH) != 0) {
+        free(ops);
+        free(rules);
+        return -1;
+    }
+    memcpy(rules, old_rules, sizeof(*rules) * n);
+    if(count > max_ops) {
+        printf("%s: %d ops, expected at most %d\n", name, count, max_ops);
+        goto out;
+    }
+    if(DiffEncodeBatch(&msg, 1, -1, ops, count) != 0) {
+        printf("%s: encode %d ops FAILED!\n", name, count);
+        goto out;
+    }
+    nlh = (struct nlmsghdr *)msg.buf;
+    nlh->nlmsg_len = msg.len;
+
+    nla = (const struct nlattr *)((const char *)NLMSG_DATA(nlh) + GENL_HDRLEN);
+    for(rem = nlh->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN; rem >= NLA_HDRLEN;
+            rem -= NLA_ALIGN(nla->nla_len), nla = (const struct nlattr *)((const char *)nla + NLA_ALIGN(nla->nla_len))) {
+        if(nla->nla_len < NLA_HDRLEN || nla->nla_len > rem) {
+            printf("%s: attribute %d has bad nla_len %u (%d bytes left)\n", name, nop, nla->nla_len, rem);
+            goto out;
+        }
+        switch(nla->nla_type & NLA_TYPE_MASK) {
+            case TINYFW_A_COUNT:
+                declared = NlGetU32(nla);
+                break;
+            case TINYFW_A_BATCH_OP:
+                NlParse(tb, TINYFW_A_MAX, (const char *)nla + NLA_HDRLEN, nla->nla_len - NLA_HDRLEN);
+                if(tb[TINYFW_A_RULE] != NULL) {
+                    NlGetRule(tb[TINYFW_A_RULE], &rule, NULL);
+                }
+                if(NlGetU8(tb[TINYFW_A_OP]) != ops[nop].op
+                        || ApplyOp(rules, &len, NlGetU8(tb[TINYFW_A_OP]), NlGetU32(tb[TINYFW_A_POS]),
+                                   NlGetU32(tb[TINYFW_A_TO]), &rule) != 0) {
+                    printf("%s: op %d does not decode or apply\n", name, nop);
+                    goto out;
+                }
+                ++nop;
+                break;
+            case TINYFW_A_GENERATION:
+                break;
+            default:
+                printf("%s: unexpected attribute %u\n", name, nla->nla_type);
+                goto out;
+        }
+    }
+    if(rem != 0 || declared != count || nop != count) {
+        printf("%s: %d bytes left, A_COUNT %d, %d ops parsed, %d encoded\n", name, rem, declared, nop, count);
+        goto out;
+    }
+    if(len != m || memcmp(rules, new_rules, sizeof(*rules) * m) != 0) {
+        printf("%s: applied ops do not give the new rule set\n", name);
+        goto out;
+    }
+    printf("%s: %d -> %d rules, %d ops, %zu bytes OK\n", name, n, m, count, msg.len);
+    iRet = 0;
+
+out:
+    NlMsgFree(&msg);
+    free(ops);
+    free(rules);
+    return iRet;
+}
+
+//嵌套属性超过 0xffff 字节时 NlNestEnd 必须失败
+static int CheckNestLimit(void) {
+    struct NlMsg msg;
+    size_t nest;
+    int i, iRet;
+
+    if(NlMsgInit(&msg, GENL_ID_CTRL, 0, TINYFW_CMD_BATCH) != 0) {
+        return -1;
+    }
+    nest = NlNestStart(&msg, TINYFW_A_BATCH_OP);
+    for(i = 0; i < 0x10000 / 8; ++i) {
+        NlPutU32(&msg, TINYFW_A_POS, i);
+    }
+    iRet = (nest != 0 && NlNestEnd(&msg, nest) != 0) ? 0 : -1;
+    NlMsgFree(&msg);
+    printf("nest over 0xffff bytes: %s\n", iRet == 0 ? "rejected OK" : "NOT rejected");
+    return iRet;
+}
+
+int main(int argc, char *argv[]) {
+    struct RuleSpec *a, *b, *c;
+    int n = argc > 1 ? atoi(argv[1]) : 10000, i, j, fail = 0;
+
+    srandom(argc > 2 ? atoi(argv[2]) : 1);
+    if(n <= 0) {
+        printf("usage: difftest [rules] [seed]\n");
+        return -1;
+    }
+    a = (struct RuleSpec *)malloc(sizeof(*a) * n);
+    b = (struct RuleSpec *)malloc(sizeof(*b) * n * 2);
+    c = (struct RuleSpec *)malloc(sizeof(*c) * n);
+    if(a == NULL || b == NULL || c == NULL) {
+        return -1;
+    }
+    for(i = 0; i < n; ++i) {
+        RandRule(&a[i]);
+        RandRule(&c[i]);
+    }
+    //少量改动：删除、插入、相邻交换各约 n/100 处
+    for(i = j = 0; i < n; ++i) {
+        switch(random() % 100) {
+            case 0:
+                break;
+            case 1:
+                RandRule(&b[j++]);
+                b[j++] = a[i];
+                break;
+            case 2:
+                if(i + 1 < n) {
+                    b[j++] = a[i + 1];
+                    b[j++] = a[i++];
+                    break;
+                }
+                //fall through
+            default:
+                b[j++] = a[i];
+        }
+    }
+
+    fail |= CheckNestLimit();
+    fail |= CheckDiff("first load", NULL, 0, a, n, n);
+    fail |= CheckDiff("small edit", a, n, b, j, n / 10 + 10);
+    fail |= CheckDiff("replace all", a, n, c, n, 2 * n);
+    fail |= CheckDiff("flush", a, n, NULL, 0, n);
+
+    free(a);
+    free(b);
+    free(c);
+    return fail ? 1 : 0;
+}
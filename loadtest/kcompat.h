@@ -0,0 +1,129 @@
+// clsbench 在用户态编译内核分类器源码（classifier.c、cls_tuple.c、rule_list_manage.c）所需的内核接口
+// 单线程使用：锁为空操作，RCU 回调立即执行，后台任务不运行。
+// 由 Makefile 以 -include 引入，内核头文件由 Makefile 生成为空文件。
+
+#ifndef KCOMPAT_H
+#define KCOMPAT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef _Bool bool;
+typedef unsigned int gfp_t;
+#define true 1
+#define false 0
+
+#define __user
+#define __rcu
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define printk printf
+#define module_param(name, type, perm)
+#define MODULE_PARM_DESC(name, desc)
+#define EXPORT_SYMBOL(sym)
+#define cond_resched()
+
+#define GFP_KERNEL 0
+#define __GFP_NOWARN 0
+#define PAGE_SIZE 4096UL
+#define PAGE_ALLOC_COSTLY_ORDER 3
+#define HZ 100
+
+static inline void *kmalloc(size_t size, gfp_t flags) { return malloc(size); }
+static inline void *kzalloc(size_t size, gfp_t flags) { return calloc(1, size); }
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags) { return calloc(n, size); }
+static inline void *vmalloc(unsigned long size) { return malloc(size); }
+static inline void *vzalloc(unsigned long size) { return calloc(1, size); }
+static inline void kfree(const void *ptr) { free((void *)ptr); }
+#define vfree kfree
+#define kvfree kfree
+
+struct kmem_cache { size_t size; };
+static inline struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                                   unsigned long flags, void (*ctor)(void *)) {
+    struct kmem_cache *cache = (struct kmem_cache *)malloc(sizeof(*cache));
+
+    if(cache != NULL) {
+        cache->size = size;
+    }
+    return cache;
+}
+static inline void kmem_cache_destroy(struct kmem_cache *cache) { free(cache); }
+static inline void *kmem_cache_zalloc(struct kmem_cache *cache, gfp_t flags) { return calloc(1, cache->size); }
+static inline void kmem_cache_free(struct kmem_cache *cache, void *ptr) { free(ptr); }
+static inline unsigned int kmem_cache_size(struct kmem_cache *cache) { return cache->size; }
+
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic_long_t;
+#define ATOMIC_INIT(i) { (i) }
+#define ATOMIC_LONG_INIT(i) { (i) }
+#define atomic_read(v) ((v)->counter)
+#define atomic_set(v, i) ((v)->counter = (i))
+#define atomic_inc_return(v) (++(v)->counter)
+#define atomic_long_read(v) ((v)->counter)
+#define atomic_long_set(v, i) ((v)->counter = (i))
+#define atomic_long_inc(v) ((v)->counter++)
+#define atomic_long_dec(v) ((v)->counter--)
+#define atomic_long_add(i, v) ((v)->counter += (i))
+#define atomic_long_sub(i, v) ((v)->counter -= (i))
+#define atomic_long_inc_return(v) (++(v)->counter)
+
+struct mutex { int unused; };
+#define DEFINE_MUTEX(name) struct mutex name
+#define mutex_lock(m)
+#define mutex_unlock(m)
+
+struct rcu_head { void (*func)(struct rcu_head *); };
+#define rcu_dereference(p) (p)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_assign_pointer(p, v) ((p) = (v))
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+#define synchronize_rcu()
+#define rcu_barrier()
+static inline void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *)) { func(head); }
+
+struct work_struct { int unused; };
+struct delayed_work { struct work_struct work; };
+#define DECLARE_DELAYED_WORK(name, fn) struct delayed_work name
+#define schedule_delayed_work(work, delay) 0
+#define cancel_delayed_work_sync(work) 0
+
+#define BITS_PER_LONG (8 * sizeof(long))
+#define BITS_TO_LONGS(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+static inline int __test_and_set_bit(unsigned long nr, unsigned long *addr) {
+    unsigned long mask = 1UL << (nr % BITS_PER_LONG);
+    int old = (addr[nr / BITS_PER_LONG] & mask) != 0;
+
+    addr[nr / BITS_PER_LONG] |= mask;
+    return old;
+}
+#define hweight32(x) __builtin_popcount(x)
+static inline unsigned long roundup_pow_of_two(unsigned long n) {
+    return n <= 1 ? 1 : 1UL << (8 * sizeof(long) - __builtin_clzl(n - 1));
+}
+static inline void sort(void *base, size_t num, size_t size, int (*cmp)(const void *, const void *),
+                        void (*swap)(void *, void *, int)) {
+    qsort(base, num, size, cmp);
+}
+
+static inline int kstrtouint(const char *s, unsigned int base, unsigned int *res) {
+    char *end;
+    unsigned long val = strtoul(s, &end, base);
+
+    if(end == s || *end != '\0') {
+        return -EINVAL;
+    }
+    *res = val;
+    return 0;
+}
+
+#endif
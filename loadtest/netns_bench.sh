@@ -0,0 +1,171 @@
+#!/bin/bash
+# 在本机用两个 network namespace + veth 对测量 hook 吞吐量，无需外部设备。
+#
+#   tfa (10.200.0.1) --veth--> tfb (10.200.0.2)  UDP 流量由 udpflood 产生，
+#   hook 在 tfb 的 PRE_ROUTING 上处理。每个命名空间有自己的规则集，规则与计数都在 tfb 中：
+#   对每种分类方式、每个规则集大小、每种默认策略，加载模块后生成 N 条不会命中的规则
+#   （每个报文都要比较全部规则），在 tfb 中以 conf --diff 装入，发送 duration 秒流量，
+#   记录发送/放行/丢弃 pps 与每包 CPU 时间。tfb 的默认规则计数没有增加时返回非0。
+#
+# 用法: sudo ./netns_bench.sh [-s "0 10 100 1000 10000"] [-d 5] [-o result]
+#           [-m "list:cls_engine=1 array:cls_engine=2 tuple:cls_engine=3"] [-v "permit reject"]
+#           [-k ../myNetfilter_kernel/myntfw.ko] [-t ../myNetfilter_user/tinyfw_nf]
+#           [-p payload] [-f flows]
+# 结果写入 <result>.csv 与 <result>.json。
+# cpu_ns_per_pkt 为测量期间所有 CPU 的 system+irq+softirq 时间除以发送的报文数（含发送端开销），
+# hook_ns_per_pkt 为相对同一分类方式、同一策略下 0 条规则时的增量，即规则匹配的开销。
+# 只比较各分类器引擎的查找开销（不经过网络栈、无需 root）可用 clsbench。
+
+set -u
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+SIZES="0 10 100 1000 10000"
+DURATION=5
+OUT=result
+MODES="list:cls_engine=1 array:cls_engine=2 tuple:cls_engine=3"
+VERDICTS="permit reject"
+KO=$HERE/../myNetfilter_kernel/myntfw.ko
+TOOL=$HERE/../myNetfilter_user/tinyfw_nf
+FLOOD=$HERE/udpflood
+PAYLOAD=18
+FLOWS=4
+PORT=9000
+NS_A=tfa
+NS_B=tfb
+WORK=$(mktemp -d /tmp/tinyfw_bench.XXXXXX)
+
+while getopts "s:d:o:m:v:k:t:p:f:h" opt; do
+    case $opt in
+        s) SIZES=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        o) OUT=$OPTARG ;;
+        m) MODES=$OPTARG ;;
+        v) VERDICTS=$OPTARG ;;
+        k) KO=$OPTARG ;;
+        t) TOOL=$OPTARG ;;
+        p) PAYLOAD=$OPTARG ;;
+        f) FLOWS=$OPTARG ;;
+        *) sed -n '2,18p' "$0"; exit 1 ;;
+    esac
+done
+
+die() {
+    echo "$*" >&2
+    exit 1
+}
+
+cleanup() {
+    rmmod myntfw 2>/dev/null
+    ip netns del $NS_A 2>/dev/null
+    ip netns del $NS_B 2>/dev/null
+    rm -rf "$WORK"
+}
+
+[ "$(id -u)" = 0 ] || die "must run as root"
+[ -f "$KO" ] || die "module $KO not found, build myNetfilter_kernel first"
+[ -x "$TOOL" ] || die "$TOOL not found, build myNetfilter_user first"
+[ -x "$FLOOD" ] || make -C "$HERE" >/dev/null || die "build udpflood FAILED"
+lsmod | grep -q '^myntfw ' && die "myntfw is already loaded"
+trap cleanup EXIT
+
+setup_netns() {
+    ip netns add $NS_A || die "create netns FAILED"
+    ip netns add $NS_B || die "create netns FAILED"
+    ip link add veth_tfa type veth peer name veth_tfb || die "create veth FAILED"
+    ip link set veth_tfa netns $NS_A
+    ip link set veth_tfb netns $NS_B
+    ip -n $NS_A addr add 10.200.0.1/24 dev veth_tfa
+    ip -n $NS_B addr add 10.200.0.2/24 dev veth_tfb
+    ip -n $NS_A link set lo up
+    ip -n $NS_B link set lo up
+    ip -n $NS_A link set veth_tfa up
+    ip -n $NS_B link set veth_tfb up
+    #static neighbours so no ARP traffic during the run
+    ip -n $NS_A neigh replace 10.200.0.2 dev veth_tfa \
+        lladdr "$(ip -n $NS_B -o link show veth_tfb | sed 's/.*link\/ether \([^ ]*\).*/\1/')"
+}
+
+# N rules that never match the test traffic (sources in 172.16.0.0/12)
+gen_rules() {
+    awk -v n="$1" 'BEGIN {
+        for(i = 0; i < n; ++i) {
+            printf("U 172.%d.%d.%d/32:A A:%d R\n", 16 + int(i / 65536) % 16,
+                   int(i / 256) % 256, i % 256, 1024 + i % 60000);
+        }
+    }'
+}
+
+# busy jiffies (system + irq + softirq) of all cpus
+cpu_busy() {
+    awk '/^cpu / { print $4 + $7 + $8 }' /proc/stat
+}
+
+# tfb 的计数，宿主命名空间的计数不包含这里的流量
+stat_field() {
+    ip netns exec $NS_B "$TOOL" stat 2>/dev/null | awk -v k="$1" '$1 == k":" { print $2 }'
+}
+
+stat_hits() {
+    ip netns exec $NS_B "$TOOL" stat 2>/dev/null | awk '$1 == "default" && $2 == "hits:" { print $3 }'
+}
+
+HZ=$(getconf CLK_TCK)
+setup_netns
+echo "mode,rules,verdict,duration_s,sent,sent_pps,accepted,accepted_pps,dropped,dropped_pps,delivered,cpu_ns_per_pkt,hook_ns_per_pkt" > "$WORK/raw.csv"
+
+for mode in $MODES; do
+    name=${mode%%:*}
+    params=$(echo "${mode#*:}" | tr ',' ' ')
+    for verdict in $VERDICTS; do
+        [ "$verdict" = permit ] && def=P || def=R
+        base_cpu=""
+        for size in $SIZES; do
+            gen_rules "$size" > "$WORK/rules.conf"
+            insmod "$KO" $params || die "insmod $KO FAILED"
+            ip netns exec $NS_B "$TOOL" conf --diff "$WORK/rules.conf" $def >/dev/null \
+                || die "install $size rules in $NS_B FAILED"
+            [ "$(stat_field rules)" = "$size" ] || die "$NS_B has $(stat_field rules) rules, expected $size"
+
+            ip netns exec $NS_B "$FLOOD" sink $PORT $((DURATION + 1)) > "$WORK/sink.out" &
+            sink_pid=$!
+            sleep 0.3
+            acc0=$(stat_field accepted); drop0=$(stat_field dropped); hit0=$(stat_hits); cpu0=$(cpu_busy)
+            ip netns exec $NS_A "$FLOOD" send 10.200.0.2 $PORT "$DURATION" $PAYLOAD $FLOWS > "$WORK/send.out"
+            acc1=$(stat_field accepted); drop1=$(stat_field dropped); hit1=$(stat_hits); cpu1=$(cpu_busy)
+            wait $sink_pid
+            rmmod myntfw || die "rmmod FAILED"
+            #每个报文都比较过全部规则后落到默认规则，计数不增说明 hook 没有处理这些流量
+            [ $((hit1 - hit0)) -gt 0 ] || die "$name/$size/$verdict: no packet reached the rules in $NS_B"
+
+            read sent secs < "$WORK/send.out"
+            read delivered _ < "$WORK/sink.out"
+            line=$(awk -v name="$name" -v size="$size" -v verdict="$verdict" -v secs="$secs" \
+                       -v sent="$sent" -v acc=$((acc1 - acc0)) -v drop=$((drop1 - drop0)) \
+                       -v delivered="$delivered" -v busy=$((cpu1 - cpu0)) -v hz="$HZ" -v base="$base_cpu" 'BEGIN {
+                cpu = sent ? busy * 1e9 / hz / sent : 0
+                hook = (base == "") ? 0 : cpu - base
+                printf("%s,%d,%s,%.3f,%d,%.0f,%d,%.0f,%d,%.0f,%d,%.1f,%.1f\n", name, size, verdict, secs,
+                       sent, sent / secs, acc, acc / secs, drop, drop / secs, delivered, cpu, hook)
+            }')
+            echo "$line" | tee -a "$WORK/raw.csv"
+            [ -z "$base_cpu" ] && base_cpu=$(echo "$line" | cut -d, -f12)
+        done
+    done
+done
+
+cp "$WORK/raw.csv" "$OUT.csv"
+awk -F, 'NR == 1 { for(i = 1; i <= NF; ++i) key[i] = $i; next }
+    {
+        printf("%s  {", NR == 2 ? "[\n" : ",\n")
+        for(i = 1; i <= NF; ++i) {
+            if(i == 1 || i == 3) {
+                printf("\"%s\": \"%s\"", key[i], $i)
+            }
+            else {
+                printf("\"%s\": %s", key[i], $i)
+            }
+            printf(i < NF ? ", " : "}")
+        }
+    }
+    END { print (NR > 1) ? "\n]" : "[]" }' "$WORK/raw.csv" > "$OUT.json"
+echo "results written to $OUT.csv and $OUT.json"
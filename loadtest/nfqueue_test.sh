@@ -0,0 +1,143 @@
+#!/bin/bash
+# 在本机用两个 network namespace + veth 对检查 'Q' 规则与 tinyfw_nf queue 的用户态判决。
+#
+#   tfa (10.200.0.1) --veth--> tfb (10.200.0.2)  UDP 流量由 udpflood 产生，
+#   模块规则 "U A:A A:<port> Q" 装入 tfb 自己的规则集（每个命名空间有自己的规则与计数），
+#   把流量按流散列到 queues 个队列，tinyfw_nf queue 在 tfb 中判决：
+#     permit  用户态规则放行，报文应送达，用户态没有丢弃
+#     reject  用户态规则丢弃，报文不应送达
+#     bypass  没有程序监听队列，queue_bypass=1 时报文直接放行
+#   每种情况打印发送/送达/入队数与 tinyfw_nf queue 的各队列速率、延迟与总计，
+#   tfb 中 'Q' 规则的命中数或入队数为0时该情况失败。
+#
+# 用法: sudo ./nfqueue_test.sh [-q queues] [-d duration] [-k ../myNetfilter_kernel/myntfw.ko]
+#           [-t ../myNetfilter_user/tinyfw_nf] [-p payload] [-f flows]
+# 任一情况不符合预期时返回非0。
+
+set -u
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+QUEUES=2
+DURATION=3
+KO=$HERE/../myNetfilter_kernel/myntfw.ko
+TOOL=$HERE/../myNetfilter_user/tinyfw_nf
+FLOOD=$HERE/udpflood
+PAYLOAD=18
+FLOWS=8
+PORT=9000
+NS_A=tfa
+NS_B=tfb
+WORK=$(mktemp -d /tmp/tinyfw_nfq.XXXXXX)
+
+while getopts "q:d:k:t:p:f:h" opt; do
+    case $opt in
+        q) QUEUES=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        k) KO=$OPTARG ;;
+        t) TOOL=$OPTARG ;;
+        p) PAYLOAD=$OPTARG ;;
+        f) FLOWS=$OPTARG ;;
+        *) sed -n '2,16p' "$0"; exit 1 ;;
+    esac
+done
+
+die() {
+    echo "$*" >&2
+    exit 1
+}
+
+cleanup() {
+    [ -n "${queue_pid:-}" ] && kill -INT "$queue_pid" 2>/dev/null && wait "$queue_pid"
+    rmmod myntfw 2>/dev/null
+    ip netns del $NS_A 2>/dev/null
+    ip netns del $NS_B 2>/dev/null
+    rm -rf "$WORK"
+}
+
+[ "$(id -u)" = 0 ] || die "must run as root"
+[ -f "$KO" ] || die "module $KO not found, build myNetfilter_kernel first"
+[ -x "$TOOL" ] || die "$TOOL not found, build myNetfilter_user first"
+[ -x "$FLOOD" ] || make -C "$HERE" >/dev/null || die "build udpflood FAILED"
+lsmod | grep -q '^myntfw ' && die "myntfw is already loaded"
+trap cleanup EXIT
+
+setup_netns() {
+    ip netns add $NS_A || die "create netns FAILED"
+    ip netns add $NS_B || die "create netns FAILED"
+    ip link add veth_tfa type veth peer name veth_tfb || die "create veth FAILED"
+    ip link set veth_tfa netns $NS_A
+    ip link set veth_tfb netns $NS_B
+    ip -n $NS_A addr add 10.200.0.1/24 dev veth_tfa
+    ip -n $NS_B addr add 10.200.0.2/24 dev veth_tfb
+    ip -n $NS_A link set lo up
+    ip -n $NS_B link set lo up
+    ip -n $NS_A link set veth_tfa up
+    ip -n $NS_B link set veth_tfb up
+    #static neighbours so no ARP traffic during the run
+    ip -n $NS_A neigh replace 10.200.0.2 dev veth_tfa \
+        lladdr "$(ip -n $NS_B -o link show veth_tfb | sed 's/.*link\/ether \([^ ]*\).*/\1/')"
+}
+
+# tfb 的计数，宿主命名空间的计数不包含这里的流量
+stat_field() {
+    ip netns exec $NS_B "$TOOL" stat 2>/dev/null | awk -v k="$1" '$1 == k":" { print $2 }'
+}
+
+stat_hits() {
+    ip netns exec $NS_B "$TOOL" stat 2>/dev/null | awk '$1 == "rule" && $2 == "hits:" { print $3 }'
+}
+
+# run_case <name> <user rule action|none> <expect: all|none>
+run_case() {
+    local name=$1 action=$2 expect=$3 q0 q1 h0 h1 sent secs delivered ok
+    queue_pid=""
+    if [ "$action" != none ]; then
+        echo "U 10.200.0.1/32:A A:$PORT $action" > "$WORK/user.conf"
+        ip netns exec $NS_B "$TOOL" queue "$WORK/user.conf" "$QUEUES" 0 P > "$WORK/queue.out" 2>&1 &
+        queue_pid=$!
+        sleep 0.5
+        kill -0 $queue_pid 2>/dev/null || { cat "$WORK/queue.out"; die "tinyfw_nf queue FAILED"; }
+    fi
+
+    ip netns exec $NS_B "$FLOOD" sink $PORT $((DURATION + 1)) > "$WORK/sink.out" &
+    sink_pid=$!
+    sleep 0.3
+    q0=$(stat_field queued); h0=$(stat_hits)
+    ip netns exec $NS_A "$FLOOD" send 10.200.0.2 $PORT "$DURATION" $PAYLOAD $FLOWS > "$WORK/send.out"
+    q1=$(stat_field queued); h1=$(stat_hits)
+    wait $sink_pid
+
+    if [ -n "$queue_pid" ]; then
+        kill -INT $queue_pid
+        wait $queue_pid
+        queue_pid=""
+    fi
+
+    read sent secs < "$WORK/send.out"
+    read delivered _ < "$WORK/sink.out"
+    if [ "$expect" = all ]; then
+        [ "$delivered" -gt 0 ] && ! grep -q '[1-9][0-9]* dropped' "$WORK/queue.out" 2>/dev/null && ok=PASS || ok=FAIL
+    else
+        [ "$delivered" -eq 0 ] && ok=PASS || ok=FAIL
+    fi
+    #报文没有经过 'Q' 规则时送达与否都不说明问题
+    [ $((h1 - h0)) -gt 0 ] && [ $((q1 - q0)) -gt 0 ] || ok=FAIL
+    printf "%-7s sent %d (%.0f pps), rule hits %d, queued %d, delivered %d  %s\n" \
+           "$name" "$sent" "$(echo "$sent $secs" | awk '{ print $2 ? $1 / $2 : 0 }')" \
+           $((h1 - h0)) $((q1 - q0)) "$delivered" "$ok"
+    [ "$action" != none ] && sed 's/^/    /' "$WORK/queue.out"
+    [ $ok = PASS ]
+}
+
+setup_netns
+insmod "$KO" queue_num=0 queue_total="$QUEUES" queue_bypass=1 || die "insmod $KO FAILED"
+echo "U A:A A:$PORT Q" > "$WORK/rules.conf"
+ip netns exec $NS_B "$TOOL" conf --diff "$WORK/rules.conf" P >/dev/null \
+    || die "install rules in $NS_B FAILED"
+[ "$(stat_field rules)" = 1 ] || die "$NS_B has no 'Q' rule"
+
+fail=0
+run_case permit P all || fail=1
+run_case reject R none || fail=1
+run_case bypass none all || fail=1
+exit $fail
@@ -0,0 +1,146 @@
+// 压测用 UDP 流量发生器与接收端
+//
+// udpflood send <dst ip> <port> <seconds> [payload] [sources]
+//     用 sendmmsg 批量发送，sources>1 时轮换源端口以模拟多条流
+// udpflood sink <port> <seconds>
+//     用 recvmmsg 批量接收并丢弃
+// 结束时在标准输出打印一行 "<packets> <seconds>"
+//
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BATCH 64
+#define MAX_PAYLOAD 1472
+
+static double Now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int DoSend(const char *str_ip, int port, double seconds, int payload, int sources) {
+    struct sockaddr_in dst, src;
+    struct mmsghdr msgs[BATCH];
+    struct iovec iov;
+    static char buf[MAX_PAYLOAD];
+    int *fds, i, n;
+    unsigned long long sent = 0;
+    double start, end;
+
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(port);
+    if(inet_pton(AF_INET, str_ip, &dst.sin_addr) != 1) {
+        fprintf(stderr, "bad address %s\n", str_ip);
+        return -1;
+    }
+    fds = (int *)calloc(sources, sizeof(int));
+    for(i = 0; i < sources; ++i) {
+        if((fds[i] = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+            perror("socket");
+            return -1;
+        }
+        memset(&src, 0, sizeof(src));
+        src.sin_family = AF_INET;
+        src.sin_port = htons(20000 + i);
+        bind(fds[i], (struct sockaddr *)&src, sizeof(src)); //best effort
+    }
+
+    iov.iov_base = buf;
+    iov.iov_len = payload;
+    memset(msgs, 0, sizeof(msgs));
+    for(i = 0; i < BATCH; ++i) {
+        msgs[i].msg_hdr.msg_name = &dst;
+        msgs[i].msg_hdr.msg_namelen = sizeof(dst);
+        msgs[i].msg_hdr.msg_iov = &iov;
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    start = Now();
+    end = start + seconds;
+    for(i = 0; Now() < end; i = (i + 1) % sources) {
+        n = sendmmsg(fds[i], msgs, BATCH, 0);
+        if(n > 0) {
+            sent += n;
+        }
+        else if(errno != ENOBUFS && errno != EAGAIN && errno != ECONNREFUSED) {
+            perror("sendmmsg");
+            break;
+        }
+    }
+    printf("%llu %.3f\n", sent, Now() - start);
+    return 0;
+}
+
+static int DoSink(int port, double seconds) {
+    struct sockaddr_in addr;
+    struct mmsghdr msgs[BATCH];
+    struct iovec iovs[BATCH];
+    static char bufs[BATCH][2048];
+    struct timeval tv = { 0, 100000 };
+    unsigned long long received = 0;
+    int fd, i, n, rcvbuf = 16 << 20;
+    double start, end;
+
+    if((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("bind");
+        return -1;
+    }
+    memset(msgs, 0, sizeof(msgs));
+    for(i = 0; i < BATCH; ++i) {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = sizeof(bufs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    start = Now();
+    end = start + seconds;
+    while(Now() < end) {
+        n = recvmmsg(fd, msgs, BATCH, 0, NULL);
+        if(n > 0) {
+            received += n;
+        }
+    }
+    printf("%llu %.3f\n", received, Now() - start);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int payload, sources;
+
+    if(argc >= 5 && strcmp(argv[1], "send") == 0) {
+        payload = argc > 5 ? atoi(argv[5]) : 18;
+        sources = argc > 6 ? atoi(argv[6]) : 1;
+        if(payload < 0 || payload > MAX_PAYLOAD || sources < 1 || sources > 1024) {
+            fprintf(stderr, "bad payload or sources\n");
+            return 1;
+        }
+        return DoSend(argv[2], atoi(argv[3]), atof(argv[4]), payload, sources) ? 1 : 0;
+    }
+    if(argc >= 4 && strcmp(argv[1], "sink") == 0) {
+        return DoSink(atoi(argv[2]), atof(argv[3])) ? 1 : 0;
+    }
+    fprintf(stderr, "usage: %s send <dst ip> <port> <seconds> [payload] [sources]\n"
+                    "       %s sink <port> <seconds>\n", argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,278 @@
+// FileName: myNetfilter_kernel/ban_table.c 
+// Describe: 动态封禁表（按源IP散列，带TTL的临时封禁）
+// Note: 封禁表独立于规则链表，每个报文在遍历规则前查询一次。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hash.h>
+#include <linux/rculist.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/percpu.h>
+
+#include "../common.h"
+#include "ban_table.h"
+
+#define BAN_LOCK_BITS 10
+#define BAN_SWEEP_SECS 16   //每个桶至少每BAN_SWEEP_SECS秒被扫描一次
+
+/*
+ * 散列表桶数为 2^ban_hash_bits。默认 2^20 个桶，1M 条封禁时平均每桶一条，
+ * 查找为 O(1)。ban_max 为封禁条目上限，超过后新增失败。
+ */
+static unsigned int ban_hash_bits = 20;
+module_param(ban_hash_bits, uint, 0444);
+MODULE_PARM_DESC(ban_hash_bits, "log2 of ban table bucket count");
+static unsigned int ban_max = 1 << 21;
+module_param(ban_max, uint, 0644);
+MODULE_PARM_DESC(ban_max, "max number of ban entries");
+
+struct BanNode {
+    struct hlist_node hnode;
+    unsigned int ip;
+    unsigned long expires;  //jiffies; 0 表示永久封禁
+    struct rcu_head rcu;
+};
+
+static struct hlist_head *g_ban_hash = NULL;
+static unsigned int g_ban_size = 0;
+static spinlock_t g_ban_locks[1 << BAN_LOCK_BITS];
+static struct kmem_cache *g_ban_cache = NULL;
+static atomic_t g_ban_count = ATOMIC_INIT(0);
+static atomic_long_t g_ban_expired = ATOMIC_LONG_INIT(0);
+static DEFINE_PER_CPU(unsigned long, g_ban_hits);
+
+static unsigned int g_sweep_pos = 0;
+static void BanSweep(struct work_struct *work);
+static DECLARE_DELAYED_WORK(g_sweep_work, BanSweep);
+
+static inline unsigned int BanHash(unsigned int ip) {
+    return hash_32(ip, ban_hash_bits);
+}
+
+static inline spinlock_t *BanLock(unsigned int bucket) {
+    return &g_ban_locks[bucket & ((1 << BAN_LOCK_BITS) - 1)];
+}
+
+//expires 可能正被 BanAdd 刷新，只读一次
+static inline int BanExpired(const struct BanNode *node, unsigned long now) {
+    unsigned long expires = READ_ONCE(node->expires);
+
+    return expires != 0 && time_after_eq(now, expires);
+}
+
+/* 调用方持有桶锁 */
+static void BanUnlink(struct BanNode *node) {
+    hlist_del_rcu(&node->hnode);
+    kfree_rcu(node, rcu);
+    atomic_dec(&g_ban_count);
+}
+
+/*
+ * 后台增量清理：每秒扫描 g_ban_size/BAN_SWEEP_SECS 个桶，回收已过期条目。
+ * 报文路径只做惰性判断（过期即视为未命中），从不在软中断里加锁或释放内存。
+ */
+static void BanSweep(struct work_struct *work) {
+    unsigned int i, step;
+    unsigned long now = jiffies;
+    struct BanNode *node;
+    struct hlist_node *tmp;
+
+    step = g_ban_size / BAN_SWEEP_SECS;
+    if(step == 0) {
+        step = g_ban_size;
+    }
+    for(i = 0; i < step; ++i, g_sweep_pos = (g_sweep_pos + 1) & (g_ban_size - 1)) {
+        if(hlist_empty(&g_ban_hash[g_sweep_pos])) {
+            continue;
+        }
+        spin_lock(BanLock(g_sweep_pos));
+        hlist_for_each_entry_safe(node, tmp, &g_ban_hash[g_sweep_pos], hnode) {
+            if(BanExpired(node, now)) {
+                BanUnlink(node);
+                atomic_long_inc(&g_ban_expired);
+            }
+        }
+        spin_unlock(BanLock(g_sweep_pos));
+    }
+
+    schedule_delayed_work(&g_sweep_work, HZ);
+}
+
+int BanTableInit(void) {
+    unsigned int i;
+
+    if(ban_hash_bits < BAN_LOCK_BITS || ban_hash_bits > 24) {
+        printk("ban_hash_bits out of range [%d, 24]\n", BAN_LOCK_BITS);
+        return -EINVAL;
+    }
+    g_ban_size = 1U << ban_hash_bits;
+    g_ban_hash = vmalloc(g_ban_size * sizeof(struct hlist_head));
+    if(g_ban_hash == NULL) {
+        return -ENOMEM;
+    }
+    for(i = 0; i < g_ban_size; ++i) {
+        INIT_HLIST_HEAD(&g_ban_hash[i]);
+    }
+    for(i = 0; i < (1 << BAN_LOCK_BITS); ++i) {
+        spin_lock_init(&g_ban_locks[i]);
+    }
+
+    g_ban_cache = kmem_cache_create("myfw_ban", sizeof(struct BanNode), 0, 0, NULL);
+    if(g_ban_cache == NULL) {
+        vfree(g_ban_hash);
+        g_ban_hash = NULL;
+        return -ENOMEM;
+    }
+
+    g_sweep_pos = 0;
+    schedule_delayed_work(&g_sweep_work, HZ);
+    return 0;
+}
+
+void BanTableCleanup(void) {
+    cancel_delayed_work_sync(&g_sweep_work);
+    BanFlush();
+    rcu_barrier(); //等待所有 kfree_rcu 完成后再销毁 cache
+    kmem_cache_destroy(g_ban_cache);
+    vfree(g_ban_hash);
+    g_ban_hash = NULL;
+}
+
+/*
+ * 添加或刷新一条封禁。ttl 以秒为单位，0 表示永久封禁。
+ * 已存在的地址只更新过期时间。g_ban_count 包含后台尚未清理的过期条目，
+ * 所以先回收目标桶中已过期的条目，再检查 ban_max。
+ */
+int BanAdd(unsigned int ip, unsigned int ttl) {
+    unsigned int bucket = BanHash(ip);
+    unsigned long now = jiffies, expires = 0;
+    struct BanNode *node, *found = NULL;
+    struct BanNode *new_node;
+    struct hlist_node *tmp;
+
+    if(ttl != 0) {
+        expires = now + (unsigned long)ttl * HZ;
+        if(expires == 0) {
+            expires = 1;
+        }
+    }
+
+    new_node = kmem_cache_alloc(g_ban_cache, GFP_KERNEL);
+    if(new_node == NULL) {
+        return -ENOMEM;
+    }
+    new_node->ip = ip;
+    new_node->expires = expires;
+
+    spin_lock(BanLock(bucket));
+    hlist_for_each_entry_safe(node, tmp, &g_ban_hash[bucket], hnode) {
+        if(node->ip == ip) {
+            found = node;
+        }
+        else if(BanExpired(node, now)) {
+            BanUnlink(node);
+            atomic_long_inc(&g_ban_expired);
+        }
+    }
+    if(found != NULL) {
+        WRITE_ONCE(found->expires, expires); //BanLookup reads it without the lock
+        spin_unlock(BanLock(bucket));
+        kmem_cache_free(g_ban_cache, new_node);
+        return 0;
+    }
+    if((unsigned int)atomic_read(&g_ban_count) >= ban_max) {
+        spin_unlock(BanLock(bucket));
+        kmem_cache_free(g_ban_cache, new_node);
+        return -ENOSPC;
+    }
+    hlist_add_head_rcu(&new_node->hnode, &g_ban_hash[bucket]);
+    atomic_inc(&g_ban_count);
+    spin_unlock(BanLock(bucket));
+
+    return 0;
+}
+
+int BanDelete(unsigned int ip) {
+    unsigned int bucket = BanHash(ip);
+    struct BanNode *node;
+
+    spin_lock(BanLock(bucket));
+    hlist_for_each_entry(node, &g_ban_hash[bucket], hnode) {
+        if(node->ip == ip) {
+            BanUnlink(node);
+            spin_unlock(BanLock(bucket));
+            return 0;
+        }
+    }
+    spin_unlock(BanLock(bucket));
+
+    return -ENOENT;
+}
+
+void BanFlush(void) {
+    unsigned int i;
+    struct BanNode *node;
+    struct hlist_node *tmp;
+
+    for(i = 0; i < g_ban_size; ++i) {
+        if(hlist_empty(&g_ban_hash[i])) {
+            continue;
+        }
+        spin_lock(BanLock(i));
+        hlist_for_each_entry_safe(node, tmp, &g_ban_hash[i], hnode) {
+            BanUnlink(node);
+        }
+        spin_unlock(BanLock(i));
+        cond_resched();
+    }
+}
+
+/*
+ * 报文路径调用（软中断上下文）。
+ * 返回1表示源地址处于封禁中。
+ */
+int BanLookup(unsigned int ip) {
+    struct BanNode *node;
+    int banned = 0;
+
+    if(atomic_read(&g_ban_count) == 0) {
+        return 0;
+    }
+
+    rcu_read_lock();
+    hlist_for_each_entry_rcu(node, &g_ban_hash[BanHash(ip)], hnode) {
+        if(node->ip == ip) {
+            banned = !BanExpired(node, jiffies);
+            break;
+        }
+    }
+    rcu_read_unlock();
+
+    if(banned) {
+        this_cpu_inc(g_ban_hits);
+    }
+    return banned;
+}
+
+void BanGetMem(struct MemStat *stat) {
+    stat->ban_entries = atomic_read(&g_ban_count);
+    stat->ban_bytes = stat->ban_entries * kmem_cache_size(g_ban_cache)
+                    + (unsigned long long)g_ban_size * sizeof(struct hlist_head);
+    stat->ban_max = ban_max;
+}
+
+void BanGetStat(struct BanStat *stat) {
+    int cpu;
+
+    stat->active = atomic_read(&g_ban_count);
+    stat->expired = atomic_long_read(&g_ban_expired);
+    stat->capacity = ban_max;
+    stat->hits = 0;
+    for_each_possible_cpu(cpu) {
+        stat->hits += per_cpu(g_ban_hits, cpu);
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef BAN_TABLE_H
+#define BAN_TABLE_H
+
+#include "../common.h"
+
+int BanTableInit(void);
+void BanTableCleanup(void);
+int BanAdd(unsigned int ip, unsigned int ttl);
+int BanDelete(unsigned int ip);
+void BanFlush(void);
+int BanLookup(unsigned int ip);
+void BanGetStat(struct BanStat *);
+void BanGetMem(struct MemStat *);
+
+#endif
@@ -0,0 +1,1274 @@
+// FileName: myNetfilter_kernel/classifier.c
+// Describe: 把规则链表编译为分类器供 hook 函数查找，查找结构由可替换的引擎实现
+// Note: 整体编译时按规则集形态选择引擎（list、array、tuple，见 cls_tuple.c），可用参数或命令指定，
+//       并构造预过滤器，hook 先用它排除不可能匹配任何规则的报文。
+//       array 引擎按协议分表、分块存储，单条增删改按规则的排序键定位，在草稿版本上写时复制
+//       （只复制页目录和被修改的块及 spine 页），提交时经 RCU 发布；其他引擎和整体变化时重新编译。编译失败时发布NULL，
+//       hook 退回遍历链表。后台任务在块填充率过低或所选引擎变化时整体重新编译。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+#include "../common.h"
+#include "classifier.h"
+
+/*
+ * cls_engine 指定引擎（enum ClsEngineId：0 自动 1 list 2 array 3 tuple），
+ * 修改后在下一次整体编译或后台检查时生效，'tinyfw_nf engine' 立即生效。
+ * use_classifier 为0时等同于 list 引擎（逐条遍历规则链表，原来的实现），保留用于兼容。
+ * cls_compact_fill: 块填充率（百分比）低于该值时整体重新编译，0 表示不压缩。
+ * cls_compact_interval_s: 检查填充率的周期。
+ * cls_max_kb: 分类器块（含等待 RCU 释放的旧版本）占用上限，超过时编译失败，
+ * 规则集仍然生效，hook 退回遍历链表；镜像安装则整体失败。0 表示不限制。
+ * cls_prefilter: 编译时构造预过滤器，修改后在下一次整体编译时生效。
+ */
+static unsigned int cls_engine = CLS_ENGINE_AUTO;
+module_param(cls_engine, uint, 0644);
+MODULE_PARM_DESC(cls_engine, "classifier engine: 0 auto, 1 list, 2 array, 3 tuple");
+static bool use_classifier = true;
+module_param(use_classifier, bool, 0644);
+MODULE_PARM_DESC(use_classifier, "match with the compiled classifier, 0 walks the rule list (cls_engine=1)");
+static unsigned int cls_compact_fill = 50;
+module_param(cls_compact_fill, uint, 0644);
+MODULE_PARM_DESC(cls_compact_fill, "recompile when chunk fill ratio drops below this percent, 0 to disable");
+static unsigned int cls_compact_interval_s = 30;
+module_param(cls_compact_interval_s, uint, 0644);
+MODULE_PARM_DESC(cls_compact_interval_s, "chunk fill ratio check period in seconds");
+static unsigned int cls_max_kb = 0;
+module_param(cls_max_kb, uint, 0644);
+MODULE_PARM_DESC(cls_max_kb, "max classifier memory in KB, 0 for no limit");
+static bool cls_prefilter = true;
+module_param(cls_prefilter, bool, 0644);
+MODULE_PARM_DESC(cls_prefilter, "skip the lookup for packets no rule can match");
+
+/* 一次散列探测的开销约相当于线性比较的表项数，用于选择引擎（由 loadtest/clsbench 测得） */
+#define CLS_TUPLE_PROBE 32
+
+extern struct RuleList g_rule_list;
+
+struct Classifier __rcu *g_classifier = NULL;
+
+/*
+ * 以下状态由 g_rule_mutex 保护。
+ * g_cls_draft 为尚未发布的下一版本，g_cls_rebuild 表示变化无法增量表示，提交时重新编译。
+ */
+static struct Classifier *g_cls_draft = NULL;
+static int g_cls_rebuild = 0;
+static atomic_t g_cls_version = ATOMIC_INIT(0);
+static struct ClsStat g_cls_stat;
+
+static atomic_long_t g_cls_chunks = ATOMIC_LONG_INIT(0);
+static atomic_long_t g_cls_spine_slots = ATOMIC_LONG_INIT(0);    //页目录
+static atomic_long_t g_cls_spine_pages = ATOMIC_LONG_INIT(0);
+static atomic_long_t g_cls_priv_bytes = ATOMIC_LONG_INIT(0);   //array 以外引擎的数据
+
+static void ClassifierDiscard(struct Classifier *draft);
+static void ClassifierCompactWork(struct work_struct *work);
+static DECLARE_DELAYED_WORK(g_cls_compact_work, ClassifierCompactWork);
+
+int ClassifierEnabled(void) {
+    return use_classifier;
+}
+
+/*
+ * 已发布的分类器不遍历 g_rule_list 时返回1（持有 g_rule_mutex）：hook 只经分类器查找，
+ * 对当前规则表的修改在下次提交前对读者不可见，批量事务可以原地执行。
+ */
+int ClassifierCoversList(void) {
+    const struct Classifier *cur = rcu_dereference_protected(g_classifier, 1);
+
+    return cur != NULL && cur->engine != &cls_list_engine;
+}
+
+int ClsRuleInProto(const struct RuleNode *rnode, int proto_idx) {
+    return rnode->type == PACKAGE_TYPE_ANY || rnode->type == proto_idx + PACKAGE_TYPE_TCP;
+}
+
+/*
+ * 把规则编译为第 proto_idx 张表（0:TCP 1:UDP 2:ICMP）中的一项。
+ * 保持 RuleMatch 的语义：IP 为 IP_ANY、端口为 PORT_ANY 时为通配，ICMP 报文不比较端口。
+ */
+void ClsCompile(struct ClsEntry *entry, const struct RuleNode *rnode, int proto_idx) {
+    memset(entry, 0, sizeof(*entry));
+    entry->srcmask = (rnode->srcip == IP_ANY) ? 0 : rnode->srcmask;
+    entry->srcip = rnode->srcip & entry->srcmask;
+    entry->dstmask = (rnode->dstip == IP_ANY) ? 0 : rnode->dstmask;
+    entry->dstip = rnode->dstip & entry->dstmask;
+    if(proto_idx != PACKAGE_TYPE_ICMP - PACKAGE_TYPE_TCP) {
+        entry->srcpmask = (rnode->srcport == PORT_ANY) ? 0 : 0xffff;
+        entry->srcport = rnode->srcport & entry->srcpmask;
+        entry->dstpmask = (rnode->dstport == PORT_ANY) ? 0 : 0xffff;
+        entry->dstport = rnode->dstport & entry->dstpmask;
+    }
+    entry->id = rnode->id;
+    entry->action = rnode->rule;
+}
+
+//分类器总占用（含等待 RCU 释放的旧版本，不计 spine）再增加 bytes 后是否超过 cls_max_kb
+static int ClsMemOver(unsigned long bytes) {
+    return cls_max_kb != 0
+        && atomic_long_read(&g_cls_chunks) * sizeof(struct ClsChunk) + atomic_long_read(&g_cls_priv_bytes)
+           + bytes > ((unsigned long)cls_max_kb << 10);
+}
+
+/* 其他引擎分配数据前登记，超过 cls_max_kb 时返回 -ENOMEM */
+int ClsMemCharge(unsigned long bytes) {
+    if(ClsMemOver(bytes)) {
+        return -ENOMEM;
+    }
+    atomic_long_add(bytes, &g_cls_priv_bytes);
+    return 0;
+}
+
+void ClsMemUncharge(unsigned long bytes) {
+    atomic_long_sub(bytes, &g_cls_priv_bytes);
+}
+
+static struct ClsChunk *ClsChunkAlloc(unsigned int version) {
+    struct ClsChunk *chunk;
+
+    if(ClsMemOver(sizeof(struct ClsChunk))) {
+        return NULL;
+    }
+    chunk = (struct ClsChunk *)kmalloc(sizeof(struct ClsChunk), GFP_KERNEL);
+    if(chunk == NULL) {
+        return NULL;
+    }
+    chunk->count = 0;
+    chunk->version = version;
+    chunk->retire_next = NULL;
+    atomic_long_inc(&g_cls_chunks);
+
+    return chunk;
+}
+
+static void ClsChunkFree(struct ClsChunk *chunk) {
+    atomic_long_dec(&g_cls_chunks);
+    kfree(chunk);
+}
+
+static struct ClsSpinePage *ClsPageAlloc(unsigned int version) {
+    struct ClsSpinePage *page;
+
+    page = (struct ClsSpinePage *)kmalloc(sizeof(struct ClsSpinePage), GFP_KERNEL);
+    if(page == NULL) {
+        return NULL;
+    }
+    page->count = 0;
+    page->version = version;
+    page->retire_next = NULL;
+    atomic_long_inc(&g_cls_spine_pages);
+
+    return page;
+}
+
+static void ClsPageFree(struct ClsSpinePage *page) {
+    atomic_long_dec(&g_cls_spine_pages);
+    kfree(page);
+}
+
+//页目录小时用 kmalloc，大时退回 vmalloc
+static int ClsSpineResize(struct ClsTable *table, unsigned int cap) {
+    struct ClsSpinePage **dir = NULL;
+    size_t size = sizeof(struct ClsSpinePage *) * cap;
+
+    if(size <= (PAGE_SIZE << PAGE_ALLOC_COSTLY_ORDER)) {
+        dir = (struct ClsSpinePage **)kmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+    }
+    if(dir == NULL) {
+        dir = (struct ClsSpinePage **)vmalloc(size);
+        if(dir == NULL) {
+            return -ENOMEM;
+        }
+    }
+    if(table->npage != 0) {
+        memcpy(dir, table->page, sizeof(struct ClsSpinePage *) * table->npage);
+    }
+    kvfree(table->page);
+    atomic_long_add((long)cap - (long)table->cap, &g_cls_spine_slots);
+    table->page = dir;
+    table->cap = cap;
+
+    return 0;
+}
+
+//只释放页目录
+static void ClsSpineFree(struct ClsTable *table) {
+    kvfree(table->page);
+    atomic_long_sub(table->cap, &g_cls_spine_slots);
+    table->page = NULL;
+    table->cap = table->npage = table->nchunk = 0;
+}
+
+/* 草稿中第 g 页可写：共享的页先复制一份，原页挂到 retired_pages 等待旧版本释放 */
+static struct ClsSpinePage *ClsPageWritable(struct Classifier *draft, struct ClsTable *table, unsigned int g) {
+    struct ClsSpinePage *page = table->page[g], *copy;
+
+    if(page->version == draft->version) {
+        return page;
+    }
+    copy = ClsPageAlloc(draft->version);
+    if(copy == NULL) {
+        return NULL;
+    }
+    copy->count = page->count;
+    memcpy(copy->chunk, page->chunk, sizeof(struct ClsChunk *) * page->count);
+    page->retire_next = draft->retired_pages;
+    draft->retired_pages = page;
+    table->page[g] = copy;
+
+    return copy;
+}
+
+/*
+ * 把块插入第 g 页第 c 个位置，g 等于页数时追加新页。页满时若插在页尾则另起一页，
+ * 否则对半拆分。本版本分配的块总是位于本版本的页中。
+ */
+static int ClsSpineInsert(struct Classifier *cls, struct ClsTable *table, unsigned int g, unsigned int c,
+                          struct ClsChunk *chunk) {
+    struct ClsSpinePage *page = NULL, *right;
+    unsigned int half;
+
+    if(g < table->npage && (page = ClsPageWritable(cls, table, g)) == NULL) {
+        return -ENOMEM;
+    }
+    if(page == NULL || page->count == CLS_SPINE_PAGE) {
+        g += (page != NULL);
+        if(table->npage == table->cap
+                && ClsSpineResize(table, table->cap ? table->cap * 2 : 4) != 0) {
+            return -ENOMEM;
+        }
+        right = ClsPageAlloc(cls->version);
+        if(right == NULL) {
+            return -ENOMEM;
+        }
+        memmove(&table->page[g + 1], &table->page[g], sizeof(struct ClsSpinePage *) * (table->npage - g));
+        table->page[g] = right;
+        ++table->npage;
+        if(page == NULL || c == page->count) {
+            page = right;
+            c = 0;
+        }
+        else {
+            half = CLS_SPINE_PAGE / 2;
+            right->count = page->count - half;
+            memcpy(right->chunk, page->chunk + half, sizeof(struct ClsChunk *) * right->count);
+            page->count = half;
+            if(c > half) {
+                page = right;
+                c -= half;
+            }
+        }
+    }
+    memmove(&page->chunk[c + 1], &page->chunk[c], sizeof(struct ClsChunk *) * (page->count - c));
+    page->chunk[c] = chunk;
+    ++page->count;
+    ++table->nchunk;
+
+    return 0;
+}
+
+/* 从可写的第 g 页摘下第 c 块，页空时一并移出目录并释放 */
+static void ClsSpineRemove(struct ClsTable *table, unsigned int g, unsigned int c) {
+    struct ClsSpinePage *page = table->page[g];
+
+    --page->count;
+    memmove(&page->chunk[c], &page->chunk[c + 1], sizeof(struct ClsChunk *) * (page->count - c));
+    --table->nchunk;
+    if(page->count == 0) {
+        --table->npage;
+        memmove(&table->page[g], &table->page[g + 1], sizeof(struct ClsSpinePage *) * (table->npage - g));
+        ClsPageFree(page);
+    }
+}
+
+struct Classifier *ClassifierNew(void) {
+    struct Classifier *cls;
+
+    cls = (struct Classifier *)kzalloc(sizeof(struct Classifier), GFP_KERNEL);
+    if(cls == NULL) {
+        return NULL;
+    }
+    cls->engine = &cls_array_engine;
+    cls->version = atomic_inc_return(&g_cls_version);
+    cls->own_all = 1;
+
+    return cls;
+}
+
+/* 追加到第 proto_idx 张表末尾，用于整体编译 */
+int ClassifierAppend(struct Classifier *cls, int proto_idx, const struct ClsEntry *entry,
+                     struct RuleNode *rnode) {
+    struct ClsTable *table = &cls->table[proto_idx];
+    struct ClsSpinePage *page = table->npage ? table->page[table->npage - 1] : NULL;
+    struct ClsChunk *chunk = page ? page->chunk[page->count - 1] : NULL;
+
+    if(chunk == NULL || chunk->count == CLS_CHUNK_SIZE) {
+        chunk = ClsChunkAlloc(cls->version);
+        if(chunk == NULL) {
+            return -ENOMEM;
+        }
+        if(ClsSpineInsert(cls, table, page ? table->npage - 1 : 0, page ? page->count : 0, chunk) != 0) {
+            ClsChunkFree(chunk);
+            return -ENOMEM;
+        }
+    }
+    chunk->rules[chunk->count] = *entry;
+    chunk->node[chunk->count++] = rnode;
+    ++table->count;
+
+    return 0;
+}
+
+/*
+ * own_all 为0时（已被增量版本取代）只释放页目录和被新版本替换掉的块、页，
+ * 其余块和页归新版本所有。
+ */
+static void ClsArrayDestroy(struct Classifier *cls) {
+    struct ClsSpinePage *page;
+    struct ClsChunk *chunk;
+    unsigned int g, c;
+    int p;
+
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        for(g = 0; cls->own_all && g < cls->table[p].npage; ++g) {
+            page = cls->table[p].page[g];
+            for(c = 0; c < page->count; ++c) {
+                ClsChunkFree(page->chunk[c]);
+            }
+            ClsPageFree(page);
+        }
+        ClsSpineFree(&cls->table[p]);
+    }
+    while((chunk = cls->retired) != NULL) {
+        cls->retired = chunk->retire_next;
+        ClsChunkFree(chunk);
+    }
+    while((page = cls->retired_pages) != NULL) {
+        cls->retired_pages = page->retire_next;
+        ClsPageFree(page);
+    }
+}
+
+//规则在第 p 张表中的锚点字段，没有精确字段时返回 CLS_PF_NUM
+static int ClsPrefilterAnchor(const struct RuleNode *rnode, int p, u32 *value) {
+    struct ClsEntry entry;
+
+    ClsCompile(&entry, rnode, p);
+    if(entry.srcmask == 0xffffffff) {
+        *value = entry.srcip;
+        return CLS_PF_SRCIP;
+    }
+    if(entry.dstmask == 0xffffffff) {
+        *value = entry.dstip;
+        return CLS_PF_DSTIP;
+    }
+    if(entry.dstpmask != 0) {
+        *value = entry.dstport;
+        return CLS_PF_DPORT;
+    }
+    if(entry.srcpmask != 0) {
+        *value = entry.srcport;
+        return CLS_PF_SPORT;
+    }
+    return CLS_PF_NUM;
+}
+
+/*
+ * 把规则加入预过滤器（持有 g_rule_mutex）。预过滤器可能正被 hook 读取，
+ * 只置位，读者至多多查找一次；新规则随分类器发布才可见，届时这些写入也已可见。
+ */
+static void ClsPrefilterAdd(struct ClsPrefilter *pf, const struct RuleNode *rnode) {
+    u64 h, *line;
+    u32 value;
+    int p, field;
+    unsigned int i;
+
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        if(!ClsRuleInProto(rnode, p)) {
+            continue;
+        }
+        field = ClsPrefilterAnchor(rnode, p, &value);
+        if(field == CLS_PF_NUM) {
+            pf->open |= 1U << p;
+        }
+        else {
+            h = ClsPrefilterHash(p, field, value);
+            line = pf->bits + ((u32)h & (pf->lines - 1)) * CLS_PF_LINE_WORDS;
+            for(i = 0, h >>= 28; i < CLS_PF_HASHES; ++i, h >>= 9) {
+                line[(h & 511) >> 6] |= 1ULL << (h & 63);
+            }
+            pf->fields[p] |= 1U << field;
+            ++pf->keys;
+        }
+        pf->protos |= 1U << p;
+    }
+}
+
+/* 规则已删除，它的键留在预过滤器中 */
+static void ClsPrefilterRemove(struct ClsPrefilter *pf, const struct RuleNode *rnode) {
+    u32 value;
+    int p;
+
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        if(ClsRuleInProto(rnode, p) && ClsPrefilterAnchor(rnode, p, &value) != CLS_PF_NUM) {
+            ++pf->stale;
+        }
+    }
+}
+
+/* 由规则表构造预过滤器，关闭或失败时返回NULL（hook 总是查找） */
+struct ClsPrefilter *ClsPrefilterBuild(const struct RuleList *list) {
+    struct ClsPrefilter *pf;
+    const struct RuleNode *cur;
+    unsigned long keys = 0, bytes;
+    unsigned int lines;
+    int p;
+
+    if(!cls_prefilter) {
+        return NULL;
+    }
+    for(cur = list->head; cur != NULL; cur = cur->next) {
+        for(p = 0; p < CLS_PROTO_NUM; ++p) {
+            keys += ClsRuleInProto(cur, p);
+        }
+    }
+    lines = roundup_pow_of_two(keys / 32 + 1);  //16 bits per key
+    bytes = sizeof(struct ClsPrefilter) + sizeof(u64) * CLS_PF_LINE_WORDS * lines;
+    if(ClsMemCharge(bytes) != 0) {
+        return NULL;
+    }
+    pf = (struct ClsPrefilter *)vzalloc(bytes);
+    if(pf == NULL) {
+        ClsMemUncharge(bytes);
+        return NULL;
+    }
+    pf->lines = lines;
+    pf->bytes = bytes;
+    for(cur = list->head; cur != NULL; cur = cur->next) {
+        ClsPrefilterAdd(pf, cur);
+    }
+
+    return pf;
+}
+
+static void ClsPrefilterFree(struct ClsPrefilter *pf) {
+    if(pf == NULL) {
+        return;
+    }
+    ClsMemUncharge(pf->bytes);
+    vfree(pf);
+}
+
+//删除过的键过多或装载过满，假阳性率升高
+static int ClsPrefilterStale(const struct ClsPrefilter *pf) {
+    return pf != NULL && (pf->stale * 2 > pf->keys || pf->keys > pf->lines * 64);
+}
+
+void ClassifierFree(struct Classifier *cls) {
+    if(cls == NULL) {
+        return;
+    }
+    if(cls->own_all) {
+        ClsPrefilterFree(cls->prefilter);
+    }
+    cls->engine->destroy(cls);
+    kfree(cls);
+}
+
+static void ClassifierFreeRcu(struct rcu_head *head) {
+    ClassifierFree(container_of(head, struct Classifier, rcu));
+}
+
+/* 丢弃未发布的草稿：只释放草稿自己分配的块和页，被替换的块和页仍属于已发布版本 */
+static void ClassifierDiscard(struct Classifier *draft) {
+    struct ClsSpinePage *page;
+    unsigned int g, c;
+    int p;
+
+    if(draft == NULL) {
+        return;
+    }
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        for(g = 0; g < draft->table[p].npage; ++g) {
+            page = draft->table[p].page[g];
+            if(page->version != draft->version) { //shared page, so are its chunks
+                continue;
+            }
+            for(c = 0; c < page->count; ++c) {
+                if(page->chunk[c]->version == draft->version) {
+                    ClsChunkFree(page->chunk[c]);
+                }
+            }
+            ClsPageFree(page);
+        }
+    }
+    draft->own_all = 0;
+    draft->retired = NULL;
+    draft->retired_pages = NULL;
+    ClassifierFree(draft);
+}
+
+/* 按节点当前的规则编号重写表项 id，cls 必须尚未发布或已无读者 */
+void ClassifierRenumber(struct Classifier *cls) {
+    struct ClsSpinePage *page;
+    struct ClsChunk *chunk;
+    unsigned int g, c, i;
+    int p;
+
+    if(cls->engine != &cls_array_engine) { //other engines return the node, id is read from it
+        return;
+    }
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        for(g = 0; g < cls->table[p].npage; ++g) {
+            page = cls->table[p].page[g];
+            for(c = 0; c < page->count; ++c) {
+                chunk = page->chunk[c];
+                for(i = 0; i < chunk->count; ++i) {
+                    chunk->rules[i].id = chunk->node[i]->id;
+                }
+            }
+        }
+    }
+}
+
+static int ClsArrayBuild(struct Classifier *cls, const struct RuleList *list) {
+    struct RuleNode *cur;
+    struct ClsEntry entry;
+    int p;
+
+    for(cur = list->head; cur != NULL; cur = cur->next) {
+        for(p = 0; p < CLS_PROTO_NUM; ++p) {
+            if(!ClsRuleInProto(cur, p)) {
+                continue;
+            }
+            ClsCompile(&entry, cur, p);
+            if(ClassifierAppend(cls, p, &entry, cur) != 0) {
+                return -ENOMEM;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * 统计规则集形态。各协议表在第一条全通配项之后的规则不可能被匹配，不计入
+ * reach 与 shapes。规则格式中端口只有精确与通配两种，没有范围。
+ */
+void ClassifierProfile(const struct RuleList *list, struct ClsProfile *prof) {
+    const struct RuleNode *cur;
+    struct ClsEntry entry;
+    unsigned long *seen;
+    int done[CLS_PROTO_NUM] = { 0 };
+    int p;
+
+    memset(prof, 0, sizeof(*prof));
+    seen = (unsigned long *)kzalloc(BITS_TO_LONGS(CLS_PROTO_NUM * CLS_SHAPE_NUM) * sizeof(long), GFP_KERNEL);
+    for(cur = list->head; cur != NULL; cur = cur->next) {
+        ++prof->rules;
+        if(cur->srcip == IP_ANY || cur->srcmask != 0xffffffff || cur->dstip == IP_ANY
+                || cur->dstmask != 0xffffffff || cur->srcport == PORT_ANY || cur->dstport == PORT_ANY) {
+            ++prof->wildcard;
+        }
+        if(cur->srcport != PORT_ANY || cur->dstport != PORT_ANY) {
+            ++prof->port_rules;
+        }
+        for(p = 0; p < CLS_PROTO_NUM; ++p) {
+            if(done[p] || !ClsRuleInProto(cur, p)) {
+                continue;
+            }
+            ClsCompile(&entry, cur, p);
+            ++prof->reach;
+            if(seen == NULL || !__test_and_set_bit(p * CLS_SHAPE_NUM + ClsShapeIndex(&entry), seen)) {
+                ++prof->shapes; //without the bitmap every entry counts, array is chosen
+            }
+            if((entry.srcmask | entry.dstmask | entry.srcpmask | entry.dstpmask) == 0) {
+                done[p] = 1;
+            }
+        }
+    }
+    kfree(seen);
+}
+
+//cls_engine/use_classifier 指定的引擎，自动选择时返回NULL
+static const struct ClsEngine *ClassifierForced(void) {
+    if(!use_classifier) {
+        return &cls_list_engine;
+    }
+    return cls_engine == CLS_ENGINE_AUTO ? NULL : ClsEngineGet(cls_engine);
+}
+
+/*
+ * 选择引擎：array 逐项比较，开销约为 reach；tuple 每种掩码组合最多探测一次散列表，
+ * 开销不超过 shapes * CLS_TUPLE_PROBE，但每次修改都要重新编译，所以只在更优时才选。
+ * list 与 array 比较次数相同而访存更多，只在指定时使用。
+ */
+const struct ClsEngine *ClassifierSelect(const struct ClsProfile *prof) {
+    const struct ClsEngine *engine = ClassifierForced();
+
+    if(engine != NULL) {
+        return engine;
+    }
+    if((unsigned long)prof->shapes * CLS_TUPLE_PROBE < prof->reach) {
+        return &cls_tuple_engine;
+    }
+    return &cls_array_engine;
+}
+
+/* 用指定引擎编译规则表，失败返回NULL */
+struct Classifier *ClassifierBuildEngine(const struct RuleList *list, const struct ClsEngine *engine,
+                                         const struct ClsProfile *prof) {
+    struct Classifier *cls;
+
+    cls = ClassifierNew();
+    if(cls == NULL) {
+        return NULL;
+    }
+    cls->engine = engine;
+    if(engine->build(cls, list) != 0) {
+        ClassifierFree(cls);
+        return NULL;
+    }
+    cls->prefilter = ClsPrefilterBuild(list);
+    cls->profile = *prof;
+    cls->rule_count = prof->rules;
+    cls->default_rule = list->default_rule;
+    cls->generation = list->generation;
+
+    return cls;
+}
+
+/*
+ * 编译规则表（持有 g_rule_mutex），引擎按规则集形态选择。失败返回NULL。
+ */
+struct Classifier *ClassifierBuild(const struct RuleList *list) {
+    struct ClsProfile prof;
+
+    ClassifierProfile(list, &prof);
+    return ClassifierBuildEngine(list, ClassifierSelect(&prof), &prof);
+}
+
+/*
+ * 为已编译好的 cls（影子规则集镜像中的 array 表）按规则集形态选择引擎，
+ * 与 cls 的引擎不同时重新编译并释放 cls；重新编译失败时仍返回 cls。
+ * 影子规则集不经过后台检查，所以装入时就按形态选择；当前规则集的镜像见 ClassifierAdopt。
+ */
+struct Classifier *ClassifierRefit(struct Classifier *cls, const struct RuleList *list) {
+    struct ClsProfile prof;
+    const struct ClsEngine *engine;
+    struct Classifier *built;
+
+    ClassifierProfile(list, &prof);
+    cls->profile = prof;
+    if(cls->engine == &cls_list_engine) {
+        cls->list = list;
+    }
+    engine = ClassifierSelect(&prof);
+    if(engine == cls->engine || (built = ClassifierBuildEngine(list, engine, &prof)) == NULL) {
+        if(cls->prefilter == NULL) {
+            cls->prefilter = ClsPrefilterBuild(list);
+        }
+        return cls;
+    }
+    ClassifierFree(cls);
+
+    return built;
+}
+
+/*
+ * 采用已编译好的 cls（镜像装入的 array 表、提升的影子规则集）作为 list 的分类器，不逐项处理规则：
+ * 只有 cls_engine/use_classifier 指定了其他引擎时才按设置重新编译（失败时仍用 cls）。
+ * 规则集形态与引擎的自动选择由 ClassifierCompactWork 在后台补做。
+ */
+static struct Classifier *ClassifierAdopt(struct Classifier *cls, const struct RuleList *list) {
+    const struct ClsEngine *forced = ClassifierForced();
+    struct ClsProfile prof;
+    struct Classifier *built;
+
+    if(forced != NULL && forced != cls->engine) {
+        ClassifierProfile(list, &prof);
+        built = ClassifierBuildEngine(list, forced, &prof);
+        if(built != NULL) {
+            ClassifierFree(cls);
+            return built;
+        }
+    }
+    if(cls->engine == &cls_list_engine) {
+        cls->list = list;
+    }
+    if(cls->prefilter == NULL) {
+        cls->prefilter = ClsPrefilterBuild(list);
+    }
+    return cls;
+}
+
+/*
+ * 发布新分类器（可为NULL），旧分类器在宽限期后释放。调用方持有 g_rule_mutex。
+ * 新分类器若是由旧分类器增量得到的草稿，旧分类器只释放页目录和被替换的块、页。
+ */
+void ClassifierPublish(struct Classifier *cls) {
+    struct Classifier *old = rcu_dereference_protected(g_classifier, 1);
+
+    if(old != NULL && cls != NULL && cls->base == old) {
+        old->own_all = 0;
+        old->retired = cls->retired;
+        old->retired_pages = cls->retired_pages;
+        cls->retired = NULL;
+        cls->retired_pages = NULL;
+    }
+    if(cls != NULL) {
+        cls->base = NULL;
+    }
+    else if(g_cls_draft != NULL) { //unloading, the draft is never published
+        ClassifierDiscard(g_cls_draft);
+        g_cls_draft = NULL;
+    }
+    rcu_assign_pointer(g_classifier, cls);
+    if(old != NULL) {
+        call_rcu(&old->rcu, ClassifierFreeRcu);
+    }
+}
+
+/* 由已发布版本复制页目录得到草稿，页和块全部共享 */
+static struct Classifier *ClassifierDraft(const struct Classifier *cur) {
+    struct Classifier *draft;
+    int p;
+
+    draft = ClassifierNew();
+    if(draft == NULL) {
+        return NULL;
+    }
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        if(cur->table[p].npage != 0
+                && ClsSpineResize(&draft->table[p], cur->table[p].npage + 4) != 0) {
+            draft->own_all = 0;
+            ClassifierFree(draft);
+            return NULL;
+        }
+        if(cur->table[p].npage != 0) {
+            memcpy(draft->table[p].page, cur->table[p].page,
+                   sizeof(struct ClsSpinePage *) * cur->table[p].npage);
+        }
+        draft->table[p].npage = cur->table[p].npage;
+        draft->table[p].nchunk = cur->table[p].nchunk;
+        draft->table[p].count = cur->table[p].count;
+    }
+    draft->rule_count = cur->rule_count;
+    draft->profile = cur->profile;
+    draft->prefilter = cur->prefilter;
+    draft->base = cur;
+
+    return draft;
+}
+
+/*
+ * 取得可修改的草稿，不可用时转为整体重新编译。
+ * 只有 array 引擎支持增量修改；指定了其他引擎时也重新编译，使设置在本次提交生效。
+ */
+static struct Classifier *ClassifierGetDraft(void) {
+    struct Classifier *cur = rcu_dereference_protected(g_classifier, 1);
+    const struct ClsEngine *forced = ClassifierForced();
+
+    if(g_cls_rebuild) {
+        return NULL;
+    }
+    if(g_cls_draft == NULL) {
+        if(cur == NULL || cur->engine->update == NULL || (forced != NULL && forced != cur->engine)
+                || (g_cls_draft = ClassifierDraft(cur)) == NULL) {
+            g_cls_rebuild = 1;
+            return NULL;
+        }
+    }
+
+    return g_cls_draft;
+}
+
+/* 草稿中第 g 页第 c 块可写：共享的块先复制一份（所在页随之可写），原块挂到 retired 等待旧版本释放 */
+static struct ClsChunk *ClsChunkWritable(struct Classifier *draft, struct ClsTable *table,
+                                         unsigned int g, unsigned int c) {
+    struct ClsSpinePage *page;
+    struct ClsChunk *chunk = table->page[g]->chunk[c], *copy;
+
+    if(chunk->version == draft->version) {
+        return chunk;
+    }
+    page = ClsPageWritable(draft, table, g);
+    if(page == NULL) {
+        return NULL;
+    }
+    copy = ClsChunkAlloc(draft->version);
+    if(copy == NULL) {
+        return NULL;
+    }
+    copy->count = chunk->count;
+    memcpy(copy->rules, chunk->rules, sizeof(struct ClsEntry) * chunk->count);
+    memcpy(copy->node, chunk->node, sizeof(struct RuleNode *) * chunk->count);
+    chunk->retire_next = draft->retired;
+    draft->retired = chunk;
+    page->chunk[c] = copy;
+    ++g_cls_stat.chunks_copied;
+
+    return copy;
+}
+
+static u64 ClsChunkLast(const struct ClsChunk *chunk) {
+    return chunk->node[chunk->count - 1]->order;
+}
+
+/*
+ * 在非空表中二分查找第一个排序键不小于 order 的表项：第 *g 页第 *c 块的第 *off 项。
+ * 各项都小于 order 时指向最后一块末尾（*off 等于块长）。
+ */
+static void ClsFind(const struct ClsTable *table, u64 order, unsigned int *g, unsigned int *c,
+                    unsigned int *off) {
+    const struct ClsSpinePage *page;
+    const struct ClsChunk *chunk;
+    unsigned int lo, hi, mid;
+
+    for(lo = 0, hi = table->npage - 1; lo < hi; ) {
+        mid = (lo + hi) / 2;
+        page = table->page[mid];
+        if(ClsChunkLast(page->chunk[page->count - 1]) < order) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    page = table->page[*g = lo];
+    for(lo = 0, hi = page->count - 1; lo < hi; ) {
+        mid = (lo + hi) / 2;
+        if(ClsChunkLast(page->chunk[mid]) < order) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    chunk = page->chunk[*c = lo];
+    for(lo = 0, hi = chunk->count; lo < hi; ) {
+        mid = (lo + hi) / 2;
+        if(chunk->node[mid]->order < order) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *off = lo;
+}
+
+/* 按 rnode 的排序键插入 */
+static int ClsTableInsert(struct Classifier *draft, struct ClsTable *table,
+                          const struct ClsEntry *entry, struct RuleNode *rnode) {
+    struct ClsChunk *chunk, *right;
+    unsigned int g, c, off, half;
+
+    if(table->npage == 0) {
+        return ClassifierAppend(draft, table - draft->table, entry, rnode);
+    }
+    ClsFind(table, rnode->order, &g, &c, &off);
+    chunk = ClsChunkWritable(draft, table, g, c);
+    if(chunk == NULL) {
+        return -ENOMEM;
+    }
+    if(chunk->count == CLS_CHUNK_SIZE) { //split in half
+        right = ClsChunkAlloc(draft->version);
+        if(right == NULL) {
+            return -ENOMEM;
+        }
+        if(ClsSpineInsert(draft, table, g, c + 1, right) != 0) {
+            ClsChunkFree(right);
+            return -ENOMEM;
+        }
+        half = CLS_CHUNK_SIZE / 2;
+        right->count = chunk->count - half;
+        memcpy(right->rules, chunk->rules + half, sizeof(struct ClsEntry) * right->count);
+        memcpy(right->node, chunk->node + half, sizeof(struct RuleNode *) * right->count);
+        chunk->count = half;
+        if(off > half) {
+            chunk = right;
+            off -= half;
+        }
+    }
+    memmove(chunk->rules + off + 1, chunk->rules + off, sizeof(struct ClsEntry) * (chunk->count - off));
+    memmove(chunk->node + off + 1, chunk->node + off, sizeof(struct RuleNode *) * (chunk->count - off));
+    chunk->rules[off] = *entry;
+    chunk->node[off] = rnode;
+    ++chunk->count;
+    ++table->count;
+
+    return 0;
+}
+
+/* 按排序键找到 rnode 的表项并删除，不在表中时返回 -EINVAL */
+static int ClsTableDelete(struct Classifier *draft, struct ClsTable *table, const struct RuleNode *rnode) {
+    struct ClsChunk *chunk;
+    unsigned int g, c, off;
+
+    if(table->npage == 0) {
+        return -EINVAL;
+    }
+    ClsFind(table, rnode->order, &g, &c, &off);
+    chunk = table->page[g]->chunk[c];
+    if(off == chunk->count || chunk->node[off] != rnode) {
+        return -EINVAL;
+    }
+    chunk = ClsChunkWritable(draft, table, g, c);
+    if(chunk == NULL) {
+        return -ENOMEM;
+    }
+    --chunk->count;
+    memmove(chunk->rules + off, chunk->rules + off + 1, sizeof(struct ClsEntry) * (chunk->count - off));
+    memmove(chunk->node + off, chunk->node + off + 1, sizeof(struct RuleNode *) * (chunk->count - off));
+    --table->count;
+    if(chunk->count == 0) { //chunk and its page belong to the draft, no reader has seen them
+        ClsSpineRemove(table, g, c);
+        ClsChunkFree(chunk);
+    }
+
+    return 0;
+}
+
+/*
+ * 以下 Note 函数由规则表修改函数在修改当前规则表时调用（持有 g_rule_mutex），
+ * 把同样的修改应用到草稿上（原地执行的批量事务也经过这里）；
+ * 私有表（整体换入的批量事务副本）的修改不经过这里，提交时整体重新编译。
+ */
+
+/*
+ * array 引擎的增量修改，按节点的排序键定位，不遍历规则表。old_node 仍在规则表中（删除、替换），
+ * new_node 已链入规则表并分配了排序键（插入），替换时沿用 old_node 的键。
+ */
+static int ClsArrayUpdate(struct Classifier *draft, const struct RuleList *list,
+                          const struct RuleNode *old_node, const struct RuleNode *new_node) {
+    struct ClsEntry entry;
+    int p, iRet;
+
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        if(old_node != NULL && ClsRuleInProto(old_node, p)
+                && (iRet = ClsTableDelete(draft, &draft->table[p], old_node)) != 0) {
+            return iRet;
+        }
+        if(new_node == NULL || !ClsRuleInProto(new_node, p)) {
+            continue;
+        }
+        ClsCompile(&entry, new_node, p);
+        if(ClsTableInsert(draft, &draft->table[p], &entry, (struct RuleNode *)new_node) != 0) {
+            return -ENOMEM;
+        }
+    }
+    draft->rule_count += (old_node == NULL) - (new_node == NULL);
+
+    return 0;
+}
+
+static void ClassifierNoteUpdate(const struct RuleList *list, const struct RuleNode *old_node,
+                                 const struct RuleNode *new_node) {
+    struct Classifier *draft;
+
+    if(list != &g_rule_list || (draft = ClassifierGetDraft()) == NULL) {
+        return;
+    }
+    if(draft->engine->update(draft, list, old_node, new_node) != 0) {
+        g_cls_rebuild = 1;
+        return;
+    }
+    if(draft->prefilter != NULL && new_node != NULL) {
+        ClsPrefilterAdd(draft->prefilter, new_node);
+    }
+    if(draft->prefilter != NULL && old_node != NULL) {
+        ClsPrefilterRemove(draft->prefilter, old_node);
+    }
+}
+
+/* rnode 已链入规则表 */
+void ClassifierNoteInsert(const struct RuleList *list, const struct RuleNode *rnode) {
+    ClassifierNoteUpdate(list, NULL, rnode);
+}
+
+/* rnode 即将从规则表摘除 */
+void ClassifierNoteDelete(const struct RuleList *list, const struct RuleNode *rnode) {
+    ClassifierNoteUpdate(list, rnode, NULL);
+}
+
+/* old_node 仍在规则表中，即将被 new_node 替换 */
+void ClassifierNoteReplace(const struct RuleList *list, const struct RuleNode *old_node,
+                           const struct RuleNode *new_node) {
+    ClassifierNoteUpdate(list, old_node, new_node);
+}
+
+/* 规则表整体变化（清空、批量替换、按模式删除） */
+void ClassifierNoteRebuild(void) {
+    g_cls_rebuild = 1;
+}
+
+/*
+ * 规则集提交时调用（持有 g_rule_mutex）：发布 prebuilt、增量草稿或重新编译的结果。
+ * prebuilt（镜像装入的 array 表）直接采用，见 ClassifierAdopt。
+ * 返回发布的分类器，可能为NULL（编译失败，hook 遍历链表）。
+ */
+struct Classifier *ClassifierCommit(const struct RuleList *list, struct Classifier *prebuilt) {
+    struct Classifier *cls = prebuilt;
+
+    if(cls == NULL && !g_cls_rebuild) {
+        cls = ClassifierGetDraft(); //no edit yet: just a new version with shared chunks
+    }
+    if(cls != g_cls_draft) {
+        ClassifierDiscard(g_cls_draft);
+    }
+    g_cls_draft = NULL;
+    g_cls_rebuild = 0;
+
+    if(cls == NULL) {
+        cls = ClassifierBuild(list);
+        if(cls == NULL) {
+            printk("build classifier FAILED! fall back to rule list walk\n");
+        }
+        else {
+            ++g_cls_stat.rebuilds;
+        }
+    }
+    else if(cls != prebuilt) {
+        ++g_cls_stat.incremental;
+    }
+    else {
+        cls = ClassifierAdopt(cls, list);
+        g_cls_stat.rebuilds += (cls != prebuilt);
+    }
+
+    if(cls != NULL) {
+        cls->default_rule = list->default_rule;
+        cls->generation = list->generation;
+    }
+    ClassifierPublish(cls);
+
+    return cls;
+}
+
+//array 块与 spine（页和页目录）之外加上其他引擎的数据
+static unsigned long ClassifierBytes(void) {
+    return atomic_long_read(&g_cls_chunks) * sizeof(struct ClsChunk)
+         + atomic_long_read(&g_cls_spine_pages) * sizeof(struct ClsSpinePage)
+         + atomic_long_read(&g_cls_spine_slots) * sizeof(struct ClsSpinePage *)
+         + atomic_long_read(&g_cls_priv_bytes);
+}
+
+void ClassifierGetMem(struct MemStat *stat) {
+    stat->cls_chunks = atomic_long_read(&g_cls_chunks);
+    stat->cls_bytes = ClassifierBytes();
+    stat->cls_max = (unsigned long long)cls_max_kb << 10;
+}
+
+/* 填充 stat 中描述单个分类器的字段（版本、表项、引擎、规则集形态、预过滤器），cls 可为NULL */
+void ClassifierDescribe(const struct Classifier *cls, struct ClsStat *stat) {
+    int p;
+
+    if(cls == NULL) {
+        return;
+    }
+    stat->version = cls->version;
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        stat->entries += cls->table[p].count;
+    }
+    stat->engine = cls->engine->id;
+    stat->engine_bytes = cls->engine->mem(cls);
+    stat->shapes = cls->profile.shapes;
+    stat->reach = cls->profile.reach;
+    stat->wildcard_rules = cls->profile.wildcard;
+    stat->port_rules = cls->profile.port_rules;
+    if(cls->prefilter != NULL) {
+        stat->prefilter_keys = cls->prefilter->keys;
+        stat->prefilter_stale = cls->prefilter->stale;
+        stat->prefilter_bytes = cls->prefilter->bytes;
+        stat->prefilter_protos = cls->prefilter->protos;
+        stat->prefilter_open = cls->prefilter->open;
+    }
+}
+
+void ClassifierGetStat(struct ClsStat *stat) {
+    mutex_lock(&g_rule_mutex);
+    *stat = g_cls_stat;
+    stat->engine_mode = use_classifier ? cls_engine : CLS_ENGINE_LIST;
+    ClassifierDescribe(rcu_dereference_protected(g_classifier, 1), stat);
+    stat->chunks = atomic_long_read(&g_cls_chunks);
+    stat->slots = stat->chunks * CLS_CHUNK_SIZE;
+    stat->bytes = ClassifierBytes();
+    mutex_unlock(&g_rule_mutex);
+}
+
+/* 整体重新编译当前规则集并发布，规则集版本号不变（持有 g_rule_mutex，且没有未提交的草稿） */
+static int ClassifierRepublish(void) {
+    struct Classifier *cur = rcu_dereference_protected(g_classifier, 1);
+    struct Classifier *cls;
+
+    cls = ClassifierBuild(&g_rule_list);
+    if(cls == NULL) {
+        return -ENOMEM;
+    }
+    if(cur == NULL || cls->engine != cur->engine) {
+        ++g_cls_stat.engine_switches;
+    }
+    ClassifierPublish(cls);
+
+    return 0;
+}
+
+/*
+ * 指定引擎（ioctl IO_CTRL_CLS_ENGINE），立即按新设置重新编译当前规则集。
+ * 编译失败时设置仍然保留，当前分类器不变。
+ */
+int ClassifierSetEngine(unsigned int id) {
+    int iRet;
+
+    if(id >= CLS_ENGINE_NUM) {
+        return -EINVAL;
+    }
+    mutex_lock(&g_rule_mutex);
+    cls_engine = id;
+    if(id != CLS_ENGINE_LIST) {
+        use_classifier = true;
+    }
+    iRet = g_cls_draft == NULL ? ClassifierRepublish() : 0; //a pending commit picks it up
+    mutex_unlock(&g_rule_mutex);
+
+    return iRet;
+}
+
+/*
+ * 所选引擎与已发布的不同（规则集形态或参数变化）或预过滤器过时时整体重新编译，
+ * 直接采用的预编译表由此在装入后按规则集形态换成所选引擎；否则只刷新记录的规则集形态。
+ * array 引擎的块填充率过低时也整体重新编译当前版本。规则集版本号不变。
+ * 已发布版本与等待释放的旧版本的块都计入 chunks，所以这里只看当前版本。
+ */
+static void ClassifierCompactWork(struct work_struct *work) {
+    struct Classifier *cur;
+    struct ClsProfile prof;
+    unsigned long entries = 0, chunks = 0;
+    int p;
+
+    mutex_lock(&g_rule_mutex);
+    cur = rcu_dereference_protected(g_classifier, 1);
+    if(cur != NULL && g_cls_draft == NULL) {
+        ClassifierProfile(&g_rule_list, &prof);
+        if(ClassifierSelect(&prof) != cur->engine) {
+            ClassifierRepublish();
+        }
+        else {
+            cur->profile = prof; //only read under g_rule_mutex
+            if(ClsPrefilterStale(cur->prefilter) || (!cls_prefilter && cur->prefilter != NULL)) {
+                if(ClassifierRepublish() == 0) {
+                    ++g_cls_stat.prefilter_rebuilds;
+                }
+            }
+            else if(cur->engine == &cls_array_engine && cls_compact_fill != 0) {
+                for(p = 0; p < CLS_PROTO_NUM; ++p) {
+                    entries += cur->table[p].count;
+                    chunks += cur->table[p].nchunk;
+                }
+                if(chunks > CLS_PROTO_NUM && entries * 100 < chunks * CLS_CHUNK_SIZE * cls_compact_fill
+                        && ClassifierRepublish() == 0) {
+                    ++g_cls_stat.compactions;
+                }
+            }
+        }
+    }
+    mutex_unlock(&g_rule_mutex);
+
+    schedule_delayed_work(&g_cls_compact_work, (cls_compact_interval_s ? cls_compact_interval_s : 30) * HZ);
+}
+
+void ClassifierInit(void) {
+    schedule_delayed_work(&g_cls_compact_work, (cls_compact_interval_s ? cls_compact_interval_s : 30) * HZ);
+}
+
+void ClassifierExit(void) {
+    cancel_delayed_work_sync(&g_cls_compact_work);
+}
+
+/* list 引擎：逐条遍历规则链表，规则表修改后无需重新编译也总是最新的 */
+static int ClsListBuild(struct Classifier *cls, const struct RuleList *list) {
+    cls->list = list;
+    return 0;
+}
+
+static struct RuleNode *ClsListLookup(const struct Classifier *cls, const struct RuleNode *packet,
+                                      unsigned int *evaluated) {
+    struct RuleNode *cur;
+    unsigned int n = 0;
+
+    for(cur = rcu_dereference(cls->list->head); cur != NULL; cur = rcu_dereference(cur->next)) {
+        ++n;
+        if(RuleMatch(cur, packet)) {
+            break;
+        }
+    }
+    *evaluated = n;
+
+    return cur;
+}
+
+static void ClsListDestroy(struct Classifier *cls) {
+}
+
+static unsigned long ClsListMem(const struct Classifier *cls) {
+    return 0;
+}
+
+const struct ClsEngine cls_list_engine = {
+    .id = CLS_ENGINE_LIST,
+    .name = "list",
+    .build = ClsListBuild,
+    .lookup = ClsListLookup,
+    .update = NULL,
+    .destroy = ClsListDestroy,
+    .mem = ClsListMem,
+};
+
+static struct RuleNode *ClsArrayLookupOp(const struct Classifier *cls, const struct RuleNode *packet,
+                                         unsigned int *evaluated) {
+    return ClsArrayLookup(cls, packet, evaluated);
+}
+
+//本版本的块与 spine，与其他版本共享的块也计入
+static unsigned long ClsArrayMem(const struct Classifier *cls) {
+    unsigned long bytes = 0;
+    int p;
+
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        bytes += cls->table[p].nchunk * sizeof(struct ClsChunk) + cls->table[p].npage * sizeof(struct ClsSpinePage)
+                 + cls->table[p].cap * sizeof(struct ClsSpinePage *);
+    }
+
+    return bytes;
+}
+
+const struct ClsEngine cls_array_engine = {
+    .id = CLS_ENGINE_ARRAY,
+    .name = "array",
+    .build = ClsArrayBuild,
+    .lookup = ClsArrayLookupOp,
+    .update = ClsArrayUpdate,
+    .destroy = ClsArrayDestroy,
+    .mem = ClsArrayMem,
+};
+
+/* 按编号取引擎，自动或无效编号返回NULL */
+const struct ClsEngine *ClsEngineGet(unsigned int id) {
+    switch(id) {
+        case CLS_ENGINE_LIST:
+            return &cls_list_engine;
+        case CLS_ENGINE_ARRAY:
+            return &cls_array_engine;
+        case CLS_ENGINE_TUPLE:
+            return &cls_tuple_engine;
+        default:
+            return NULL;
+    }
+}
@@ -0,0 +1,255 @@
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+#include <linux/types.h>
+#include <linux/rcupdate.h>
+#include <linux/bitops.h>
+
+#include "../common.h"
+#include "rule_list_manage.h"
+
+/*
+ * 由规则表编译得到的只读分类器，按协议分表。
+ * 每张表由若干定长块（chunk）组成，块指针按顺序存放在定长的 spine 页中，页目录串起各页。
+ * 增量更新时新版本只复制页目录，重新分配被修改的块及其所在的页，其余与旧版本共享。
+ * 表项按规则节点的排序键（RuleNode.order）递增，增量修改按键二分定位。
+ */
+#define CLS_CHUNK_SIZE ((4096 - 4 * sizeof(void *)) / (sizeof(struct ClsEntry) + sizeof(void *)))
+#define CLS_SPINE_PAGE ((4096 - 4 * sizeof(void *)) / sizeof(void *))
+
+struct ClsChunk {
+    unsigned int count;
+    unsigned int version;           //分配该块的分类器版本，同版本的草稿可原地修改
+    struct ClsChunk *retire_next;
+    struct ClsEntry rules[CLS_CHUNK_SIZE];
+    struct RuleNode *node[CLS_CHUNK_SIZE];  //仅用于累加命中计数
+};
+
+struct ClsSpinePage {
+    unsigned int count;
+    unsigned int version;           //同 ClsChunk.version
+    struct ClsSpinePage *retire_next;
+    struct ClsChunk *chunk[CLS_SPINE_PAGE];
+};
+
+struct ClsTable {
+    unsigned int count;             //表项总数
+    unsigned int nchunk;
+    unsigned int npage;
+    unsigned int cap;               //页目录容量
+    struct ClsSpinePage **page;
+};
+
+struct ClsEngine;
+
+/*
+ * 预过滤器：断定"没有任何规则能匹配"的报文直接按默认规则处理，不再查找。
+ * 每条规则在其适用的每个协议中取一个精确字段（源地址、目的地址、目的端口、源端口，按此顺序）
+ * 作为锚点，(协议, 字段, 值) 插入分块 Bloom filter，每个键的各位都在同一个 64 字节的行内。
+ * 报文只需探测该协议用作锚点的字段；没有精确字段的规则（如前缀、全通配）使该协议总是查找。
+ * 增量修改只置位不清位，删除的规则计入 stale，由后台任务在过时过多时整体重新编译。
+ */
+enum ClsPrefilterField {
+    CLS_PF_SRCIP,
+    CLS_PF_DSTIP,
+    CLS_PF_DPORT,
+    CLS_PF_SPORT,
+    CLS_PF_NUM
+};
+
+#define CLS_PF_LINE_WORDS 8         //64 字节一行
+#define CLS_PF_HASHES 4
+
+struct ClsPrefilter {
+    unsigned int protos;            //第 p 位：有规则适用于协议表 p
+    unsigned int open;              //第 p 位：协议表 p 有无锚点的规则，不能跳过查找
+    unsigned int fields[CLS_PROTO_NUM];     //协议表 p 用作锚点的字段
+    unsigned int lines;             //2的幂
+    unsigned int keys;
+    unsigned int stale;             //已删除规则留下的键
+    unsigned long bytes;
+    u64 bits[0];                    //lines * CLS_PF_LINE_WORDS
+};
+
+/* 规则集形态，用于选择引擎 */
+struct ClsProfile {
+    unsigned int rules;
+    unsigned int shapes;            //不同掩码组合数，各协议表之和
+    unsigned int reach;             //线性查找最多比较的表项数（各表到第一条全通配项为止）
+    unsigned int wildcard;          //含通配地址或端口的规则数
+    unsigned int port_rules;        //指定了端口的规则数
+};
+
+struct Classifier {
+    const struct ClsEngine *engine;
+    enum Rule default_rule;
+    unsigned int generation;        //对应的规则集版本
+    unsigned int version;           //分类器版本，每次发布递增
+    unsigned int rule_count;
+    struct ClsProfile profile;      //编译时的规则集形态
+    struct ClsPrefilter *prefilter; //可为NULL；草稿与其来源版本共享，随 own_all 释放
+    struct ClsTable table[CLS_PROTO_NUM];   //array 引擎
+    const struct RuleList *list;    //list 引擎遍历的规则表
+    void *priv;                     //其他引擎的私有数据
+    const struct Classifier *base;  //草稿由哪个版本复制而来，发布后置NULL
+    struct ClsChunk *retired;       //随本版本一起释放的块
+    struct ClsSpinePage *retired_pages; //随本版本一起释放的 spine 页
+    int own_all;                    //释放时连同全部块一起释放
+    struct rcu_head rcu;
+};
+
+/*
+ * 分类器引擎。build 由规则表填充新分类器；lookup 返回第一条匹配的规则（未匹配返回NULL），
+ * evaluated 为判决前比较过的表项数（tuple 为探测过的散列表数）；
+ * update 把单条修改（old_node 为NULL是插入，new_node 为NULL是删除）应用到由当前版本
+ * 复制的草稿上，为NULL的引擎每次变化都重新编译；destroy 释放引擎数据；mem 返回占用字节数。
+ */
+struct ClsEngine {
+    unsigned int id;                //enum ClsEngineId
+    const char *name;
+    int (*build)(struct Classifier *, const struct RuleList *);
+    struct RuleNode *(*lookup)(const struct Classifier *, const struct RuleNode *packet,
+                               unsigned int *evaluated);
+    int (*update)(struct Classifier *draft, const struct RuleList *,
+                  const struct RuleNode *old_node, const struct RuleNode *new_node);
+    void (*destroy)(struct Classifier *);
+    unsigned long (*mem)(const struct Classifier *);
+};
+
+extern const struct ClsEngine cls_list_engine;
+extern const struct ClsEngine cls_array_engine;
+extern const struct ClsEngine cls_tuple_engine;
+
+extern struct Classifier __rcu *g_classifier;
+
+/* 掩码组合编号：源、目的前缀长度各33种，源、目的端口精确或通配 */
+#define CLS_SHAPE_NUM (33 * 33 * 2 * 2)
+
+static inline unsigned int ClsShapeIndex(const struct ClsEntry *entry) {
+    return ((hweight32(entry->srcmask) * 33 + hweight32(entry->dstmask)) * 2
+            + (entry->srcpmask != 0)) * 2 + (entry->dstpmask != 0);
+}
+
+int ClassifierEnabled(void);
+int ClassifierCoversList(void);
+int ClsRuleInProto(const struct RuleNode *rnode, int proto_idx);
+void ClsCompile(struct ClsEntry *entry, const struct RuleNode *rnode, int proto_idx);
+int ClsMemCharge(unsigned long bytes);
+void ClsMemUncharge(unsigned long bytes);
+const struct ClsEngine *ClsEngineGet(unsigned int id);
+struct Classifier *ClassifierNew(void);
+int ClassifierAppend(struct Classifier *cls, int proto_idx, const struct ClsEntry *entry,
+                     struct RuleNode *rnode);
+void ClassifierFree(struct Classifier *);
+void ClassifierRenumber(struct Classifier *);
+void ClassifierProfile(const struct RuleList *, struct ClsProfile *);
+const struct ClsEngine *ClassifierSelect(const struct ClsProfile *);
+struct Classifier *ClassifierBuildEngine(const struct RuleList *, const struct ClsEngine *,
+                                         const struct ClsProfile *);
+struct Classifier *ClassifierBuild(const struct RuleList *);
+struct Classifier *ClassifierRefit(struct Classifier *, const struct RuleList *);
+int ClassifierSetEngine(unsigned int id);
+void ClassifierPublish(struct Classifier *);
+struct Classifier *ClassifierCommit(const struct RuleList *, struct Classifier *prebuilt);
+void ClassifierNoteInsert(const struct RuleList *, const struct RuleNode *rnode);
+void ClassifierNoteDelete(const struct RuleList *, const struct RuleNode *rnode);
+void ClassifierNoteReplace(const struct RuleList *, const struct RuleNode *old_node,
+                           const struct RuleNode *new_node);
+void ClassifierNoteRebuild(void);
+struct ClsPrefilter *ClsPrefilterBuild(const struct RuleList *);
+void ClassifierDescribe(const struct Classifier *, struct ClsStat *);
+void ClassifierGetStat(struct ClsStat *);
+void ClassifierGetMem(struct MemStat *);
+void ClassifierInit(void);
+void ClassifierExit(void);
+
+static inline u64 ClsPrefilterHash(int proto_idx, int field, u32 value) {
+    u64 h = ((u64)(proto_idx << 4 | field) << 32 | value) * 0x9e3779b97f4a7c15ULL;
+
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return h ^ (h >> 32);
+}
+
+//低位选行，高 36 位给出行内 CLS_PF_HASHES 个 9 位的位置
+static inline int ClsPrefilterTest(const struct ClsPrefilter *pf, int proto_idx, int field, u32 value) {
+    u64 h = ClsPrefilterHash(proto_idx, field, value);
+    const u64 *line = pf->bits + ((u32)h & (pf->lines - 1)) * CLS_PF_LINE_WORDS;
+    unsigned int i, bit;
+
+    for(i = 0, h >>= 28; i < CLS_PF_HASHES; ++i, h >>= 9) {
+        bit = h & 511;
+        if(!(line[bit >> 6] & (1ULL << (bit & 63)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* 有预过滤器且 packet 的协议表中每条规则都有锚点，即预过滤器能对它作出判断 */
+static inline int ClsPrefilterCovers(const struct Classifier *cls, const struct RuleNode *packet) {
+    return cls->prefilter != NULL && !(cls->prefilter->open & (1U << (packet->type - PACKAGE_TYPE_TCP)));
+}
+
+/* 确定没有规则能匹配 packet 时返回1。调用方处于 RCU 读临界区 */
+static inline int ClsPrefilterSkip(const struct Classifier *cls, const struct RuleNode *packet) {
+    const struct ClsPrefilter *pf = cls->prefilter;
+    int p = packet->type - PACKAGE_TYPE_TCP;
+    unsigned int fields;
+
+    if(!ClsPrefilterCovers(cls, packet)) {
+        return 0;
+    }
+    if(!(pf->protos & (1U << p))) {
+        return 1;
+    }
+    fields = pf->fields[p];
+    return !((fields & (1U << CLS_PF_SRCIP)) && ClsPrefilterTest(pf, p, CLS_PF_SRCIP, packet->srcip))
+        && !((fields & (1U << CLS_PF_DSTIP)) && ClsPrefilterTest(pf, p, CLS_PF_DSTIP, packet->dstip))
+        && !((fields & (1U << CLS_PF_DPORT)) && ClsPrefilterTest(pf, p, CLS_PF_DPORT, packet->dstport))
+        && !((fields & (1U << CLS_PF_SPORT)) && ClsPrefilterTest(pf, p, CLS_PF_SPORT, packet->srcport));
+}
+
+/* array 引擎的查找，hook 中直接内联 */
+static inline struct RuleNode *ClsArrayLookup(const struct Classifier *cls,
+        const struct RuleNode *packet, unsigned int *evaluated) {
+    const struct ClsTable *table = &cls->table[packet->type - PACKAGE_TYPE_TCP];
+    const struct ClsSpinePage *page;
+    const struct ClsChunk *chunk;
+    const struct ClsEntry *entry, *end;
+    unsigned int g, c, n = 0;
+
+    for(g = 0; g < table->npage; ++g) {
+        page = table->page[g];
+        for(c = 0; c < page->count; ++c) {
+            chunk = page->chunk[c];
+            for(entry = chunk->rules, end = entry + chunk->count; entry < end; ++entry) {
+                if((packet->srcip & entry->srcmask) == entry->srcip
+                        && (packet->dstip & entry->dstmask) == entry->dstip
+                        && (packet->srcport & entry->srcpmask) == entry->srcport
+                        && (packet->dstport & entry->dstpmask) == entry->dstport) {
+                    *evaluated = n + (entry - chunk->rules) + 1;
+                    return chunk->node[entry - chunk->rules];
+                }
+            }
+            n += chunk->count;
+        }
+    }
+
+    *evaluated = n;
+    return NULL;
+}
+
+/*
+ * 查找第一条匹配的规则，未匹配返回NULL。packet 的 type 必须是 TCP/UDP/ICMP。
+ * 调用方处于 RCU 读临界区。
+ */
+static inline struct RuleNode *ClassifierLookup(const struct Classifier *cls,
+        const struct RuleNode *packet, unsigned int *evaluated) {
+    if(likely(cls->engine == &cls_array_engine)) {
+        return ClsArrayLookup(cls, packet, evaluated);
+    }
+    return cls->engine->lookup(cls, packet, evaluated);
+}
+
+#endif
@@ -0,0 +1,271 @@
+// FileName: myNetfilter_kernel/cls_tuple.c
+// Describe: tuple 分类器引擎：按掩码组合（tuple）分组，每组一张散列表
+// Note: 掩码组合相同的规则落在同一张表，键为报文按该组合取掩码后的地址与端口，冲突时保留靠前的规则。
+//       查找按各组最靠前规则的位置依次探测，已命中的规则比剩余各组都靠前时提前结束。
+//       规则集很大而掩码组合很少时比逐项比较快；不支持增量修改，规则变化时整体重新编译。
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/sort.h>
+
+#include "../common.h"
+#include "classifier.h"
+
+#define CLS_TUPLE_NONE 0xffff
+
+struct ClsTupleSlot {
+    unsigned int srcip;
+    unsigned int dstip;
+    unsigned int port;              //srcport << 16 | dstport
+    unsigned int pos;               //规则在协议表中的位置
+    struct RuleNode *node;          //NULL 为空位
+};
+
+struct ClsTuple {
+    struct ClsEntry mask;           //只用四个掩码字段
+    unsigned int first;             //组内最靠前规则的位置
+    unsigned int count;
+    unsigned int size;              //散列表大小，2的幂
+    struct ClsTupleSlot *slot;
+};
+
+struct ClsTupleTable {
+    unsigned int ntuple;
+    struct ClsTuple *tuple;         //按 first 升序
+};
+
+struct ClsTuplePriv {
+    unsigned long bytes;            //已登记的占用，含本结构
+    struct ClsTupleTable table[CLS_PROTO_NUM];
+};
+
+static inline u32 ClsTupleHash(u32 srcip, u32 dstip, u32 port) {
+    u32 h = srcip * 0x9e3779b1U;
+
+    h ^= (dstip + (h >> 15)) * 0x85ebca6bU;
+    h ^= (port + (h >> 13)) * 0xc2b2ae35U;
+    return h ^ (h >> 16);
+}
+
+static inline int ClsCatchAll(const struct ClsEntry *entry) {
+    return (entry->srcmask | entry->dstmask | entry->srcpmask | entry->dstpmask) == 0;
+}
+
+//登记后分配，超过 cls_max_kb 或分配失败返回NULL
+static void *ClsTupleAlloc(struct ClsTuplePriv *priv, unsigned long size) {
+    void *ptr;
+
+    if(ClsMemCharge(size) != 0) {
+        return NULL;
+    }
+    ptr = vzalloc(size);
+    if(ptr == NULL) {
+        ClsMemUncharge(size);
+        return NULL;
+    }
+    priv->bytes += size;
+
+    return ptr;
+}
+
+/* 把一条规则插入所在组的散列表，键已存在时保留靠前的规则 */
+static void ClsTupleInsert(struct ClsTuple *tuple, const struct ClsEntry *entry, unsigned int pos,
+                           struct RuleNode *rnode) {
+    u32 port = (u32)entry->srcport << 16 | entry->dstport;
+    unsigned int i = ClsTupleHash(entry->srcip, entry->dstip, port) & (tuple->size - 1);
+    struct ClsTupleSlot *slot;
+
+    for(;; i = (i + 1) & (tuple->size - 1)) {
+        slot = &tuple->slot[i];
+        if(slot->node == NULL) {
+            break;
+        }
+        if(slot->srcip == entry->srcip && slot->dstip == entry->dstip && slot->port == port) {
+            return; //shadowed by an earlier rule
+        }
+    }
+    slot->srcip = entry->srcip;
+    slot->dstip = entry->dstip;
+    slot->port = port;
+    slot->pos = pos;
+    slot->node = rnode;
+}
+
+static int ClsTupleCmp(const void *a, const void *b) {
+    const struct ClsTuple *ta = (const struct ClsTuple *)a, *tb = (const struct ClsTuple *)b;
+
+    return ta->first < tb->first ? -1 : ta->first > tb->first;
+}
+
+/*
+ * 编译第 p 张协议表。map 为掩码组合到组下标的临时映射。
+ * 第一遍统计各组，第二遍分配散列表后插入；第一条全通配项之后的规则不可能被匹配，不再编入。
+ */
+static int ClsTupleBuildTable(struct ClsTuplePriv *priv, const struct RuleList *list, int p,
+                              unsigned short *map) {
+    struct ClsTupleTable *table = &priv->table[p];
+    struct ClsTuple *tuple;
+    struct RuleNode *cur;
+    struct ClsEntry entry;
+    unsigned int i, pos, shape, ntuple = 0;
+
+    memset(map, 0xff, sizeof(unsigned short) * CLS_SHAPE_NUM);
+    for(cur = list->head; cur != NULL; cur = cur->next) {
+        if(!ClsRuleInProto(cur, p)) {
+            continue;
+        }
+        ClsCompile(&entry, cur, p);
+        shape = ClsShapeIndex(&entry);
+        if(map[shape] == CLS_TUPLE_NONE) {
+            map[shape] = ntuple++;
+        }
+        if(ClsCatchAll(&entry)) {
+            break;
+        }
+    }
+    if(ntuple == 0) {
+        return 0;
+    }
+    table->tuple = (struct ClsTuple *)ClsTupleAlloc(priv, sizeof(struct ClsTuple) * ntuple);
+    if(table->tuple == NULL) {
+        return -ENOMEM;
+    }
+    table->ntuple = ntuple;
+
+    for(pos = 0, cur = list->head; cur != NULL; cur = cur->next) {
+        if(!ClsRuleInProto(cur, p)) {
+            continue;
+        }
+        ClsCompile(&entry, cur, p);
+        tuple = &table->tuple[map[ClsShapeIndex(&entry)]];
+        if(tuple->count++ == 0) {
+            tuple->mask = entry;
+            tuple->first = pos;
+        }
+        ++pos;
+        if(ClsCatchAll(&entry)) {
+            break;
+        }
+    }
+    for(i = 0; i < ntuple; ++i) {
+        tuple = &table->tuple[i];
+        tuple->size = roundup_pow_of_two(tuple->count * 2);
+        tuple->slot = (struct ClsTupleSlot *)ClsTupleAlloc(priv, sizeof(struct ClsTupleSlot) * tuple->size);
+        if(tuple->slot == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    for(pos = 0, cur = list->head; cur != NULL; cur = cur->next) {
+        if(!ClsRuleInProto(cur, p)) {
+            continue;
+        }
+        ClsCompile(&entry, cur, p);
+        ClsTupleInsert(&table->tuple[map[ClsShapeIndex(&entry)]], &entry, pos++, cur);
+        if(ClsCatchAll(&entry)) {
+            break;
+        }
+    }
+    sort(table->tuple, ntuple, sizeof(struct ClsTuple), ClsTupleCmp, NULL);
+
+    return 0;
+}
+
+static void ClsTupleDestroy(struct Classifier *cls) {
+    struct ClsTuplePriv *priv = (struct ClsTuplePriv *)cls->priv;
+    unsigned int i;
+    int p;
+
+    if(priv == NULL) {
+        return;
+    }
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        for(i = 0; i < priv->table[p].ntuple; ++i) {
+            vfree(priv->table[p].tuple[i].slot);
+        }
+        vfree(priv->table[p].tuple);
+    }
+    ClsMemUncharge(priv->bytes);
+    kfree(priv);
+    cls->priv = NULL;
+}
+
+static int ClsTupleBuild(struct Classifier *cls, const struct RuleList *list) {
+    struct ClsTuplePriv *priv;
+    unsigned short *map;
+    int p, iRet = 0;
+
+    if(ClsMemCharge(sizeof(struct ClsTuplePriv)) != 0) {
+        return -ENOMEM;
+    }
+    priv = (struct ClsTuplePriv *)kzalloc(sizeof(struct ClsTuplePriv), GFP_KERNEL);
+    if(priv == NULL) {
+        ClsMemUncharge(sizeof(struct ClsTuplePriv));
+        return -ENOMEM;
+    }
+    priv->bytes = sizeof(struct ClsTuplePriv);
+    cls->priv = priv;
+
+    map = (unsigned short *)kmalloc(sizeof(unsigned short) * CLS_SHAPE_NUM, GFP_KERNEL);
+    if(map == NULL) {
+        return -ENOMEM;
+    }
+    for(p = 0; p < CLS_PROTO_NUM && iRet == 0; ++p) {
+        iRet = ClsTupleBuildTable(priv, list, p, map);
+        cond_resched();
+    }
+    kfree(map);
+
+    return iRet;
+}
+
+static struct RuleNode *ClsTupleLookup(const struct Classifier *cls, const struct RuleNode *packet,
+                                       unsigned int *evaluated) {
+    const struct ClsTuplePriv *priv = (const struct ClsTuplePriv *)cls->priv;
+    const struct ClsTupleTable *table = &priv->table[packet->type - PACKAGE_TYPE_TCP];
+    const struct ClsTuple *tuple, *end;
+    const struct ClsTupleSlot *slot, *best = NULL;
+    u32 srcip, dstip, port;
+    unsigned int i, n = 0;
+
+    for(tuple = table->tuple, end = tuple + table->ntuple; tuple < end; ++tuple) {
+        if(best != NULL && tuple->first >= best->pos) {
+            break;
+        }
+        ++n;
+        srcip = packet->srcip & tuple->mask.srcmask;
+        dstip = packet->dstip & tuple->mask.dstmask;
+        port = (u32)(packet->srcport & tuple->mask.srcpmask) << 16 | (packet->dstport & tuple->mask.dstpmask);
+        i = ClsTupleHash(srcip, dstip, port) & (tuple->size - 1);
+        for(slot = &tuple->slot[i]; slot->node != NULL; slot = &tuple->slot[i]) {
+            if(slot->srcip == srcip && slot->dstip == dstip && slot->port == port) {
+                if(best == NULL || slot->pos < best->pos) {
+                    best = slot;
+                }
+                break;
+            }
+            i = (i + 1) & (tuple->size - 1);
+        }
+    }
+    *evaluated = n;
+
+    return best ? best->node : NULL;
+}
+
+static unsigned long ClsTupleMem(const struct Classifier *cls) {
+    const struct ClsTuplePriv *priv = (const struct ClsTuplePriv *)cls->priv;
+
+    return priv ? priv->bytes : 0;
+}
+
+const struct ClsEngine cls_tuple_engine = {
+    .id = CLS_ENGINE_TUPLE,
+    .name = "tuple",
+    .build = ClsTupleBuild,
+    .lookup = ClsTupleLookup,
+    .update = NULL,
+    .destroy = ClsTupleDestroy,
+    .mem = ClsTupleMem,
+};
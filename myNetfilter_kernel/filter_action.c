@@ -1,6 +1,8 @@
 // FileName: myNetfilter_kernel/filter_action.c 
 // Describe: 实现挂钩函数
 // Note: 代码基于LWFW。代码用于《网络安全课程设计》
+//       报文按所在 network namespace 的规则集判决。只支持 4.2 内核（见 Makefile）：
+//       hook 是全局的，由报文的收发设备找到命名空间。
 
 #include <linux/socket.h>
 #include <linux/netfilter.h>
@@ -8,14 +10,86 @@
 #include <linux/ip.h>
 #include <linux/tcp.h>
 #include <linux/udp.h>
+#include <linux/icmp.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/moduleparam.h>
+#include <net/net_namespace.h>
+#include <net/netfilter/nf_queue.h>
 
 #include "../common.h"
 #include "filter_action.h"
 #include "rule_list_manage.h"
+#include "ban_table.h"
+#include "scan_detect.h"
+#include "classifier.h"
+#include "shadow.h"
+#include "frag_cache.h"
+#include "netns.h"
+#include "reject.h"
+
+#define CREATE_TRACE_POINTS
+#include "tinyfw_trace.h"
 
 extern struct RuleList g_rule_list;
 static struct nf_hook_ops nf_reg;
 static int active = 0;
+static DEFINE_PER_CPU(struct FilterStat, g_filter_stat);
+static u32 g_queue_rnd;
+
+//'Q' 规则把报文交给 queue_num 起 queue_total 个队列，同一条流总是进同一个队列
+static unsigned int queue_num = 0;
+module_param(queue_num, uint, 0644);
+MODULE_PARM_DESC(queue_num, "first NFQUEUE number of 'Q' rules");
+static unsigned int queue_total = 1;
+module_param(queue_total, uint, 0644);
+MODULE_PARM_DESC(queue_total, "number of NFQUEUEs 'Q' rules balance flows across");
+static bool queue_bypass = true;
+module_param(queue_bypass, bool, 0644);
+MODULE_PARM_DESC(queue_bypass, "accept queued packets when no program listens on the queue");
+
+//记录一次判决并返回，stat 为报文所在命名空间的计数
+static inline unsigned int Verdict(struct FilterStat __percpu *stat, unsigned int verdict) {
+    if(verdict == NF_ACCEPT) {
+        this_cpu_inc(stat->accepted);
+    }
+    else if((verdict & NF_VERDICT_MASK) == NF_QUEUE) {
+        this_cpu_inc(stat->queued);
+    }
+    else {
+        this_cpu_inc(stat->dropped);
+    }
+    return verdict;
+}
+
+/* 'Q' 规则的判决：按流散列选队列，与 iptables NFQUEUE --queue-balance 相同 */
+static inline unsigned int QueueVerdict(const struct sk_buff *skb) {
+    unsigned int num = queue_num, total = queue_total;
+    unsigned int verdict;
+
+    if(total > 1 && num + total <= 0x10000) {
+        num = nfqueue_hash(skb, num, total, NFPROTO_IPV4, g_queue_rnd);
+    }
+    verdict = NF_QUEUE_NR(num & 0xffff);
+    if(queue_bypass) {
+        verdict |= NF_VERDICT_FLAG_QUEUE_BYPASS;
+    }
+    return verdict;
+}
+
+/* 'F' 规则：报文丢弃，尽量应答；应答与未应答分别计入规则与命名空间的计数 */
+static inline void RefuseReply(struct sk_buff *skb, const struct nf_hook_state *state, enum PackageType type,
+                               struct RuleNode *rnode, struct FilterStat __percpu *stat) {
+    if(RejectReply(skb, state->hook, type)) {
+        atomic_long_inc(&rnode->replies);
+        this_cpu_inc(stat->replies);
+    }
+    else {
+        atomic_long_inc(&rnode->reply_drops);
+        this_cpu_inc(stat->reply_drops);
+    }
+}
 
 //unsigned int NFHookFunc(unsigned int hooknum,
 //                    struct sk_buff *skb,
@@ -31,6 +105,16 @@ unsigned int NFHookFunc(const struct nf_hook_ops *ops_unused,
     //struct icmp *icmph //no need to get icmp header
     struct RuleNode package_node;
     struct RuleNode *rule_partten;
+    const struct Classifier *cls;
+    const struct RuleList *list;
+    struct NetRuleSet *rules;
+    struct FilterStat __percpu *stat;
+    struct ShadowSet *shadow = NULL;
+    struct net *net;
+    enum Rule action;
+    unsigned int verdict, evaluated, id, generation, first_frag = 0;
+    int host, probe = 1;
+    u64 start = 0, live_ns;
     if(!active) { //works only when activate
         return NF_ACCEPT;
     }
@@ -39,6 +123,36 @@ unsigned int NFHookFunc(const struct nf_hook_ops *ops_unused,
     if(!skb) return NF_ACCEPT;
     if(!(iph = ip_hdr(skb))) return NF_ACCEPT;
 
+    //rule set and counters of the packet's namespace, hook runs inside rcu_read_lock
+    net = dev_net(state->in ? state->in : state->out);
+    host = NetIsHost(net);
+    if(host) {
+        list = &g_rule_list;
+        cls = rcu_dereference(g_classifier);
+        stat = &g_filter_stat;
+    }
+    else {
+        rules = rcu_dereference(TinyfwNetGet(net)->rules);
+        list = &rules->list;
+        cls = rules->cls;
+        stat = TinyfwNetGet(net)->stat;
+    }
+    this_cpu_inc(stat->packets);
+
+    //dynamic ban table, checked before rule list; host namespace only
+    if(host && BanLookup(ntohl(iph->saddr))) {
+        this_cpu_inc(stat->banned);
+        if(trace_tinyfw_classify_enabled()) {
+            package_node.type = PACKAGE_TYPE_ANY;
+            package_node.srcip = ntohl(iph->saddr);
+            package_node.dstip = ntohl(iph->daddr);
+            package_node.srcport = package_node.dstport = 0;
+            trace_tinyfw_classify(state->in, &package_node, TINYFW_SRC_BAN, 0, 0,
+                                  list->generation, NF_DROP);
+        }
+        return Verdict(stat, NF_DROP);
+    }
+
     //get and set protocol
     switch(iph->protocol) {
         case IPPROTO_ICMP:
@@ -51,7 +165,23 @@ unsigned int NFHookFunc(const struct nf_hook_ops *ops_unused,
             package_node.type = PACKAGE_TYPE_UDP;
             break;
         default:    // default rule or just accept ?
-            return NF_ACCEPT;
+            return Verdict(stat, NF_ACCEPT);
+    }
+
+    //TCP/UDP fragments: only the first one has ports, later ones reuse its verdict
+    if(package_node.type != PACKAGE_TYPE_ICMP && (iph->frag_off & htons(IP_MF | IP_OFFSET))) {
+        if(iph->frag_off & htons(IP_OFFSET)) {
+            verdict = FragCacheVerdict(net, iph, &id);
+            if(trace_tinyfw_classify_enabled()) {
+                package_node.srcip = ntohl(iph->saddr);
+                package_node.dstip = ntohl(iph->daddr);
+                package_node.srcport = package_node.dstport = 0;
+                trace_tinyfw_classify(state->in, &package_node, TINYFW_SRC_FRAG, id, 0,
+                                      list->generation, verdict);
+            }
+            return Verdict(stat, verdict);
+        }
+        first_frag = 1;
     }
 
     //get and set ip
@@ -68,16 +198,17 @@ unsigned int NFHookFunc(const struct nf_hook_ops *ops_unused,
     //NOT a ICMP package set port
         if(package_node.type == PACKAGE_TYPE_TCP) {
             if(!(tcph = tcp_hdr(skb))) {
-                return NF_ACCEPT;
+                return Verdict(stat, NF_ACCEPT);
             }
             package_node.srcport = ((tcph->source) & 0xff) << 8
                                  | ((tcph->source) & 0xff00) >> 8;
             package_node.dstport = ((tcph->dest) & 0xff) << 8
                                  | ((tcph->dest) & 0xff00) >> 8;
+            probe = tcph->syn && !tcph->ack;
         }
         else { //only UDP packages will come hear
             if(!(udph = udp_hdr(skb))) {
-                return NF_ACCEPT;
+                return Verdict(stat, NF_ACCEPT);
             }
             package_node.srcport = ((udph->source) & 0xff) << 8
                                  | ((udph->source) & 0xff00) >> 8;
@@ -86,57 +217,116 @@ unsigned int NFHookFunc(const struct nf_hook_ops *ops_unused,
         
         }
     }
+    else {
+        //only the first fragment carries the ICMP header
+        probe = !(iph->frag_off & htons(IP_OFFSET)) && icmp_hdr(skb)->type == ICMP_ECHO;
+    }
+
+    //port scan detector, counts connection attempts only, drops flagged sources only if
+    //scan_drop_s is set; host namespace only
+    if(host && ScanCheck(&package_node, probe)) {
+        trace_tinyfw_classify(state->in, &package_node, TINYFW_SRC_SCAN, 0, 0,
+                              list->generation, NF_DROP);
+        return Verdict(stat, NF_DROP);
+    }
+
+    //shadow rule set is evaluated on sampled packets after the live one, never enforced
+    if(host) {
+        shadow = ShadowSample();
+    }
+    if(shadow != NULL) {
+        start = ktime_get_ns();
+    }
 
     //match rule
-    for(rule_partten = g_rule_list.head; rule_partten != NULL; 
-            rule_partten = rule_partten->next) {
-        if(RuleMatch(rule_partten, &package_node)) {//one match RETURN;
-            if(rule_partten->rule == RULE_PERMIT) {
-                printk("match rule accept\n");
-                printk("%s: %u.%u.%u.%u:%u  %u.%u.%u.%u:%u\n", state->in->name,
-                       package_node.srcip >> 24,  (package_node.srcip >> 16) & 0xff, 
-                       (package_node.srcip >> 8) & 0xff, package_node.srcip & 0xff,
-                       package_node.srcport,
-                       package_node.dstip >> 24,  (package_node.dstip >> 16) & 0xff, 
-                       (package_node.dstip >> 8) & 0xff, package_node.dstip & 0xff,
-                       package_node.dstport);
-
-                return NF_ACCEPT;
-            }
-            else {
-                printk("match rule reject\n");
-                printk("%s: %u.%u.%u.%u:%u  %u.%u.%u.%u:%u\n", state->in->name,
-                       package_node.srcip >> 24,  (package_node.srcip >> 16) & 0xff, 
-                       (package_node.srcip >> 8) & 0xff, package_node.srcip & 0xff,
-                       package_node.srcport,
-                       package_node.dstip >> 24,  (package_node.dstip >> 16) & 0xff, 
-                       (package_node.dstip >> 8) & 0xff, package_node.dstip & 0xff,
-                       package_node.dstport);
-
-                return NF_DROP;
+    if(cls != NULL && ClsPrefilterSkip(cls, &package_node)) {
+        //no rule can match, straight to the default rule
+        this_cpu_inc(stat->prefilter_bypass);
+        rule_partten = NULL;
+        evaluated = 0;
+        live_ns = shadow ? ktime_get_ns() - start : 0;
+        action = cls->default_rule;
+        generation = cls->generation;
+    }
+    else if(cls != NULL) {
+        rule_partten = ClassifierLookup(cls, &package_node, &evaluated);
+        if(rule_partten == NULL && ClsPrefilterCovers(cls, &package_node)) {
+            this_cpu_inc(stat->prefilter_fp);
+        }
+        live_ns = shadow ? ktime_get_ns() - start : 0;
+        action = rule_partten ? rule_partten->rule : cls->default_rule;
+        generation = cls->generation;
+    }
+    else {
+        //no compiled classifier (build failed), walk the list
+        evaluated = 0;
+        for(rule_partten = rcu_dereference(list->head); rule_partten != NULL; 
+                rule_partten = rcu_dereference(rule_partten->next)) {
+            ++evaluated;
+            if(RuleMatch(rule_partten, &package_node)) {//first match wins
+                break;
             }
         }
+        live_ns = shadow ? ktime_get_ns() - start : 0;
+        action = rule_partten ? rule_partten->rule : list->default_rule;
+        generation = list->generation;
     }
 
-    if(g_rule_list.default_rule == RULE_PERMIT) {
-        return NF_ACCEPT;
+    if(shadow != NULL) {
+        ShadowEval(shadow, &package_node, rule_partten, action, evaluated, live_ns);
     }
-
-    return NF_DROP;
+    if(rule_partten != NULL) {
+        atomic_long_inc(&rule_partten->hits);
+        this_cpu_inc(stat->rule_hits);
+        id = rule_partten->id;
+    }
+    else {
+        this_cpu_inc(stat->default_hits);
+        id = 0;
+    }
+    switch(action) {
+        case RULE_PERMIT:
+            verdict = NF_ACCEPT;
+            break;
+        case RULE_QUEUE:
+            verdict = QueueVerdict(skb);
+            break;
+        case RULE_REFUSE:   //rules only, rule_partten is set
+            RefuseReply(skb, state, package_node.type, rule_partten, stat);
+            verdict = NF_DROP;
+            break;
+        default:
+            verdict = NF_DROP;
+            break;
+    }
+    if(first_frag) {
+        FragCacheStore(net, iph, verdict, id);
+    }
+    trace_tinyfw_classify(state->in, &package_node, rule_partten ? TINYFW_SRC_RULE : TINYFW_SRC_DEFAULT,
+                          id, evaluated, generation, verdict);
+    return Verdict(stat, verdict);
 }
 
-void RegistHook() {
+/* 在 NetnsInit 之后调用：hook 看到的每个命名空间都已有规则集 */
+int RegistHook() {
+    int iRet;
+
     nf_reg.hook = NFHookFunc;    //hook FUNC
     nf_reg.owner = THIS_MODULE;
     nf_reg.pf = PF_INET;         //IPv4 packages
     nf_reg.hooknum = NF_INET_PRE_ROUTING; //hook at the first stage
     nf_reg.priority = NF_IP_PRI_FIRST;
     
-    active = 0;
-    nf_register_hook(&nf_reg);
+    get_random_bytes(&g_queue_rnd, sizeof(g_queue_rnd));
+    //active is left as is: a preloaded rule image enforces from the first packet
+    iRet = nf_register_hook(&nf_reg);
+    if(iRet != 0) {
+        printk("netfilter hook regist FAILED!\n");
+        return iRet;
+    }
     printk("netfilter hook regist SUCCEED!\n");
 
-    return ;
+    return 0;
 }
 
 void RemoveHook() {
@@ -157,4 +347,30 @@ inline void ShutdownFilter() {
 
     return ;
 }
-           
+
+/* 汇总一组每 CPU 计数 */
+void FilterSumStat(const struct FilterStat __percpu *pcpu_stat, struct FilterStat *stat) {
+    const struct FilterStat *cpu_stat;
+    int cpu;
+
+    memset(stat, 0, sizeof(*stat));
+    for_each_possible_cpu(cpu) {
+        cpu_stat = per_cpu_ptr(pcpu_stat, cpu);
+        stat->packets += cpu_stat->packets;
+        stat->accepted += cpu_stat->accepted;
+        stat->dropped += cpu_stat->dropped;
+        stat->rule_hits += cpu_stat->rule_hits;
+        stat->default_hits += cpu_stat->default_hits;
+        stat->banned += cpu_stat->banned;
+        stat->prefilter_bypass += cpu_stat->prefilter_bypass;
+        stat->prefilter_fp += cpu_stat->prefilter_fp;
+        stat->queued += cpu_stat->queued;
+        stat->replies += cpu_stat->replies;
+        stat->reply_drops += cpu_stat->reply_drops;
+    }
+}
+
+/* 宿主命名空间的计数 */
+void FilterGetStat(struct FilterStat *stat) {
+    FilterSumStat(&g_filter_stat, stat);
+}
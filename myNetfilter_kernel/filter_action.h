@@ -1,10 +1,14 @@
 #ifndef FILTER_ACTION_H
 #define FILTER_ACTION_H
 
-void RegistHook(void);
+#include "../common.h"
+
+int RegistHook(void);
 void RemoveHook(void);
 void StartFilter(void);
 void ShutdownFilter(void);
+void FilterSumStat(const struct FilterStat __percpu *, struct FilterStat *);
+void FilterGetStat(struct FilterStat *);
 
 #endif
 
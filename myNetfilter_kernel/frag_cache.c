@@ -0,0 +1,198 @@
+// FileName: myNetfilter_kernel/frag_cache.c
+// Describe: 分片判决缓存：TCP/UDP 首个分片照常分类，判决按 (源, 目的, 协议, IP ID) 缓存，后续分片直接沿用
+// Note: 后续分片没有传输层头部，不能按端口匹配，这里也不做重组。每个 CPU 一张 4 路组相联的小表，
+//       报文路径无锁、不分配内存；同一数据报的分片通常由同一 CPU 接收（RSS/RPS 对分片只按地址散列）。
+//       找不到首片判决的后续分片为孤儿，默认放行：首片没有通过时数据报无法重组。
+//       各 network namespace 的地址可能重叠，表项同时记录命名空间，判决不会跨命名空间沿用。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/jiffies.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/netfilter.h>
+#include <net/netns/hash.h>
+
+#include "../common.h"
+#include "frag_cache.h"
+
+#define FRAG_WAYS 4
+#define FRAG_MAX_ENTRIES 65536
+
+static unsigned int frag_cache_entries = 256;
+module_param(frag_cache_entries, uint, 0444);
+MODULE_PARM_DESC(frag_cache_entries, "fragment verdict cache entries per cpu, 0 to disable");
+static unsigned int frag_timeout_s = 5;
+module_param(frag_timeout_s, uint, 0644);
+MODULE_PARM_DESC(frag_timeout_s, "seconds a first fragment's verdict is reused");
+static bool frag_orphan_drop = false;
+module_param(frag_orphan_drop, bool, 0644);
+MODULE_PARM_DESC(frag_orphan_drop, "drop later fragments whose first fragment was not seen");
+
+struct FragEntry {
+    const struct net *net;      //only compared, never dereferenced
+    __be32 saddr;
+    __be32 daddr;
+    __be16 id;
+    u8 proto;
+    u8 used;
+    unsigned int verdict;
+    unsigned int rule;          //rule id for trace, 0 for default rule
+    unsigned long expires;      //jiffies
+};
+
+static DEFINE_PER_CPU(struct FragEntry *, g_frag_table);
+static unsigned int g_frag_size = 0;    //entries per cpu, 0 if disabled
+static u32 g_frag_rnd;
+
+static DEFINE_PER_CPU(unsigned long, g_frag_stored);
+static DEFINE_PER_CPU(unsigned long, g_frag_hits);
+static DEFINE_PER_CPU(unsigned long, g_frag_orphans);
+static DEFINE_PER_CPU(unsigned long, g_frag_orphan_drops);
+static DEFINE_PER_CPU(unsigned long, g_frag_evictions);
+
+/* 本 CPU 表中该数据报所在的组，hook 在软中断中运行，不会被同一 CPU 上的其他报文打断 */
+static inline struct FragEntry *FragBucket(const struct net *net, const struct iphdr *iph) {
+    u32 hash = jhash_3words(iph->saddr, iph->daddr, (u32)iph->id << 8 | iph->protocol,
+                            g_frag_rnd ^ net_hash_mix(net));
+
+    return __this_cpu_read(g_frag_table) + (hash & (g_frag_size / FRAG_WAYS - 1)) * FRAG_WAYS;
+}
+
+static inline int FragMatch(const struct FragEntry *entry, const struct net *net, const struct iphdr *iph) {
+    return entry->used && entry->saddr == iph->saddr && entry->daddr == iph->daddr
+        && entry->id == iph->id && entry->proto == iph->protocol && entry->net == net;
+}
+
+/* 首个分片分类后调用；组内没有空位时挤掉最早过期的一项 */
+void FragCacheStore(const struct net *net, const struct iphdr *iph, unsigned int verdict, unsigned int rule) {
+    struct FragEntry *bucket, *victim = NULL;
+    unsigned long now = jiffies;
+    int i;
+
+    if(g_frag_size == 0) {
+        return;
+    }
+    bucket = FragBucket(net, iph);
+    for(i = 0; i < FRAG_WAYS; ++i) {
+        if(FragMatch(&bucket[i], net, iph)) { //first fragment seen again
+            victim = &bucket[i];
+            goto store;
+        }
+    }
+    for(i = 0; i < FRAG_WAYS; ++i) {
+        if(!bucket[i].used || time_after_eq(now, bucket[i].expires)) {
+            victim = &bucket[i];
+            goto store;
+        }
+        if(victim == NULL || time_before(bucket[i].expires, victim->expires)) {
+            victim = &bucket[i];
+        }
+    }
+    __this_cpu_inc(g_frag_evictions);
+
+store:
+    victim->net = net;
+    victim->saddr = iph->saddr;
+    victim->daddr = iph->daddr;
+    victim->id = iph->id;
+    victim->proto = iph->protocol;
+    victim->used = 1;
+    victim->verdict = verdict;
+    victim->rule = rule;
+    victim->expires = now + (unsigned long)frag_timeout_s * HZ;
+    __this_cpu_inc(g_frag_stored);
+}
+
+/*
+ * 后续分片的判决：命中时为首片的判决，*rule 为首片命中的规则；
+ * 孤儿按 frag_orphan_drop 放行或丢弃，*rule 为0。
+ */
+unsigned int FragCacheVerdict(const struct net *net, const struct iphdr *iph, unsigned int *rule) {
+    const struct FragEntry *bucket;
+    int i;
+
+    if(g_frag_size != 0) {
+        bucket = FragBucket(net, iph);
+        for(i = 0; i < FRAG_WAYS; ++i) {
+            if(FragMatch(&bucket[i], net, iph) && time_before(jiffies, bucket[i].expires)) {
+                __this_cpu_inc(g_frag_hits);
+                *rule = bucket[i].rule;
+                return bucket[i].verdict;
+            }
+        }
+    }
+    __this_cpu_inc(g_frag_orphans);
+    *rule = 0;
+    if(frag_orphan_drop) {
+        __this_cpu_inc(g_frag_orphan_drops);
+        return NF_DROP;
+    }
+    return NF_ACCEPT;
+}
+
+void FragGetStat(struct FragStat *stat) {
+    const struct FragEntry *table;
+    unsigned long now = jiffies;
+    unsigned int i;
+    int cpu;
+
+    memset(stat, 0, sizeof(*stat));
+    stat->capacity = g_frag_size;
+    stat->cpus = num_possible_cpus();
+    stat->timeout_s = frag_timeout_s;
+    for_each_possible_cpu(cpu) {
+        table = per_cpu(g_frag_table, cpu);
+        for(i = 0; table != NULL && i < g_frag_size; ++i) { //racy read, only for display
+            if(table[i].used && time_before(now, table[i].expires)) {
+                ++stat->live;
+            }
+        }
+        stat->stored += per_cpu(g_frag_stored, cpu);
+        stat->hits += per_cpu(g_frag_hits, cpu);
+        stat->orphans += per_cpu(g_frag_orphans, cpu);
+        stat->orphan_drops += per_cpu(g_frag_orphan_drops, cpu);
+        stat->evictions += per_cpu(g_frag_evictions, cpu);
+    }
+}
+
+void FragGetMem(struct MemStat *stat) {
+    stat->frag_slots = (unsigned long long)g_frag_size * num_possible_cpus();
+    stat->frag_bytes = stat->frag_slots * sizeof(struct FragEntry);
+}
+
+int FragCacheInit(void) {
+    int cpu;
+
+    if(frag_cache_entries == 0) {
+        return 0;
+    }
+    if(frag_cache_entries > FRAG_MAX_ENTRIES) {
+        printk("frag_cache_entries out of range [0, %d]\n", FRAG_MAX_ENTRIES);
+        return -EINVAL;
+    }
+    g_frag_size = roundup_pow_of_two(max_t(unsigned int, frag_cache_entries, FRAG_WAYS));
+    get_random_bytes(&g_frag_rnd, sizeof(g_frag_rnd));
+    for_each_possible_cpu(cpu) {
+        per_cpu(g_frag_table, cpu) = vzalloc_node(g_frag_size * sizeof(struct FragEntry), cpu_to_node(cpu));
+        if(per_cpu(g_frag_table, cpu) == NULL) {
+            FragCacheCleanup();
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+/* hook 已注销后调用 */
+void FragCacheCleanup(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        vfree(per_cpu(g_frag_table, cpu));
+        per_cpu(g_frag_table, cpu) = NULL;
+    }
+    g_frag_size = 0;
+}
@@ -0,0 +1,16 @@
+#ifndef FRAG_CACHE_H
+#define FRAG_CACHE_H
+
+#include <linux/ip.h>
+#include <net/net_namespace.h>
+
+#include "../common.h"
+
+int FragCacheInit(void);
+void FragCacheCleanup(void);
+void FragCacheStore(const struct net *, const struct iphdr *iph, unsigned int verdict, unsigned int rule);
+unsigned int FragCacheVerdict(const struct net *, const struct iphdr *iph, unsigned int *rule);
+void FragGetStat(struct FragStat *);
+void FragGetMem(struct MemStat *);
+
+#endif
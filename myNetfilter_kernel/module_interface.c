@@ -13,11 +13,23 @@
 #include <linux/device.h>
 #include <linux/cdev.h>           /// struct cdev  
 #include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/nsproxy.h>
 
 #include "../common.h"
 #include "module_interface.h"
 #include "rule_list_manage.h"
 #include "filter_action.h"
+#include "ban_table.h"
+#include "scan_detect.h"
+#include "frag_cache.h"
+#include "nl_interface.h"
+#include "stats_map.h"
+#include "rule_image.h"
+#include "rule_optimize.h"
+#include "classifier.h"
+#include "shadow.h"
+#include "netns.h"
 
 #define IO_BUFF_SIZE 4096   
 
@@ -33,6 +45,7 @@ ssize_t ModuleRead(struct file *filp, char *buf, size_t count, loff_t *f_pos);
 ssize_t ModuleWrite(struct file *filp, const char *user_buf, 
         size_t count, loff_t *f_pos);
 long ModuleIoctl(struct file *file, unsigned int cmd, unsigned long arg);
+static long DoBanBatch(unsigned int cmd, unsigned long arg);
 
 static struct file_operations file_ops = {
     .open = ModuleOpen,
@@ -40,13 +53,29 @@ static struct file_operations file_ops = {
     .read = ModuleRead,
     .write = ModuleWrite,
     .unlocked_ioctl = ModuleIoctl,
+    .mmap = StatsMapMmap,   //read-only stats region
 };
 
+/*
+ * 字符设备只操作宿主命名空间的规则集（g_rule_list），调用者不在宿主命名空间时返回 -EPERM，
+ * 容器即使能看到 /dev/myntfw 也不能改写宿主的规则；容器经 generic netlink 配置自己的规则集。
+ */
+static int ModuleCheckNet(void) {
+    if(!NetIsHost(current->nsproxy->net_ns)) {
+        printk("caller outside the host network namespace, use generic netlink\n");
+        return -EPERM;
+    }
+    return 0;
+}
+
 /*
  * 打开设备文件时调用。
  * 计数，保证同一时间只有一个用户态进程控向内核发送过滤规则。
  */
 int ModuleOpen(struct inode *inode, struct file *file) {
+    if(ModuleCheckNet() != 0) {
+        return -EPERM;
+    }
     if(g_device_status) {
         return -EBUSY;
     }
@@ -69,7 +98,11 @@ ssize_t ModuleRead(struct file *file, char *buf, size_t count, loff_t *f_pos) {
     char *cur_pointer;
     struct RuleNode *cur_node;
     
+    if(ModuleCheckNet() != 0) {
+        return -EPERM;
+    }
     cur_pointer = g_io_buff;
+    mutex_lock(&g_rule_mutex);
     for(cur_node = g_rule_list.head; cur_node !=  NULL; cur_node = cur_node->next) {
         if(cur_pointer - g_io_buff > IO_BUFF_SIZE - 80) {
             /* NO enough buff left */
@@ -78,6 +111,7 @@ ssize_t ModuleRead(struct file *file, char *buf, size_t count, loff_t *f_pos) {
         }
         ReadRule(&cur_pointer, cur_node);
     }
+    mutex_unlock(&g_rule_mutex);
     *(cur_pointer++) = '\0';
 
     size = (cur_pointer - g_io_buff)/sizeof(char);
@@ -96,6 +130,9 @@ ssize_t ModuleWrite(struct file *filp, const char *buf,
     struct RuleNode *new_node;
     int iRet;
 
+    if(ModuleCheckNet() != 0) {
+        return -EPERM;
+    }
     iRet = copy_from_user(g_io_buff, buf, count);
     if(iRet != 0) {
         printk("copy_from_user FAILED\n");
@@ -107,22 +144,91 @@ ssize_t ModuleWrite(struct file *filp, const char *buf,
         printk("ParseRule FAILED\n");
         return -EFAULT;
     }
+    mutex_lock(&g_rule_mutex);
     RuleInsert(new_node);
+    RuleListCommit();
+    mutex_unlock(&g_rule_mutex);
 
     printk("write rule SUCCEED!\n");
     return 0;
 }
 
+/*
+ * 批量添加/删除封禁条目。
+ * 用户态一次传入任意条数，这里以 IO_BUFF_SIZE 为单位分段拷贝。
+ * 返回成功处理的条目数。
+ */
+static long DoBanBatch(unsigned int cmd, unsigned long arg) {
+    struct BanBatch batch;
+    struct BanEntry *entries = (struct BanEntry *)g_io_buff;
+    unsigned int per_copy = IO_BUFF_SIZE / sizeof(struct BanEntry);
+    unsigned int done, n, i;
+    long count = 0;
+
+    if(copy_from_user(&batch, (void *)arg, sizeof(batch))) {
+        printk("copy_from_user FAILED!\n");
+        return -1;
+    }
+    for(done = 0; done < batch.count; done += n) {
+        n = batch.count - done;
+        if(n > per_copy) {
+            n = per_copy;
+        }
+        if(copy_from_user(entries, batch.entries + done, n * sizeof(struct BanEntry))) {
+            printk("copy_from_user FAILED!\n");
+            return -1;
+        }
+        for(i = 0; i < n; ++i) {
+            if(cmd == IO_CTRL_BAN_ADD) {
+                if(BanAdd(entries[i].ip, entries[i].ttl) == 0) {
+                    ++count;
+                }
+            }
+            else if(BanDelete(entries[i].ip) == 0) {
+                ++count;
+            }
+        }
+        cond_resched();
+    }
+
+    return count;
+}
+
+/* 汇总模块各部分占用的内存 */
+static void GetMemStat(struct MemStat *stat) {
+    memset(stat, 0, sizeof(*stat));
+    RuleNodeGetMem(stat);
+    ClassifierGetMem(stat);
+    BanGetMem(stat);
+    ScanGetMem(stat);
+    FragGetMem(stat);
+    NetnsGetMem(stat);
+    stat->stats_map_bytes = StatsMapGetMem();
+    stat->io_bytes = IO_BUFF_SIZE;
+    stat->total_bytes = stat->rule_bytes + stat->cls_bytes + stat->ban_bytes
+                      + stat->scan_bytes + stat->frag_bytes + stat->stats_map_bytes + stat->io_bytes;
+}
+
 long ModuleIoctl(struct file *file, unsigned int cmd, unsigned long arg) {
     long kernel_arg;
+    struct BanStat ban_stat;
+    struct ScanStat scan_stat;
+    struct FragStat frag_stat;
+    struct MemStat mem_stat;
+    struct ShadowStat *shadow_stat;
+    struct RuleImageBuf image;
     struct RuleNode *new_node;
-    struct RuleNode *pre;
+    int iRet;
     
+    if(ModuleCheckNet() != 0) { //the descriptor may have been passed into a container
+        return -EPERM;
+    }
     switch(cmd) {
         case IO_CTRL_CLE:
-            kernel_arg = g_rule_list.default_rule;
+            mutex_lock(&g_rule_mutex);
             RuleListCleanup();
-            g_rule_list.default_rule = kernel_arg;
+            RuleListCommit();
+            mutex_unlock(&g_rule_mutex);
             break;
         case IO_CTRL_START:
             StartFilter();
@@ -131,12 +237,15 @@ long ModuleIoctl(struct file *file, unsigned int cmd, unsigned long arg) {
             ShutdownFilter();
             break;
         case IO_CTRL_DEF:
+            mutex_lock(&g_rule_mutex);
             if(arg == IO_CTRL_PERMIT) {
                 g_rule_list.default_rule = RULE_PERMIT;
             }
             else { //arg == IO_CTRL_REJECT
                 g_rule_list.default_rule = RULE_REJECT;
             }
+            RuleListCommit();
+            mutex_unlock(&g_rule_mutex);
             break;
         case IO_CTRL_GET_DEF:
             if(g_rule_list.default_rule == RULE_PERMIT) {
@@ -158,28 +267,104 @@ long ModuleIoctl(struct file *file, unsigned int cmd, unsigned long arg) {
             new_node = ParseRule(g_io_buff);
             if(new_node == NULL) {
                 printk("ParseRule FAILED\n");
-                return -1;
+                return RuleNodeFull() ? -ENOSPC : -EINVAL;
             }
+            mutex_lock(&g_rule_mutex);
             RuleInsert(new_node);
+            RuleListCommit();
+            mutex_unlock(&g_rule_mutex);
             break;
         case IO_CTRL_DEL:
-            if(arg == 1 && g_rule_list.head != NULL) {
-                pre = g_rule_list.head;
-                g_rule_list.head = g_rule_list.head->next;
-                kfree(pre);
-                return 0;
+            mutex_lock(&g_rule_mutex);
+            iRet = RuleListDeleteAt(&g_rule_list, arg);
+            if(iRet == 0) {
+                RuleListCommit();
+            }
+            mutex_unlock(&g_rule_mutex);
+            return iRet; //only if we DON'T find the rule, we get -1. SO WE FAILED!
+        case IO_CTRL_BAN_ADD:
+        case IO_CTRL_BAN_DEL:
+            return DoBanBatch(cmd, arg);
+        case IO_CTRL_BAN_FLUSH:
+            BanFlush();
+            break;
+        case IO_CTRL_BAN_STAT:
+            BanGetStat(&ban_stat);
+            if(copy_to_user((void *)arg, &ban_stat, sizeof(ban_stat)) != 0) {
+                printk("copy_to_user FAILED!\n");
+                return -1;
+            }
+            break;
+        case IO_CTRL_SCAN_STAT:
+            ScanGetStat(&scan_stat);
+            if(copy_to_user((void *)arg, &scan_stat, sizeof(scan_stat)) != 0) {
+                printk("copy_to_user FAILED!\n");
+                return -1;
+            }
+            break;
+        case IO_CTRL_FRAG_STAT:
+            FragGetStat(&frag_stat);
+            if(copy_to_user((void *)arg, &frag_stat, sizeof(frag_stat)) != 0) {
+                printk("copy_to_user FAILED!\n");
+                return -1;
+            }
+            break;
+        case IO_CTRL_MEM_STAT:
+            GetMemStat(&mem_stat);
+            if(copy_to_user((void *)arg, &mem_stat, sizeof(mem_stat)) != 0) {
+                printk("copy_to_user FAILED!\n");
+                return -1;
+            }
+            break;
+        case IO_CTRL_IMAGE:
+            if(copy_from_user(&image, (void *)arg, sizeof(image))) {
+                printk("copy_from_user FAILED!\n");
+                return -1;
+            }
+            iRet = RuleImageLoadUser(image.data, image.size);
+            if(iRet != 0) {
+                printk("install rule image FAILED! (%d)\n", iRet);
+                return -1;
+            }
+            break;
+        case IO_CTRL_SHADOW_LOAD:
+            iRet = ShadowLoadUser((const struct ShadowLoad __user *)arg);
+            if(iRet != 0) {
+                printk("load shadow rule set FAILED! (%d)\n", iRet);
+                return -1;
+            }
+            break;
+        case IO_CTRL_SHADOW_STAT:
+            shadow_stat = (struct ShadowStat *)kmalloc(sizeof(struct ShadowStat), GFP_KERNEL);
+            if(shadow_stat == NULL) {
+                return -1;
+            }
+            ShadowGetStat(shadow_stat);
+            iRet = copy_to_user((void *)arg, shadow_stat, sizeof(struct ShadowStat));
+            kfree(shadow_stat);
+            if(iRet != 0) {
+                printk("copy_to_user FAILED!\n");
+                return -1;
+            }
+            break;
+        case IO_CTRL_SHADOW_PROMOTE:
+            iRet = ShadowPromote();
+            if(iRet != 0) {
+                return iRet;    //-ENOENT none loaded, -EAGAIN replaced while promoting
+            }
+            break;
+        case IO_CTRL_SHADOW_DROP:
+            if(ShadowDrop() != 0) {
+                return -1;
             }
-            for(kernel_arg = 2, pre = g_rule_list.head, new_node = pre->next;
-                    (unsigned long)kernel_arg < arg && new_node != NULL;
-                    ++kernel_arg, pre = new_node, new_node = new_node->next){
-                ; //empyt
-            } 
-            if(new_node != NULL) {
-                pre->next = new_node->next;
-                kfree(new_node);
-                return 0;
+            break;
+        case IO_CTRL_CLS_ENGINE:
+            iRet = ClassifierSetEngine(arg);
+            if(iRet != 0) {
+                printk("set classifier engine FAILED! (%d)\n", iRet);
+                return -1;
             }
-            return -1; //only if we DON'T find the rule, we get here. SO WE FAILED!
+            break;
         default:
             printk("Unknown CMD!\n");
             return -1;
@@ -191,12 +376,15 @@ long ModuleIoctl(struct file *file, unsigned int cmd, unsigned long arg) {
 /* 
  * ModuleInit函数，模块加载时调用。
  * 1. 创建用于和用户态进程通信的设备节点。
- * 2. 初始化规则表（空表）；
- * 3. 设置默认策略为允许；
- * 4. 挂在netfilter的hook函数；
+ * 2. 初始化规则表（空表），设置默认策略为允许；
+ * 3. 若指定了预编译镜像则加载，加载后（或 fail-closed）直接进入过滤状态；
+ * 4. 初始化动态封禁表、扫描检测、分片缓存，为宿主以外的每个 network namespace 建立空规则集；
+ * 5. 分配只读统计区；
+ * 6. 注册 generic netlink 控制通道，启动后台规则优化（默认关闭）；
+ * 7. 挂在netfilter的hook函数：hook 全局只注册一份，报文所属的命名空间由 dev_net 取得；
  */
 int ModuleInit(void) {
-    int iRet, err;
+    int iRet, err, enforce;
     dev_t devno, devno_m;
 
     //setp1: regist cdev
@@ -227,10 +415,122 @@ int ModuleInit(void) {
     printk("cdev regist succeed!\n");
 
     //setp2: init rule list
-    RuleListInit();
+    iRet = RuleListInit();
+    if(iRet != 0) {
+        printk("init rule list FAILED!\n");
+        kfree(g_io_buff);
+        cdev_del(&g_cdev_m);
+        unregister_chrdev_region(MKDEV(g_dev_major, 0), 1);
+        return iRet;
+    }
 
-    //step3: regist hook
-    RegistHook(); 
+    //step3: load precompiled rule image
+    enforce = RuleImageInit();
+    if(enforce < 0) {
+        RuleListExit();
+        kfree(g_io_buff);
+        cdev_del(&g_cdev_m);
+        unregister_chrdev_region(MKDEV(g_dev_major, 0), 1);
+        return enforce;
+    }
+
+    //step4: init ban table, scan detector, fragment cache and per-namespace rule sets
+    iRet = BanTableInit();
+    if(iRet != 0) {
+        printk("init ban table FAILED!\n");
+        RuleListExit();
+        kfree(g_io_buff);
+        cdev_del(&g_cdev_m);
+        unregister_chrdev_region(MKDEV(g_dev_major, 0), 1);
+        return iRet;
+    }
+    iRet = ScanDetectInit();
+    if(iRet != 0) {
+        printk("init scan detector FAILED!\n");
+        BanTableCleanup();
+        RuleListExit();
+        kfree(g_io_buff);
+        cdev_del(&g_cdev_m);
+        unregister_chrdev_region(MKDEV(g_dev_major, 0), 1);
+        return iRet;
+    }
+    iRet = FragCacheInit();
+    if(iRet != 0) {
+        printk("init fragment cache FAILED!\n");
+        ScanDetectCleanup();
+        BanTableCleanup();
+        RuleListExit();
+        kfree(g_io_buff);
+        cdev_del(&g_cdev_m);
+        unregister_chrdev_region(MKDEV(g_dev_major, 0), 1);
+        return iRet;
+    }
+    iRet = NetnsInit();
+    if(iRet != 0) {
+        printk("init per-namespace rule sets FAILED!\n");
+        FragCacheCleanup();
+        ScanDetectCleanup();
+        BanTableCleanup();
+        RuleListExit();
+        kfree(g_io_buff);
+        cdev_del(&g_cdev_m);
+        unregister_chrdev_region(MKDEV(g_dev_major, 0), 1);
+        return iRet;
+    }
+
+    //step5: alloc stats region
+    iRet = StatsMapInit();
+    if(iRet != 0) {
+        NetnsExit();
+        FragCacheCleanup();
+        ScanDetectCleanup();
+        BanTableCleanup();
+        RuleListExit();
+        kfree(g_io_buff);
+        cdev_del(&g_cdev_m);
+        unregister_chrdev_region(MKDEV(g_dev_major, 0), 1);
+        return iRet;
+    }
+
+    //step6: regist genl family
+    iRet = NlInit();
+    if(iRet != 0) {
+        StatsMapExit();
+        NetnsExit();
+        FragCacheCleanup();
+        ScanDetectCleanup();
+        BanTableCleanup();
+        RuleListExit();
+        kfree(g_io_buff);
+        cdev_del(&g_cdev_m);
+        unregister_chrdev_region(MKDEV(g_dev_major, 0), 1);
+        return iRet;
+    }
+
+    RuleOptimizeInit();
+    ClassifierInit();
+
+    //step7: regist hook, already enforcing if a rule image was loaded
+    if(enforce) {
+        StartFilter();
+    }
+    iRet = RegistHook();
+    if(iRet != 0) {
+        ShutdownFilter();
+        ClassifierExit();
+        RuleOptimizeExit();
+        NlExit();
+        StatsMapExit();
+        NetnsExit();
+        FragCacheCleanup();
+        ScanDetectCleanup();
+        BanTableCleanup();
+        RuleListExit();
+        kfree(g_io_buff);
+        cdev_del(&g_cdev_m);
+        unregister_chrdev_region(MKDEV(g_dev_major, 0), 1);
+        return iRet;
+    }
 
     printk("Module install succeed!\n");
     return 0;
@@ -238,23 +538,35 @@ int ModuleInit(void) {
 
 /*
  * ModuleExit函数，模块卸载时调用
- * 1. 取消挂在在hook函数；
- * 2. 释放规则表所占用的内存；
+ * 1. 取消挂在在hook函数，停止后台优化、分类器压缩与扫描检测，释放分片缓存，注销 generic netlink 控制通道；
+ * 2. 释放影子规则集、各命名空间规则集与规则表所占用的内存；
  * 3. 删除用于与用户态进程通信的设备节点；
- * 4. 清理I/O缓冲区。
+ * 4. 清理动态封禁表与统计区；
+ * 5. 清理I/O缓冲区。
  */
 void ModuleExit(void) {
-    //setp1: remove hook
+    //setp1: remove hook and genl family
     RemoveHook();
+    RuleOptimizeExit();
+    ClassifierExit();
+    ScanDetectCleanup();
+    FragCacheCleanup();
+    NlExit();
     
     //setp2: delete cdev
     cdev_del(&g_cdev_m);
     unregister_chrdev_region(MKDEV(g_dev_major, 0), 1);
 
-    //step3: clean up rule_list
-    RuleListCleanup();
+    //step3: clean up shadow rule set, per-namespace rule sets and rule_list
+    ShadowExit();
+    NetnsExit();
+    RuleListExit();
+
+    //step4: clean up ban table and stats region
+    StatsMapExit();
+    BanTableCleanup();
     
-    //step4: free io_buff
+    //step5: free io_buff
     kfree(g_io_buff);
 
     printk("Module unistall succeed!\n");
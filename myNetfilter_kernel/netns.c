@@ -0,0 +1,223 @@
+// FileName: myNetfilter_kernel/netns.c
+// Describe: 按 network namespace 划分的规则集与统计：容器的报文只按该容器自己的规则判决
+// Note: 宿主（初始）命名空间沿用全局规则表与增量分类器，其余命名空间各有一个整体发布的规则集：
+//       每次修改在副本上进行，编译好分类器后替换，旧规则集由 RCU 回调在宽限期后释放，
+//       写者不等待宽限期。
+//       容器的规则通常只有几条，整体复制比增量维护简单，读者看到的总是完整的一版。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+
+#include "../common.h"
+#include "netns.h"
+#include "rule_list_manage.h"
+#include "classifier.h"
+#include "filter_action.h"
+#include "nl_interface.h"
+
+extern struct RuleList g_rule_list;
+
+int g_tinyfw_net_id;
+
+//非宿主命名空间的规则集汇总，由 g_rule_mutex 保护
+static unsigned long g_net_count = 0;
+static unsigned long g_net_rules = 0;
+static unsigned long g_net_bytes = 0;
+
+static unsigned long NetSetBytes(const struct RuleList *list, const struct Classifier *cls) {
+    unsigned long bytes = (unsigned long)list->length * sizeof(struct RuleNode);
+
+    if(cls != NULL) {
+        bytes += cls->engine->mem(cls) + sizeof(*cls);
+        if(cls->prefilter != NULL) {
+            bytes += cls->prefilter->bytes;
+        }
+    }
+    return bytes;
+}
+
+//已不可见的规则集
+static void NetRuleSetFree(struct NetRuleSet *set) {
+    if(set == NULL) {
+        return;
+    }
+    ClassifierFree(set->cls);
+    RuleListFree(&set->list);
+    kfree(set);
+}
+
+static void NetRuleSetFreeRcu(struct rcu_head *head) {
+    NetRuleSetFree(container_of(head, struct NetRuleSet, rcu));
+}
+
+//由私有表 list 构造规则集，节点转移给规则集，list 置空。失败返回NULL，list 不变
+static struct NetRuleSet *NetRuleSetNew(struct RuleList *list) {
+    struct NetRuleSet *set;
+
+    set = (struct NetRuleSet *)kzalloc(sizeof(*set), GFP_KERNEL);
+    if(set == NULL) {
+        return NULL;
+    }
+    set->list = *list;
+    set->list.garbage = NULL;
+    list->head = list->tail = NULL;
+    list->length = 0;
+    //编译失败时与宿主一样退回遍历链表
+    set->cls = ClassifierEnabled() ? ClassifierBuild(&set->list) : NULL;
+    set->bytes = sizeof(*set) + NetSetBytes(&set->list, set->cls);
+
+    return set;
+}
+
+/* 当前命名空间的规则表，调用方持有 g_rule_mutex，只读 */
+struct RuleList *NetRuleList(struct net *net) {
+    if(NetIsHost(net)) {
+        return &g_rule_list;
+    }
+    return &rcu_dereference_protected(TinyfwNetGet(net)->rules, 1)->list;
+}
+
+/*
+ * 用私有表 list 整体替换非宿主命名空间 net 的规则集（持有 g_rule_mutex），
+ * 版本号递增并通知该命名空间的订阅者。成功时 list 的节点归规则集所有；
+ * 失败返回 -ENOMEM，list 仍由调用方释放。
+ */
+int NetRulesPublish(struct net *net, struct RuleList *list) {
+    struct TinyfwNet *tn = TinyfwNetGet(net);
+    struct NetRuleSet *old, *set;
+
+    old = rcu_dereference_protected(tn->rules, 1);
+    list->generation = old->list.generation + 1;
+    set = NetRuleSetNew(list);
+    if(set == NULL) {
+        return -ENOMEM;
+    }
+    rcu_assign_pointer(tn->rules, set);
+    g_net_rules = g_net_rules - old->list.length + set->list.length;
+    g_net_bytes = g_net_bytes - old->bytes + set->bytes;
+    NlNotifyNetGeneration(net, &set->list);
+
+    //不在 g_rule_mutex 下等待宽限期，模块卸载时由 RuleListExit 的 rcu_barrier 等待回调完成
+    call_rcu(&old->rcu, NetRuleSetFreeRcu);
+
+    return 0;
+}
+
+/* 命名空间规则集占用的内存：规则节点与分类器 */
+unsigned long long NetMemBytes(struct net *net) {
+    struct NetRuleSet *set;
+    unsigned long long bytes;
+
+    mutex_lock(&g_rule_mutex);
+    if(NetIsHost(net)) {
+        bytes = NetSetBytes(&g_rule_list, rcu_dereference_protected(g_classifier, 1));
+    }
+    else {
+        set = rcu_dereference_protected(TinyfwNetGet(net)->rules, 1);
+        bytes = set->bytes;
+    }
+    mutex_unlock(&g_rule_mutex);
+
+    return bytes;
+}
+
+void NetGetStat(struct net *net, struct FilterStat *stat) {
+    if(NetIsHost(net)) {
+        FilterGetStat(stat);
+    }
+    else {
+        FilterSumStat(TinyfwNetGet(net)->stat, stat);
+    }
+}
+
+/* 分类器统计：宿主为全局分类器；其他命名空间只有描述其分类器的字段，块与更新计数属于宿主 */
+void NetClsStat(struct net *net, struct ClsStat *stat) {
+    if(NetIsHost(net)) {
+        ClassifierGetStat(stat);
+        return;
+    }
+    memset(stat, 0, sizeof(*stat));
+    mutex_lock(&g_rule_mutex);
+    ClassifierDescribe(rcu_dereference_protected(TinyfwNetGet(net)->rules, 1)->cls, stat);
+    mutex_unlock(&g_rule_mutex);
+}
+
+void NetnsGetMem(struct MemStat *stat) {
+    mutex_lock(&g_rule_mutex);
+    stat->netns = g_net_count;
+    stat->netns_rules = g_net_rules;
+    stat->netns_bytes = g_net_bytes;
+    mutex_unlock(&g_rule_mutex);
+}
+
+/* 新命名空间从空规则集、默认允许开始，容器未配置规则时不影响其通信 */
+static int __net_init TinyfwNetInit(struct net *net) {
+    struct TinyfwNet *tn = TinyfwNetGet(net);
+    struct RuleList empty;
+    struct NetRuleSet *set;
+
+    if(NetIsHost(net)) {
+        return 0;
+    }
+    tn->stat = alloc_percpu(struct FilterStat);
+    if(tn->stat == NULL) {
+        return -ENOMEM;
+    }
+    memset(&empty, 0, sizeof(empty));
+    empty.default_rule = RULE_PERMIT;
+    mutex_lock(&g_rule_mutex);
+    set = NetRuleSetNew(&empty);
+    if(set == NULL) {
+        mutex_unlock(&g_rule_mutex);
+        free_percpu(tn->stat);
+        tn->stat = NULL;
+        return -ENOMEM;
+    }
+    RCU_INIT_POINTER(tn->rules, set);
+    ++g_net_count;
+    g_net_bytes += set->bytes;
+    mutex_unlock(&g_rule_mutex);
+    return 0;
+}
+
+/* 命名空间销毁时 hook 已不会再看到它的报文（cleanup_net 在调用 exit 前等待了宽限期） */
+static void __net_exit TinyfwNetExit(struct net *net) {
+    struct TinyfwNet *tn = TinyfwNetGet(net);
+    struct NetRuleSet *set;
+
+    if(NetIsHost(net)) {
+        return;
+    }
+    mutex_lock(&g_rule_mutex);
+    set = rcu_dereference_protected(tn->rules, 1);
+    RCU_INIT_POINTER(tn->rules, NULL);
+    --g_net_count;
+    g_net_rules -= set->list.length;
+    g_net_bytes -= set->bytes;
+    NetRuleSetFree(set);
+    mutex_unlock(&g_rule_mutex);
+    free_percpu(tn->stat);
+    tn->stat = NULL;
+}
+
+static struct pernet_operations g_tinyfw_net_ops = {
+    .init = TinyfwNetInit,
+    .exit = TinyfwNetExit,
+    .id = &g_tinyfw_net_id,
+    .size = sizeof(struct TinyfwNet),
+};
+
+/* 为已有的每个命名空间建立空规则集，此后新建的命名空间由 TinyfwNetInit 处理 */
+int NetnsInit(void) {
+    return register_pernet_subsys(&g_tinyfw_net_ops);
+}
+
+/* hook 与 genl 通道已注销后调用 */
+void NetnsExit(void) {
+    unregister_pernet_subsys(&g_tinyfw_net_ops);
+}
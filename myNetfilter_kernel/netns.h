@@ -0,0 +1,50 @@
+#ifndef NETNS_H
+#define NETNS_H
+
+#include <linux/types.h>
+#include <linux/rcupdate.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+
+#include "../common.h"
+#include "rule_list_manage.h"
+
+struct Classifier;
+
+/* 非宿主命名空间的规则集，整体发布、整体替换；分类器的 list 引擎引用同一结构中的 list */
+struct NetRuleSet {
+    struct RuleList list;
+    struct Classifier *cls;         //NULL 时 hook 遍历 list
+    unsigned long bytes;            //规则与分类器占用的内存
+    struct rcu_head rcu;
+};
+
+/*
+ * 每个 network namespace 的状态。宿主命名空间沿用 g_rule_list、g_classifier 与全局统计，
+ * rules 与 stat 都为NULL。
+ */
+struct TinyfwNet {
+    struct NetRuleSet __rcu *rules;
+    struct FilterStat __percpu *stat;
+};
+
+extern int g_tinyfw_net_id;
+
+static inline struct TinyfwNet *TinyfwNetGet(const struct net *net) {
+    return (struct TinyfwNet *)net_generic(net, g_tinyfw_net_id);
+}
+
+static inline int NetIsHost(const struct net *net) {
+    return net_eq(net, &init_net);
+}
+
+struct RuleList *NetRuleList(struct net *net);
+int NetRulesPublish(struct net *net, struct RuleList *list);
+unsigned long long NetMemBytes(struct net *net);
+void NetGetStat(struct net *net, struct FilterStat *stat);
+void NetClsStat(struct net *net, struct ClsStat *stat);
+void NetnsGetMem(struct MemStat *);
+int NetnsInit(void);
+void NetnsExit(void);
+
+#endif
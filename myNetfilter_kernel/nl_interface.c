@@ -0,0 +1,802 @@
+// FileName: myNetfilter_kernel/nl_interface.c 
+// Describe: generic netlink 控制通道（规则增删改查、批量事务、统计查询、事件广播）
+// Note: 与字符设备并存。不限制同时使用的进程数，写操作由 g_rule_mutex 串行化。
+//       命令作用于调用者所在 network namespace 的规则集（netnsok），宿主命名空间之外的修改整体发布。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <net/netlink.h>
+#include <net/genetlink.h>
+#include <net/net_namespace.h>
+
+#include "../common.h"
+#include "nl_interface.h"
+#include "classifier.h"
+#include "rule_list_manage.h"
+#include "filter_action.h"
+#include "rule_optimize.h"
+#include "netns.h"
+
+/*
+ * 每秒丢包数超过 drop_alert_pps 时向多播组广播 TINYFW_CMD_EVT_THRESHOLD，0 表示关闭。
+ */
+static unsigned int drop_alert_pps = 0;
+module_param(drop_alert_pps, uint, 0644);
+MODULE_PARM_DESC(drop_alert_pps, "multicast an event when drops per second exceed this, 0 to disable");
+
+extern struct RuleList g_rule_list;
+
+static int g_nl_registered = 0;
+static unsigned long long g_last_dropped = 0;
+static void NlThresholdWork(struct work_struct *work);
+static DECLARE_DELAYED_WORK(g_threshold_work, NlThresholdWork);
+
+static const struct nla_policy g_nl_policy[TINYFW_A_MAX + 1] = {
+    [TINYFW_A_RULE] = { .type = NLA_NESTED },
+    [TINYFW_A_POS] = { .type = NLA_U32 },
+    [TINYFW_A_GENERATION] = { .type = NLA_U32 },
+    [TINYFW_A_BATCH_OP] = { .type = NLA_NESTED },
+    [TINYFW_A_COUNT] = { .type = NLA_U32 },
+    [TINYFW_A_OP] = { .type = NLA_U8 },
+    [TINYFW_A_TO] = { .type = NLA_U32 },
+    [TINYFW_A_DRY_RUN] = { .type = NLA_FLAG },
+    [TINYFW_A_DEFAULT] = { .type = NLA_U8 },
+};
+
+static const struct nla_policy g_rule_policy[TINYFW_RA_MAX + 1] = {
+    [TINYFW_RA_TYPE] = { .type = NLA_U8 },
+    [TINYFW_RA_SRCIP] = { .type = NLA_U32 },
+    [TINYFW_RA_SRCMASK] = { .type = NLA_U32 },
+    [TINYFW_RA_SRCPORT] = { .type = NLA_U32 },
+    [TINYFW_RA_DSTIP] = { .type = NLA_U32 },
+    [TINYFW_RA_DSTMASK] = { .type = NLA_U32 },
+    [TINYFW_RA_DSTPORT] = { .type = NLA_U32 },
+    [TINYFW_RA_ACTION] = { .type = NLA_U8 },
+};
+
+static struct genl_family g_nl_family;
+
+static inline unsigned int NlGetU32(const struct nlattr *nla, unsigned int def) {
+    return nla ? nla_get_u32(nla) : def;
+}
+
+/*
+ * 由嵌套属性构造规则节点。未给出的地址/端口字段视为任意(IP_ANY/PORT_ANY)。
+ * 失败返回 ERR_PTR：属性无效 -EINVAL，达到 rule_max -ENOSPC。
+ */
+static struct RuleNode *NlParseRule(const struct nlattr *nla) {
+    struct nlattr *tb[TINYFW_RA_MAX + 1];
+    struct RuleNode *new_node;
+
+    if(nla == NULL || nla_parse_nested(tb, TINYFW_RA_MAX, nla, g_rule_policy) != 0) {
+        return ERR_PTR(-EINVAL);
+    }
+    if(!tb[TINYFW_RA_TYPE] || !tb[TINYFW_RA_ACTION]) {
+        return ERR_PTR(-EINVAL);
+    }
+
+    new_node = RuleNodeAlloc();
+    if(new_node == NULL) {
+        return ERR_PTR(RuleNodeFull() ? -ENOSPC : -ENOMEM);
+    }
+    new_node->type = nla_get_u8(tb[TINYFW_RA_TYPE]);
+    new_node->rule = nla_get_u8(tb[TINYFW_RA_ACTION]);
+    new_node->srcip = NlGetU32(tb[TINYFW_RA_SRCIP], IP_ANY);
+    new_node->srcmask = NlGetU32(tb[TINYFW_RA_SRCMASK], 0);
+    new_node->srcport = NlGetU32(tb[TINYFW_RA_SRCPORT], PORT_ANY);
+    new_node->dstip = NlGetU32(tb[TINYFW_RA_DSTIP], IP_ANY);
+    new_node->dstmask = NlGetU32(tb[TINYFW_RA_DSTMASK], 0);
+    new_node->dstport = NlGetU32(tb[TINYFW_RA_DSTPORT], PORT_ANY);
+    if(RuleValidate(new_node) != 0) {
+        RuleNodeFree(new_node);
+        return ERR_PTR(-EINVAL);
+    }
+
+    return new_node;
+}
+
+static int NlPutRule(struct sk_buff *skb, const struct RuleNode *rnode) {
+    struct nlattr *nest;
+
+    nest = nla_nest_start(skb, TINYFW_A_RULE);
+    if(nest == NULL) {
+        return -EMSGSIZE;
+    }
+    if(nla_put_u8(skb, TINYFW_RA_TYPE, rnode->type)
+            || nla_put_u32(skb, TINYFW_RA_SRCIP, rnode->srcip)
+            || nla_put_u32(skb, TINYFW_RA_SRCMASK, rnode->srcmask)
+            || nla_put_u32(skb, TINYFW_RA_SRCPORT, rnode->srcport)
+            || nla_put_u32(skb, TINYFW_RA_DSTIP, rnode->dstip)
+            || nla_put_u32(skb, TINYFW_RA_DSTMASK, rnode->dstmask)
+            || nla_put_u32(skb, TINYFW_RA_DSTPORT, rnode->dstport)
+            || nla_put_u8(skb, TINYFW_RA_ACTION, rnode->rule)
+            || nla_put_u64(skb, TINYFW_RA_HITS, atomic_long_read(&rnode->hits))
+            || nla_put_u64(skb, TINYFW_RA_REPLIES, atomic_long_read(&rnode->replies))
+            || nla_put_u64(skb, TINYFW_RA_REPLY_DROPS, atomic_long_read(&rnode->reply_drops))
+            || nla_put_u32(skb, TINYFW_RA_ID, rnode->id)) {
+        nla_nest_cancel(skb, nest);
+        return -EMSGSIZE;
+    }
+    nla_nest_end(skb, nest);
+
+    return 0;
+}
+
+/* 在私有副本上执行一个操作，tb 为操作的属性 */
+static int NlApplyAttrs(struct RuleList *list, unsigned char op, struct nlattr **tb) {
+    struct RuleNode *new_node = NULL;
+    unsigned int pos = NlGetU32(tb[TINYFW_A_POS], 0);
+
+    if(op == TINYFW_CMD_ADD || op == TINYFW_CMD_REPLACE) {
+        new_node = NlParseRule(tb[TINYFW_A_RULE]);
+        if(IS_ERR(new_node)) {
+            return PTR_ERR(new_node);
+        }
+    }
+
+    switch(op) {
+        case TINYFW_CMD_ADD:
+            RuleListInsertAt(list, pos, new_node);
+            return 0;
+        case TINYFW_CMD_DEL:
+            return RuleListDeleteAt(list, pos) == 0 ? 0 : -ENOENT;
+        case TINYFW_CMD_REPLACE:
+            if(RuleListReplaceAt(list, pos, new_node) != 0) {
+                RuleNodeFree(new_node);
+                return -ENOENT;
+            }
+            return 0;
+        case TINYFW_CMD_MOVE:
+            if(!tb[TINYFW_A_TO]) {
+                return -EINVAL;
+            }
+            return RuleListMoveAt(list, pos, nla_get_u32(tb[TINYFW_A_TO])) == 0 ? 0 : -ENOENT;
+        default:
+            return -EOPNOTSUPP;
+    }
+}
+
+/* 在私有副本上执行批量事务中的一个操作 */
+static int NlApplyOp(struct RuleList *list, const struct nlattr *op_attr) {
+    struct nlattr *tb[TINYFW_A_MAX + 1];
+
+    if(nla_parse_nested(tb, TINYFW_A_MAX, op_attr, g_nl_policy) != 0 || !tb[TINYFW_A_OP]) {
+        return -EINVAL;
+    }
+    return NlApplyAttrs(list, nla_get_u8(tb[TINYFW_A_OP]), tb);
+}
+
+/* 宿主之外的命名空间的单条修改：在规则集副本上执行后整体发布 */
+static int NlNetOp(struct genl_info *info, unsigned char op) {
+    struct net *net = genl_info_net(info);
+    struct RuleList list;
+    int iRet;
+
+    mutex_lock(&g_rule_mutex);
+    iRet = RuleListCopy(&list, NetRuleList(net));
+    if(iRet == 0 && (iRet = NlApplyAttrs(&list, op, info->attrs)) == 0) {
+        iRet = NetRulesPublish(net, &list);
+    }
+    RuleListFree(&list);    //empty once published
+    mutex_unlock(&g_rule_mutex);
+
+    return iRet;
+}
+
+static int NlRuleAdd(struct sk_buff *skb, struct genl_info *info) {
+    struct RuleNode *new_node;
+
+    if(!NetIsHost(genl_info_net(info))) {
+        return NlNetOp(info, TINYFW_CMD_ADD);
+    }
+    new_node = NlParseRule(info->attrs[TINYFW_A_RULE]);
+    if(IS_ERR(new_node)) {
+        return PTR_ERR(new_node);
+    }
+
+    mutex_lock(&g_rule_mutex);
+    RuleListInsertAt(&g_rule_list, NlGetU32(info->attrs[TINYFW_A_POS], 0), new_node);
+    RuleListCommit();
+    mutex_unlock(&g_rule_mutex);
+
+    return 0;
+}
+
+static int NlRuleDel(struct sk_buff *skb, struct genl_info *info) {
+    int iRet;
+
+    if(!info->attrs[TINYFW_A_POS]) {
+        return -EINVAL;
+    }
+    if(!NetIsHost(genl_info_net(info))) {
+        return NlNetOp(info, TINYFW_CMD_DEL);
+    }
+
+    mutex_lock(&g_rule_mutex);
+    iRet = RuleListDeleteAt(&g_rule_list, nla_get_u32(info->attrs[TINYFW_A_POS]));
+    if(iRet == 0) {
+        RuleListCommit();
+    }
+    mutex_unlock(&g_rule_mutex);
+
+    return iRet == 0 ? 0 : -ENOENT;
+}
+
+static int NlRuleReplace(struct sk_buff *skb, struct genl_info *info) {
+    struct RuleNode *new_node;
+    int iRet;
+
+    if(!info->attrs[TINYFW_A_POS]) {
+        return -EINVAL;
+    }
+    if(!NetIsHost(genl_info_net(info))) {
+        return NlNetOp(info, TINYFW_CMD_REPLACE);
+    }
+    new_node = NlParseRule(info->attrs[TINYFW_A_RULE]);
+    if(IS_ERR(new_node)) {
+        return PTR_ERR(new_node);
+    }
+
+    mutex_lock(&g_rule_mutex);
+    iRet = RuleListReplaceAt(&g_rule_list, nla_get_u32(info->attrs[TINYFW_A_POS]), new_node);
+    if(iRet == 0) {
+        RuleListCommit();
+    }
+    mutex_unlock(&g_rule_mutex);
+
+    if(iRet != 0) {
+        RuleNodeFree(new_node);
+        return -ENOENT;
+    }
+    return 0;
+}
+
+/* 批量事务中已解析的一个操作 */
+struct NlBatchOp {
+    unsigned char op;
+    unsigned int pos;
+    unsigned int to;
+    struct RuleNode *rnode;     //ADD、REPLACE 的新规则
+};
+
+/*
+ * 批量事务的各操作是消息中顶层的 TINYFW_A_BATCH_OP 属性（嵌套属性的 nla_len 只有16位，
+ * 装不下大事务）。返回操作数；属性之后有残留字节（消息被截断）或操作数与客户端给出的
+ * TINYFW_A_COUNT 不符时返回 -EINVAL，损坏的事务不会发布新版本。
+ */
+static int NlBatchCount(const struct genl_info *info) {
+    const struct nlattr *op_attr;
+    int rem, count = 0;
+
+    nlmsg_for_each_attr(op_attr, info->nlhdr, GENL_HDRLEN, rem) {
+        count += (nla_type(op_attr) == TINYFW_A_BATCH_OP);
+    }
+    if(rem != 0 || !info->attrs[TINYFW_A_COUNT] || nla_get_u32(info->attrs[TINYFW_A_COUNT]) != count) {
+        return -EINVAL;
+    }
+    return count;
+}
+
+/*
+ * 解析一个操作并按表长 *length 检查位置，与 NlApplyAttrs 的结果一致：
+ * 能通过检查的操作执行时不会失败。成功后 *length 为执行该操作后的表长。
+ */
+static int NlBatchParse(struct NlBatchOp *op, const struct nlattr *op_attr, unsigned int *length) {
+    struct nlattr *tb[TINYFW_A_MAX + 1];
+    struct RuleNode *rnode;
+
+    if(nla_parse_nested(tb, TINYFW_A_MAX, op_attr, g_nl_policy) != 0 || !tb[TINYFW_A_OP]) {
+        return -EINVAL;
+    }
+    op->op = nla_get_u8(tb[TINYFW_A_OP]);
+    op->pos = NlGetU32(tb[TINYFW_A_POS], 0);
+    switch(op->op) {
+        case TINYFW_CMD_ADD:
+            break;
+        case TINYFW_CMD_DEL:
+        case TINYFW_CMD_REPLACE:
+            if(op->pos < 1 || op->pos > *length) {
+                return -ENOENT;
+            }
+            break;
+        case TINYFW_CMD_MOVE:
+            if(!tb[TINYFW_A_TO]) {
+                return -EINVAL;
+            }
+            if(op->pos < 1 || op->pos > *length) {
+                return -ENOENT;
+            }
+            op->to = nla_get_u32(tb[TINYFW_A_TO]);
+            return 0;
+        default:
+            return -EOPNOTSUPP;
+    }
+    if(op->op == TINYFW_CMD_DEL) {
+        --*length;
+        return 0;
+    }
+    rnode = NlParseRule(tb[TINYFW_A_RULE]);
+    if(IS_ERR(rnode)) {
+        return PTR_ERR(rnode);
+    }
+    op->rnode = rnode;
+    *length += (op->op == TINYFW_CMD_ADD);
+    return 0;
+}
+
+/*
+ * 在当前规则表上原地执行宿主命名空间的批量事务（持有 g_rule_mutex，ClassifierCoversList 成立）。
+ * 先解析并检查全部操作，任一无效则规则表不变；随后依次执行，各修改记入分类器草稿，
+ * 由调用方提交为一个新版本。开销与操作数成正比，不复制规则表、不重新编译分类器。
+ */
+static int NlBatchInPlace(const struct genl_info *info, int count) {
+    struct NlBatchOp *ops;
+    const struct nlattr *op_attr;
+    unsigned int length = g_rule_list.length;
+    int rem, i = 0, iRet = 0;
+
+    ops = (struct NlBatchOp *)vzalloc(sizeof(*ops) * (count ? count : 1));
+    if(ops == NULL) {
+        return -ENOMEM;
+    }
+    nlmsg_for_each_attr(op_attr, info->nlhdr, GENL_HDRLEN, rem) {
+        if(nla_type(op_attr) != TINYFW_A_BATCH_OP) {
+            continue;
+        }
+        iRet = NlBatchParse(&ops[i++], op_attr, &length);
+        if(iRet != 0) {
+            break;
+        }
+    }
+    for(i = 0; i < count; ++i) {
+        if(iRet != 0) {
+            if(ops[i].rnode != NULL) {
+                RuleNodeFree(ops[i].rnode);
+            }
+            continue;
+        }
+        switch(ops[i].op) {
+            case TINYFW_CMD_ADD:
+                RuleListInsertAt(&g_rule_list, ops[i].pos, ops[i].rnode);
+                break;
+            case TINYFW_CMD_DEL:
+                RuleListDeleteAt(&g_rule_list, ops[i].pos);
+                break;
+            case TINYFW_CMD_REPLACE:
+                RuleListReplaceAt(&g_rule_list, ops[i].pos, ops[i].rnode);
+                break;
+            case TINYFW_CMD_MOVE:
+                RuleListMoveAt(&g_rule_list, ops[i].pos, ops[i].to);
+                break;
+        }
+        cond_resched();
+    }
+    vfree(ops);
+
+    return iRet;
+}
+
+/*
+ * 批量事务：按顺序执行全部 TINYFW_A_BATCH_OP（须给出 TINYFW_A_COUNT，见 NlBatchCount），
+ * 任一操作失败则整体放弃；全部成功后一次性发布为新版本。
+ * 宿主命名空间的读者只经分类器查找且操作数不超过 DIFF_MAX_EDITS 时原地执行（NlBatchInPlace），
+ * 否则在当前规则表的副本上执行后整体换入。
+ * 若给出 TINYFW_A_GENERATION 且与当前版本不符，返回 -EAGAIN；给出 TINYFW_A_DEFAULT 时一并修改默认规则。
+ */
+static int NlBatch(struct sk_buff *skb, struct genl_info *info) {
+    struct net *net = genl_info_net(info);
+    struct RuleList list, *cur;
+    struct nlattr *op_attr;
+    int rem, count, iRet = 0;
+
+    if(info->attrs[TINYFW_A_DEFAULT] && nla_get_u8(info->attrs[TINYFW_A_DEFAULT]) != RULE_PERMIT
+            && nla_get_u8(info->attrs[TINYFW_A_DEFAULT]) != RULE_REJECT) {
+        return -EINVAL;
+    }
+    count = NlBatchCount(info);
+    if(count < 0) {
+        return count;
+    }
+
+    mutex_lock(&g_rule_mutex);
+    cur = NetRuleList(net);
+    if(info->attrs[TINYFW_A_GENERATION]
+            && nla_get_u32(info->attrs[TINYFW_A_GENERATION]) != cur->generation) {
+        mutex_unlock(&g_rule_mutex);
+        return -EAGAIN;
+    }
+    if(NetIsHost(net) && count <= DIFF_MAX_EDITS && ClassifierCoversList()) {
+        iRet = NlBatchInPlace(info, count);
+        if(iRet == 0) {
+            if(info->attrs[TINYFW_A_DEFAULT]) {
+                g_rule_list.default_rule = nla_get_u8(info->attrs[TINYFW_A_DEFAULT]);
+            }
+            RuleListCommit();
+        }
+        mutex_unlock(&g_rule_mutex);
+        return iRet;
+    }
+    iRet = RuleListCopy(&list, cur);
+    if(iRet != 0) {
+        mutex_unlock(&g_rule_mutex);
+        return iRet;
+    }
+    nlmsg_for_each_attr(op_attr, info->nlhdr, GENL_HDRLEN, rem) {
+        if(nla_type(op_attr) != TINYFW_A_BATCH_OP) {
+            continue;
+        }
+        iRet = NlApplyOp(&list, op_attr);
+        if(iRet != 0) {
+            break;
+        }
+        cond_resched();
+    }
+    if(iRet == 0 && info->attrs[TINYFW_A_DEFAULT]) {
+        list.default_rule = nla_get_u8(info->attrs[TINYFW_A_DEFAULT]);
+    }
+    if(iRet == 0 && NetIsHost(net)) {
+        RuleListSwap(&list);
+        RuleListCommit();
+    }
+    else {
+        if(iRet == 0) {
+            iRet = NetRulesPublish(net, &list);
+        }
+        RuleListFree(&list);
+    }
+    mutex_unlock(&g_rule_mutex);
+
+    return iRet;
+}
+
+/*
+ * 分页导出规则。cb->args[0] 为已导出条数，cb->args[1] 为下一条待导出的节点，
+ * cb->args[2] 为上一页时的版本号（+1，避免与初值0混淆），cb->args[3] 为结束标记。
+ * 版本号未变时节点指针仍然有效，直接续传，每页开销与页大小成正比；
+ * 版本号变化时从头定位并由 NLM_F_DUMP_INTR 通知用户态重试。
+ */
+static int NlRuleDump(struct sk_buff *skb, struct netlink_callback *cb) {
+    const struct RuleList *list;
+    struct RuleNode *cur;
+    unsigned long pos = cb->args[0];
+    unsigned long i;
+    void *hdr;
+
+    if(cb->args[3]) {
+        return 0;
+    }
+
+    mutex_lock(&g_rule_mutex);
+    list = NetRuleList(sock_net(cb->skb->sk));
+    cb->seq = list->generation + 1;
+    if(cb->args[2] == cb->seq && cb->args[1] != 0) {
+        cur = (struct RuleNode *)cb->args[1];
+    }
+    else {
+        for(i = 0, cur = list->head; cur != NULL && i < pos; ++i, cur = cur->next) {
+            ; //empty
+        }
+    }
+
+    for(; cur != NULL; cur = cur->next, ++pos) {
+        hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+                          &g_nl_family, NLM_F_MULTI, TINYFW_CMD_DUMP);
+        if(hdr == NULL) {
+            break;
+        }
+        genl_dump_check_consistent(cb, hdr, &g_nl_family);
+        if(nla_put_u32(skb, TINYFW_A_POS, pos + 1)
+                || nla_put_u32(skb, TINYFW_A_GENERATION, list->generation)
+                || NlPutRule(skb, cur) != 0) {
+            genlmsg_cancel(skb, hdr);
+            break;
+        }
+        genlmsg_end(skb, hdr);
+    }
+
+    cb->args[0] = pos;
+    cb->args[1] = (unsigned long)cur;
+    cb->args[2] = cb->seq;
+    cb->args[3] = (cur == NULL);
+    mutex_unlock(&g_rule_mutex);
+
+    return skb->len;
+}
+
+static int NlPutSummary(struct sk_buff *msg, const struct RuleList *list) {
+    return nla_put_u32(msg, TINYFW_A_GENERATION, list->generation)
+        || nla_put_u32(msg, TINYFW_A_COUNT, list->length)
+        || nla_put_u8(msg, TINYFW_A_DEFAULT, list->default_rule);
+}
+
+/* 调用者所在命名空间的规则集概要、报文计数、分类器与内存 */
+static int NlGetStats(struct sk_buff *skb, struct genl_info *info) {
+    struct net *net = genl_info_net(info);
+    struct sk_buff *msg;
+    struct nlattr *nest;
+    struct FilterStat stat;
+    struct ClsStat cstat;
+    void *hdr;
+    int iRet;
+
+    msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+    if(msg == NULL) {
+        return -ENOMEM;
+    }
+    hdr = genlmsg_put(msg, info->snd_portid, info->snd_seq, &g_nl_family, 0, TINYFW_CMD_GET_STATS);
+    if(hdr == NULL) {
+        nlmsg_free(msg);
+        return -EMSGSIZE;
+    }
+
+    NetGetStat(net, &stat);
+    mutex_lock(&g_rule_mutex);
+    iRet = NlPutSummary(msg, NetRuleList(net));
+    mutex_unlock(&g_rule_mutex);
+    if(iRet == 0) {
+        iRet = nla_put_u8(msg, TINYFW_A_NETNS, !NetIsHost(net))
+            || nla_put_u64(msg, TINYFW_A_MEM_BYTES, NetMemBytes(net));
+    }
+    nest = nla_nest_start(msg, TINYFW_A_STATS);
+    if(iRet != 0 || nest == NULL
+            || nla_put_u64(msg, TINYFW_SA_PACKETS, stat.packets)
+            || nla_put_u64(msg, TINYFW_SA_ACCEPTED, stat.accepted)
+            || nla_put_u64(msg, TINYFW_SA_DROPPED, stat.dropped)
+            || nla_put_u64(msg, TINYFW_SA_RULE_HITS, stat.rule_hits)
+            || nla_put_u64(msg, TINYFW_SA_DEFAULT_HITS, stat.default_hits)
+            || nla_put_u64(msg, TINYFW_SA_BANNED, stat.banned)
+            || nla_put_u64(msg, TINYFW_SA_PREFILTER_BYPASS, stat.prefilter_bypass)
+            || nla_put_u64(msg, TINYFW_SA_PREFILTER_FP, stat.prefilter_fp)
+            || nla_put_u64(msg, TINYFW_SA_QUEUED, stat.queued)
+            || nla_put_u64(msg, TINYFW_SA_REPLIES, stat.replies)
+            || nla_put_u64(msg, TINYFW_SA_REPLY_DROPS, stat.reply_drops)) {
+        nlmsg_free(msg);
+        return -EMSGSIZE;
+    }
+    nla_nest_end(msg, nest);
+
+    NetClsStat(net, &cstat);
+    nest = nla_nest_start(msg, TINYFW_A_CLS_STATS);
+    if(nest == NULL
+            || nla_put_u64(msg, TINYFW_CA_VERSION, cstat.version)
+            || nla_put_u64(msg, TINYFW_CA_ENTRIES, cstat.entries)
+            || nla_put_u64(msg, TINYFW_CA_CHUNKS, cstat.chunks)
+            || nla_put_u64(msg, TINYFW_CA_SLOTS, cstat.slots)
+            || nla_put_u64(msg, TINYFW_CA_BYTES, cstat.bytes)
+            || nla_put_u64(msg, TINYFW_CA_INCREMENTAL, cstat.incremental)
+            || nla_put_u64(msg, TINYFW_CA_REBUILDS, cstat.rebuilds)
+            || nla_put_u64(msg, TINYFW_CA_COMPACTIONS, cstat.compactions)
+            || nla_put_u64(msg, TINYFW_CA_CHUNKS_COPIED, cstat.chunks_copied)
+            || nla_put_u64(msg, TINYFW_CA_ENGINE, cstat.engine)
+            || nla_put_u64(msg, TINYFW_CA_ENGINE_MODE, cstat.engine_mode)
+            || nla_put_u64(msg, TINYFW_CA_ENGINE_BYTES, cstat.engine_bytes)
+            || nla_put_u64(msg, TINYFW_CA_ENGINE_SWITCHES, cstat.engine_switches)
+            || nla_put_u64(msg, TINYFW_CA_SHAPES, cstat.shapes)
+            || nla_put_u64(msg, TINYFW_CA_REACH, cstat.reach)
+            || nla_put_u64(msg, TINYFW_CA_WILDCARD_RULES, cstat.wildcard_rules)
+            || nla_put_u64(msg, TINYFW_CA_PORT_RULES, cstat.port_rules)
+            || nla_put_u64(msg, TINYFW_CA_PREFILTER_KEYS, cstat.prefilter_keys)
+            || nla_put_u64(msg, TINYFW_CA_PREFILTER_STALE, cstat.prefilter_stale)
+            || nla_put_u64(msg, TINYFW_CA_PREFILTER_BYTES, cstat.prefilter_bytes)
+            || nla_put_u64(msg, TINYFW_CA_PREFILTER_PROTOS, cstat.prefilter_protos)
+            || nla_put_u64(msg, TINYFW_CA_PREFILTER_OPEN, cstat.prefilter_open)
+            || nla_put_u64(msg, TINYFW_CA_PREFILTER_REBUILDS, cstat.prefilter_rebuilds)) {
+        nlmsg_free(msg);
+        return -EMSGSIZE;
+    }
+    nla_nest_end(msg, nest);
+    genlmsg_end(msg, hdr);
+
+    return genlmsg_reply(msg, info);
+}
+
+static int NlPutOptimizeReport(struct sk_buff *msg, const struct OptimizeReport *report) {
+    return nla_put_u32(msg, TINYFW_A_GENERATION, report->generation)
+        || nla_put_u32(msg, TINYFW_A_COUNT, report->rule_count)
+        || nla_put_u32(msg, TINYFW_A_MOVED, report->moved)
+        || nla_put_u8(msg, TINYFW_A_APPLIED, report->applied)
+        || nla_put_u64(msg, TINYFW_A_COST_BEFORE, report->cost_before)
+        || nla_put_u64(msg, TINYFW_A_COST_AFTER, report->cost_after);
+}
+
+static int NlOptimize(struct sk_buff *skb, struct genl_info *info) {
+    struct OptimizeReport report;
+    struct sk_buff *msg;
+    void *hdr;
+    int iRet;
+
+    if(!NetIsHost(genl_info_net(info))) {
+        return -EOPNOTSUPP;     //hit counts of the host rule set only
+    }
+    iRet = RuleOptimize(info->attrs[TINYFW_A_DRY_RUN] != NULL, &report);
+    if(iRet != 0) {
+        return iRet;
+    }
+
+    msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+    if(msg == NULL) {
+        return -ENOMEM;
+    }
+    hdr = genlmsg_put(msg, info->snd_portid, info->snd_seq, &g_nl_family, 0, TINYFW_CMD_OPTIMIZE);
+    if(hdr == NULL || NlPutOptimizeReport(msg, &report) != 0) {
+        nlmsg_free(msg);
+        return -EMSGSIZE;
+    }
+    genlmsg_end(msg, hdr);
+
+    return genlmsg_reply(msg, info);
+}
+
+static const struct genl_ops g_nl_ops[] = {
+    {
+        .cmd = TINYFW_CMD_ADD,
+        .flags = GENL_ADMIN_PERM,
+        .policy = g_nl_policy,
+        .doit = NlRuleAdd,
+    },
+    {
+        .cmd = TINYFW_CMD_DEL,
+        .flags = GENL_ADMIN_PERM,
+        .policy = g_nl_policy,
+        .doit = NlRuleDel,
+    },
+    {
+        .cmd = TINYFW_CMD_REPLACE,
+        .flags = GENL_ADMIN_PERM,
+        .policy = g_nl_policy,
+        .doit = NlRuleReplace,
+    },
+    {
+        .cmd = TINYFW_CMD_BATCH,
+        .flags = GENL_ADMIN_PERM,
+        .policy = g_nl_policy,
+        .doit = NlBatch,
+    },
+    {
+        .cmd = TINYFW_CMD_DUMP,
+        .policy = g_nl_policy,
+        .dumpit = NlRuleDump,
+    },
+    {
+        .cmd = TINYFW_CMD_GET_STATS,
+        .policy = g_nl_policy,
+        .doit = NlGetStats,
+    },
+    {
+        .cmd = TINYFW_CMD_OPTIMIZE,
+        .flags = GENL_ADMIN_PERM,
+        .policy = g_nl_policy,
+        .doit = NlOptimize,
+    },
+};
+
+static const struct genl_multicast_group g_nl_mcgrps[] = {
+    { .name = TINYFW_GENL_MCGRP, },
+};
+
+static struct genl_family g_nl_family = {
+    .id = GENL_ID_GENERATE,
+    .hdrsize = 0,
+    .name = TINYFW_GENL_NAME,
+    .version = TINYFW_GENL_VERSION,
+    .maxattr = TINYFW_A_MAX,
+    .netnsok = true,        //各命名空间操作自己的规则集
+    .parallel_ops = true,   //并发由 g_rule_mutex 控制，不占用全局 genl_mutex
+};
+
+/*
+ * 构造一条多播事件消息，填充属性后交给 NlEventSend 发送。
+ * 通道未注册或内存不足时返回NULL。
+ */
+struct sk_buff *NlEventNew(unsigned char cmd, void **hdr) {
+    struct sk_buff *msg;
+
+    if(!g_nl_registered) {
+        return NULL;
+    }
+    msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+    if(msg == NULL) {
+        return NULL;
+    }
+    *hdr = genlmsg_put(msg, 0, 0, &g_nl_family, 0, cmd);
+    if(*hdr == NULL) {
+        nlmsg_free(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+void NlEventSend(struct sk_buff *msg, void *hdr) {
+    genlmsg_end(msg, hdr);
+    genlmsg_multicast(&g_nl_family, msg, 0, 0, GFP_KERNEL); //no listener is fine
+}
+
+/* 规则集版本变化通知，调用方持有 g_rule_mutex */
+void NlNotifyGeneration(unsigned int generation) {
+    NlNotifyNetGeneration(&init_net, &g_rule_list);
+}
+
+/* 命名空间 net 的规则集 list 版本变化，只通知该命名空间的订阅者；调用方持有 g_rule_mutex */
+void NlNotifyNetGeneration(struct net *net, const struct RuleList *list) {
+    struct sk_buff *msg;
+    void *hdr;
+
+    msg = NlEventNew(TINYFW_CMD_EVT_GENERATION, &hdr);
+    if(msg == NULL) {
+        return;
+    }
+    if(NlPutSummary(msg, list) != 0) {
+        nlmsg_free(msg);
+        return;
+    }
+    genlmsg_end(msg, hdr);
+    genlmsg_multicast_netns(&g_nl_family, net, msg, 0, 0, GFP_KERNEL); //no listener is fine
+}
+
+/* 后台优化器发布了新顺序 */
+void NlNotifyOptimized(const struct OptimizeReport *report) {
+    struct sk_buff *msg;
+    void *hdr;
+
+    msg = NlEventNew(TINYFW_CMD_EVT_OPTIMIZED, &hdr);
+    if(msg == NULL) {
+        return;
+    }
+    if(NlPutOptimizeReport(msg, report) != 0) {
+        nlmsg_free(msg);
+        return;
+    }
+    NlEventSend(msg, hdr);
+}
+
+static void NlThresholdWork(struct work_struct *work) {
+    struct FilterStat stat;
+    unsigned long long rate;
+    struct sk_buff *msg;
+    void *hdr;
+
+    FilterGetStat(&stat);
+    rate = stat.dropped - g_last_dropped;
+    g_last_dropped = stat.dropped;
+
+    if(drop_alert_pps != 0 && rate >= drop_alert_pps) {
+        msg = NlEventNew(TINYFW_CMD_EVT_THRESHOLD, &hdr);
+        if(msg != NULL) {
+            if(nla_put_u64(msg, TINYFW_A_RATE, rate)
+                    || nla_put_u32(msg, TINYFW_A_THRESHOLD, drop_alert_pps)) {
+                nlmsg_free(msg);
+            }
+            else {
+                NlEventSend(msg, hdr);
+            }
+        }
+    }
+
+    schedule_delayed_work(&g_threshold_work, HZ);
+}
+
+int NlInit(void) {
+    int iRet;
+
+    iRet = genl_register_family_with_ops_groups(&g_nl_family, g_nl_ops, g_nl_mcgrps);
+    if(iRet != 0) {
+        printk("genl register FAILED!\n");
+        return iRet;
+    }
+    g_nl_registered = 1;
+    schedule_delayed_work(&g_threshold_work, HZ);
+
+    printk("genl family %s regist SUCCEED!\n", TINYFW_GENL_NAME);
+    return 0;
+}
+
+void NlExit(void) {
+    cancel_delayed_work_sync(&g_threshold_work);
+    g_nl_registered = 0;
+    genl_unregister_family(&g_nl_family);
+}
@@ -0,0 +1,19 @@
+#ifndef NL_INTERFACE_H
+#define NL_INTERFACE_H
+
+#include <linux/skbuff.h>
+
+#include "../common.h"
+
+int NlInit(void);
+void NlExit(void);
+void NlNotifyGeneration(unsigned int generation);
+struct net;
+struct RuleList;
+void NlNotifyNetGeneration(struct net *net, const struct RuleList *list);
+struct sk_buff *NlEventNew(unsigned char cmd, void **hdr);
+void NlEventSend(struct sk_buff *msg, void *hdr);
+struct OptimizeReport;
+void NlNotifyOptimized(const struct OptimizeReport *report);
+
+#endif
@@ -0,0 +1,91 @@
+// FileName: myNetfilter_kernel/reject.c
+// Describe: 'F' 规则的应答：TCP 回 RST，UDP 回 ICMP 端口不可达，ICMP 回 ICMP 管理性禁止
+// Note: 应答在 hook 中同步发出，原报文随后丢弃，被拒绝的一方立即失败而不是等待超时。
+//       每个 CPU 一个令牌桶限制应答速率，超出部分只丢弃不应答：伪造源地址的洪泛不会被
+//       变成发往第三方的应答流。PRE_ROUTING 时报文还没有路由，先按接收路径查一次。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/jiffies.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/icmp.h>
+#include <net/icmp.h>
+#include <net/route.h>
+#include <net/netfilter/ipv4/nf_reject.h>
+
+#include "../common.h"
+#include "reject.h"
+
+static unsigned int reject_pps = 100;
+module_param(reject_pps, uint, 0644);
+MODULE_PARM_DESC(reject_pps, "replies per second per cpu for 'F' rules, 0 drops without reply");
+
+struct RejectBucket {
+    unsigned long stamp;        //jiffies of the last refill
+    unsigned int tokens;
+};
+
+static DEFINE_PER_CPU(struct RejectBucket, g_reject_bucket);
+
+/* 取一个令牌，桶容量为一秒的配额。hook 在软中断中运行，不会被同一 CPU 上的其他报文打断 */
+static int RejectAllow(void) {
+    struct RejectBucket *bucket = this_cpu_ptr(&g_reject_bucket);
+    unsigned int rate = ACCESS_ONCE(reject_pps);
+    unsigned long now = jiffies, refill;
+
+    if(rate == 0) {
+        return 0;
+    }
+    if(time_after_eq(now, bucket->stamp + HZ)) {
+        bucket->tokens = rate;
+        bucket->stamp = now;
+    }
+    else {
+        refill = (now - bucket->stamp) * rate / HZ;
+        if(refill != 0) {
+            bucket->tokens = min_t(unsigned long, bucket->tokens + refill, rate);
+            bucket->stamp += refill * HZ / rate;
+        }
+    }
+    if(bucket->tokens == 0) {
+        return 0;
+    }
+    --bucket->tokens;
+    return 1;
+}
+
+/*
+ * 为被 'F' 规则丢弃的报文发送应答，type 为 hook 解析出的协议。
+ * 返回1表示已交给协议栈发送；超出速率、对方发来的就是 RST 或找不到路由时返回0。
+ * 广播、多播与 ICMP 差错报文由 icmp_send / nf_send_reset 自行忽略。
+ */
+int RejectReply(struct sk_buff *skb, unsigned int hook, enum PackageType type) {
+    const struct iphdr *iph = ip_hdr(skb);
+
+    if(type == PACKAGE_TYPE_TCP && tcp_hdr(skb)->rst) {
+        return 0;
+    }
+    //icmp_send 与 nf_send_reset 都依赖原报文的路由
+    if(skb_dst(skb) == NULL
+            && ip_route_input_noref(skb, iph->daddr, iph->saddr, iph->tos, skb->dev) != 0) {
+        return 0;
+    }
+    if(!RejectAllow()) {
+        return 0;
+    }
+
+    switch(type) {
+        case PACKAGE_TYPE_TCP:
+            nf_send_reset(skb, hook);
+            break;
+        case PACKAGE_TYPE_UDP:
+            icmp_send(skb, ICMP_DEST_UNREACH, ICMP_PORT_UNREACH, 0);
+            break;
+        default:
+            icmp_send(skb, ICMP_DEST_UNREACH, ICMP_PKT_FILTERED, 0);
+            break;
+    }
+    return 1;
+}
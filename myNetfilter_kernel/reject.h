@@ -0,0 +1,10 @@
+#ifndef REJECT_H
+#define REJECT_H
+
+#include <linux/skbuff.h>
+
+#include "../common.h"
+
+int RejectReply(struct sk_buff *skb, unsigned int hook, enum PackageType type);
+
+#endif
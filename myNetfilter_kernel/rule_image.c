@@ -0,0 +1,334 @@
+// FileName: myNetfilter_kernel/rule_image.c 
+// Describe: 加载 'tinyfw_nf compile' 生成的预编译规则集镜像
+// Note: 镜像中规则已解析、分类器表已构建，加载时只做 CRC、范围与一致性检查，表项直接采用，
+//       使模块在注册 hook 之前即按规则集过滤。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/crc32.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+
+#include "../common.h"
+#include "rule_image.h"
+#include "rule_list_manage.h"
+#include "classifier.h"
+
+/*
+ * rule_image 为镜像文件路径，为空时不加载（与原来一样以空表、默认允许启动）。
+ * rule_image_fail_closed 为真时镜像读取或校验失败按"默认拒绝、空规则表"强制过滤，
+ * 否则模块加载失败。
+ */
+static char *rule_image = "";
+module_param(rule_image, charp, 0444);
+MODULE_PARM_DESC(rule_image, "precompiled rule set image loaded at init");
+static bool rule_image_fail_closed = true;
+module_param(rule_image_fail_closed, bool, 0444);
+MODULE_PARM_DESC(rule_image_fail_closed, "reject everything if the rule image cannot be loaded");
+
+#define RULE_IMAGE_MAX_SIZE (512UL << 20)
+
+extern struct RuleList g_rule_list;
+
+//[offset, offset + count * size) 在镜像内且4字节对齐
+static int RuleImageRange(unsigned int offset, unsigned int count, unsigned int size, size_t len) {
+    return (offset & 3) == 0 && (u64)offset + (u64)count * size <= len;
+}
+
+static int RuleImageCheckHeader(const struct RuleImageHeader *hdr, size_t len) {
+    struct RuleImageHeader temp;
+    u32 crc;
+    int p;
+
+    if(len < sizeof(*hdr) || hdr->magic != RULE_IMAGE_MAGIC) {
+        printk("rule image: bad magic\n");
+        return -EINVAL;
+    }
+    if(hdr->version != RULE_IMAGE_VERSION || hdr->header_size != sizeof(*hdr)
+            || hdr->entry_size != sizeof(struct ClsEntry)) {
+        printk("rule image: unsupported version %u\n", hdr->version);
+        return -EINVAL;
+    }
+    if(hdr->total_size != len || hdr->default_rule > RULE_REJECT) {
+        printk("rule image: bad size or default rule\n");
+        return -EINVAL;
+    }
+
+    temp = *hdr;
+    temp.crc = 0;
+    crc = crc32_le(~0, (const unsigned char *)&temp, sizeof(temp));
+    crc = crc32_le(crc, (const unsigned char *)hdr + sizeof(*hdr), len - sizeof(*hdr));
+    if((crc ^ ~0) != hdr->crc) {
+        printk("rule image: crc mismatch\n");
+        return -EBADMSG;
+    }
+
+    if(!RuleImageRange(hdr->rule_offset, hdr->rule_count, sizeof(struct RuleSpec), len)) {
+        return -EINVAL;
+    }
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        if(hdr->table_count[p] > hdr->rule_count
+                || !RuleImageRange(hdr->table_offset[p], hdr->table_count[p], sizeof(struct ClsEntry), len)) {
+            printk("rule image: bad classifier table %d\n", p);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * 检查预编译的分类器表与规则一致并追加到 cls，表项直接采用，不重新编译：
+ * 每张表的表项按规则顺序排列（序号严格递增），恰好是适用于该协议的全部规则，动作与规则相同。
+ * 表项的编译结果由镜像 CRC 与 'tinyfw_nf compile' 保证。
+ * 镜像中的 id 是规则在文件中的序号，装入时换成节点分配到的规则编号。
+ */
+static int RuleImageCheckTables(const struct RuleImageHeader *hdr, struct RuleNode **nodes,
+                                struct Classifier *cls) {
+    const struct ClsEntry *table;
+    struct ClsEntry entry;
+    unsigned int id, k, members;
+    int p;
+
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        table = (const struct ClsEntry *)((const char *)hdr + hdr->table_offset[p]);
+        for(k = 0; k < hdr->table_count[p]; ++k) {
+            id = table[k].id;
+            if(id >= hdr->rule_count || (k != 0 && id <= table[k - 1].id)
+                    || !ClsRuleInProto(nodes[id], p) || table[k].action != nodes[id]->rule) {
+                printk("rule image: classifier table %d inconsistent at entry %u\n", p, k + 1);
+                return -EINVAL;
+            }
+            entry = table[k];
+            entry.id = nodes[id]->id;
+            if(ClassifierAppend(cls, p, &entry, nodes[id]) != 0) {
+                return -ENOMEM;
+            }
+        }
+        //ids are increasing and each one applies to p: the table misses a rule iff it is short
+        for(id = 0, members = 0; id < hdr->rule_count; ++id) {
+            members += ClsRuleInProto(nodes[id], p);
+        }
+        if(members != hdr->table_count[p]) {
+            printk("rule image: classifier table %d has %u entries, %u rules apply\n",
+                   p, hdr->table_count[p], members);
+            return -EINVAL;
+        }
+        cond_resched();
+    }
+
+    return 0;
+}
+
+/*
+ * 校验内存中的镜像，构造私有规则表 list 和对应的分类器 *o_cls，不改变当前规则。
+ * live 为0时（影子规则集）规则编号取规则在表中的位置（从1开始），否则分配新编号。
+ * 成功返回0，失败返回负的错误码。
+ */
+int RuleImageBuild(const void *image, size_t len, int live, struct RuleList *list,
+                   struct Classifier **o_cls) {
+    const struct RuleImageHeader *hdr = (const struct RuleImageHeader *)image;
+    const struct RuleSpec *specs;
+    struct RuleNode **nodes = NULL;
+    struct Classifier *cls = NULL;
+    unsigned int i;
+    int iRet;
+
+    memset(list, 0, sizeof(*list));
+    iRet = RuleImageCheckHeader(hdr, len);
+    if(iRet != 0) {
+        return iRet;
+    }
+
+    list->default_rule = hdr->default_rule;
+    if(hdr->rule_count != 0) {
+        nodes = (struct RuleNode **)vmalloc(sizeof(struct RuleNode *) * hdr->rule_count);
+        if(nodes == NULL) {
+            return -ENOMEM;
+        }
+    }
+    specs = (const struct RuleSpec *)((const char *)image + hdr->rule_offset);
+    for(i = 0; i < hdr->rule_count; ++i) {
+        nodes[i] = RuleFromSpec(&specs[i]);
+        if(nodes[i] == NULL && RuleNodeFull()) {
+            printk("rule image: rule_max reached at rule %u\n", i + 1);
+            iRet = -ENOSPC;
+            goto fail;
+        }
+        if(nodes[i] == NULL) {
+            printk("rule image: invalid rule %u\n", i + 1);
+            iRet = -EINVAL;
+            goto fail;
+        }
+        if(live) {
+            RuleListAssignId(nodes[i]);
+        }
+        else {
+            nodes[i]->id = i + 1;
+        }
+        if(list->tail == NULL) {
+            list->head = nodes[i];
+        }
+        else {
+            list->tail->next = nodes[i];
+        }
+        list->tail = nodes[i];
+        ++list->length;
+        if((i & 0xffff) == 0xffff) {
+            cond_resched();
+        }
+    }
+
+    cls = ClassifierNew();
+    if(cls == NULL) {
+        iRet = -ENOMEM;
+        goto fail;
+    }
+    iRet = RuleImageCheckTables(hdr, nodes, cls);
+    if(iRet != 0) {
+        goto fail;
+    }
+    cls->rule_count = hdr->rule_count;
+    cls->default_rule = hdr->default_rule;
+    vfree(nodes);
+    *o_cls = cls;
+
+    return 0;
+
+fail:
+    ClassifierFree(cls);
+    RuleListFree(list);
+    vfree(nodes);
+    return iRet;
+}
+
+/*
+ * 校验并安装内存中的镜像，整体替换当前规则表和默认规则。
+ * 成功返回0，失败返回负的错误码且不改变当前规则。
+ */
+int RuleImageInstall(const void *image, size_t len) {
+    struct RuleList list;
+    struct Classifier *cls;
+    unsigned int count;
+    int iRet;
+
+    iRet = RuleImageBuild(image, len, 1, &list, &cls);
+    if(iRet != 0) {
+        return iRet;
+    }
+    count = list.length;
+
+    mutex_lock(&g_rule_mutex);
+    RuleListSwap(&list);
+    RuleListCommitClassifier(cls);
+    mutex_unlock(&g_rule_mutex);
+
+    printk("rule image: %u rules installed\n", count);
+    return 0;
+}
+
+/* 读取镜像文件并安装 */
+int RuleImageLoadFile(const char *path) {
+    struct file *filp;
+    loff_t size, pos;
+    char *buf;
+    int iRet;
+
+    filp = filp_open(path, O_RDONLY, 0);
+    if(IS_ERR(filp)) {
+        printk("rule image: open %s FAILED!\n", path);
+        return PTR_ERR(filp);
+    }
+    size = i_size_read(file_inode(filp));
+    if(size <= 0 || size > RULE_IMAGE_MAX_SIZE) {
+        filp_close(filp, NULL);
+        return -EFBIG;
+    }
+    buf = (char *)vmalloc(size);
+    if(buf == NULL) {
+        filp_close(filp, NULL);
+        return -ENOMEM;
+    }
+    for(pos = 0; pos < size; pos += iRet) {
+        iRet = kernel_read(filp, pos, buf + pos, size - pos);
+        if(iRet <= 0) {
+            printk("rule image: read %s FAILED!\n", path);
+            vfree(buf);
+            filp_close(filp, NULL);
+            return iRet < 0 ? iRet : -EIO;
+        }
+    }
+    filp_close(filp, NULL);
+
+    iRet = RuleImageInstall(buf, size);
+    vfree(buf);
+
+    return iRet;
+}
+
+/* 把用户态传入的镜像复制到 vmalloc 缓冲区，由调用方 vfree，失败返回 ERR_PTR */
+void *RuleImageFromUser(const void __user *data, size_t size) {
+    char *buf;
+
+    if(size == 0 || size > RULE_IMAGE_MAX_SIZE) {
+        return ERR_PTR(-EFBIG);
+    }
+    buf = (char *)vmalloc(size);
+    if(buf == NULL) {
+        return ERR_PTR(-ENOMEM);
+    }
+    if(copy_from_user(buf, data, size) != 0) {
+        vfree(buf);
+        return ERR_PTR(-EFAULT);
+    }
+
+    return buf;
+}
+
+/* 安装用户态传入的镜像（ioctl IO_CTRL_IMAGE） */
+int RuleImageLoadUser(const void __user *data, size_t size) {
+    char *buf;
+    int iRet;
+
+    buf = (char *)RuleImageFromUser(data, size);
+    if(IS_ERR(buf)) {
+        return PTR_ERR(buf);
+    }
+    iRet = RuleImageInstall(buf, size);
+    vfree(buf);
+
+    return iRet;
+}
+
+/*
+ * 模块初始化时调用（hook 注册之前）。
+ * 返回0：未配置镜像；1：已安装镜像或按 fail-closed 进入拒绝模式，调用方应立即启用过滤；
+ * 负数：加载失败且未设置 fail-closed，模块加载应失败。
+ */
+int RuleImageInit(void) {
+    int iRet;
+
+    if(rule_image == NULL || rule_image[0] == '\0') {
+        return 0;
+    }
+    iRet = RuleImageLoadFile(rule_image);
+    if(iRet == 0) {
+        return 1;
+    }
+
+    printk("load rule image %s FAILED! (%d)\n", rule_image, iRet);
+    if(!rule_image_fail_closed) {
+        return iRet;
+    }
+    mutex_lock(&g_rule_mutex);
+    RuleListCleanup();
+    g_rule_list.default_rule = RULE_REJECT;
+    RuleListCommit();
+    mutex_unlock(&g_rule_mutex);
+    printk("rule image: fail closed, rejecting all packets\n");
+
+    return 1;
+}
@@ -0,0 +1,17 @@
+#ifndef RULE_IMAGE_H
+#define RULE_IMAGE_H
+
+#include <linux/types.h>
+
+struct RuleList;
+struct Classifier;
+
+int RuleImageInit(void);
+int RuleImageBuild(const void *image, size_t len, int live, struct RuleList *list,
+                   struct Classifier **o_cls);
+int RuleImageInstall(const void *image, size_t len);
+int RuleImageLoadFile(const char *path);
+void *RuleImageFromUser(const void __user *data, size_t size);
+int RuleImageLoadUser(const void __user *data, size_t size);
+
+#endif
@@ -2,76 +2,503 @@
 // Describe: 管理（增、删、查、改）规则列表
 // Note: 代码基于LWFW。代码用于《网络安全课程设计
 
+#include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
 
 #include "../common.h"
 #include "rule_list_manage.h"
+#include "nl_interface.h"
+#include "classifier.h"
 
+/*
+ * 规则表由 g_rule_mutex 保护写操作（ioctl、netlink 均可能并发修改）；
+ * hook 函数在 RCU 读临界区内使用编译后的分类器（或无锁遍历链表），
+ * 分类器直接引用规则节点，所以摘除的节点先挂到 garbage，
+ * 待 RuleListCommit 发布新分类器后再经 RCU 宽限期释放。
+ */
 struct RuleList g_rule_list; 
+DEFINE_MUTEX(g_rule_mutex);
+static atomic_t g_rule_id = ATOMIC_INIT(0);
+
+/*
+ * 规则节点由专用 kmem_cache 分配并计数。rule_max 限制同时存在的节点数
+ * （包括批量事务、优化器的私有副本），达到上限时分配失败，安装以 -ENOSPC 返回。
+ */
+static unsigned int rule_max = 1 << 22;
+module_param(rule_max, uint, 0644);
+MODULE_PARM_DESC(rule_max, "max rule nodes incl. private copies of transactions, 0 for no limit");
+
+static struct kmem_cache *g_rule_cache = NULL;
+static atomic_long_t g_rule_nodes = ATOMIC_LONG_INIT(0);
 
-void RuleListInit(void) {
+struct RuleNode *RuleNodeAlloc(void) {
+    struct RuleNode *rnode;
+
+    if(atomic_long_inc_return(&g_rule_nodes) > rule_max && rule_max != 0) {
+        atomic_long_dec(&g_rule_nodes);
+        return NULL;
+    }
+    rnode = (struct RuleNode *)kmem_cache_zalloc(g_rule_cache, GFP_KERNEL);
+    if(rnode == NULL) {
+        atomic_long_dec(&g_rule_nodes);
+    }
+
+    return rnode;
+}
+
+void RuleNodeFree(struct RuleNode *rnode) {
+    kmem_cache_free(g_rule_cache, rnode);
+    atomic_long_dec(&g_rule_nodes);
+}
+
+/* 分配失败是否因为达到 rule_max */
+int RuleNodeFull(void) {
+    return rule_max != 0 && atomic_long_read(&g_rule_nodes) >= rule_max;
+}
+
+void RuleNodeGetMem(struct MemStat *stat) {
+    stat->rule_nodes = atomic_long_read(&g_rule_nodes);
+    stat->rule_bytes = stat->rule_nodes * kmem_cache_size(g_rule_cache);
+    stat->rule_max = rule_max;
+}
+
+static void RuleFreeRcu(struct rcu_head *head) {
+    RuleNodeFree(container_of(head, struct RuleNode, rcu));
+}
+
+static void RuleFree(struct RuleList *list, struct RuleNode *rnode) {
+    if(list == &g_rule_list) {
+        rnode->gc_next = list->garbage;
+        list->garbage = rnode;
+    }
+    else { //private list, no reader can see it
+        RuleNodeFree(rnode);
+    }
+}
+
+static void RuleChainFree(struct RuleNode *head) {
+    struct RuleNode *temp;
+
+    for(temp = head; temp != NULL; temp = head) {
+        head = temp->next;
+        RuleNodeFree(temp);
+    }
+}
+
+//整条链转入 garbage
+static void RuleChainRetire(struct RuleNode *head) {
+    struct RuleNode *cur;
+
+    for(cur = head; cur != NULL; cur = cur->next) {
+        cur->gc_next = g_rule_list.garbage;
+        g_rule_list.garbage = cur;
+    }
+}
+
+//释放 garbage 中的节点，必须在不再引用它们的分类器发布之后调用
+static void RuleListReclaim(void) {
+    struct RuleNode *cur;
+
+    while((cur = g_rule_list.garbage) != NULL) {
+        g_rule_list.garbage = cur->gc_next;
+        call_rcu(&cur->rcu, RuleFreeRcu);
+    }
+}
+
+int RuleListInit(void) {
+    g_rule_cache = kmem_cache_create("myfw_rule", sizeof(struct RuleNode), 0, 0, NULL);
+    if(g_rule_cache == NULL) {
+        return -ENOMEM;
+    }
     g_rule_list.head = NULL;
     g_rule_list.tail = NULL;
+    g_rule_list.garbage = NULL;
     g_rule_list.length = 0;
     g_rule_list.default_rule = RULE_PERMIT;
+
+    return 0;
 }
 
+/* 清空规则表（保留默认规则），节点在下次提交后释放 */
 void RuleListCleanup(void) {
-    struct RuleNode *temp;
-    for(temp = g_rule_list.head; temp != NULL; temp = g_rule_list.head) {
-        g_rule_list.head = temp->next;
-        kfree(temp);
-    } 
-    RuleListInit();
+    struct RuleNode *old_head = g_rule_list.head;
+
+    ClassifierNoteRebuild();
+    rcu_assign_pointer(g_rule_list.head, NULL);
+    RuleChainRetire(old_head);
+    g_rule_list.tail = NULL;
+    g_rule_list.length = 0;
+}
+
+/* 模块卸载时调用，hook 已注销 */
+void RuleListExit(void) {
+    mutex_lock(&g_rule_mutex);
+    RuleListCleanup();
+    ClassifierPublish(NULL);
+    RuleListReclaim();
+    mutex_unlock(&g_rule_mutex);
+    rcu_barrier(); //等待 RCU 回调全部完成后再销毁 cache
+    kmem_cache_destroy(g_rule_cache);
+    g_rule_cache = NULL;
+}
+
+/*
+ * 规则集发生变化后调用（持有 g_rule_mutex）：
+ * 递增版本号，发布增量修改或重新编译的分类器，回收摘除的节点，广播通知。
+ */
+void RuleListCommit(void) {
+    RuleListCommitClassifier(NULL);
+}
+
+/*
+ * 同 RuleListCommit，但发布调用方已构建好的分类器（如预编译镜像），
+ * cls 为NULL时发布增量修改的草稿或由当前规则表编译。
+ * 编译失败或关闭了分类器时发布NULL，hook 退回遍历链表。
+ */
+void RuleListCommitClassifier(struct Classifier *cls) {
+    ++g_rule_list.generation;
+    ClassifierCommit(&g_rule_list, cls);
+    RuleListReclaim();
+    NlNotifyGeneration(g_rule_list.generation);
 }
 
 void RuleInsert(struct RuleNode *rnode) {
-    if(g_rule_list.tail == NULL) {
-        g_rule_list.tail = rnode;
+    RuleListInsertAt(&g_rule_list, 0, rnode);
+}
+
+void RuleAppend(struct RuleNode *rnode) {
+    RuleListInsertAt(&g_rule_list, g_rule_list.length + 1, rnode);
+}
+
+/*
+ * 排序键：新节点取前后两节点键的中点（追加到表尾时取前驱加 RULE_ORDER_GAP），
+ * 没有空隙时整表按间隔重排。键只在持有 g_rule_mutex 时读写，hook 不使用。
+ */
+#define RULE_ORDER_GAP (1ULL << 32)
+
+static void RuleListRenumberOrder(struct RuleList *list) {
+    struct RuleNode *cur;
+    u64 order = 0;
+
+    for(cur = list->head; cur != NULL; cur = cur->next) {
+        order += RULE_ORDER_GAP;
+        cur->order = order;
+    }
+}
+
+//rnode 刚链入 pre 之后（pre 为NULL时在表头）
+static void RuleListSetOrder(struct RuleList *list, const struct RuleNode *pre, struct RuleNode *rnode) {
+    u64 lo = (pre == NULL) ? 0 : pre->order;
+
+    if(rnode->next == NULL && lo <= ~0ULL - RULE_ORDER_GAP) {
+        rnode->order = lo + RULE_ORDER_GAP;
+    }
+    else if(rnode->next != NULL && rnode->next->order - lo >= 2) {
+        rnode->order = lo + (rnode->next->order - lo) / 2;
+    }
+    else {
+        RuleListRenumberOrder(list);
+    }
+}
+
+/*
+ * 将节点链入第 pos 条之前（pos 从1开始），pos 为0时插入表头，
+ * 大于表长时追加到表尾。
+ */
+static void RuleListLink(struct RuleList *list, unsigned int pos, struct RuleNode *rnode) {
+    struct RuleNode *pre;
+    unsigned int i;
+
+    if(pos <= 1 || list->head == NULL) {
+        pre = NULL;
+        rnode->next = list->head;
+        rcu_assign_pointer(list->head, rnode);
+        if(list->tail == NULL) {
+            list->tail = rnode;
+        }
+    }
+    else if(pos > list->length) {
+        pre = list->tail;
+        rnode->next = NULL;
+        rcu_assign_pointer(list->tail->next, rnode);
+        list->tail = rnode;
+    }
+    else {
+        for(i = 2, pre = list->head; i < pos; ++i, pre = pre->next) {
+            ; //empty
+        }
+        rnode->next = pre->next;
+        rcu_assign_pointer(pre->next, rnode);
     }
-    rnode->next = g_rule_list.head;
-    g_rule_list.head = rnode;
 
-    ++g_rule_list.length;
+    ++list->length;
+    RuleListSetOrder(list, pre, rnode);
 }
 
-void RuleAppend(struct RuleNode *rnode) {
-    rnode->next = NULL;
-    if(g_rule_list.head == NULL) {
-        g_rule_list.head = g_rule_list.tail = rnode;
+/* 为新规则分配编号，编号从1开始 */
+void RuleListAssignId(struct RuleNode *rnode) {
+    rnode->id = atomic_inc_return(&g_rule_id);
+}
+
+//新规则的命中与应答计数从0开始
+static void RuleResetCounters(struct RuleNode *rnode) {
+    atomic_long_set(&rnode->hits, 0);
+    atomic_long_set(&rnode->replies, 0);
+    atomic_long_set(&rnode->reply_drops, 0);
+}
+
+/* 插入新规则，位置含义同 RuleListLink */
+void RuleListInsertAt(struct RuleList *list, unsigned int pos, struct RuleNode *rnode) {
+    RuleResetCounters(rnode);
+    RuleListAssignId(rnode);
+    RuleListLink(list, pos, rnode);
+    ClassifierNoteInsert(list, rnode);
+}
+
+/*
+ * 返回第 pos 条规则的前驱，pos 为1时返回NULL；pos 越界时 *found 置0。
+ */
+static struct RuleNode *RuleListPrev(struct RuleList *list, unsigned int pos, int *found) {
+    struct RuleNode *pre;
+    unsigned int i;
+
+    *found = (pos >= 1 && pos <= list->length);
+    if(!*found || pos == 1) {
+        return NULL;
+    }
+    for(i = 2, pre = list->head; i < pos; ++i, pre = pre->next) {
+        ; //empty
+    }
+    return pre;
+}
+
+int RuleListDeleteAt(struct RuleList *list, unsigned int pos) {
+    struct RuleNode *pre, *del_node;
+    int found;
+
+    pre = RuleListPrev(list, pos, &found);
+    if(!found) {
+        return -1;
+    }
+    del_node = (pre == NULL) ? list->head : pre->next;
+    ClassifierNoteDelete(list, del_node);
+    if(pre == NULL) {
+        rcu_assign_pointer(list->head, del_node->next);
     }
     else {
-        g_rule_list.tail->next = rnode;
-        g_rule_list.tail = rnode;
+        rcu_assign_pointer(pre->next, del_node->next);
+    }
+    if(list->tail == del_node) {
+        list->tail = pre;
     }
+    --list->length;
+    RuleFree(list, del_node);
 
-    ++g_rule_list.length;
+    return 0;
+}
+
+int RuleListReplaceAt(struct RuleList *list, unsigned int pos, struct RuleNode *rnode) {
+    struct RuleNode *pre, *old_node;
+    int found;
+
+    pre = RuleListPrev(list, pos, &found);
+    if(!found) {
+        return -1;
+    }
+    old_node = (pre == NULL) ? list->head : pre->next;
+    RuleResetCounters(rnode);
+    RuleListAssignId(rnode);
+    rnode->order = old_node->order;
+    ClassifierNoteReplace(list, old_node, rnode);
+    rnode->next = old_node->next;
+    if(pre == NULL) {
+        rcu_assign_pointer(list->head, rnode);
+    }
+    else {
+        rcu_assign_pointer(pre->next, rnode);
+    }
+    if(list->tail == old_node) {
+        list->tail = rnode;
+    }
+    RuleFree(list, old_node);
+
+    return 0;
+}
+
+/*
+ * 把第 from 条规则移动到第 to 条之前（to 按移出后的表计算），保留其命中计数。
+ * 同一节点先摘下再链入，对遍历链表的读者不是原子的：只用于私有表，
+ * 或 ClassifierCoversList 成立时的当前规则表（修改记入分类器草稿）。
+ */
+int RuleListMoveAt(struct RuleList *list, unsigned int from, unsigned int to) {
+    struct RuleNode *pre, *move_node;
+    int found;
+
+    pre = RuleListPrev(list, from, &found);
+    if(!found) {
+        return -1;
+    }
+    move_node = (pre == NULL) ? list->head : pre->next;
+    ClassifierNoteDelete(list, move_node);
+    if(pre == NULL) {
+        list->head = move_node->next;
+    }
+    else {
+        pre->next = move_node->next;
+    }
+    if(list->tail == move_node) {
+        list->tail = pre;
+    }
+    --list->length;
+    RuleListLink(list, to, move_node);
+    ClassifierNoteInsert(list, move_node);
+
+    return 0;
+}
+
+/*
+ * 复制当前规则表到私有表 dst（不含 RCU 发布），用于批量事务：
+ * 在副本上依次执行各操作，全部成功后由 RuleListSwap 一次性发布。
+ * 失败返回 -ENOMEM，达到 rule_max 时返回 -ENOSPC。
+ */
+int RuleListCopy(struct RuleList *dst, const struct RuleList *src) {
+    struct RuleNode *cur, *new_node;
+    int iRet;
+
+    dst->head = dst->tail = NULL;
+    dst->garbage = NULL;
+    dst->length = 0;
+    dst->default_rule = src->default_rule;
+    dst->generation = src->generation;
+    for(cur = src->head; cur != NULL; cur = cur->next) {
+        new_node = RuleNodeAlloc();
+        if(new_node == NULL) {
+            iRet = RuleNodeFull() ? -ENOSPC : -ENOMEM;
+            RuleListFree(dst);
+            return iRet;
+        }
+        *new_node = *cur;
+        atomic_long_set(&new_node->hits, atomic_long_read(&cur->hits));
+        atomic_long_set(&new_node->replies, atomic_long_read(&cur->replies));
+        atomic_long_set(&new_node->reply_drops, atomic_long_read(&cur->reply_drops));
+        new_node->next = NULL;
+        if(dst->tail == NULL) {
+            dst->head = new_node;
+        }
+        else {
+            dst->tail->next = new_node;
+        }
+        dst->tail = new_node;
+        ++dst->length;
+    }
+
+    return 0;
+}
+
+/* 释放私有规则表 */
+void RuleListFree(struct RuleList *list) {
+    RuleChainFree(list->head);
+    list->head = list->tail = NULL;
+    list->length = 0;
+}
+
+/*
+ * 用私有表 list 整体替换当前规则表（持有 g_rule_mutex），随后须调用 RuleListCommit。
+ * 读者要么看到旧表，要么看到新表；旧表在提交后经宽限期释放。
+ */
+void RuleListSwap(struct RuleList *list) {
+    struct RuleNode *old_head = g_rule_list.head;
+
+    ClassifierNoteRebuild();
+    g_rule_list.tail = list->tail;
+    g_rule_list.length = list->length;
+    g_rule_list.default_rule = list->default_rule;
+    rcu_assign_pointer(g_rule_list.head, list->head);
+    list->head = list->tail = NULL;
+    list->length = 0;
+    RuleListRenumberOrder(&g_rule_list);
+
+    RuleChainRetire(old_head); //freed by the following RuleListCommit
 }
 
 int RuleDelete(const struct RuleNode *node_pattern) {
-    struct RuleNode *pre_node;
+    struct RuleNode *pre_node, *del_node;
     int count = 0;
 
     while(g_rule_list.head != NULL && RuleMatch(node_pattern, g_rule_list.head)) {
-        pre_node = g_rule_list.head;
-        g_rule_list.head = pre_node->next;
-        kfree(pre_node);       
-        --g_rule_list.length;
+        RuleListDeleteAt(&g_rule_list, 1);
         ++count;
     }
-    for(pre_node = g_rule_list.head; pre_node != NULL && pre_node->next != NULL; 
-            pre_node = pre_node->next) {
-        if(RuleMatch(node_pattern, pre_node->next)) {
-            pre_node->next = pre_node->next->next;
-            kfree(pre_node->next);
+    for(pre_node = g_rule_list.head; pre_node != NULL && pre_node->next != NULL; ) {
+        del_node = pre_node->next;
+        if(RuleMatch(node_pattern, del_node)) {
+            ClassifierNoteDelete(&g_rule_list, del_node);
+            rcu_assign_pointer(pre_node->next, del_node->next);
+            if(g_rule_list.tail == del_node) {
+                g_rule_list.tail = pre_node;
+            }
             --g_rule_list.length;
+            RuleFree(&g_rule_list, del_node);
             ++count;
         }
+        else {
+            pre_node = del_node;
+        }
     }
     
     return count;
 }
 
+/*
+ * 检查以二进制形式（如 netlink 属性）给出的规则，并将IP与屏蔽字相与。
+ * 屏蔽字必须是连续的前缀形式。成功返回0，失败返回-1。
+ */
+int RuleValidate(struct RuleNode *rnode) {
+    if((unsigned int)rnode->type > PACKAGE_TYPE_ICMP
+            || (unsigned int)rnode->rule > RULE_REFUSE) {
+        return -1;
+    }
+    if((~rnode->srcmask & (~rnode->srcmask + 1)) != 0
+            || (~rnode->dstmask & (~rnode->dstmask + 1)) != 0) {
+        return -1;
+    }
+    if(rnode->srcport > 0xffff || rnode->dstport > 0xffff) {
+        return -1;
+    }
+    rnode->srcip &= rnode->srcmask;
+    rnode->dstip &= rnode->dstmask;
+
+    return 0;
+}
+
+/*
+ * 由二进制规则构造并检查规则节点，失败返回NULL。
+ */
+struct RuleNode *RuleFromSpec(const struct RuleSpec *spec) {
+    struct RuleNode *new_node;
+
+    new_node = RuleNodeAlloc();
+    if(new_node == NULL) {
+        return NULL;
+    }
+    new_node->type = spec->type;
+    new_node->rule = spec->action;
+    new_node->srcip = spec->srcip;
+    new_node->srcmask = spec->srcmask;
+    new_node->srcport = spec->srcport;
+    new_node->dstip = spec->dstip;
+    new_node->dstmask = spec->dstmask;
+    new_node->dstport = spec->dstport;
+    if(RuleValidate(new_node) != 0) {
+        RuleNodeFree(new_node);
+        return NULL;
+    }
+
+    return new_node;
+}
+
 int RuleMatch(const struct RuleNode *node_pattern, const struct RuleNode *rnode) {
     if((node_pattern->type == PACKAGE_TYPE_ANY || node_pattern->type == rnode->type)
             && (node_pattern->srcip == IP_ANY 
@@ -130,8 +557,7 @@ int GetIpPort(unsigned int *ip, unsigned int *ipmask, unsigned int *port, const
         if(temp > 32) { //IPv4 屏蔽字表示成十进制时不应大于32
             return -1;
         }
-        *ipmask = 0xffffffff;
-        *ipmask <<= 32 - temp;
+        *ipmask = (temp == 0) ? 0 : (0xffffffff << (32 - temp)); //移位32位是未定义行为
         *ip &= *ipmask;
     }
     else {
@@ -161,12 +587,15 @@ int GetIpPort(unsigned int *ip, unsigned int *ipmask, unsigned int *port, const
 
 /*
  * 规则由字符串描述，解析规则如下：
- * 1. 所有规则包含字符 0~9、'A'、'I'、'T'、'U'、'P'、'R'、'/'、'.'、':'
+ * 1. 所有规则包含字符 0~9、'A'、'I'、'T'、'U'、'P'、'R'、'Q'、'F'、'/'、'.'、':'
  * 2. 规则包含4个字段: 报文类型、源IP-PORT、目的IP-PORT、策略。
  * 3. 各个字段由空格隔开,所有不合法格式将导致失败，函数不检查规则描述合理性。
  * 4. 报文类型字段取值: A:任意类型 I:ICMP T:TCP U:UDP
  * 5. 源IP-PORT字段格式: "IP/mask:PORT" 必须指定mask（没有取32）,IP和PORT可为'A'
- * 6. 策略字段取值 P:PERMIT R:REJECT
+ * 6. 策略字段取值 P:PERMIT R:REJECT Q:QUEUE（交给用户态程序判决）
+ *    F:REFUSE（丢弃并应答 TCP RST 或 ICMP 不可达，调用方立即得知失败）
+ * 7. 解析结果与二进制规则一样经 RuleValidate 检查（端口不大于65535），
+ *    否则链表遍历与编译后的分类器（端口按16位比较）会给出不同的判决。
  * 
  * 返回值: 
  *  成功返回解析得到RuleNode指针,其内存动态分配,内存释放由调用方管理
@@ -177,7 +606,7 @@ struct RuleNode *ParseRule(const char *rnode) {
     int iRet;
     struct RuleNode *new_node;
 
-    new_node = (struct RuleNode *)kmalloc(sizeof(struct RuleNode), GFP_KERNEL);
+    new_node = RuleNodeAlloc();
     if(new_node == NULL) {
         return NULL;
     }
@@ -201,26 +630,26 @@ struct RuleNode *ParseRule(const char *rnode) {
             new_node->type = PACKAGE_TYPE_UDP;
             break;
         default:
-            kfree(new_node);
+            RuleNodeFree(new_node);
             return NULL;
     }
     ++cur;
     if(*cur != ' ' && *cur != '\t') {
-        kfree(new_node);
+        RuleNodeFree(new_node);
         return NULL;
     }
 
     //set src   eg. 123.234.111.0/24:1234 
     iRet = GetIpPort(&(new_node->srcip), &(new_node->srcmask), &(new_node->srcport), &cur);
     if(iRet != 0 || (*cur != ' ' && *cur != '\t')) {
-        kfree(new_node);
+        RuleNodeFree(new_node);
         return NULL;
     }
     
     //set dst  same as set src
     iRet = GetIpPort(&(new_node->dstip), &(new_node->dstmask), &(new_node->dstport), &cur);
     if(iRet != 0 || (*cur != ' ' && *cur != '\t')) {
-        kfree(new_node);
+        RuleNodeFree(new_node);
         return NULL;
     }
 
@@ -235,10 +664,20 @@ struct RuleNode *ParseRule(const char *rnode) {
         case 'R':
             new_node->rule = RULE_REJECT;
             break;
+        case 'Q':
+            new_node->rule = RULE_QUEUE;
+            break;
+        case 'F':
+            new_node->rule = RULE_REFUSE;
+            break;
         default:
-            kfree(new_node);
+            RuleNodeFree(new_node);
             return NULL;
     }
+    if(RuleValidate(new_node) != 0) {
+        RuleNodeFree(new_node);
+        return NULL;
+    }
     
     return new_node;
 }
@@ -362,6 +801,12 @@ int ReadRule(char **o_strbuf, const struct RuleNode *rnode) {
         case RULE_REJECT:
             *cur = 'R';
             break;
+        case RULE_QUEUE:
+            *cur = 'Q';
+            break;
+        case RULE_REFUSE:
+            *cur = 'F';
+            break;
         default:
             return -1;
     }
@@ -1,23 +1,11 @@
 #ifndef RULE_LIST_MANAGE
 #define RULE_LIST_MANAGE
 
-enum Rule{
-    RULE_PERMIT,  
-    RULE_REJECT
-};
-
-enum PackageType {
-    PACKAGE_TYPE_ANY, //匹配所有类型
-    PACKAGE_TYPE_TCP,
-    PACKAGE_TYPE_UDP,
-    PACKAGE_TYPE_ICMP
-};
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
 
-//分别用于匹配任意IP 和 任意PORT
-enum {
-    IP_ANY, 
-    PORT_ANY
-};
+#include "../common.h"
 
 struct RuleNode {
     enum Rule rule;
@@ -28,21 +16,51 @@ struct RuleNode {
     unsigned int dstmask;
     unsigned int srcport;
     unsigned int dstport;
+    unsigned int id;        //规则编号，插入时分配，移动、复制时保持不变
+    u64 order;              //排序键，沿链表严格递增，分类器增量修改据此定位表项
+    atomic_long_t hits;     //命中计数
+    atomic_long_t replies;  //'F' 规则：已应答的丢弃
+    atomic_long_t reply_drops;  //'F' 规则：因限速或无路由未应答的丢弃
     struct RuleNode *next;
+    struct RuleNode *gc_next;   //摘除后等待下次提交再释放
+    struct rcu_head rcu;
 };
 
 struct RuleList {
     enum Rule default_rule; //不匹配任意一条规则时的默认规则
     unsigned int length;
+    unsigned int generation; //规则集版本号，每次变更递增
     struct RuleNode *head;
     struct RuleNode *tail;
+    struct RuleNode *garbage;   //已摘除、分类器可能仍在引用的节点
 };
 
-void RuleListInit(void);
+struct Classifier;
+
+extern struct mutex g_rule_mutex;
+
+int RuleListInit(void);
+struct RuleNode *RuleNodeAlloc(void);
+void RuleNodeFree(struct RuleNode *);
+int RuleNodeFull(void);
+void RuleNodeGetMem(struct MemStat *);
 void RuleListCleanup(void);
+void RuleListExit(void);
+void RuleListCommit(void);
+void RuleListCommitClassifier(struct Classifier *);
 void RuleInsert(struct RuleNode *);
 void RuleAppend(struct RuleNode *);
+void RuleListAssignId(struct RuleNode *);
+void RuleListInsertAt(struct RuleList *, unsigned int pos, struct RuleNode *);
+int RuleListDeleteAt(struct RuleList *, unsigned int pos);
+int RuleListReplaceAt(struct RuleList *, unsigned int pos, struct RuleNode *);
+int RuleListMoveAt(struct RuleList *, unsigned int from, unsigned int to);
+int RuleListCopy(struct RuleList *dst, const struct RuleList *src);
+void RuleListFree(struct RuleList *);
+void RuleListSwap(struct RuleList *);
 int RuleDelete(const struct RuleNode *);
+int RuleValidate(struct RuleNode *);
+struct RuleNode *RuleFromSpec(const struct RuleSpec *);
 int RuleMatch(const struct RuleNode *, const struct RuleNode *);
 struct RuleNode *ParseRule(const char *);
 int ReadRule(char **o_strbuf, const struct RuleNode *);
@@ -0,0 +1,210 @@
+// FileName: myNetfilter_kernel/rule_optimize.c 
+// Describe: 按规则命中计数调整规则顺序，让热点规则靠前
+// Note: 只交换匹配空间不相交或动作相同的相邻规则，任何报文的首次匹配判决都不变。
+//       默认关闭，由 optimize_interval_s 开启后台优化，或用 'tinyfw_nf optimize' 手动触发。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/math64.h>
+
+#include "../common.h"
+#include "rule_optimize.h"
+#include "rule_list_manage.h"
+#include "classifier.h"
+#include "nl_interface.h"
+
+/*
+ * optimize_interval_s: 后台优化周期（秒），0 表示关闭。
+ * optimize_min_gain: 预计平均比较次数至少降低该百分比才发布新顺序，避免频繁抖动。
+ * optimize_max_rules: 规则数超过该值时不做优化（冲突检查为 O(n^2)）。
+ */
+static unsigned int optimize_interval_s = 0;
+module_param(optimize_interval_s, uint, 0644);
+MODULE_PARM_DESC(optimize_interval_s, "background rule reordering period in seconds, 0 to disable");
+static unsigned int optimize_min_gain = 5;
+module_param(optimize_min_gain, uint, 0644);
+MODULE_PARM_DESC(optimize_min_gain, "minimal expected gain in percent to publish a new order");
+static unsigned int optimize_max_rules = 8192;
+module_param(optimize_max_rules, uint, 0644);
+MODULE_PARM_DESC(optimize_max_rules, "skip reordering for larger rule sets");
+
+#define OPTIMIZE_IDLE_POLL (10 * HZ)
+
+extern struct RuleList g_rule_list;
+
+static void RuleOptimizeWork(struct work_struct *work);
+static DECLARE_DELAYED_WORK(g_optimize_work, RuleOptimizeWork);
+
+static int RuleInProto(const struct RuleNode *rnode, int proto_idx) {
+    return rnode->type == PACKAGE_TYPE_ANY || rnode->type == proto_idx + PACKAGE_TYPE_TCP;
+}
+
+/* 是否存在同时匹配两条规则的报文 */
+static int RuleOverlap(const struct RuleNode *a, const struct RuleNode *b) {
+    struct ClsEntry ea, eb;
+    int p;
+
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        if(!RuleInProto(a, p) || !RuleInProto(b, p)) {
+            continue;
+        }
+        ClsCompile(&ea, a, p);
+        ClsCompile(&eb, b, p);
+        if(((ea.srcip ^ eb.srcip) & ea.srcmask & eb.srcmask) == 0
+                && ((ea.dstip ^ eb.dstip) & ea.dstmask & eb.dstmask) == 0
+                && ((ea.srcport ^ eb.srcport) & ea.srcpmask & eb.srcpmask) == 0
+                && ((ea.dstport ^ eb.dstport) & ea.dstpmask & eb.dstpmask) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+//相邻两条规则可以交换
+static int RuleSwappable(const struct RuleNode *a, const struct RuleNode *b) {
+    return a->rule == b->rule || !RuleOverlap(a, b);
+}
+
+/* 按链表位置估算：命中第 i 条规则的报文比较 i 次。返回值放大100倍 */
+static unsigned long long RuleCost(const unsigned long *hits, unsigned int n) {
+    unsigned long long weighted = 0, total = 0;
+    unsigned int i;
+
+    for(i = 0; i < n; ++i) {
+        weighted += (unsigned long long)hits[i] * (i + 1);
+        total += hits[i];
+    }
+    return total ? div64_u64(weighted * 100, total) : 0;
+}
+
+/*
+ * 在规则表副本上按命中数做受限的插入排序：规则只越过可交换且命中更少的前驱。
+ * 每一步都是合法的相邻交换，所以结果与原顺序判决等价。
+ * 只在复制和发布时持有 g_rule_mutex，排序期间不阻塞控制面；发布前规则集版本已变化时
+ * 放弃本次结果并返回 -EAGAIN（后台任务在下一周期重试）。
+ * dry_run 为真时只给出报告。成功返回0。
+ */
+int RuleOptimize(int dry_run, struct OptimizeReport *report) {
+    struct RuleList list;
+    struct RuleNode **nodes = NULL, **src = NULL, *node_temp;
+    unsigned long *hits = NULL;
+    unsigned int *origin = NULL;
+    unsigned int n, i, j;
+    unsigned long long gain;
+    int iRet = 0;
+
+    memset(report, 0, sizeof(*report));
+    mutex_lock(&g_rule_mutex);
+    n = g_rule_list.length;
+    report->rule_count = n;
+    report->generation = g_rule_list.generation;
+    if(n < 2) {
+        mutex_unlock(&g_rule_mutex);
+        return 0;
+    }
+    if(n > optimize_max_rules) {
+        mutex_unlock(&g_rule_mutex);
+        return -E2BIG;
+    }
+    nodes = (struct RuleNode **)vmalloc(sizeof(*nodes) * n);
+    src = (struct RuleNode **)vmalloc(sizeof(*src) * n);
+    hits = (unsigned long *)vmalloc(sizeof(*hits) * n);
+    origin = (unsigned int *)vmalloc(sizeof(*origin) * n);
+    if(nodes == NULL || src == NULL || hits == NULL || origin == NULL
+            || RuleListCopy(&list, &g_rule_list) != 0) {
+        mutex_unlock(&g_rule_mutex);
+        iRet = -ENOMEM;
+        goto out;
+    }
+    //同一版本内节点不会被释放，发布时据此补上排序期间的命中计数
+    for(i = 0, node_temp = g_rule_list.head; node_temp != NULL; node_temp = node_temp->next, ++i) {
+        src[i] = node_temp;
+    }
+    mutex_unlock(&g_rule_mutex);
+
+    for(i = 0, node_temp = list.head; node_temp != NULL; node_temp = node_temp->next, ++i) {
+        nodes[i] = node_temp;
+        hits[i] = atomic_long_read(&node_temp->hits);
+        origin[i] = i;
+    }
+    report->cost_before = RuleCost(hits, n);
+
+    for(i = 1; i < n; ++i) {
+        for(j = i; j > 0 && hits[j] > hits[j - 1] && RuleSwappable(nodes[j - 1], nodes[j]); --j) {
+            swap(nodes[j], nodes[j - 1]);
+            swap(hits[j], hits[j - 1]);
+            swap(origin[j], origin[j - 1]);
+        }
+        if((i & 0xff) == 0) {
+            cond_resched();
+        }
+    }
+    report->cost_after = RuleCost(hits, n);
+    for(i = 0; i < n; ++i) {
+        report->moved += (origin[i] != i);
+    }
+
+    gain = report->cost_before - report->cost_after;
+    if(dry_run || report->moved == 0 || gain * 100 < report->cost_before * optimize_min_gain) {
+        RuleListFree(&list);
+        goto out;
+    }
+
+    //relink the copy in the new order and publish it
+    for(i = 0; i + 1 < n; ++i) {
+        nodes[i]->next = nodes[i + 1];
+    }
+    nodes[n - 1]->next = NULL;
+    list.head = nodes[0];
+    list.tail = nodes[n - 1];
+
+    mutex_lock(&g_rule_mutex);
+    if(g_rule_list.generation != report->generation) {
+        mutex_unlock(&g_rule_mutex);
+        RuleListFree(&list);
+        iRet = -EAGAIN;
+        goto out;
+    }
+    for(i = 0; i < n; ++i) {
+        atomic_long_set(&nodes[i]->hits, atomic_long_read(&src[origin[i]]->hits));
+        atomic_long_set(&nodes[i]->replies, atomic_long_read(&src[origin[i]]->replies));
+        atomic_long_set(&nodes[i]->reply_drops, atomic_long_read(&src[origin[i]]->reply_drops));
+    }
+    RuleListSwap(&list);
+    RuleListCommit();
+    report->applied = 1;
+    report->generation = g_rule_list.generation;
+    mutex_unlock(&g_rule_mutex);
+    printk("rule optimize: %u rules moved, avg rules evaluated %llu.%02llu -> %llu.%02llu\n",
+           report->moved, report->cost_before / 100, report->cost_before % 100,
+           report->cost_after / 100, report->cost_after % 100);
+
+out:
+    vfree(nodes);
+    vfree(src);
+    vfree(hits);
+    vfree(origin);
+    return iRet;
+}
+
+static void RuleOptimizeWork(struct work_struct *work) {
+    struct OptimizeReport report;
+    unsigned int interval = optimize_interval_s;
+
+    if(interval != 0 && RuleOptimize(0, &report) == 0 && report.applied) {
+        NlNotifyOptimized(&report);
+    }
+    schedule_delayed_work(&g_optimize_work, interval ? interval * HZ : OPTIMIZE_IDLE_POLL);
+}
+
+void RuleOptimizeInit(void) {
+    schedule_delayed_work(&g_optimize_work, optimize_interval_s ? optimize_interval_s * HZ : OPTIMIZE_IDLE_POLL);
+}
+
+void RuleOptimizeExit(void) {
+    cancel_delayed_work_sync(&g_optimize_work);
+}
@@ -0,0 +1,17 @@
+#ifndef RULE_OPTIMIZE_H
+#define RULE_OPTIMIZE_H
+
+struct OptimizeReport {
+    unsigned int rule_count;
+    unsigned int moved;             //rules whose position changed
+    unsigned int generation;        //generation after publishing
+    int applied;                    //new order published
+    unsigned long long cost_before; //avg rules evaluated per matched packet * 100
+    unsigned long long cost_after;
+};
+
+int RuleOptimize(int dry_run, struct OptimizeReport *report);
+void RuleOptimizeInit(void);
+void RuleOptimizeExit(void);
+
+#endif
@@ -0,0 +1,370 @@
+// FileName: myNetfilter_kernel/scan_detect.c
+// Describe: 端口扫描检测（按源IP记录时间窗内访问过的目的端口、目的主机）
+// Note: 定长散列表，每个源一个槽，槽内用小位图近似统计不同端口/主机数；
+//       报文路径不分配内存，伪造源地址洪泛时只会挤掉计数最小的槽。
+//       只统计发起连接的报文（TCP SYN 不带 ACK、ICMP echo 请求），UDP 默认不统计（scan_udp）：
+//       我方访问的服务器的应答也是"一个源、大量不同端口"，统计它们会把 DNS、CDN 等上游判为扫描。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/hash.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include <net/netlink.h>
+#include <net/genetlink.h>
+
+#include "../common.h"
+#include "scan_detect.h"
+#include "nl_interface.h"
+
+#define SCAN_WAYS 4             //每个桶的槽数（组相联），同桶内挤掉计数最小的槽
+#define SCAN_LOCK_BITS 8
+#define SCAN_PORT_BITS 256      //位图大小，不同端口数由置位数按线性计数估算
+#define SCAN_HOST_BITS 128
+#define SCAN_EVENT_RING 64
+
+/*
+ * scan_detect: 是否检测，关闭时报文路径只有一次判断。
+ * scan_window_s 秒内访问超过 scan_ports 个不同端口或 scan_hosts 个不同主机视为扫描，
+ * 为0表示不按该项检测。scan_drop_s 不为0时此后丢弃该源的报文 scan_drop_s 秒，
+ * 否则只计数并发送事件。
+ */
+static bool scan_detect = false;
+module_param(scan_detect, bool, 0644);
+MODULE_PARM_DESC(scan_detect, "detect port/host scans");
+static unsigned int scan_window_s = 10;
+module_param(scan_window_s, uint, 0644);
+MODULE_PARM_DESC(scan_window_s, "scan detection time window in seconds");
+static unsigned int scan_ports = 64;
+module_param(scan_ports, uint, 0644);
+MODULE_PARM_DESC(scan_ports, "distinct destination ports per window to flag a source, 0 to ignore");
+static unsigned int scan_hosts = 32;
+module_param(scan_hosts, uint, 0644);
+MODULE_PARM_DESC(scan_hosts, "distinct destination hosts per window to flag a source, 0 to ignore");
+static unsigned int scan_drop_s = 0;
+module_param(scan_drop_s, uint, 0644);
+MODULE_PARM_DESC(scan_drop_s, "drop a flagged source for this many seconds, 0 only reports");
+static bool scan_udp = false;
+module_param(scan_udp, bool, 0644);
+MODULE_PARM_DESC(scan_udp, "also count UDP datagrams, replies from busy upstream servers may get flagged");
+static unsigned int scan_table_bits = 14;
+module_param(scan_table_bits, uint, 0444);
+MODULE_PARM_DESC(scan_table_bits, "log2 of scan table slot count");
+
+struct ScanSlot {
+    unsigned int ip;
+    unsigned long window;       //jiffies, start of current window; 0 for empty slot
+    unsigned long block_until;  //jiffies, 0 if not blocked
+    unsigned short port_bits;   //bits set in port_map
+    unsigned short host_bits;
+    unsigned int flagged;
+    unsigned long port_map[BITS_TO_LONGS(SCAN_PORT_BITS)];
+    unsigned long host_map[BITS_TO_LONGS(SCAN_HOST_BITS)];
+};
+
+struct ScanEvent {
+    unsigned int ip;
+    unsigned short port_bits;
+    unsigned short host_bits;
+};
+
+static struct ScanSlot *g_scan_table = NULL;
+static unsigned int g_scan_size = 0;
+static spinlock_t g_scan_locks[1 << SCAN_LOCK_BITS];
+
+//阈值换算成的位图置位数，由后台任务根据参数刷新
+static unsigned int g_scan_port_limit = SCAN_PORT_BITS + 1;
+static unsigned int g_scan_host_limit = SCAN_HOST_BITS + 1;
+
+static DEFINE_SPINLOCK(g_scan_ring_lock);
+static struct ScanEvent g_scan_ring[SCAN_EVENT_RING];
+static unsigned int g_scan_ring_head = 0, g_scan_ring_tail = 0;
+
+static DEFINE_PER_CPU(unsigned long, g_scan_detections);
+static DEFINE_PER_CPU(unsigned long, g_scan_drops);
+static DEFINE_PER_CPU(unsigned long, g_scan_evictions);
+static DEFINE_PER_CPU(unsigned long, g_scan_untracked);
+static atomic_long_t g_scan_events_lost = ATOMIC_LONG_INIT(0);
+
+static void ScanEventWork(struct work_struct *work);
+static DECLARE_WORK(g_scan_event_work, ScanEventWork);
+static void ScanTuneWork(struct work_struct *work);
+static DECLARE_DELAYED_WORK(g_scan_tune_work, ScanTuneWork);
+
+/*
+ * n 个不同值散列到 m 位的位图后期望的置位数 m*(1-(1-1/m)^n)（16位定点迭代）。
+ * 位图饱和前 n 与置位数一一对应，阈值比较因此直接用置位数。
+ */
+static unsigned int ScanExpectedBits(unsigned int n, unsigned int m) {
+    unsigned long zeros = (unsigned long)m << 16;
+    unsigned int i;
+
+    for(i = 0; i < n && zeros >= (1UL << 16); ++i) {
+        zeros -= zeros / m;
+    }
+    return m - (unsigned int)((zeros + (1UL << 15)) >> 16);
+}
+
+/* ScanExpectedBits 的反函数：置位数对应的不同值个数估计，位图饱和时返回下界 */
+static unsigned int ScanEstimate(unsigned int bits, unsigned int m) {
+    unsigned long zeros = (unsigned long)m << 16;
+    unsigned int n;
+
+    for(n = 0; n < 16 * m && m - (unsigned int)((zeros + (1UL << 15)) >> 16) < bits; ++n) {
+        zeros -= zeros / m;
+    }
+    return n;
+}
+
+static unsigned int ScanLimit(unsigned int threshold, unsigned int m) {
+    unsigned int bits;
+
+    if(threshold == 0) {
+        return m + 1; //never reached
+    }
+    bits = ScanExpectedBits(threshold, m);
+    return bits < m ? bits : m;
+}
+
+static void ScanTuneWork(struct work_struct *work) {
+    g_scan_port_limit = ScanLimit(scan_ports, SCAN_PORT_BITS);
+    g_scan_host_limit = ScanLimit(scan_hosts, SCAN_HOST_BITS);
+    schedule_delayed_work(&g_scan_tune_work, HZ);
+}
+
+/* 调用方持有槽锁 */
+static void ScanEventPush(const struct ScanSlot *slot) {
+    spin_lock(&g_scan_ring_lock);
+    if(g_scan_ring_head - g_scan_ring_tail < SCAN_EVENT_RING) {
+        g_scan_ring[g_scan_ring_head % SCAN_EVENT_RING].ip = slot->ip;
+        g_scan_ring[g_scan_ring_head % SCAN_EVENT_RING].port_bits = slot->port_bits;
+        g_scan_ring[g_scan_ring_head % SCAN_EVENT_RING].host_bits = slot->host_bits;
+        ++g_scan_ring_head;
+    }
+    else {
+        atomic_long_inc(&g_scan_events_lost);
+    }
+    spin_unlock(&g_scan_ring_lock);
+    schedule_work(&g_scan_event_work);
+}
+
+static void ScanEventWork(struct work_struct *work) {
+    struct ScanEvent event;
+    struct sk_buff *msg;
+    void *hdr;
+
+    for(;;) {
+        spin_lock_bh(&g_scan_ring_lock);
+        if(g_scan_ring_tail == g_scan_ring_head) {
+            spin_unlock_bh(&g_scan_ring_lock);
+            break;
+        }
+        event = g_scan_ring[g_scan_ring_tail++ % SCAN_EVENT_RING];
+        spin_unlock_bh(&g_scan_ring_lock);
+
+        msg = NlEventNew(TINYFW_CMD_EVT_SCAN, &hdr);
+        if(msg == NULL) {
+            continue;
+        }
+        if(nla_put_u32(msg, TINYFW_A_SRCIP, event.ip)
+                || nla_put_u32(msg, TINYFW_A_PORTS, ScanEstimate(event.port_bits, SCAN_PORT_BITS))
+                || nla_put_u32(msg, TINYFW_A_HOSTS, ScanEstimate(event.host_bits, SCAN_HOST_BITS))
+                || nla_put_u32(msg, TINYFW_A_WINDOW, scan_window_s)
+                || nla_put_u8(msg, TINYFW_A_DROP, scan_drop_s != 0)) {
+            nlmsg_free(msg);
+            continue;
+        }
+        NlEventSend(msg, hdr);
+    }
+}
+
+static inline int ScanSlotLive(const struct ScanSlot *slot, unsigned long now, unsigned long window) {
+    return slot->window != 0 && time_before(now, slot->window + window);
+}
+
+static inline int ScanSlotBlocked(const struct ScanSlot *slot, unsigned long now) {
+    return slot->block_until != 0 && time_before(now, slot->block_until);
+}
+
+/*
+ * 不加桶锁查看 ip 是否处于丢弃期。封禁中的槽不会被挤掉，与持锁的写者并发时
+ * 最多得到过时的判断。空槽的 block_until 为0。
+ */
+static int ScanSlotPeek(const struct ScanSlot *bucket, unsigned int ip, unsigned long now) {
+    unsigned long until;
+    unsigned int i;
+
+    for(i = 0; i < SCAN_WAYS; ++i) {
+        if(READ_ONCE(bucket[i].ip) == ip) {
+            until = READ_ONCE(bucket[i].block_until);
+            return until != 0 && time_before(now, until);
+        }
+    }
+    return 0;
+}
+
+/*
+ * 在桶中找到 ip 的槽，没有则挤掉一个：空槽或窗口已过期的槽优先，
+ * 其次是计数最小的未封禁槽；全部处于封禁中时返回NULL。调用方持有桶锁。
+ */
+static struct ScanSlot *ScanSlotGet(struct ScanSlot *bucket, unsigned int ip,
+                                    unsigned long now, unsigned long window) {
+    struct ScanSlot *slot, *victim = NULL;
+    unsigned int i, weight, min_weight = UINT_MAX;
+
+    for(i = 0; i < SCAN_WAYS; ++i) {
+        slot = &bucket[i];
+        if(slot->window != 0 && slot->ip == ip) {
+            return slot;
+        }
+        if(ScanSlotBlocked(slot, now)) {
+            continue;
+        }
+        weight = ScanSlotLive(slot, now, window) ? slot->port_bits + slot->host_bits + 1 : 0;
+        if(weight < min_weight) {
+            min_weight = weight;
+            victim = slot;
+        }
+    }
+    if(victim == NULL) {
+        this_cpu_inc(g_scan_untracked);
+        return NULL;
+    }
+    if(min_weight != 0) {
+        this_cpu_inc(g_scan_evictions);
+    }
+    memset(victim, 0, sizeof(*victim));
+    WRITE_ONCE(victim->ip, ip);
+
+    return victim;
+}
+
+/*
+ * 报文路径调用（软中断上下文），packet 为 NFHookFunc 中提取的报文信息，
+ * probe 表示报文发起新的连接（TCP SYN 不带 ACK、ICMP echo 请求，UDP 总是1）。
+ * 只有发起连接的报文计入端口/主机统计并获取桶锁，其余报文无锁地检查源是否处于丢弃期。
+ * 返回1表示该源已被判定为扫描且处于丢弃期内。
+ */
+int ScanCheck(const struct RuleNode *packet, int probe) {
+    struct ScanSlot *bucket, *slot;
+    unsigned long now = jiffies, window = (unsigned long)scan_window_s * HZ;
+    unsigned long until;
+    unsigned int index;
+    int drop = 0;
+
+    if(!scan_detect || g_scan_table == NULL) {
+        return 0;
+    }
+    index = hash_32(packet->srcip, scan_table_bits) & ~(SCAN_WAYS - 1);
+    bucket = &g_scan_table[index];
+
+    if(!probe || (packet->type == PACKAGE_TYPE_UDP && !scan_udp)) {
+        //不计数的报文不占用槽，避免应答流量挤掉正在统计的源
+        drop = ScanSlotPeek(bucket, packet->srcip, now);
+        goto out_count;
+    }
+
+    spin_lock(&g_scan_locks[(index / SCAN_WAYS) & ((1 << SCAN_LOCK_BITS) - 1)]);
+    slot = ScanSlotGet(bucket, packet->srcip, now, window);
+    if(slot == NULL) {
+        goto out;
+    }
+    if(ScanSlotBlocked(slot, now)) {
+        drop = 1;
+        goto out;
+    }
+    if(!ScanSlotLive(slot, now, window)) {
+        memset(slot->port_map, 0, sizeof(slot->port_map));
+        memset(slot->host_map, 0, sizeof(slot->host_map));
+        slot->port_bits = slot->host_bits = 0;
+        slot->flagged = 0;
+        WRITE_ONCE(slot->block_until, 0);
+        slot->window = now ? now : 1;
+    }
+    if(packet->type != PACKAGE_TYPE_ICMP
+            && !__test_and_set_bit(hash_32(packet->dstport, ilog2(SCAN_PORT_BITS)), slot->port_map)) {
+        ++slot->port_bits;
+    }
+    if(!__test_and_set_bit(hash_32(packet->dstip, ilog2(SCAN_HOST_BITS)), slot->host_map)) {
+        ++slot->host_bits;
+    }
+    if(!slot->flagged && (slot->port_bits >= g_scan_port_limit || slot->host_bits >= g_scan_host_limit)) {
+        slot->flagged = 1;
+        this_cpu_inc(g_scan_detections);
+        ScanEventPush(slot);
+        if(scan_drop_s != 0) {
+            until = now + (unsigned long)scan_drop_s * HZ;
+            WRITE_ONCE(slot->block_until, until ? until : 1);
+            drop = 1;
+        }
+    }
+
+out:
+    spin_unlock(&g_scan_locks[(index / SCAN_WAYS) & ((1 << SCAN_LOCK_BITS) - 1)]);
+out_count:
+    if(drop) {
+        this_cpu_inc(g_scan_drops);
+    }
+    return drop;
+}
+
+void ScanGetStat(struct ScanStat *stat) {
+    unsigned long now = jiffies, window = (unsigned long)scan_window_s * HZ;
+    unsigned int i;
+    int cpu;
+
+    memset(stat, 0, sizeof(*stat));
+    stat->capacity = g_scan_size;
+    for(i = 0; i < g_scan_size; ++i) { //racy read, only for display
+        if(ScanSlotLive(&g_scan_table[i], now, window)) {
+            ++stat->active;
+        }
+        if(ScanSlotBlocked(&g_scan_table[i], now)) {
+            ++stat->blocked;
+        }
+    }
+    for_each_possible_cpu(cpu) {
+        stat->detections += per_cpu(g_scan_detections, cpu);
+        stat->drops += per_cpu(g_scan_drops, cpu);
+        stat->evictions += per_cpu(g_scan_evictions, cpu);
+        stat->untracked += per_cpu(g_scan_untracked, cpu);
+    }
+    stat->events_lost = atomic_long_read(&g_scan_events_lost);
+}
+
+void ScanGetMem(struct MemStat *stat) {
+    stat->scan_slots = g_scan_size;
+    stat->scan_bytes = (unsigned long long)g_scan_size * sizeof(struct ScanSlot);
+}
+
+int ScanDetectInit(void) {
+    unsigned int i;
+
+    if(scan_table_bits < ilog2(SCAN_WAYS) + SCAN_LOCK_BITS || scan_table_bits > 24) {
+        printk("scan_table_bits out of range [%d, 24]\n", ilog2(SCAN_WAYS) + SCAN_LOCK_BITS);
+        return -EINVAL;
+    }
+    g_scan_size = 1U << scan_table_bits;
+    g_scan_table = vzalloc(g_scan_size * sizeof(struct ScanSlot));
+    if(g_scan_table == NULL) {
+        return -ENOMEM;
+    }
+    for(i = 0; i < (1 << SCAN_LOCK_BITS); ++i) {
+        spin_lock_init(&g_scan_locks[i]);
+    }
+
+    ScanTuneWork(NULL);
+    return 0;
+}
+
+/* hook 已注销后调用 */
+void ScanDetectCleanup(void) {
+    cancel_delayed_work_sync(&g_scan_tune_work);
+    cancel_work_sync(&g_scan_event_work);
+    vfree(g_scan_table);
+    g_scan_table = NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef SCAN_DETECT_H
+#define SCAN_DETECT_H
+
+#include "../common.h"
+#include "rule_list_manage.h"
+
+int ScanDetectInit(void);
+void ScanDetectCleanup(void);
+int ScanCheck(const struct RuleNode *packet, int probe);
+void ScanGetStat(struct ScanStat *);
+void ScanGetMem(struct MemStat *);
+
+#endif
@@ -0,0 +1,304 @@
+// FileName: myNetfilter_kernel/shadow.c
+// Describe: 影子规则集（A/B 对比）：候选规则集与当前规则集并行判决，只统计不执行
+// Note: hook 每 sample 个包抽一个再用影子分类器判决，记录判决不一致的规则对和两边的耗时；
+//       提升时影子规则表与分类器整体替换当前规则集，不重新编译。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/jiffies.h>
+#include <linux/hash.h>
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+
+#include "../common.h"
+#include "shadow.h"
+#include "rule_list_manage.h"
+#include "classifier.h"
+#include "rule_image.h"
+
+#define SHADOW_PAIR_BITS 6      //1 << SHADOW_PAIR_BITS == SHADOW_PAIR_MAX
+
+struct ShadowCpuStat {
+    unsigned int tick;          //抽样计数
+    u64 samples;
+    u64 disagreements;
+    u64 live_ns;
+    u64 shadow_ns;
+    u64 live_evaluated;
+    u64 shadow_evaluated;
+};
+
+struct ShadowSet {
+    struct RuleList list;       //私有规则表，规则编号为表中位置
+    struct Classifier *cls;
+    unsigned int sample;
+    unsigned long loaded;       //jiffies
+    struct ShadowCpuStat __percpu *stat;
+    spinlock_t pair_lock;
+    u64 pairs_lost;
+    struct ShadowPair pair[SHADOW_PAIR_MAX];   //count 为0的是空位
+};
+
+struct ShadowSet __rcu *g_shadow = NULL;
+
+//释放已不可见（已摘下并经过宽限期）的影子规则集
+static void ShadowFree(struct ShadowSet *shadow) {
+    if(shadow == NULL) {
+        return;
+    }
+    ClassifierFree(shadow->cls);
+    RuleListFree(&shadow->list);
+    free_percpu(shadow->stat);
+    kfree(shadow);
+}
+
+//摘下当前影子规则集（持有 g_rule_mutex），返回后由调用方等待宽限期
+static struct ShadowSet *ShadowUnpublish(void) {
+    struct ShadowSet *shadow = rcu_dereference_protected(g_shadow, 1);
+
+    RCU_INIT_POINTER(g_shadow, NULL);
+    return shadow;
+}
+
+struct ShadowSet *ShadowSampleSlow(struct ShadowSet *shadow) {
+    return (this_cpu_inc_return(shadow->stat->tick) % shadow->sample) == 0 ? shadow : NULL;
+}
+
+static void ShadowSpec(struct RuleSpec *spec, const struct RuleNode *rnode, enum Rule rule) {
+    memset(spec, 0, sizeof(*spec));
+    spec->action = rule;
+    if(rnode == NULL) { //default rule
+        spec->type = PACKAGE_TYPE_ANY;
+        return;
+    }
+    spec->type = rnode->type;
+    spec->srcip = rnode->srcip;
+    spec->srcmask = rnode->srcmask;
+    spec->srcport = rnode->srcport;
+    spec->dstip = rnode->dstip;
+    spec->dstmask = rnode->dstmask;
+    spec->dstport = rnode->dstport;
+}
+
+//规则对计数，表满时只计入 pairs_lost
+static void ShadowPairCount(struct ShadowSet *shadow, const struct RuleNode *live_node, enum Rule live_rule,
+                            const struct RuleNode *shadow_node, enum Rule shadow_rule) {
+    unsigned int live_id = live_node ? live_node->id : 0;
+    unsigned int shadow_id = shadow_node ? shadow_node->id : 0;
+    unsigned int i, n;
+    struct ShadowPair *pair;
+
+    i = hash_32(live_id * 31 + shadow_id, SHADOW_PAIR_BITS);
+    spin_lock(&shadow->pair_lock);
+    for(n = 0; n < SHADOW_PAIR_MAX; ++n, i = (i + 1) & (SHADOW_PAIR_MAX - 1)) {
+        pair = &shadow->pair[i];
+        if(pair->count == 0) {
+            pair->live_id = live_id;
+            pair->shadow_id = shadow_id;
+            ShadowSpec(&pair->live, live_node, live_rule);
+            ShadowSpec(&pair->shadow, shadow_node, shadow_rule);
+        }
+        if(pair->live_id == live_id && pair->shadow_id == shadow_id) {
+            ++pair->count;
+            break;
+        }
+    }
+    if(n == SHADOW_PAIR_MAX) {
+        ++shadow->pairs_lost;
+    }
+    spin_unlock(&shadow->pair_lock);
+}
+
+/*
+ * 用影子规则集判决一个抽样包并与当前规则集的结果比较（在 hook 中调用）。
+ * live_node 为当前规则集匹配的规则，NULL 表示默认规则；live_ns 为当前规则集判决耗时。
+ */
+void ShadowEval(struct ShadowSet *shadow, const struct RuleNode *packet, const struct RuleNode *live_node,
+                enum Rule live_rule, unsigned int live_evaluated, u64 live_ns) {
+    struct ShadowCpuStat *stat = this_cpu_ptr(shadow->stat);
+    struct RuleNode *shadow_node;
+    enum Rule shadow_rule;
+    unsigned int evaluated;
+    u64 start;
+
+    start = ktime_get_ns();
+    if(ClsPrefilterSkip(shadow->cls, packet)) {
+        shadow_node = NULL;
+        evaluated = 0;
+    }
+    else {
+        shadow_node = ClassifierLookup(shadow->cls, packet, &evaluated);
+    }
+    stat->shadow_ns += ktime_get_ns() - start;
+    stat->live_ns += live_ns;
+    ++stat->samples;
+    stat->live_evaluated += live_evaluated;
+    stat->shadow_evaluated += evaluated;
+
+    shadow_rule = shadow_node ? shadow_node->rule : shadow->list.default_rule;
+    if(shadow_rule != live_rule) {
+        ++stat->disagreements;
+        ShadowPairCount(shadow, live_node, live_rule, shadow_node, shadow_rule);
+    }
+}
+
+/* 装入用户态传入的影子规则集镜像（ioctl IO_CTRL_SHADOW_LOAD），替换已有的影子规则集 */
+int ShadowLoadUser(const struct ShadowLoad __user *arg) {
+    struct ShadowLoad load;
+    struct ShadowSet *shadow, *old;
+    unsigned int count;
+    void *image;
+    int iRet;
+
+    if(copy_from_user(&load, arg, sizeof(load)) != 0) {
+        return -EFAULT;
+    }
+    if(load.sample == 0) {
+        return -EINVAL;
+    }
+    image = RuleImageFromUser(load.image.data, load.image.size);
+    if(IS_ERR(image)) {
+        return PTR_ERR(image);
+    }
+
+    shadow = (struct ShadowSet *)kzalloc(sizeof(struct ShadowSet), GFP_KERNEL);
+    if(shadow == NULL) {
+        vfree(image);
+        return -ENOMEM;
+    }
+    shadow->stat = alloc_percpu(struct ShadowCpuStat);
+    if(shadow->stat == NULL) {
+        kfree(shadow);
+        vfree(image);
+        return -ENOMEM;
+    }
+    iRet = RuleImageBuild(image, load.image.size, 0, &shadow->list, &shadow->cls);
+    vfree(image);
+    if(iRet != 0) {
+        free_percpu(shadow->stat);
+        kfree(shadow);
+        return iRet;
+    }
+    shadow->cls = ClassifierRefit(shadow->cls, &shadow->list);
+    spin_lock_init(&shadow->pair_lock);
+    shadow->sample = load.sample;
+    shadow->loaded = jiffies;
+    count = shadow->list.length;
+
+    mutex_lock(&g_rule_mutex);
+    old = ShadowUnpublish();
+    rcu_assign_pointer(g_shadow, shadow);
+    mutex_unlock(&g_rule_mutex);
+
+    if(old != NULL) {
+        synchronize_rcu();
+        ShadowFree(old);
+    }
+    printk("shadow rule set: %u rules loaded, sampling 1 in %u\n", count, load.sample);
+
+    return 0;
+}
+
+/*
+ * 影子规则集整体替换当前规则表和默认规则（ioctl IO_CTRL_SHADOW_PROMOTE）。
+ * 先摘下影子规则集，释放 g_rule_mutex 等待宽限期（不阻塞其他写者），hook 不再读它之后
+ * 才重新加锁给规则分配正式编号，分类器只改写表项 id 后直接发布，读者要么看到旧规则集，
+ * 要么看到新规则集。等待期间又装入了新的影子规则集时放弃提升，返回 -EAGAIN。
+ */
+int ShadowPromote(void) {
+    struct ShadowSet *shadow;
+    struct RuleNode *cur;
+    unsigned int count;
+
+    mutex_lock(&g_rule_mutex);
+    shadow = ShadowUnpublish();
+    mutex_unlock(&g_rule_mutex);
+    if(shadow == NULL) {
+        return -ENOENT;
+    }
+    synchronize_rcu();
+
+    mutex_lock(&g_rule_mutex);
+    if(rcu_access_pointer(g_shadow) != NULL) {
+        mutex_unlock(&g_rule_mutex);
+        ShadowFree(shadow);
+        return -EAGAIN;
+    }
+    for(cur = shadow->list.head; cur != NULL; cur = cur->next) {
+        RuleListAssignId(cur);
+    }
+    ClassifierRenumber(shadow->cls);
+    count = shadow->list.length;
+    RuleListSwap(&shadow->list);
+    RuleListCommitClassifier(shadow->cls);
+    shadow->cls = NULL;
+    mutex_unlock(&g_rule_mutex);
+
+    ShadowFree(shadow);
+    printk("shadow rule set: promoted, %u rules\n", count);
+
+    return 0;
+}
+
+/* 丢弃影子规则集（ioctl IO_CTRL_SHADOW_DROP） */
+int ShadowDrop(void) {
+    struct ShadowSet *shadow;
+
+    mutex_lock(&g_rule_mutex);
+    shadow = ShadowUnpublish();
+    mutex_unlock(&g_rule_mutex);
+    if(shadow == NULL) {
+        return -ENOENT;
+    }
+    synchronize_rcu();
+    ShadowFree(shadow);
+
+    return 0;
+}
+
+void ShadowGetStat(struct ShadowStat *stat) {
+    const struct ShadowCpuStat *cpu_stat;
+    struct ShadowSet *shadow;
+    unsigned int i, n = 0;
+    int cpu;
+
+    memset(stat, 0, sizeof(*stat));
+    mutex_lock(&g_rule_mutex);
+    shadow = rcu_dereference_protected(g_shadow, 1);
+    if(shadow != NULL) {
+        stat->loaded = 1;
+        stat->rules = shadow->list.length;
+        stat->default_rule = shadow->list.default_rule;
+        stat->sample = shadow->sample;
+        stat->age = (jiffies - shadow->loaded) / HZ;
+        for_each_possible_cpu(cpu) {
+            cpu_stat = per_cpu_ptr(shadow->stat, cpu);
+            stat->samples += cpu_stat->samples;
+            stat->disagreements += cpu_stat->disagreements;
+            stat->live_ns += cpu_stat->live_ns;
+            stat->shadow_ns += cpu_stat->shadow_ns;
+            stat->live_evaluated += cpu_stat->live_evaluated;
+            stat->shadow_evaluated += cpu_stat->shadow_evaluated;
+        }
+        spin_lock_bh(&shadow->pair_lock);
+        for(i = 0; i < SHADOW_PAIR_MAX; ++i) {
+            if(shadow->pair[i].count != 0) {
+                stat->pair[n++] = shadow->pair[i];
+            }
+        }
+        stat->pair_count = n;
+        stat->pairs_lost = shadow->pairs_lost;
+        spin_unlock_bh(&shadow->pair_lock);
+    }
+    mutex_unlock(&g_rule_mutex);
+}
+
+/* 模块卸载时调用，hook 已注销 */
+void ShadowExit(void) {
+    ShadowDrop();
+}
@@ -0,0 +1,31 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <linux/types.h>
+#include <linux/rcupdate.h>
+
+#include "../common.h"
+#include "rule_list_manage.h"
+
+struct ShadowSet;
+
+extern struct ShadowSet __rcu *g_shadow;
+
+struct ShadowSet *ShadowSampleSlow(struct ShadowSet *);
+
+/* 本包是否要再用影子规则集判决，是则返回影子规则集。调用方处于 RCU 读临界区 */
+static inline struct ShadowSet *ShadowSample(void) {
+    struct ShadowSet *shadow = rcu_dereference(g_shadow);
+
+    return shadow == NULL ? NULL : ShadowSampleSlow(shadow);
+}
+
+void ShadowEval(struct ShadowSet *, const struct RuleNode *packet, const struct RuleNode *live_node,
+                enum Rule live_rule, unsigned int live_evaluated, u64 live_ns);
+int ShadowLoadUser(const struct ShadowLoad __user *arg);
+int ShadowPromote(void);
+int ShadowDrop(void);
+void ShadowGetStat(struct ShadowStat *);
+void ShadowExit(void);
+
+#endif
@@ -0,0 +1,102 @@
+// FileName: myNetfilter_kernel/stats_map.c 
+// Describe: 可 mmap 的只读统计区（全局计数、每条规则命中数、规则集版本号）
+// Note: 由后台任务周期性刷新，用户态直接读内存，无需每次系统调用。
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+
+#include "../common.h"
+#include "stats_map.h"
+#include "rule_list_manage.h"
+#include "filter_action.h"
+
+/*
+ * stats_map_rules 为统计区可容纳的规则数，超出部分只计入 rule_total。
+ * stats_map_interval_ms 为刷新周期。
+ */
+static unsigned int stats_map_rules = 65536;
+module_param(stats_map_rules, uint, 0444);
+MODULE_PARM_DESC(stats_map_rules, "per-rule counter slots in the mmap stats region");
+static unsigned int stats_map_interval_ms = 100;
+module_param(stats_map_interval_ms, uint, 0644);
+MODULE_PARM_DESC(stats_map_interval_ms, "stats region refresh interval in ms");
+
+extern struct RuleList g_rule_list;
+
+static struct StatsMapHeader *g_stats_map = NULL;
+static unsigned long g_stats_map_size = 0;
+static void StatsMapUpdate(struct work_struct *work);
+static DECLARE_DELAYED_WORK(g_stats_map_work, StatsMapUpdate);
+
+static void StatsMapUpdate(struct work_struct *work) {
+    struct StatsMapHeader *map = g_stats_map;
+    struct RuleNode *cur;
+    unsigned int i;
+    unsigned int interval = stats_map_interval_ms ? stats_map_interval_ms : 100;
+
+    mutex_lock(&g_rule_mutex);
+    ++map->seq;
+    smp_wmb();
+
+    map->generation = g_rule_list.generation;
+    map->rule_total = g_rule_list.length;
+    map->interval_ms = interval;
+    for(i = 0, cur = g_rule_list.head; cur != NULL && i < map->capacity; ++i, cur = cur->next) {
+        map->rules[i] = atomic_long_read(&cur->hits);
+    }
+    map->rule_count = i;
+    FilterGetStat(&map->global);
+    map->update_ns = ktime_get_ns();
+
+    smp_wmb();
+    ++map->seq;
+    mutex_unlock(&g_rule_mutex);
+
+    schedule_delayed_work(&g_stats_map_work, msecs_to_jiffies(interval));
+}
+
+int StatsMapInit(void) {
+    g_stats_map_size = PAGE_ALIGN(sizeof(struct StatsMapHeader)
+                                  + (unsigned long)stats_map_rules * sizeof(unsigned long long));
+    g_stats_map = (struct StatsMapHeader *)vmalloc_user(g_stats_map_size);
+    if(g_stats_map == NULL) {
+        return -ENOMEM;
+    }
+    g_stats_map->magic = STATS_MAP_MAGIC;
+    g_stats_map->capacity = stats_map_rules;
+
+    schedule_delayed_work(&g_stats_map_work, 0);
+    return 0;
+}
+
+void StatsMapExit(void) {
+    cancel_delayed_work_sync(&g_stats_map_work);
+    vfree(g_stats_map);
+    g_stats_map = NULL;
+}
+
+unsigned long StatsMapGetMem(void) {
+    return g_stats_map_size;
+}
+
+/*
+ * 只允许只读共享映射，映射长度不超过统计区大小。
+ */
+int StatsMapMmap(struct file *file, struct vm_area_struct *vma) {
+    unsigned long size = vma->vm_end - vma->vm_start;
+
+    if(vma->vm_flags & VM_WRITE) {
+        return -EPERM;
+    }
+    if(vma->vm_pgoff != 0 || size > g_stats_map_size) {
+        return -EINVAL;
+    }
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    return remap_vmalloc_range(vma, g_stats_map, 0);
+}
@@ -0,0 +1,12 @@
+#ifndef STATS_MAP_H
+#define STATS_MAP_H
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+
+int StatsMapInit(void);
+void StatsMapExit(void);
+int StatsMapMmap(struct file *file, struct vm_area_struct *vma);
+unsigned long StatsMapGetMem(void);
+
+#endif
@@ -0,0 +1,83 @@
+// FileName: myNetfilter_kernel/tinyfw_trace.h 
+// Describe: 报文分类跟踪点 tinyfw:tinyfw_classify
+// Note: 跟踪点由 static key 保护，未启用时 hook 中只有一条空跳转，参数也不会求值。
+//       可用 ftrace/perf 按字段过滤，例如：
+//       echo 'saddr == 0x0a000001 && dport == 80' > events/tinyfw/tinyfw_classify/filter
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tinyfw
+
+#if !defined(_TINYFW_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TINYFW_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter.h>
+
+#include "rule_list_manage.h"
+
+//判决来源
+#define TINYFW_SRC_RULE     0   //rule = id of the matched rule (see tinyfw_nf dump)
+#define TINYFW_SRC_DEFAULT  1   //no rule matched
+#define TINYFW_SRC_BAN      2   //dynamic ban table
+#define TINYFW_SRC_SCAN     3   //source flagged by the port scan detector
+#define TINYFW_SRC_FRAG     4   //later fragment, rule = that of its first fragment, 0 for orphans
+
+TRACE_EVENT(tinyfw_classify,
+
+    TP_PROTO(const struct net_device *in, const struct RuleNode *packet, unsigned int source,
+             unsigned int rule, unsigned int evaluated, unsigned int generation, unsigned int verdict),
+
+    TP_ARGS(in, packet, source, rule, evaluated, generation, verdict),
+
+    TP_STRUCT__entry(
+        __array(char, ifname, IFNAMSIZ)
+        __field(u32, saddr)         //host byte order
+        __field(u32, daddr)
+        __field(u16, sport)
+        __field(u16, dport)
+        __field(u8, proto)          //enum PackageType
+        __field(u8, source)
+        __field(u8, verdict)        //NF_ACCEPT / NF_DROP / NF_QUEUE
+        __field(u32, rule)
+        __field(u32, evaluated)     //rules compared before the verdict
+        __field(u32, generation)
+    ),
+
+    TP_fast_assign(
+        strlcpy(__entry->ifname, in ? in->name : "", IFNAMSIZ);
+        __entry->saddr = packet->srcip;
+        __entry->daddr = packet->dstip;
+        __entry->proto = packet->type;
+        __entry->sport = (packet->type == PACKAGE_TYPE_ICMP) ? 0 : packet->srcport;
+        __entry->dport = (packet->type == PACKAGE_TYPE_ICMP) ? 0 : packet->dstport;
+        __entry->source = source;
+        __entry->verdict = verdict & NF_VERDICT_MASK;
+        __entry->rule = rule;
+        __entry->evaluated = evaluated;
+        __entry->generation = generation;
+    ),
+
+    TP_printk("%s %s %u.%u.%u.%u:%u -> %u.%u.%u.%u:%u %s rule=%u evaluated=%u gen=%u verdict=%s",
+        __entry->ifname,
+        __print_symbolic(__entry->proto, { PACKAGE_TYPE_TCP, "TCP" }, { PACKAGE_TYPE_UDP, "UDP" },
+                         { PACKAGE_TYPE_ICMP, "ICMP" }, { PACKAGE_TYPE_ANY, "IP" }),
+        __entry->saddr >> 24, (__entry->saddr >> 16) & 0xff,
+        (__entry->saddr >> 8) & 0xff, __entry->saddr & 0xff, __entry->sport,
+        __entry->daddr >> 24, (__entry->daddr >> 16) & 0xff,
+        (__entry->daddr >> 8) & 0xff, __entry->daddr & 0xff, __entry->dport,
+        __print_symbolic(__entry->source, { TINYFW_SRC_RULE, "match" },
+                         { TINYFW_SRC_DEFAULT, "default" }, { TINYFW_SRC_BAN, "ban" },
+                         { TINYFW_SRC_SCAN, "scan" }, { TINYFW_SRC_FRAG, "frag" }),
+        __entry->rule, __entry->evaluated, __entry->generation,
+        __print_symbolic(__entry->verdict, { NF_ACCEPT, "accept" }, { NF_DROP, "drop" },
+                         { NF_QUEUE, "queue" }))
+);
+
+#endif /* _TINYFW_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tinyfw_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,472 @@
+// conf --diff：对比已安装规则与配置文件，生成最小编辑脚本并作为一个原子批量事务提交
+//
+// 1. 通过 generic netlink 分页导出当前规则及版本号；
+// 2. 去掉公共前缀/后缀后用 Myers 算法求最短编辑序列（插入+删除）；
+// 3. 相同规则的一删一插合并为移动，保留其命中计数；
+// 4. 在用户态模拟执行得到每个操作的位置，连同版本号一起提交，版本不符时重试。
+// 编辑数超过 DIFF_MAX_EDITS 时退化为在同一事务中整体替换。
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/genetlink.h>
+
+#include "../common.h"
+#include "genl_client.h"
+#include "rule_spec.h"
+#include "conf_diff.h"
+
+#define DIFF_RETRY 3
+
+struct ScriptEntry {
+    unsigned char type;     //enum DiffOpType
+    int a;                  //index in old list
+    int b;                  //index in new list
+};
+
+/*
+ * Myers O((N+M)D) 差分。trace[d] 保存第 d 轮开始前 V 在 [-d-1, d+1] 上的取值，
+ * 用于回溯出编辑序列。编辑距离超过 max_d 时返回-1。
+ * 成功时 *o_script 按正序给出 KEEP/DEL/INS 序列，返回其长度。
+ */
+static int Myers(const struct RuleSpec *a, int n, const struct RuleSpec *b, int m, int max_d,
+                 struct ScriptEntry **o_script) {
+    int *v, *trace, *tv;
+    size_t *trace_off;
+    struct ScriptEntry *script;
+    int off = max_d + 1;
+    int d, k, x, y, prev_k, prev_x, prev_y, len = 0, found = -1;
+
+    if(max_d > n + m) {
+        max_d = n + m;
+    }
+    v = (int *)calloc(2 * off + 1, sizeof(int));
+    trace = (int *)malloc(sizeof(int) * ((size_t)(max_d + 2) * (max_d + 2) + 4));
+    trace_off = (size_t *)malloc(sizeof(size_t) * (max_d + 1));
+    script = (struct ScriptEntry *)malloc(sizeof(struct ScriptEntry) * (n + m + 1));
+    if(v == NULL || trace == NULL || trace_off == NULL || script == NULL) {
+        free(v); free(trace); free(trace_off); free(script);
+        return -1;
+    }
+
+    for(d = 0, tv = trace; d <= max_d && found < 0; ++d) {
+        trace_off[d] = tv - trace;
+        memcpy(tv, v + off - d - 1, sizeof(int) * (2 * d + 3));
+        tv += 2 * d + 3;
+        for(k = -d; k <= d; k += 2) {
+            if(k == -d || (k != d && v[off + k - 1] < v[off + k + 1])) {
+                x = v[off + k + 1];         //down: insert b[y]
+            }
+            else {
+                x = v[off + k - 1] + 1;     //right: delete a[x]
+            }
+            y = x - k;
+            while(x < n && y < m && RuleSpecEqual(&a[x], &b[y])) {
+                ++x;
+                ++y;
+            }
+            v[off + k] = x;
+            if(x >= n && y >= m) {
+                found = d;
+                break;
+            }
+        }
+    }
+    if(found < 0) {
+        free(v); free(trace); free(trace_off); free(script);
+        return -1;
+    }
+
+    //回溯（逆序生成）
+    x = n;
+    y = m;
+    for(d = found; d >= 0; --d) {
+        tv = trace + trace_off[d] + d + 1;  //tv[k] == V[k] before round d
+        k = x - y;
+        if(k == -d || (k != d && tv[k - 1] < tv[k + 1])) {
+            prev_k = k + 1;
+        }
+        else {
+            prev_k = k - 1;
+        }
+        prev_x = (d == 0) ? 0 : tv[prev_k];
+        prev_y = prev_x - prev_k;
+        if(d == 0) {
+            prev_y = 0;
+        }
+        while(x > prev_x && y > prev_y) {
+            --x;
+            --y;
+            script[len].type = DIFF_KEEP;
+            script[len].a = x;
+            script[len++].b = y;
+        }
+        if(d > 0) {
+            if(x == prev_x) {
+                script[len].type = DIFF_INS;
+                script[len].a = x;
+                script[len++].b = prev_y;
+            }
+            else {
+                script[len].type = DIFF_DEL;
+                script[len].a = prev_x;
+                script[len++].b = y;
+            }
+        }
+        x = prev_x;
+        y = prev_y;
+    }
+    for(k = 0; k < len / 2; ++k) {
+        struct ScriptEntry temp = script[k];
+        script[k] = script[len - 1 - k];
+        script[len - 1 - k] = temp;
+    }
+
+    free(v); free(trace); free(trace_off);
+    *o_script = script;
+    return len;
+}
+
+static int IndexOf(const int *sim, int len, int id) {
+    int i;
+
+    for(i = 0; i < len; ++i) {
+        if(sim[i] == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * 由编辑序列生成按顺序执行的 ADD/DEL/MOVE 操作。编辑序列不含长为 pre、suf 的公共前缀、后缀。
+ * 在数组上模拟执行以得到每一步的1基位置（与内核 RuleListInsertAt/DeleteAt/MoveAt 语义一致），
+ * 最后校验模拟结果等于目标序列。
+ */
+static int BuildOps(const struct ScriptEntry *script, int len, int n, int m, int pre, int suf,
+                    const struct RuleSpec *a, const struct RuleSpec *b,
+                    struct DiffOp *ops, int *o_count) {
+    int *sim, *new_id, *pair_of_del, *pair_of_ins;
+    int i, j, p, prev, sim_len = n, count = 0, iRet = 0;
+
+    sim = (int *)malloc(sizeof(int) * (n + m + 1));
+    new_id = (int *)malloc(sizeof(int) * (m + 1));
+    pair_of_del = (int *)malloc(sizeof(int) * (len + 1));
+    pair_of_ins = (int *)malloc(sizeof(int) * (len + 1));
+    if(sim == NULL || new_id == NULL || pair_of_del == NULL || pair_of_ins == NULL) {
+        iRet = -1;
+        goto out;
+    }
+    for(i = 0; i < n; ++i) {
+        sim[i] = i;
+    }
+
+    //相同规则的删除与插入配对为移动
+    for(i = 0; i < len; ++i) {
+        pair_of_del[i] = pair_of_ins[i] = -1;
+    }
+    for(i = 0; i < len; ++i) {
+        if(script[i].type != DIFF_INS) {
+            continue;
+        }
+        for(j = 0; j < len; ++j) {
+            if(script[j].type == DIFF_DEL && pair_of_del[j] < 0
+                    && RuleSpecEqual(&a[script[j].a], &b[script[i].b])) {
+                pair_of_del[j] = i;
+                pair_of_ins[i] = j;
+                break;
+            }
+        }
+    }
+    for(i = 0; i < pre; ++i) {
+        new_id[i] = i;
+    }
+    for(i = 1; i <= suf; ++i) {
+        new_id[m - i] = n - i;
+    }
+    for(i = 0; i < len; ++i) {
+        if(script[i].type == DIFF_KEEP) {
+            new_id[script[i].b] = script[i].a;
+        }
+        else if(script[i].type == DIFF_INS) {
+            new_id[script[i].b] = pair_of_ins[i] >= 0 ? script[pair_of_ins[i]].a : n + script[i].b;
+        }
+    }
+
+    for(i = 0; i < len; ++i) {
+        if(script[i].type == DIFF_DEL && pair_of_del[i] < 0) {
+            p = IndexOf(sim, sim_len, script[i].a);
+            ops[count].op = TINYFW_CMD_DEL;
+            ops[count++].pos = p + 1;
+            memmove(sim + p, sim + p + 1, sizeof(int) * (sim_len - p - 1));
+            --sim_len;
+        }
+        else if(script[i].type == DIFF_INS) {
+            j = script[i].b;
+            if(pair_of_ins[i] >= 0) {
+                p = IndexOf(sim, sim_len, new_id[j]);
+                memmove(sim + p, sim + p + 1, sizeof(int) * (sim_len - p - 1));
+                --sim_len;
+                ops[count].op = TINYFW_CMD_MOVE;
+                ops[count].pos = p + 1;
+            }
+            else {
+                ops[count].op = TINYFW_CMD_ADD;
+                ops[count].rule = &b[j];
+            }
+            prev = (j == 0) ? -1 : IndexOf(sim, sim_len, new_id[j - 1]);
+            ops[count].to = prev + 2;
+            if(ops[count].op == TINYFW_CMD_ADD) {
+                ops[count].pos = prev + 2;
+            }
+            if(ops[count].op != TINYFW_CMD_MOVE || ops[count].pos != ops[count].to) {
+                ++count;
+            }
+            memmove(sim + prev + 2, sim + prev + 1, sizeof(int) * (sim_len - prev - 1));
+            sim[prev + 1] = new_id[j];
+            ++sim_len;
+        }
+    }
+
+    if(sim_len != m) {
+        iRet = -1;
+        goto out;
+    }
+    for(i = 0; i < m; ++i) {
+        if(sim[i] != new_id[i]) {
+            iRet = -1;
+            goto out;
+        }
+    }
+    *o_count = count;
+
+out:
+    free(sim); free(new_id); free(pair_of_del); free(pair_of_ins);
+    return iRet;
+}
+
+/*
+ * 计算把 old_rules 变为 new_rules 的有序操作序列。
+ * 编辑距离超过 DIFF_MAX_EDITS 时返回整体替换（先全部删除再依次追加）。
+ * 返回0表示成功，*o_ops 由调用方释放。
+ */
+int DiffRules(const struct RuleSpec *old_rules, int n, const struct RuleSpec *new_rules, int m,
+              struct DiffOp **o_ops, int *o_count) {
+    struct ScriptEntry *script = NULL;
+    struct DiffOp *ops;
+    int pre = 0, suf = 0, len, i;
+
+    //公共前缀、后缀不参与差分，常见的小改动只需线性比较
+    while(pre < n && pre < m && RuleSpecEqual(&old_rules[pre], &new_rules[pre])) {
+        ++pre;
+    }
+    while(suf < n - pre && suf < m - pre
+            && RuleSpecEqual(&old_rules[n - 1 - suf], &new_rules[m - 1 - suf])) {
+        ++suf;
+    }
+
+    ops = (struct DiffOp *)malloc(sizeof(struct DiffOp) * (n + m + 1));
+    if(ops == NULL) {
+        return -1;
+    }
+    len = Myers(old_rules + pre, n - pre - suf, new_rules + pre, m - pre - suf,
+                DIFF_MAX_EDITS, &script);
+    if(len >= 0) {
+        for(i = 0; i < len; ++i) {
+            script[i].a += pre;
+            script[i].b += pre;
+        }
+        if(BuildOps(script, len, n, m, pre, suf, old_rules, new_rules, ops, o_count) == 0) {
+            free(script);
+            *o_ops = ops;
+            return 0;
+        }
+        free(script);
+    }
+
+    //fallback: replace everything in one transaction
+    for(i = 0; i < n; ++i) {
+        ops[i].op = TINYFW_CMD_DEL;
+        ops[i].pos = 1;
+    }
+    for(i = 0; i < m; ++i) {
+        ops[n + i].op = TINYFW_CMD_ADD;
+        ops[n + i].pos = i + 1;
+        ops[n + i].rule = &new_rules[i];
+    }
+    *o_count = n + m;
+    *o_ops = ops;
+    return 0;
+}
+
+static int DumpCollect(const struct nlmsghdr *nlh, void *arg) {
+    struct RuleSpecArray *array = (struct RuleSpecArray *)arg;
+    const struct nlattr *tb[TINYFW_A_MAX + 1];
+    struct RuleSpec rule;
+
+    NlParseMsg(tb, TINYFW_A_MAX, nlh);
+    if(NlGetRule(tb[TINYFW_A_RULE], &rule, NULL) != 0) {
+        return 0;
+    }
+    array->generation = NlGetU32(tb[TINYFW_A_GENERATION]);
+    return RuleSpecArrayPush(array, &rule) == 0 ? 0 : -ENOMEM;
+}
+
+static int GenerationCollect(const struct nlmsghdr *nlh, void *arg) {
+    const struct nlattr *tb[TINYFW_A_MAX + 1];
+
+    NlParseMsg(tb, TINYFW_A_MAX, nlh);
+    *(unsigned int *)arg = NlGetU32(tb[TINYFW_A_GENERATION]);
+    return 0;
+}
+
+/* 导出当前规则，返回0成功；generation 为导出时的版本号 */
+static int FetchRules(struct GenlSock *sock, struct RuleSpecArray *array) {
+    struct NlMsg msg;
+    int iRet;
+
+    array->count = 0;
+    if(NlMsgInit(&msg, sock->family, 0, TINYFW_CMD_GET_STATS) != 0) {
+        return -ENOMEM;
+    }
+    iRet = GenlTalk(sock, &msg, GenerationCollect, &array->generation);
+    NlMsgFree(&msg);
+    if(iRet != 0) {
+        return iRet;
+    }
+
+    if(NlMsgInit(&msg, sock->family, NLM_F_DUMP, TINYFW_CMD_DUMP) != 0) {
+        return -ENOMEM;
+    }
+    iRet = GenlTalk(sock, &msg, DumpCollect, array);
+    NlMsgFree(&msg);
+    return iRet;
+}
+
+/*
+ * 把操作序列编码为 TINYFW_CMD_BATCH 消息的属性，msg 已由 NlMsgInit 初始化。
+ * 各操作是顶层的 TINYFW_A_BATCH_OP 属性：嵌套属性的 nla_len 只有16位，而 nlmsg_len 有32位；
+ * TINYFW_A_COUNT 给出操作数，内核据此拒绝被截断的消息。default_rule 小于0时不修改默认规则。
+ */
+int DiffEncodeBatch(struct NlMsg *msg, unsigned int generation, int default_rule,
+                    const struct DiffOp *ops, int count) {
+    size_t op_nest;
+    int i;
+
+    if(NlPutU32(msg, TINYFW_A_GENERATION, generation) != 0
+            || (default_rule >= 0 && NlPutU8(msg, TINYFW_A_DEFAULT, default_rule) != 0)
+            || NlPutU32(msg, TINYFW_A_COUNT, count) != 0) {
+        return -ENOMEM;
+    }
+    for(i = 0; i < count; ++i) {
+        if((op_nest = NlNestStart(msg, TINYFW_A_BATCH_OP)) == 0
+                || NlPutU8(msg, TINYFW_A_OP, ops[i].op) != 0
+                || NlPutU32(msg, TINYFW_A_POS, ops[i].pos) != 0
+                || (ops[i].op == TINYFW_CMD_MOVE && NlPutU32(msg, TINYFW_A_TO, ops[i].to) != 0)
+                || (ops[i].op == TINYFW_CMD_ADD && NlPutRule(msg, ops[i].rule) != 0)
+                || NlNestEnd(msg, op_nest) != 0) {
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+static int SendBatch(struct GenlSock *sock, unsigned int generation, int default_rule,
+                     const struct DiffOp *ops, int count) {
+    struct NlMsg msg;
+    int iRet;
+
+    if(NlMsgInit(&msg, sock->family, 0, TINYFW_CMD_BATCH) != 0) {
+        return -ENOMEM;
+    }
+    iRet = DiffEncodeBatch(&msg, generation, default_rule, ops, count);
+    if(iRet == 0) {
+        iRet = GenlTalk(sock, &msg, NULL, NULL);
+    }
+    NlMsgFree(&msg);
+    return iRet;
+}
+
+/*
+ * 按差异修改调用者所在 network namespace 的规则集，容器中执行即配置该容器的规则。
+ * def 为 "P" 或 "R" 时在同一事务中设置默认规则，NULL 表示不修改。
+ */
+int DoConfDiff(const char *path, const char *def) {
+    struct GenlSock sock;
+    struct RuleSpecArray new_rules, old_rules;
+    struct DiffOp *ops = NULL;
+    int count, i, iRet, fail, try;
+    int adds, dels, moves, default_rule = -1;
+
+    if(def != NULL) {
+        if(strcmp(def, "P") == 0) {
+            default_rule = RULE_PERMIT;
+        }
+        else if(strcmp(def, "R") == 0) {
+            default_rule = RULE_REJECT;
+        }
+        else {
+            printf("ONLY 'P' or 'R' is accepted as default rule!\n");
+            return -1;
+        }
+    }
+    memset(&new_rules, 0, sizeof(new_rules));
+    memset(&old_rules, 0, sizeof(old_rules));
+    if((fail = RuleSpecLoadConf(path, &new_rules)) < 0) {
+        return -1;
+    }
+
+    if((iRet = GenlOpen(&sock)) != 0) {
+        printf("open generic netlink family %s FAILED! (%s)\n", TINYFW_GENL_NAME, strerror(-iRet));
+        return -1;
+    }
+
+    for(try = 0; try < DIFF_RETRY; ++try) {
+        if((iRet = FetchRules(&sock, &old_rules)) != 0) {
+            if(iRet == -EINTR) {
+                continue;   //rule set changed during dump
+            }
+            printf("fetch installed rules FAILED! (%s)\n", strerror(-iRet));
+            break;
+        }
+        if(DiffRules(old_rules.rules, old_rules.count, new_rules.rules, new_rules.count,
+                     &ops, &count) != 0) {
+            printf("compute rule diff FAILED!\n");
+            iRet = -1;
+            break;
+        }
+
+        for(i = adds = dels = moves = 0; i < count; ++i) {
+            adds += (ops[i].op == TINYFW_CMD_ADD);
+            dels += (ops[i].op == TINYFW_CMD_DEL);
+            moves += (ops[i].op == TINYFW_CMD_MOVE);
+        }
+        printf("installed %d rules, file %d rules (%d invalid lines): %d add, %d delete, %d move\n",
+               old_rules.count, new_rules.count, fail, adds, dels, moves);
+        if(count == 0 && default_rule < 0) {
+            free(ops);
+            iRet = 0;
+            break;
+        }
+
+        iRet = SendBatch(&sock, old_rules.generation, default_rule, ops, count);
+        free(ops);
+        if(iRet != -EAGAIN) {
+            break;
+        }
+        printf("rule set changed concurrently, retry...\n");
+    }
+
+    GenlClose(&sock);
+    free(new_rules.rules);
+    free(old_rules.rules);
+    if(iRet != 0) {
+        printf("apply rule diff FAILED! (%s)\n", iRet < 0 ? strerror(-iRet) : "unknown");
+        return -1;
+    }
+    printf("apply rule diff SUCCEED!\n");
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef CONF_DIFF_H
+#define CONF_DIFF_H
+
+#include "../common.h"
+
+enum DiffOpType {
+    DIFF_KEEP,
+    DIFF_DEL,
+    DIFF_INS
+};
+
+struct DiffOp {
+    unsigned char op;       //TINYFW_CMD_ADD/DEL/MOVE
+    unsigned int pos;
+    unsigned int to;        //MOVE only
+    const struct RuleSpec *rule;    //ADD only
+};
+
+int DiffRules(const struct RuleSpec *old_rules, int n, const struct RuleSpec *new_rules, int m,
+              struct DiffOp **o_ops, int *o_count);
+struct NlMsg;
+int DiffEncodeBatch(struct NlMsg *msg, unsigned int generation, int default_rule,
+                    const struct DiffOp *ops, int count);
+int DoConfDiff(const char *path, const char *def);
+
+#endif
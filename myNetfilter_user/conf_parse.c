@@ -0,0 +1,240 @@
+// 并行解析规则配置文件
+//
+// 文件整体 mmap 后按行边界切成若干段，每段由一个线程解析、校验为 struct RuleSpec，
+// 各段结果按段序拼接，因此规则顺序与逐行读取完全相同；出错行按全局行号报告。
+//
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../common.h"
+#include "rule_spec.h"
+#include "conf_parse.h"
+
+#define CONF_LINE_MAX 4096              //longer lines are invalid
+#define CONF_MIN_CHUNK (1UL << 20)      //smaller files are parsed by one thread
+#define CONF_MAX_THREADS 64
+#define CONF_ERROR_SHOW 100             //invalid lines printed
+
+struct ConfError {
+    unsigned int line;      //line number within the chunk, 1-based
+    unsigned int len;
+    const char *text;
+};
+
+struct ConfChunk {
+    const char *begin;
+    const char *end;
+    unsigned int lines;
+    struct RuleSpecArray rules;
+    struct ConfError *errors;
+    int error_count;
+    int error_cap;
+    int oom;
+    int threaded;       //parsed by its own thread, must be joined
+};
+
+static int ConfErrorPush(struct ConfChunk *chunk, unsigned int line, const char *text, size_t len) {
+    struct ConfError *temp;
+
+    if(chunk->error_count == chunk->error_cap) {
+        chunk->error_cap = chunk->error_cap ? chunk->error_cap * 2 : 64;
+        temp = (struct ConfError *)realloc(chunk->errors, sizeof(struct ConfError) * chunk->error_cap);
+        if(temp == NULL) {
+            return -1;
+        }
+        chunk->errors = temp;
+    }
+    chunk->errors[chunk->error_count].line = line;
+    chunk->errors[chunk->error_count].len = len < CONF_LINE_MAX ? len : CONF_LINE_MAX;
+    chunk->errors[chunk->error_count].text = text;
+    ++chunk->error_count;
+    return 0;
+}
+
+/* 解析 [begin, end) 中的各行，最后一行可以没有换行符；空行跳过 */
+static void *ConfParseChunk(void *arg) {
+    struct ConfChunk *chunk = (struct ConfChunk *)arg;
+    const char *cur = chunk->begin, *eol;
+    char line[CONF_LINE_MAX + 1];
+    struct RuleSpec rule;
+    size_t len;
+
+    while(cur < chunk->end && !chunk->oom) {
+        eol = (const char *)memchr(cur, '\n', chunk->end - cur);
+        if(eol == NULL) {
+            eol = chunk->end;
+        }
+        ++chunk->lines;
+        len = eol - cur;
+        while(len > 0 && (cur[len - 1] == '\r' || cur[len - 1] == ' ' || cur[len - 1] == '\t')) {
+            --len;
+        }
+        if(len != 0) {
+            if(len <= CONF_LINE_MAX) {
+                memcpy(line, cur, len);
+                line[len] = '\0';
+            }
+            if(len > CONF_LINE_MAX || RuleSpecParse(line, &rule) != 0) {
+                chunk->oom = ConfErrorPush(chunk, chunk->lines, cur, len) != 0;
+            }
+            else {
+                chunk->oom = RuleSpecArrayPush(&chunk->rules, &rule) != 0;
+            }
+        }
+        cur = eol + 1;
+    }
+
+    return NULL;
+}
+
+static int ConfThreads(size_t size, int threads) {
+    long cpus;
+
+    if(threads <= 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if(threads > CONF_MAX_THREADS) {
+        threads = CONF_MAX_THREADS;
+    }
+    if((size_t)threads > size / CONF_MIN_CHUNK) {
+        threads = size / CONF_MIN_CHUNK;
+    }
+    return threads > 0 ? threads : 1;
+}
+
+/*
+ * 解析内存中的配置文本，结果按文件行序追加到 array。
+ * threads 为0时按在线 CPU 数。返回无效行数，出错返回-1。
+ */
+int ConfParseBuffer(const char *buf, size_t size, struct RuleSpecArray *array, int threads) {
+    struct ConfChunk *chunks;
+    pthread_t *tids;
+    const char *cur = buf, *end = buf + size;
+    unsigned int line_base = 0;
+    int n, i, j, fail = 0, iRet = 0;
+    size_t total = 0;
+
+    n = ConfThreads(size, threads);
+    chunks = (struct ConfChunk *)calloc(n, sizeof(struct ConfChunk));
+    tids = (pthread_t *)calloc(n, sizeof(pthread_t));
+    if(chunks == NULL || tids == NULL) {
+        free(chunks);
+        free(tids);
+        return -1;
+    }
+
+    //split on line boundaries, the last chunk takes the rest
+    for(i = 0; i < n; ++i) {
+        chunks[i].begin = cur;
+        if(i == n - 1) {
+            cur = end;
+        }
+        else {
+            cur = buf + size / n * (i + 1);
+            if(cur < chunks[i].begin) {
+                cur = chunks[i].begin;
+            }
+            cur = (const char *)memchr(cur, '\n', end - cur);
+            cur = (cur == NULL) ? end : cur + 1;
+        }
+        chunks[i].end = cur;
+    }
+
+    for(i = 1; i < n; ++i) {
+        chunks[i].threaded = pthread_create(&tids[i], NULL, ConfParseChunk, &chunks[i]) == 0;
+    }
+    for(i = 0; i < n; ++i) {
+        if(!chunks[i].threaded) {
+            ConfParseChunk(&chunks[i]); //chunk 0, or thread creation failed
+        }
+    }
+    for(i = 1; i < n; ++i) {
+        if(chunks[i].threaded) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+
+    for(i = 0; i < n; ++i) {
+        if(chunks[i].oom) {
+            iRet = -1;
+        }
+        total += chunks[i].rules.count;
+    }
+    if(iRet == 0 && total > (size_t)(array->cap - array->count)) {
+        struct RuleSpec *temp = (struct RuleSpec *)realloc(array->rules,
+                                sizeof(struct RuleSpec) * (array->count + total));
+        if(temp == NULL) {
+            iRet = -1;
+        }
+        else {
+            array->rules = temp;
+            array->cap = array->count + total;
+        }
+    }
+
+    for(i = 0; i < n; ++i) {
+        for(j = 0; iRet == 0 && j < chunks[i].error_count; ++j, ++fail) {
+            if(fail < CONF_ERROR_SHOW) {
+                printf("line %u: invalid rule \"%.*s\"\n", line_base + chunks[i].errors[j].line,
+                       (int)chunks[i].errors[j].len, chunks[i].errors[j].text);
+            }
+        }
+        if(iRet == 0 && chunks[i].rules.count != 0) {
+            memcpy(array->rules + array->count, chunks[i].rules.rules,
+                   sizeof(struct RuleSpec) * chunks[i].rules.count);
+            array->count += chunks[i].rules.count;
+        }
+        line_base += chunks[i].lines;
+        free(chunks[i].rules.rules);
+        free(chunks[i].errors);
+    }
+    if(fail > CONF_ERROR_SHOW) {
+        printf("... %d more invalid lines\n", fail - CONF_ERROR_SHOW);
+    }
+    free(chunks);
+    free(tids);
+
+    return iRet == 0 ? fail : -1;
+}
+
+/* mmap 配置文件并解析，参数与返回值同 ConfParseBuffer */
+int ConfParseFile(const char *path, struct RuleSpecArray *array, int threads) {
+    struct stat st;
+    void *map;
+    int fd, iRet;
+
+    if((fd = open(path, O_RDONLY)) == -1) {
+        printf("open config file FAILED! (%s)\n", strerror(errno));
+        return -1;
+    }
+    if(fstat(fd, &st) == -1) {
+        printf("stat config file FAILED! (%s)\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if(st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        printf("mmap config file FAILED! (%s)\n", strerror(errno));
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    iRet = ConfParseBuffer((const char *)map, st.st_size, array, threads);
+    munmap(map, st.st_size);
+
+    return iRet;
+}
@@ -0,0 +1,11 @@
+#ifndef CONF_PARSE_H
+#define CONF_PARSE_H
+
+#include <stddef.h>
+
+#include "rule_spec.h"
+
+int ConfParseBuffer(const char *buf, size_t size, struct RuleSpecArray *array, int threads);
+int ConfParseFile(const char *path, struct RuleSpecArray *array, int threads);
+
+#endif
@@ -0,0 +1,369 @@
+// 基于原始 netlink 套接字的 generic netlink 客户端，不依赖 libnl
+//
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include "../common.h"
+#include "genl_client.h"
+
+#define NL_RECV_SIZE 65536
+
+static char g_recv_buff[NL_RECV_SIZE];
+
+int NlMsgInit(struct NlMsg *msg, unsigned short type, unsigned short flags, unsigned char cmd) {
+    struct nlmsghdr *nlh;
+    struct genlmsghdr *genlh;
+
+    msg->cap = 4096;
+    msg->buf = (char *)calloc(1, msg->cap);
+    if(msg->buf == NULL) {
+        return -1;
+    }
+    msg->len = NLMSG_HDRLEN + GENL_HDRLEN;
+
+    nlh = (struct nlmsghdr *)msg->buf;
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+    genlh = (struct genlmsghdr *)NLMSG_DATA(nlh);
+    genlh->cmd = cmd;
+    genlh->version = TINYFW_GENL_VERSION;
+
+    return 0;
+}
+
+void NlMsgFree(struct NlMsg *msg) {
+    free(msg->buf);
+    msg->buf = NULL;
+    msg->len = msg->cap = 0;
+}
+
+//nla_len 只有16位，属性（含嵌套属性的全部内容）不能超过 0xffff 字节
+int NlPut(struct NlMsg *msg, unsigned short type, const void *data, size_t len) {
+    struct nlattr *nla;
+    size_t need = NLA_ALIGN(NLA_HDRLEN + len);
+    char *temp;
+
+    if(NLA_HDRLEN + len > 0xffff) {
+        return -1;
+    }
+
+    while(msg->len + need > msg->cap) {
+        temp = (char *)realloc(msg->buf, msg->cap * 2);
+        if(temp == NULL) {
+            return -1;
+        }
+        memset(temp + msg->cap, 0, msg->cap);
+        msg->buf = temp;
+        msg->cap *= 2;
+    }
+
+    nla = (struct nlattr *)(msg->buf + msg->len);
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + len;
+    if(len != 0) {
+        memcpy((char *)nla + NLA_HDRLEN, data, len);
+    }
+    msg->len += need;
+
+    return 0;
+}
+
+int NlPutU8(struct NlMsg *msg, unsigned short type, unsigned char value) {
+    return NlPut(msg, type, &value, sizeof(value));
+}
+
+int NlPutU32(struct NlMsg *msg, unsigned short type, unsigned int value) {
+    return NlPut(msg, type, &value, sizeof(value));
+}
+
+/* 返回嵌套属性头的偏移，msg->buf 可能因扩容而移动，不能返回指针 */
+size_t NlNestStart(struct NlMsg *msg, unsigned short type) {
+    size_t offset = msg->len;
+
+    if(NlPut(msg, type | NLA_F_NESTED, NULL, 0) != 0) {
+        return 0;
+    }
+    return offset;
+}
+
+/* 嵌套属性超过 nla_len 能表示的长度时返回-1，调用方应放弃该消息 */
+int NlNestEnd(struct NlMsg *msg, size_t offset) {
+    struct nlattr *nla = (struct nlattr *)(msg->buf + offset);
+
+    if(msg->len - offset > 0xffff) {
+        return -1;
+    }
+    nla->nla_len = msg->len - offset;
+    return 0;
+}
+
+int NlPutRule(struct NlMsg *msg, const struct RuleSpec *rule) {
+    size_t nest = NlNestStart(msg, TINYFW_A_RULE);
+
+    if(nest == 0
+            || NlPutU8(msg, TINYFW_RA_TYPE, rule->type)
+            || NlPutU32(msg, TINYFW_RA_SRCIP, rule->srcip)
+            || NlPutU32(msg, TINYFW_RA_SRCMASK, rule->srcmask)
+            || NlPutU32(msg, TINYFW_RA_SRCPORT, rule->srcport)
+            || NlPutU32(msg, TINYFW_RA_DSTIP, rule->dstip)
+            || NlPutU32(msg, TINYFW_RA_DSTMASK, rule->dstmask)
+            || NlPutU32(msg, TINYFW_RA_DSTPORT, rule->dstport)
+            || NlPutU8(msg, TINYFW_RA_ACTION, rule->action)) {
+        return -1;
+    }
+
+    return NlNestEnd(msg, nest);
+}
+
+void NlParse(const struct nlattr **tb, int max, const void *data, int len) {
+    const struct nlattr *nla = (const struct nlattr *)data;
+    int type;
+
+    memset(tb, 0, sizeof(struct nlattr *) * (max + 1));
+    while(len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len) {
+        type = nla->nla_type & NLA_TYPE_MASK;
+        if(type <= max) {
+            tb[type] = nla;
+        }
+        len -= NLA_ALIGN(nla->nla_len);
+        nla = (const struct nlattr *)((const char *)nla + NLA_ALIGN(nla->nla_len));
+    }
+}
+
+void NlParseMsg(const struct nlattr **tb, int max, const struct nlmsghdr *nlh) {
+    NlParse(tb, max, (const char *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+            nlh->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN);
+}
+
+unsigned char NlGetU8(const struct nlattr *nla) {
+    return nla ? *(const unsigned char *)((const char *)nla + NLA_HDRLEN) : 0;
+}
+
+unsigned int NlGetU32(const struct nlattr *nla) {
+    unsigned int value = 0;
+
+    if(nla != NULL) {
+        memcpy(&value, (const char *)nla + NLA_HDRLEN, sizeof(value));
+    }
+    return value;
+}
+
+unsigned long long NlGetU64(const struct nlattr *nla) {
+    unsigned long long value = 0;
+
+    if(nla != NULL) {
+        memcpy(&value, (const char *)nla + NLA_HDRLEN, sizeof(value));
+    }
+    return value;
+}
+
+int NlGetRule(const struct nlattr *nla, struct RuleSpec *rule, unsigned long long *hits) {
+    const struct nlattr *tb[TINYFW_RA_MAX + 1];
+
+    if(nla == NULL) {
+        return -1;
+    }
+    NlParse(tb, TINYFW_RA_MAX, (const char *)nla + NLA_HDRLEN, nla->nla_len - NLA_HDRLEN);
+    memset(rule, 0, sizeof(*rule));
+    rule->type = NlGetU8(tb[TINYFW_RA_TYPE]);
+    rule->action = NlGetU8(tb[TINYFW_RA_ACTION]);
+    rule->srcip = NlGetU32(tb[TINYFW_RA_SRCIP]);
+    rule->srcmask = NlGetU32(tb[TINYFW_RA_SRCMASK]);
+    rule->srcport = NlGetU32(tb[TINYFW_RA_SRCPORT]);
+    rule->dstip = NlGetU32(tb[TINYFW_RA_DSTIP]);
+    rule->dstmask = NlGetU32(tb[TINYFW_RA_DSTMASK]);
+    rule->dstport = NlGetU32(tb[TINYFW_RA_DSTPORT]);
+    if(hits != NULL) {
+        *hits = NlGetU64(tb[TINYFW_RA_HITS]);
+    }
+
+    return 0;
+}
+
+static int GenlSendRaw(struct GenlSock *sock, struct NlMsg *msg) {
+    struct nlmsghdr *nlh = (struct nlmsghdr *)msg->buf;
+    struct sockaddr_nl addr;
+    int sndbuf;
+
+    //大批量事务可能超过默认发送缓冲区，按需扩大
+    if(msg->len > 128 * 1024) {
+        sndbuf = msg->len + 4096;
+        if(setsockopt(sock->fd, SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, sizeof(sndbuf)) < 0) {
+            setsockopt(sock->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        }
+    }
+
+    nlh->nlmsg_len = msg->len;
+    nlh->nlmsg_seq = ++sock->seq;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+
+    if(sendto(sock->fd, msg->buf, msg->len, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+/*
+ * 发送请求并接收应答，直到收到 ACK/NLMSG_DONE 或错误。
+ * 每条数据消息交给 handler 处理；handler 返回非0时提前结束。
+ * 成功返回0，失败返回负的 errno；分页导出期间规则集变化时返回 -EINTR。
+ */
+int GenlTalk(struct GenlSock *sock, struct NlMsg *msg, GenlHandler handler, void *arg) {
+    struct nlmsghdr *nlh;
+    struct nlmsgerr *err;
+    int len, iRet, intr = 0;
+
+    ((struct nlmsghdr *)msg->buf)->nlmsg_flags |= NLM_F_ACK;
+    if((iRet = GenlSendRaw(sock, msg)) != 0) {
+        return iRet;
+    }
+
+    for(;;) {
+        len = recv(sock->fd, g_recv_buff, NL_RECV_SIZE, 0);
+        if(len < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        for(nlh = (struct nlmsghdr *)g_recv_buff; len >= (int)NLMSG_HDRLEN;
+                nlh = NLMSG_NEXT(nlh, len)) {
+            if(nlh->nlmsg_type == NLMSG_ERROR && nlh->nlmsg_seq == sock->seq
+                    && len >= (int)NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+                //错误应答会回显整个请求，大批量请求时可能被截断，只取错误码
+                err = (struct nlmsgerr *)NLMSG_DATA(nlh);
+                return intr ? -EINTR : err->error;
+            }
+            if(!NLMSG_OK(nlh, (unsigned int)len)) {
+                break;
+            }
+            if(nlh->nlmsg_seq != sock->seq) {
+                continue;
+            }
+            if(nlh->nlmsg_flags & NLM_F_DUMP_INTR) {
+                intr = 1;
+            }
+            if(nlh->nlmsg_type == NLMSG_DONE) {
+                return intr ? -EINTR : 0;
+            }
+            if(handler != NULL && (iRet = handler(nlh, arg)) != 0) {
+                return iRet;
+            }
+        }
+    }
+}
+
+/* 阻塞接收一批多播事件 */
+int GenlRecvEvent(struct GenlSock *sock, GenlHandler handler, void *arg) {
+    struct nlmsghdr *nlh;
+    int len, iRet;
+
+    len = recv(sock->fd, g_recv_buff, NL_RECV_SIZE, 0);
+    if(len < 0) {
+        return -errno;
+    }
+    for(nlh = (struct nlmsghdr *)g_recv_buff; NLMSG_OK(nlh, (unsigned int)len);
+            nlh = NLMSG_NEXT(nlh, len)) {
+        if(nlh->nlmsg_type == sock->family && (iRet = handler(nlh, arg)) != 0) {
+            return iRet;
+        }
+    }
+    return 0;
+}
+
+/* 解析 CTRL_CMD_GETFAMILY 的应答，取得族 ID 与多播组 ID */
+static int GenlFamilyHandler(const struct nlmsghdr *nlh, void *arg) {
+    struct GenlSock *sock = (struct GenlSock *)arg;
+    const struct nlattr *tb[CTRL_ATTR_MAX + 1];
+    const struct nlattr *grp_tb[CTRL_ATTR_MCAST_GRP_MAX + 1];
+    const struct nlattr *grp;
+    int rem;
+
+    NlParseMsg(tb, CTRL_ATTR_MAX, nlh);
+    if(tb[CTRL_ATTR_FAMILY_ID] != NULL) {
+        memcpy(&sock->family, (const char *)tb[CTRL_ATTR_FAMILY_ID] + NLA_HDRLEN,
+               sizeof(sock->family));
+    }
+    if(tb[CTRL_ATTR_MCAST_GROUPS] == NULL) {
+        return 0;
+    }
+
+    grp = (const struct nlattr *)((const char *)tb[CTRL_ATTR_MCAST_GROUPS] + NLA_HDRLEN);
+    rem = tb[CTRL_ATTR_MCAST_GROUPS]->nla_len - NLA_HDRLEN;
+    while(rem >= NLA_HDRLEN && grp->nla_len >= NLA_HDRLEN && grp->nla_len <= rem) {
+        NlParse(grp_tb, CTRL_ATTR_MCAST_GRP_MAX, (const char *)grp + NLA_HDRLEN,
+                grp->nla_len - NLA_HDRLEN);
+        if(grp_tb[CTRL_ATTR_MCAST_GRP_NAME] != NULL && grp_tb[CTRL_ATTR_MCAST_GRP_ID] != NULL
+                && strcmp((const char *)grp_tb[CTRL_ATTR_MCAST_GRP_NAME] + NLA_HDRLEN,
+                          TINYFW_GENL_MCGRP) == 0) {
+            sock->mcgrp = NlGetU32(grp_tb[CTRL_ATTR_MCAST_GRP_ID]);
+        }
+        rem -= NLA_ALIGN(grp->nla_len);
+        grp = (const struct nlattr *)((const char *)grp + NLA_ALIGN(grp->nla_len));
+    }
+
+    return 0;
+}
+
+int GenlOpen(struct GenlSock *sock) {
+    struct sockaddr_nl addr;
+    struct NlMsg msg;
+    int iRet;
+
+    memset(sock, 0, sizeof(*sock));
+    sock->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if(sock->fd < 0) {
+        return -errno;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if(bind(sock->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        iRet = -errno;
+        close(sock->fd);
+        return iRet;
+    }
+
+    if(NlMsgInit(&msg, GENL_ID_CTRL, 0, CTRL_CMD_GETFAMILY) != 0) {
+        close(sock->fd);
+        return -ENOMEM;
+    }
+    ((struct genlmsghdr *)NLMSG_DATA((struct nlmsghdr *)msg.buf))->version = 1;
+    NlPut(&msg, CTRL_ATTR_FAMILY_NAME, TINYFW_GENL_NAME, strlen(TINYFW_GENL_NAME) + 1);
+    iRet = GenlTalk(sock, &msg, GenlFamilyHandler, sock);
+    NlMsgFree(&msg);
+    if(iRet == 0 && sock->family == 0) {
+        iRet = -ENOENT;
+    }
+    if(iRet != 0) {
+        close(sock->fd);
+        sock->fd = -1;
+    }
+
+    return iRet;
+}
+
+void GenlClose(struct GenlSock *sock) {
+    if(sock->fd >= 0) {
+        close(sock->fd);
+        sock->fd = -1;
+    }
+}
+
+int GenlSubscribe(struct GenlSock *sock) {
+    if(sock->mcgrp == 0) {
+        return -ENOENT;
+    }
+    if(setsockopt(sock->fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+                  &sock->mcgrp, sizeof(sock->mcgrp)) < 0) {
+        return -errno;
+    }
+    return 0;
+}
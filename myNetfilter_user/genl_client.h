@@ -0,0 +1,48 @@
+#ifndef GENL_CLIENT_H
+#define GENL_CLIENT_H
+
+#include <stddef.h>
+#include <linux/netlink.h>
+
+#include "../common.h"
+
+struct GenlSock {
+    int fd;
+    unsigned short family;      //resolved id of TINYFW_GENL_NAME
+    unsigned int mcgrp;         //resolved id of TINYFW_GENL_MCGRP
+    unsigned int seq;
+};
+
+//growable netlink message
+struct NlMsg {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+typedef int (*GenlHandler)(const struct nlmsghdr *nlh, void *arg);
+
+int GenlOpen(struct GenlSock *sock);
+void GenlClose(struct GenlSock *sock);
+int GenlSubscribe(struct GenlSock *sock);
+
+int NlMsgInit(struct NlMsg *msg, unsigned short type, unsigned short flags, unsigned char cmd);
+void NlMsgFree(struct NlMsg *msg);
+int NlPut(struct NlMsg *msg, unsigned short type, const void *data, size_t len);
+int NlPutU8(struct NlMsg *msg, unsigned short type, unsigned char value);
+int NlPutU32(struct NlMsg *msg, unsigned short type, unsigned int value);
+size_t NlNestStart(struct NlMsg *msg, unsigned short type);
+int NlNestEnd(struct NlMsg *msg, size_t offset);
+int NlPutRule(struct NlMsg *msg, const struct RuleSpec *rule);
+
+int GenlTalk(struct GenlSock *sock, struct NlMsg *msg, GenlHandler handler, void *arg);
+int GenlRecvEvent(struct GenlSock *sock, GenlHandler handler, void *arg);
+
+void NlParse(const struct nlattr **tb, int max, const void *data, int len);
+void NlParseMsg(const struct nlattr **tb, int max, const struct nlmsghdr *nlh);
+unsigned char NlGetU8(const struct nlattr *nla);
+unsigned int NlGetU32(const struct nlattr *nla);
+unsigned long long NlGetU64(const struct nlattr *nla);
+int NlGetRule(const struct nlattr *nla, struct RuleSpec *rule, unsigned long long *hits);
+
+#endif
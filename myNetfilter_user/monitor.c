@@ -0,0 +1,159 @@
+// 实时监控：mmap 内核只读统计区，按固定间隔计算并显示速率
+// 每次刷新只读共享内存，不产生取数的系统调用。
+//
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "../common.h"
+#include "monitor.h"
+
+#define MONITOR_TOP_N 10
+
+/* 按 seqlock 协议复制一份一致的快照 */
+static void StatsSnapshot(const struct StatsMapHeader *map, struct StatsMapHeader *out) {
+    unsigned int seq, n;
+
+    for(;;) {
+        seq = map->seq;
+        if(seq & 1) {
+            continue;   //writer in progress
+        }
+        __sync_synchronize();
+        memcpy(out, map, sizeof(*out));
+        n = out->rule_count < out->capacity ? out->rule_count : out->capacity;
+        memcpy(out->rules, map->rules, n * sizeof(unsigned long long));
+        out->rule_count = n;
+        __sync_synchronize();
+        if(map->seq == seq) {
+            return;
+        }
+    }
+}
+
+static double Rate(unsigned long long cur, unsigned long long pre, double secs) {
+    return cur >= pre ? (double)(cur - pre) / secs : 0.0;
+}
+
+static void Render(const struct StatsMapHeader *cur, const struct StatsMapHeader *pre) {
+    double secs = (double)(cur->update_ns - pre->update_ns) / 1e9;
+    double pps, drop;
+    unsigned int top[MONITOR_TOP_N];
+    unsigned long long delta, top_delta[MONITOR_TOP_N];
+    unsigned int i, j, k, ntop = 0;
+
+    pps = Rate(cur->global.packets, pre->global.packets, secs);
+    drop = Rate(cur->global.dropped, pre->global.dropped, secs);
+
+    printf("\033[H\033[2J");
+    printf("tinyfw_nf monitor    generation %u    rules %u    refresh %ums\n\n",
+           cur->generation, cur->rule_total, cur->interval_ms);
+    printf("  packets/s   %12.0f\n", pps);
+    printf("  accepted/s  %12.0f\n", Rate(cur->global.accepted, pre->global.accepted, secs));
+    printf("  dropped/s   %12.0f  (%5.1f%%)\n", drop, pps > 0 ? drop * 100.0 / pps : 0.0);
+    printf("  queued/s    %12.0f\n", Rate(cur->global.queued, pre->global.queued, secs));
+    printf("  replies/s   %12.0f\n", Rate(cur->global.replies, pre->global.replies, secs));
+    printf("  banned/s    %12.0f\n", Rate(cur->global.banned, pre->global.banned, secs));
+    printf("  rule hit/s  %12.0f\n", Rate(cur->global.rule_hits, pre->global.rule_hits, secs));
+    printf("  default/s   %12.0f\n", Rate(cur->global.default_hits, pre->global.default_hits, secs));
+    printf("  bypass/s    %12.0f  (prefilter, %.0f false positives/s)\n\n",
+           Rate(cur->global.prefilter_bypass, pre->global.prefilter_bypass, secs),
+           Rate(cur->global.prefilter_fp, pre->global.prefilter_fp, secs));
+
+    if(cur->generation != pre->generation) {
+        printf("  rule set changed, per-rule rates reset\n");
+        fflush(stdout);
+        return;
+    }
+
+    //选出命中速率最高的 MONITOR_TOP_N 条规则（插入排序）
+    for(i = 0; i < cur->rule_count && i < pre->rule_count; ++i) {
+        delta = cur->rules[i] - pre->rules[i];
+        if(delta == 0 || (ntop == MONITOR_TOP_N && delta <= top_delta[ntop - 1])) {
+            continue;
+        }
+        k = (ntop < MONITOR_TOP_N) ? ntop++ : ntop - 1;
+        for(j = k; j > 0 && top_delta[j - 1] < delta; --j) {
+            top[j] = top[j - 1];
+            top_delta[j] = top_delta[j - 1];
+        }
+        top[j] = i;
+        top_delta[j] = delta;
+    }
+    printf("  %6s  %12s  %16s\n", "num", "hits/s", "hits");
+    for(i = 0; i < ntop; ++i) {
+        printf("  %6u  %12.0f  %16llu\n", top[i] + 1, (double)top_delta[i] / secs, cur->rules[top[i]]);
+    }
+    if(cur->rule_total > cur->capacity) {
+        printf("\n  only first %u rules are tracked\n", cur->capacity);
+    }
+    fflush(stdout);
+}
+
+int DoMonitor(const char *str_interval) {
+    const struct StatsMapHeader *map;
+    struct StatsMapHeader *cur, *pre, *temp;
+    struct timespec ts;
+    size_t size, page = sysconf(_SC_PAGESIZE);
+    unsigned int interval_ms = 1000;
+    int fd, first = 1;
+
+    if(str_interval != NULL && atoi(str_interval) > 0) {
+        interval_ms = atoi(str_interval);
+    }
+
+    fd = open("/dev/myntfw", O_RDONLY);
+    if(fd < 0) {
+        printf("open char device FAILED!\n");
+        return -1;
+    }
+    //先映射一页读出容量，再映射完整区域
+    map = (const struct StatsMapHeader *)mmap(NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED || map->magic != STATS_MAP_MAGIC) {
+        printf("map stats region FAILED!\n");
+        close(fd);
+        return -1;
+    }
+    size = (sizeof(struct StatsMapHeader) + map->capacity * sizeof(unsigned long long) + page - 1)
+           / page * page;
+    munmap((void *)map, page);
+    map = (const struct StatsMapHeader *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  //映射建立后不再需要设备文件，也不占用单用户打开限制
+    if(map == MAP_FAILED) {
+        printf("map stats region FAILED!\n");
+        return -1;
+    }
+
+    cur = (struct StatsMapHeader *)malloc(size);
+    pre = (struct StatsMapHeader *)malloc(size);
+    if(cur == NULL || pre == NULL) {
+        printf("malloc FAILED!\n");
+        free(cur);
+        free(pre);
+        munmap((void *)map, size);
+        return -1;
+    }
+
+    ts.tv_sec = interval_ms / 1000;
+    ts.tv_nsec = (interval_ms % 1000) * 1000000L;
+    for(;;) {
+        StatsSnapshot(map, cur);
+        if(!first && cur->update_ns != pre->update_ns) {
+            Render(cur, pre);
+        }
+        if(first || cur->update_ns != pre->update_ns) {
+            temp = pre;
+            pre = cur;
+            cur = temp;
+            first = 0;
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    return 0;
+}
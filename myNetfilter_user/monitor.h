@@ -0,0 +1,6 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+int DoMonitor(const char *str_interval);
+
+#endif
@@ -7,10 +7,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <linux/genetlink.h>
 
 #include "../common.h"
+#include "genl_client.h"
+#include "rule_spec.h"
+#include "monitor.h"
+#include "conf_diff.h"
+#include "rule_image.h"
+#include "trace.h"
+#include "nfqueue.h"
 
 #define IO_BUFF_SIZE 4096
+#define BAN_BATCH_SIZE 4096     //ban entries sent per ioctl
 
 static char *io_buff = NULL;
 
@@ -27,6 +38,13 @@ void PrintHelpMsg() {
     printf("  list          show current rules.\n");
     printf("  conf          read rule list file and reset rules.\n");
     printf("                a file path args is needed.\n");
+    printf("                'conf --diff <file> [P|R]' applies only the differences\n");
+    printf("                in one atomic transaction and keeps hit counters;\n");
+    printf("                run it inside a network namespace (e.g. 'ip netns exec')\n");
+    printf("                to set that namespace's own rules and default rule.\n");
+    printf("  compile       compile a rule list file into a binary image.\n");
+    printf("                args: <conf file> <image file> [P|R default rule].\n");
+    printf("                load it with 'insmod myntfw.ko rule_image=<image file>'.\n");
     printf("  default       set default rules.\n");
     printf("                ONLY 'P' or 'R' as args is accepted.\n");
     printf("                P--PERMIT  R--REJECT\n");
@@ -35,13 +53,51 @@ void PrintHelpMsg() {
     printf("  del           delete a rule.\n");
     printf("                a num is needed to locate rule.\n");
     printf("                you can get the num by using list cmd\n");
+    printf("  ban           ban a source ip for a while.\n");
+    printf("                args: <ip> [seconds], 0 or none for ever.\n");
+    printf("  unban         remove a source ip from ban table.\n");
+    printf("  banload       ban every ip listed in a file.\n");
+    printf("                one '<ip> [seconds]' per line.\n");
+    printf("  banrm         unban every ip listed in a file.\n");
+    printf("  banflush      remove all ban entries.\n");
+    printf("  banstat       show ban table statistics.\n");
+    printf("  scanstat      show port scan detector statistics.\n");
+    printf("                enable it with the scan_detect module parameter.\n");
+    printf("                counts TCP SYN and ICMP echo requests, UDP only with scan_udp=1.\n");
+    printf("  fragstat      show fragment verdict cache statistics.\n");
+    printf("                later TCP/UDP fragments reuse the verdict of the first one.\n");
+    printf("  mem           show kernel memory used by rules and tables.\n");
+    printf("  engine        choose the classifier engine and recompile.\n");
+    printf("                ONLY 'auto', 'list', 'array' or 'tuple' as args is accepted.\n");
+    printf("                auto picks by rule set shape, 'stat' shows the current one.\n");
+    printf("  shadow        compare a candidate rule file with the live rules.\n");
+    printf("                'shadow load <file> [N]' evaluates it on 1 in N packets\n");
+    printf("                (64 by default) without enforcing it;\n");
+    printf("                'shadow' reports disagreements and timing,\n");
+    printf("                'shadow promote' makes it live atomically, 'shadow drop'.\n");
+    printf("  stat          show packet counters (generic netlink).\n");
+    printf("  dump          show all rules with hit counts (generic netlink).\n");
+    printf("                generic netlink cmds work on the caller's network namespace.\n");
+    printf("  events        print rule set change, threshold and scan events.\n");
+    printf("  trace         print how each packet from/to an address or port is classified.\n");
+    printf("                args: <ip|port> [seconds], 10 seconds by default.\n");
+    printf("  optimize      move frequently hit rules earlier, verdicts never change.\n");
+    printf("                '--dry-run' only reports the expected gain.\n");
+    printf("  monitor       live packet and rule hit rates from the mmap stats region.\n");
+    printf("                an optional refresh interval in ms is accepted.\n");
+    printf("  queue         judge packets of 'Q' rules in userspace through NFQUEUE.\n");
+    printf("                args: <conf file> [queues] [first queue] [P|R default rule],\n");
+    printf("                one pinned worker per queue, Ctrl-C to stop;\n");
+    printf("                load the module with queue_num=<first> queue_total=<queues>.\n");
     printf("\n");
     printf("Note:\n");
     printf("  How to write rule description:\n");
     printf("    1. a rule description includes 4 parts just like below:\n");
     printf("         <type> <srcip>/<mask>:<port> <dstip>/<dstmask>:<port> <rule>\n");
     printf("    2. <type> = T|U|I|A (TCP|UDP|ICMP|ANY);\n");
-
+    printf("    3. <rule> = P|R|Q|F (PERMIT|REJECT|QUEUE to the 'queue' cmd|\n");
+    printf("       REFUSE: drop and answer with TCP RST or ICMP unreachable,\n");
+    printf("       at most reject_pps replies per second per cpu);\n");
     printf("    4. <ip>/<mask> = ip/mask as usual or 'A' fro ANY IP;\n");
     printf("    5. <port> = port as usual or 'A' for ANY port.\n");
     printf("\n");
@@ -69,43 +125,60 @@ int DoList(int fd) {
     return 0;    
 }
 
-int DoConf(int fd, const char *str_arg) {
-    FILE *fp;
-    int succ = 0;
-    int fail = 0;
-    
-    printf("open config file ");
-    if((fp = fopen(str_arg, "rb")) == NULL) {
-        printf("FAILED!\n");
-        return -1;
+/*
+ * 解析配置文件（并行，见 conf_parse.c），连同当前默认规则编译为镜像，
+ * o_count/o_fail 返回有效与无效的规则数。失败返回NULL。
+ */
+static void *ConfImage(int fd, const char *path, size_t *o_len, int *o_count, int *o_fail) {
+    struct RuleSpecArray rules;
+    long def_rule;
+    void *image;
+
+    memset(&rules, 0, sizeof(rules));
+    if((*o_fail = RuleSpecLoadConf(path, &rules)) < 0) {
+        printf("read config file FAILED!\n");
+        return NULL;
     }
-    printf("OK!\n");
-    
-    if(ioctl(fd, IO_CTRL_CLE) == -1) {
-        printf("clean up old rule list FAILED!\n");
-        return -1;
+    if(ioctl(fd, IO_CTRL_GET_DEF, &def_rule) == -1) {
+        printf("get default rule FAILED!\n");
+        free(rules.rules);
+        return NULL;
     }
-    printf("clean up old rule list SUCCEED!\n");
 
-    while(fgets(io_buff, IO_BUFF_SIZE, fp) != NULL) {
-        char *temp = io_buff;
+    image = RuleImageBuild(rules.rules, rules.count,
+                           def_rule == IO_CTRL_PERMIT ? RULE_PERMIT : RULE_REJECT, o_len);
+    free(rules.rules);
+    if(image == NULL) {
+        printf("build rule image FAILED!\n");
+        return NULL;
+    }
+    *o_count = rules.count;
+    return image;
+}
 
-        //为了格式化输出，去掉尾部换行符。
-        while(*temp != '\n') ++temp;
-        *temp = '\0';
+/*
+ * 配置文件编译为镜像后一次性装入，
+ * 装入是原子的：读者要么看到旧规则集，要么看到新规则集。
+ */
+int DoConf(int fd, const char *str_arg) {
+    struct RuleImageBuf buf;
+    void *image;
+    size_t len;
+    int count, fail;
 
-        printf("set rule \"%s\"... ", io_buff);
-        if(write(fd, io_buff, IO_BUFF_SIZE) == -1) {
-            printf("FAILED!\n");
-            ++fail;
-        }
-        else {
-            printf("OK!\n");
-            ++succ;
-        }
+    if((image = ConfImage(fd, str_arg, &len, &count, &fail)) == NULL) {
+        return -1;
+    }
+    buf.size = len;
+    buf.data = image;
+    if(ioctl(fd, IO_CTRL_IMAGE, &buf) == -1) {
+        printf("set rules FAILED!\n");
+        free(image);
+        return -1;
     }
+    free(image);
 
-    printf("read %d rules and %d rules set succeed!\n", fail+succ, succ);
+    printf("read %d rules and %d rules set succeed!\n", fail + count, count);
     return 0;    
 }
 
@@ -127,6 +200,27 @@ int DoDefault(int fd, const char *str_arg) {
     return -1;
 }
 
+int DoEngine(int fd, const char *str_arg) {
+    static const char *names[] = CLS_ENGINE_NAMES;
+    unsigned int id;
+
+    for(id = 0; id < CLS_ENGINE_NUM; ++id) {
+        if(strcmp(str_arg, names[id]) == 0) {
+            break;
+        }
+    }
+    if(id == CLS_ENGINE_NUM) {
+        printf("unknown engine %s!\n", str_arg);
+        return -1;
+    }
+    if(ioctl(fd, IO_CTRL_CLS_ENGINE, id) == -1) {
+        printf("set classifier engine FAILED!\n");
+        return -1;
+    }
+    printf("set classifier engine as %s! SUCCEED!\n", names[id]);
+    return 0;
+}
+
 int DoDelete(int fd, const char *str_arg) {
     int num = 0;
 
@@ -148,6 +242,567 @@ int DoDelete(int fd, const char *str_arg) {
     return 0;
 }
 
+static int ParseIp(const char *str, unsigned int *ip) {
+    struct in_addr addr;
+
+    if(inet_pton(AF_INET, str, &addr) != 1) {
+        return -1;
+    }
+    *ip = ntohl(addr.s_addr);
+    return 0;
+}
+
+static int SendBanBatch(int fd, unsigned int cmd, struct BanEntry *entries, unsigned int count) {
+    struct BanBatch batch;
+    long ret;
+
+    batch.count = count;
+    batch.entries = entries;
+    ret = ioctl(fd, cmd, &batch);
+    if(ret == -1) {
+        return -1;
+    }
+    return (int)ret;
+}
+
+int DoBan(int fd, unsigned int cmd, const char *str_ip, const char *str_ttl) {
+    struct BanEntry entry;
+
+    if(ParseIp(str_ip, &entry.ip) != 0) {
+        printf("invalid ip \"%s\"!\n", str_ip);
+        return -1;
+    }
+    entry.ttl = (str_ttl == NULL) ? 0 : (unsigned int)strtoul(str_ttl, NULL, 10);
+
+    if(SendBanBatch(fd, cmd, &entry, 1) != 1) {
+        printf("%s %s FAILED!\n", cmd == IO_CTRL_BAN_ADD ? "ban" : "unban", str_ip);
+        return -1;
+    }
+    printf("%s %s OK!\n", cmd == IO_CTRL_BAN_ADD ? "ban" : "unban", str_ip);
+    return 0;
+}
+
+/*
+ * 从文件批量添加/删除封禁，每行 "<ip> [seconds]"。
+ * 条目按 BAN_BATCH_SIZE 打包，一次 ioctl 提交一批。
+ */
+int DoBanFile(int fd, unsigned int cmd, const char *str_arg) {
+    FILE *fp;
+    struct BanEntry *entries;
+    unsigned int n = 0;
+    int total = 0, succ = 0, bad = 0, iRet;
+    char ip_str[64];
+
+    if((fp = fopen(str_arg, "r")) == NULL) {
+        printf("open ban file FAILED!\n");
+        return -1;
+    }
+    entries = (struct BanEntry *)malloc(sizeof(struct BanEntry) * BAN_BATCH_SIZE);
+    if(entries == NULL) {
+        fclose(fp);
+        return -1;
+    }
+
+    while(fgets(io_buff, IO_BUFF_SIZE, fp) != NULL) {
+        unsigned int ttl = 0;
+
+        if(sscanf(io_buff, "%63s %u", ip_str, &ttl) < 1 || ip_str[0] == '#') {
+            continue;
+        }
+        if(ParseIp(ip_str, &entries[n].ip) != 0) {
+            printf("skip invalid ip \"%s\"\n", ip_str);
+            ++bad;
+            continue;
+        }
+        entries[n].ttl = ttl;
+        ++total;
+        if(++n == BAN_BATCH_SIZE) {
+            if((iRet = SendBanBatch(fd, cmd, entries, n)) > 0) {
+                succ += iRet;
+            }
+            n = 0;
+        }
+    }
+    if(n != 0 && (iRet = SendBanBatch(fd, cmd, entries, n)) > 0) {
+        succ += iRet;
+    }
+    fclose(fp);
+    free(entries);
+
+    printf("read %d entries (%d invalid), %d applied!\n", total + bad, bad, succ);
+    return 0;
+}
+
+int DoBanStat(int fd) {
+    struct BanStat stat;
+
+    if(ioctl(fd, IO_CTRL_BAN_STAT, &stat) == -1) {
+        printf("get ban statistics FAILED!\n");
+        return -1;
+    }
+    printf("active:   %u / %u\n", stat.active, stat.capacity);
+    printf("expired:  %lu\n", stat.expired);
+    printf("dropped:  %lu\n", stat.hits);
+    return 0;
+}
+
+int DoScanStat(int fd) {
+    struct ScanStat stat;
+
+    if(ioctl(fd, IO_CTRL_SCAN_STAT, &stat) == -1) {
+        printf("get scan detector statistics FAILED!\n");
+        return -1;
+    }
+    printf("active:      %u / %u\n", stat.active, stat.capacity);
+    printf("blocked:     %u\n", stat.blocked);
+    printf("detections:  %lu\n", stat.detections);
+    printf("dropped:     %lu\n", stat.drops);
+    printf("evictions:   %lu\n", stat.evictions);
+    printf("untracked:   %lu\n", stat.untracked);
+    printf("events lost: %lu\n", stat.events_lost);
+    return 0;
+}
+
+int DoFragStat(int fd) {
+    struct FragStat stat;
+
+    if(ioctl(fd, IO_CTRL_FRAG_STAT, &stat) == -1) {
+        printf("get fragment cache statistics FAILED!\n");
+        return -1;
+    }
+    if(stat.capacity == 0) {
+        printf("cache:        disabled, every later fragment is an orphan\n");
+    }
+    else {
+        printf("cache:        %u entries x %u cpus, timeout %us\n", stat.capacity, stat.cpus, stat.timeout_s);
+    }
+    printf("live:         %u\n", stat.live);
+    printf("stored:       %lu\n", stat.stored);
+    printf("hits:         %lu\n", stat.hits);
+    printf("orphans:      %lu (%lu dropped)\n", stat.orphans, stat.orphan_drops);
+    printf("evictions:    %lu\n", stat.evictions);
+    return 0;
+}
+
+static void PrintShadowRule(const char *name, unsigned int id, const struct RuleSpec *rule) {
+    char line[128];
+
+    if(id == 0) {
+        printf("    %-7s default %s\n", name, rule->action == RULE_PERMIT ? "PERMIT" : "REJECT");
+    }
+    else if(RuleSpecFormat(line, sizeof(line), rule) < 0) {
+        printf("    %-7s #%u ?\n", name, id);
+    }
+    else {
+        printf("    %-7s #%u %s\n", name, id, line);
+    }
+}
+
+static int DoShadowReport(int fd) {
+    struct ShadowStat *stat;
+    unsigned int i;
+
+    stat = (struct ShadowStat *)malloc(sizeof(struct ShadowStat));
+    if(stat == NULL) {
+        return -1;
+    }
+    if(ioctl(fd, IO_CTRL_SHADOW_STAT, stat) == -1) {
+        printf("get shadow statistics FAILED!\n");
+        free(stat);
+        return -1;
+    }
+    if(!stat->loaded) {
+        printf("no shadow rule set loaded.\n");
+        free(stat);
+        return 0;
+    }
+
+    printf("shadow:        %u rules, default %s, 1 in %u packets, loaded %u s ago\n",
+           stat->rules, stat->default_rule == RULE_PERMIT ? "PERMIT" : "REJECT",
+           stat->sample, stat->age);
+    printf("samples:       %llu\n", stat->samples);
+    printf("disagreements: %llu (%.3f%%)\n", stat->disagreements,
+           stat->samples ? stat->disagreements * 100.0 / stat->samples : 0.0);
+    if(stat->samples != 0) {
+        printf("live:          %.0f ns, %.1f rules per packet\n",
+               (double)stat->live_ns / stat->samples, (double)stat->live_evaluated / stat->samples);
+        printf("shadow:        %.0f ns, %.1f rules per packet\n",
+               (double)stat->shadow_ns / stat->samples, (double)stat->shadow_evaluated / stat->samples);
+    }
+    if(stat->pair_count != 0) {
+        printf("\ndisagreeing rule pairs (live id as in dump, shadow id is the position in the shadow set):\n");
+    }
+    for(i = 0; i < stat->pair_count && i < SHADOW_PAIR_MAX; ++i) {
+        printf("  %llu packets\n", stat->pair[i].count);
+        PrintShadowRule("live", stat->pair[i].live_id, &stat->pair[i].live);
+        PrintShadowRule("shadow", stat->pair[i].shadow_id, &stat->pair[i].shadow);
+    }
+    if(stat->pairs_lost != 0) {
+        printf("  %llu disagreements of other pairs not shown\n", stat->pairs_lost);
+    }
+    free(stat);
+    return 0;
+}
+
+/*
+ * shadow load <conf file> [N]：装入影子规则集，每 N 个包（默认64）抽一个用它判决，只统计不执行；
+ * shadow [report]、shadow promote（原子地替换当前规则集）、shadow drop。
+ */
+int DoShadow(int fd, int argc, char *argv[]) {
+    struct ShadowLoad load;
+    void *image;
+    size_t len;
+    int count, fail;
+
+    if(argc == 0 || strcmp(argv[0], "report") == 0) {
+        return DoShadowReport(fd);
+    }
+    if(strcmp(argv[0], "promote") == 0) {
+        if(ioctl(fd, IO_CTRL_SHADOW_PROMOTE) == -1) {
+            printf("promote shadow rule set FAILED! (%s)\n",
+                   errno == ENOENT ? "is one loaded?" : errno == EAGAIN ? "a new one was loaded meanwhile" : strerror(errno));
+            return -1;
+        }
+        printf("shadow rule set promoted!\n");
+        return 0;
+    }
+    if(strcmp(argv[0], "drop") == 0) {
+        if(ioctl(fd, IO_CTRL_SHADOW_DROP) == -1) {
+            printf("drop shadow rule set FAILED! (is one loaded?)\n");
+            return -1;
+        }
+        return 0;
+    }
+    if(strcmp(argv[0], "load") != 0 || argc < 2) {
+        printf("usage: shadow load <conf file> [N] | report | promote | drop\n");
+        return -1;
+    }
+
+    load.sample = argc > 2 ? (unsigned int)atoi(argv[2]) : 64;
+    if(load.sample == 0) {
+        printf("invalid sample rate %s\n", argv[2]);
+        return -1;
+    }
+    if((image = ConfImage(fd, argv[1], &len, &count, &fail)) == NULL) {
+        return -1;
+    }
+    load.image.size = len;
+    load.image.data = image;
+    if(ioctl(fd, IO_CTRL_SHADOW_LOAD, &load) == -1) {
+        printf("load shadow rule set FAILED!\n");
+        free(image);
+        return -1;
+    }
+    free(image);
+
+    printf("read %d rules and %d rules loaded as shadow, 1 in %u packets!\n",
+           fail + count, count, load.sample);
+    return 0;
+}
+
+static void PrintMemLine(const char *name, unsigned long long count, const char *unit,
+                         unsigned long long bytes, unsigned long long max) {
+    printf("%-11s %10llu %-7s %10llu KB", name, count, unit, (bytes + 1023) >> 10);
+    if(max != 0) {
+        printf("   (limit %llu)", max);
+    }
+    printf("\n");
+}
+
+int DoMemStat(int fd) {
+    struct MemStat stat;
+
+    if(ioctl(fd, IO_CTRL_MEM_STAT, &stat) == -1) {
+        printf("get memory statistics FAILED!\n");
+        return -1;
+    }
+    PrintMemLine("rules:", stat.rule_nodes, "nodes", stat.rule_bytes, stat.rule_max);
+    PrintMemLine("classifier:", stat.cls_chunks, "chunks", stat.cls_bytes, stat.cls_max >> 10);
+    PrintMemLine("ban table:", stat.ban_entries, "entries", stat.ban_bytes, stat.ban_max);
+    PrintMemLine("scan table:", stat.scan_slots, "slots", stat.scan_bytes, 0);
+    PrintMemLine("frag cache:", stat.frag_slots, "slots", stat.frag_bytes, 0);
+    printf("%-11s %10llu %-7s %10llu KB   (%llu rules, included above)\n", "netns:", stat.netns, "sets",
+           (stat.netns_bytes + 1023) >> 10, stat.netns_rules);
+    printf("%-11s %18s %10llu KB\n", "stats map:", "", stat.stats_map_bytes >> 10);
+    printf("%-11s %18s %10llu KB\n", "io buffer:", "", stat.io_bytes >> 10);
+    printf("%-11s %18s %10llu KB\n", "total:", "", (stat.total_bytes + 1023) >> 10);
+    return 0;
+}
+
+static int OpenGenl(struct GenlSock *sock) {
+    int iRet = GenlOpen(sock);
+
+    if(iRet != 0) {
+        printf("open generic netlink family %s FAILED! (%s)\n", TINYFW_GENL_NAME, strerror(-iRet));
+    }
+    return iRet;
+}
+
+static const char *EngineName(unsigned long long id) {
+    static const char *names[] = CLS_ENGINE_NAMES;
+
+    return id < CLS_ENGINE_NUM ? names[id] : "?";
+}
+
+//协议表位图，第 p 位为 TCP/UDP/ICMP
+static const char *ProtoMask(unsigned long long mask) {
+    static char buf[4][8];
+    static int n = 0;
+    char *str = buf[n++ & 3];
+    const char *names = "TUI";
+    int p, len = 0;
+
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        if(mask & (1ULL << p)) {
+            str[len++] = names[p];
+        }
+    }
+    if(len == 0) {
+        str[len++] = '-';
+    }
+    str[len] = '\0';
+    return str;
+}
+
+static int StatHandler(const struct nlmsghdr *nlh, void *arg) {
+    const struct nlattr *tb[TINYFW_A_MAX + 1];
+    const struct nlattr *sa[TINYFW_SA_MAX + 1];
+    const struct nlattr *ca[TINYFW_CA_MAX + 1];
+    unsigned long long bypass, fp;
+
+    NlParseMsg(tb, TINYFW_A_MAX, nlh);
+    printf("namespace:     %s, rule set %llu bytes\n", NlGetU8(tb[TINYFW_A_NETNS]) ? "container" : "host",
+           NlGetU64(tb[TINYFW_A_MEM_BYTES]));
+    printf("generation:    %u\n", NlGetU32(tb[TINYFW_A_GENERATION]));
+    printf("rules:         %u\n", NlGetU32(tb[TINYFW_A_COUNT]));
+    printf("default rule:  %s\n", NlGetU8(tb[TINYFW_A_DEFAULT]) == RULE_PERMIT ? "PERMIT" : "REJECT");
+    if(tb[TINYFW_A_STATS] == NULL) {
+        return 0;
+    }
+    NlParse(sa, TINYFW_SA_MAX, (const char *)tb[TINYFW_A_STATS] + NLA_HDRLEN,
+            tb[TINYFW_A_STATS]->nla_len - NLA_HDRLEN);
+    printf("packets:       %llu\n", NlGetU64(sa[TINYFW_SA_PACKETS]));
+    printf("accepted:      %llu\n", NlGetU64(sa[TINYFW_SA_ACCEPTED]));
+    printf("dropped:       %llu\n", NlGetU64(sa[TINYFW_SA_DROPPED]));
+    printf("queued:        %llu\n", NlGetU64(sa[TINYFW_SA_QUEUED]));
+    printf("replies:       %llu sent, %llu unanswered (rate limit or no route)\n",
+           NlGetU64(sa[TINYFW_SA_REPLIES]), NlGetU64(sa[TINYFW_SA_REPLY_DROPS]));
+    printf("rule hits:     %llu\n", NlGetU64(sa[TINYFW_SA_RULE_HITS]));
+    printf("default hits:  %llu\n", NlGetU64(sa[TINYFW_SA_DEFAULT_HITS]));
+    printf("banned:        %llu\n", NlGetU64(sa[TINYFW_SA_BANNED]));
+    bypass = NlGetU64(sa[TINYFW_SA_PREFILTER_BYPASS]);
+    fp = NlGetU64(sa[TINYFW_SA_PREFILTER_FP]);
+    printf("prefilter:     %llu bypassed, %llu false positives (%.3f%%)\n",
+           bypass, fp, bypass + fp ? fp * 100.0 / (bypass + fp) : 0.0);
+    if(tb[TINYFW_A_CLS_STATS] == NULL) {
+        return 0;
+    }
+    NlParse(ca, TINYFW_CA_MAX, (const char *)tb[TINYFW_A_CLS_STATS] + NLA_HDRLEN,
+            tb[TINYFW_A_CLS_STATS]->nla_len - NLA_HDRLEN);
+    printf("classifier:    version %llu, %llu entries in %llu chunks (%llu slots), %llu bytes\n",
+           NlGetU64(ca[TINYFW_CA_VERSION]), NlGetU64(ca[TINYFW_CA_ENTRIES]),
+           NlGetU64(ca[TINYFW_CA_CHUNKS]), NlGetU64(ca[TINYFW_CA_SLOTS]), NlGetU64(ca[TINYFW_CA_BYTES]));
+    printf("cls updates:   %llu incremental, %llu rebuilds, %llu compactions, %llu chunks copied\n",
+           NlGetU64(ca[TINYFW_CA_INCREMENTAL]), NlGetU64(ca[TINYFW_CA_REBUILDS]),
+           NlGetU64(ca[TINYFW_CA_COMPACTIONS]), NlGetU64(ca[TINYFW_CA_CHUNKS_COPIED]));
+    printf("cls engine:    %s (%s), %llu bytes, %llu switches\n",
+           EngineName(NlGetU64(ca[TINYFW_CA_ENGINE])), EngineName(NlGetU64(ca[TINYFW_CA_ENGINE_MODE])),
+           NlGetU64(ca[TINYFW_CA_ENGINE_BYTES]), NlGetU64(ca[TINYFW_CA_ENGINE_SWITCHES]));
+    printf("rule shape:    %llu mask combinations, %llu reachable entries, %llu wildcard rules, "
+           "%llu port rules\n",
+           NlGetU64(ca[TINYFW_CA_SHAPES]), NlGetU64(ca[TINYFW_CA_REACH]),
+           NlGetU64(ca[TINYFW_CA_WILDCARD_RULES]), NlGetU64(ca[TINYFW_CA_PORT_RULES]));
+    printf("prefilter set: %llu keys (%llu stale), %llu bytes, %llu rebuilds, protocols %s, always looked up %s\n",
+           NlGetU64(ca[TINYFW_CA_PREFILTER_KEYS]), NlGetU64(ca[TINYFW_CA_PREFILTER_STALE]),
+           NlGetU64(ca[TINYFW_CA_PREFILTER_BYTES]), NlGetU64(ca[TINYFW_CA_PREFILTER_REBUILDS]),
+           ProtoMask(NlGetU64(ca[TINYFW_CA_PREFILTER_PROTOS])), ProtoMask(NlGetU64(ca[TINYFW_CA_PREFILTER_OPEN])));
+    return 0;
+}
+
+int DoStat(void) {
+    struct GenlSock sock;
+    struct NlMsg msg;
+    int iRet;
+
+    if(OpenGenl(&sock) != 0) {
+        return -1;
+    }
+    if(NlMsgInit(&msg, sock.family, 0, TINYFW_CMD_GET_STATS) != 0) {
+        return -1;
+    }
+    iRet = GenlTalk(&sock, &msg, StatHandler, NULL);
+    NlMsgFree(&msg);
+    GenlClose(&sock);
+    if(iRet != 0) {
+        printf("get statistics FAILED! (%s)\n", strerror(-iRet));
+        return -1;
+    }
+    return 0;
+}
+
+static int DumpHandler(const struct nlmsghdr *nlh, void *arg) {
+    const struct nlattr *tb[TINYFW_A_MAX + 1];
+    const struct nlattr *ra[TINYFW_RA_MAX + 1];
+    struct RuleSpec rule;
+    unsigned long long hits;
+    char line[128];
+
+    NlParseMsg(tb, TINYFW_A_MAX, nlh);
+    if(NlGetRule(tb[TINYFW_A_RULE], &rule, &hits) != 0
+            || RuleSpecFormat(line, sizeof(line), &rule) < 0) {
+        return 0;
+    }
+    NlParse(ra, TINYFW_RA_MAX, (const char *)tb[TINYFW_A_RULE] + NLA_HDRLEN,
+            tb[TINYFW_A_RULE]->nla_len - NLA_HDRLEN);
+    printf("%6u  %6u  %-48s %llu", NlGetU32(tb[TINYFW_A_POS]), NlGetU32(ra[TINYFW_RA_ID]), line, hits);
+    if(rule.action == RULE_REFUSE) {
+        printf("  (%llu replied, %llu unanswered)",
+               NlGetU64(ra[TINYFW_RA_REPLIES]), NlGetU64(ra[TINYFW_RA_REPLY_DROPS]));
+    }
+    printf("\n");
+    ++*(unsigned int *)arg;
+    return 0;
+}
+
+int DoDump(void) {
+    struct GenlSock sock;
+    struct NlMsg msg;
+    unsigned int count = 0;
+    int iRet;
+
+    if(OpenGenl(&sock) != 0) {
+        return -1;
+    }
+    if(NlMsgInit(&msg, sock.family, NLM_F_DUMP, TINYFW_CMD_DUMP) != 0) {
+        return -1;
+    }
+    printf("%6s  %6s  %-48s %s\n", "num", "id", "rule", "hits");
+    iRet = GenlTalk(&sock, &msg, DumpHandler, &count);
+    NlMsgFree(&msg);
+    GenlClose(&sock);
+    if(iRet == -EINTR) {
+        printf("rule set changed during dump, output may be inconsistent!\n");
+    }
+    else if(iRet != 0) {
+        printf("dump rules FAILED! (%s)\n", strerror(-iRet));
+        return -1;
+    }
+    printf("%u rules dumped!\n", count);
+    return 0;
+}
+
+static void PrintOptimizeReport(const struct nlattr **tb) {
+    unsigned long long before = NlGetU64(tb[TINYFW_A_COST_BEFORE]);
+    unsigned long long after = NlGetU64(tb[TINYFW_A_COST_AFTER]);
+
+    printf("%u of %u rules moved, avg rules evaluated per matched packet %llu.%02llu -> %llu.%02llu",
+           NlGetU32(tb[TINYFW_A_MOVED]), NlGetU32(tb[TINYFW_A_COUNT]),
+           before / 100, before % 100, after / 100, after % 100);
+    if(before != 0) {
+        printf(" (-%llu%%)", (before - after) * 100 / before);
+    }
+    printf(", %s generation %u\n", NlGetU8(tb[TINYFW_A_APPLIED]) ? "published as" : "not applied,",
+           NlGetU32(tb[TINYFW_A_GENERATION]));
+}
+
+static int OptimizeHandler(const struct nlmsghdr *nlh, void *arg) {
+    const struct nlattr *tb[TINYFW_A_MAX + 1];
+
+    NlParseMsg(tb, TINYFW_A_MAX, nlh);
+    PrintOptimizeReport(tb);
+    return 0;
+}
+
+/*
+ * 按命中计数重排规则（不改变任何报文的判决），dry_run 时只报告预期效果。
+ */
+int DoOptimize(const char *str_arg) {
+    struct GenlSock sock;
+    struct NlMsg msg;
+    int iRet, dry_run = 0;
+
+    if(str_arg != NULL) {
+        if(strcmp(str_arg, "--dry-run") != 0) {
+            printf("ONLY '--dry-run' is accepted.\n");
+            return -1;
+        }
+        dry_run = 1;
+    }
+    if(OpenGenl(&sock) != 0) {
+        return -1;
+    }
+    if(NlMsgInit(&msg, sock.family, 0, TINYFW_CMD_OPTIMIZE) != 0
+            || (dry_run && NlPut(&msg, TINYFW_A_DRY_RUN, NULL, 0) != 0)) {
+        GenlClose(&sock);
+        return -1;
+    }
+    iRet = GenlTalk(&sock, &msg, OptimizeHandler, NULL);
+    NlMsgFree(&msg);
+    GenlClose(&sock);
+    if(iRet != 0) {
+        printf("optimize rules FAILED! (%s)\n",
+               iRet == -EAGAIN ? "rule set changed while sorting, try again" : strerror(-iRet));
+        return -1;
+    }
+    return 0;
+}
+
+static int EventHandler(const struct nlmsghdr *nlh, void *arg) {
+    const struct genlmsghdr *genlh = (const struct genlmsghdr *)NLMSG_DATA(nlh);
+    const struct nlattr *tb[TINYFW_A_MAX + 1];
+    unsigned int ip;
+
+    NlParseMsg(tb, TINYFW_A_MAX, nlh);
+    switch(genlh->cmd) {
+        case TINYFW_CMD_EVT_GENERATION:
+            printf("generation %u: %u rules, default %s\n", NlGetU32(tb[TINYFW_A_GENERATION]),
+                   NlGetU32(tb[TINYFW_A_COUNT]),
+                   NlGetU8(tb[TINYFW_A_DEFAULT]) == RULE_PERMIT ? "PERMIT" : "REJECT");
+            break;
+        case TINYFW_CMD_EVT_THRESHOLD:
+            printf("drop rate %llu/s above threshold %u/s\n", NlGetU64(tb[TINYFW_A_RATE]),
+                   NlGetU32(tb[TINYFW_A_THRESHOLD]));
+            break;
+        case TINYFW_CMD_EVT_OPTIMIZED:
+            printf("rules reordered: ");
+            PrintOptimizeReport(tb);
+            break;
+        case TINYFW_CMD_EVT_SCAN:
+            ip = NlGetU32(tb[TINYFW_A_SRCIP]);
+            printf("scan from %u.%u.%u.%u: ~%u ports, ~%u hosts in %us%s\n", ip >> 24, (ip >> 16) & 0xff,
+                   (ip >> 8) & 0xff, ip & 0xff, NlGetU32(tb[TINYFW_A_PORTS]), NlGetU32(tb[TINYFW_A_HOSTS]),
+                   NlGetU32(tb[TINYFW_A_WINDOW]), NlGetU8(tb[TINYFW_A_DROP]) ? ", dropping" : "");
+            break;
+        default:
+            printf("unknown event %u\n", genlh->cmd);
+            break;
+    }
+    fflush(stdout);
+    return 0;
+}
+
+int DoEvents(void) {
+    struct GenlSock sock;
+    int iRet;
+
+    if(OpenGenl(&sock) != 0) {
+        return -1;
+    }
+    if((iRet = GenlSubscribe(&sock)) != 0) {
+        printf("subscribe events FAILED! (%s)\n", strerror(-iRet));
+        return -1;
+    }
+    printf("waiting for events...\n");
+    fflush(stdout);
+    while((iRet = GenlRecvEvent(&sock, EventHandler, NULL)) == 0 || iRet == -ENOBUFS) {
+        if(iRet == -ENOBUFS) {
+            printf("event queue overrun, some events lost!\n");
+        }
+    }
+    GenlClose(&sock);
+    return -1;
+}
+
 int main(int argc, char *argv[]) {
     int fd;
    
@@ -161,6 +816,47 @@ int main(int argc, char *argv[]) {
         PrintHelpMsg();
         return 0;
     }
+
+    //generic netlink 命令不占用字符设备，可与其他进程同时使用
+    if(strcmp(argv[1], "stat") == 0) {
+        return DoStat();
+    }
+    else if(strcmp(argv[1], "dump") == 0) {
+        return DoDump();
+    }
+    else if(strcmp(argv[1], "events") == 0) {
+        return DoEvents();
+    }
+    else if(strcmp(argv[1], "monitor") == 0) {
+        return DoMonitor(argc > 2 ? argv[2] : NULL);
+    }
+    else if(strcmp(argv[1], "trace") == 0) {
+        if(argc < 3) {
+            printf("an IPv4 address or a port is needed.\n");
+            return -1;
+        }
+        return DoTrace(argv[2], argc > 3 ? argv[3] : NULL);
+    }
+    else if(strcmp(argv[1], "queue") == 0) {
+        return DoQueue(argc - 2, argv + 2);
+    }
+    else if(strcmp(argv[1], "optimize") == 0) {
+        return DoOptimize(argc > 2 ? argv[2] : NULL);
+    }
+    else if(strcmp(argv[1], "compile") == 0) {
+        if(argc < 4) {
+            printf("a conf file and an image file path are needed.\n");
+            return -1;
+        }
+        return DoCompile(argv[2], argv[3], argc > 4 ? argv[4] : NULL);
+    }
+    else if(strcmp(argv[1], "conf") == 0 && argc > 2 && strcmp(argv[2], "--diff") == 0) {
+        if(argc < 4) {
+            printf("a file path args is needed.\n");
+            return -1;
+        }
+        return DoConfDiff(argv[3], argc > 4 ? argv[4] : NULL);
+    }
     
     printf("open char device: ");
     fd = open("/dev/myntfw", O_RDWR);
@@ -195,6 +891,27 @@ int main(int argc, char *argv[]) {
     else if(strcmp(argv[1], "list") == 0) {
         return DoList(fd);
     }
+    else if(strcmp(argv[1], "banflush") == 0) {
+        if(ioctl(fd, IO_CTRL_BAN_FLUSH) == -1) {
+            printf("flush ban table FAILED!\n");
+            return -1;
+        }
+    }
+    else if(strcmp(argv[1], "banstat") == 0) {
+        return DoBanStat(fd);
+    }
+    else if(strcmp(argv[1], "scanstat") == 0) {
+        return DoScanStat(fd);
+    }
+    else if(strcmp(argv[1], "fragstat") == 0) {
+        return DoFragStat(fd);
+    }
+    else if(strcmp(argv[1], "mem") == 0) {
+        return DoMemStat(fd);
+    }
+    else if(strcmp(argv[1], "shadow") == 0) {
+        return DoShadow(fd, argc - 2, argv + 2);
+    }
     else if(argc < 3) { //除了此前处理的cmd，其他cmd需要额外参数
         printf("invalid cmd or an argument is need!\n\n");
         PrintHelpMsg();
@@ -210,6 +927,21 @@ int main(int argc, char *argv[]) {
         else if(strcmp(argv[1], "del") == 0) {
             return DoDelete(fd, argv[2]);
         }
+        else if(strcmp(argv[1], "engine") == 0) {
+            return DoEngine(fd, argv[2]);
+        }
+        else if(strcmp(argv[1], "ban") == 0) {
+            return DoBan(fd, IO_CTRL_BAN_ADD, argv[2], argc > 3 ? argv[3] : NULL);
+        }
+        else if(strcmp(argv[1], "unban") == 0) {
+            return DoBan(fd, IO_CTRL_BAN_DEL, argv[2], NULL);
+        }
+        else if(strcmp(argv[1], "banload") == 0) {
+            return DoBanFile(fd, IO_CTRL_BAN_ADD, argv[2]);
+        }
+        else if(strcmp(argv[1], "banrm") == 0) {
+            return DoBanFile(fd, IO_CTRL_BAN_DEL, argv[2]);
+        }
         else if(strcmp(argv[1], "add") == 0) {
             strcpy((char *)io_buff, argv[2]);
             if(ioctl(fd, IO_CTRL_ADD, io_buff) == -1) {
@@ -0,0 +1,548 @@
+// NFQUEUE 用户态判决：内核 'Q' 规则命中的报文由本程序按另一份规则集判决
+//
+// 规则文件编译成与 compile 命令相同的分类器表（rule_image.c），按协议逐项首次匹配，
+// 语义与内核 array 引擎一致；用户态规则集里不允许再出现 'Q'。
+// 每个队列一个工作线程并绑定到一个 CPU，队列配置 NFQA_CFG_F_GSO，大包不在内核分段，
+// 只复制报文头部。一次 recvmmsg 取一批报文，判决相同且连续的报文合并成一个
+// NFQNL_MSG_VERDICT_BATCH，整批判决由一次 send 发出。
+// 内核以 queue_num、queue_total 模块参数按流散列分到各队列（同 --queue-balance）。
+//
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_queue.h>
+
+#include "../common.h"
+#include "genl_client.h"
+#include "rule_spec.h"
+#include "rule_image.h"
+#include "nfqueue.h"
+
+#define NFQ_MAX_QUEUES 64
+#define NFQ_BATCH 64                //packets per recvmmsg
+#define NFQ_COPY_RANGE 128          //bytes copied of each packet, enough for IP + TCP/UDP header
+#define NFQ_MSG_SIZE 1024           //one packet message with its attributes
+#define NFQ_VERDICT_SIZE 64         //one verdict message
+#define NFQ_QUEUE_MAXLEN 8192
+#define NFQ_RCVBUF (8 << 20)
+
+struct NfqTable {
+    const struct ClsEntry *entry;
+    unsigned int count;
+};
+
+struct NfqRules {
+    void *image;
+    struct NfqTable table[CLS_PROTO_NUM];
+    int default_rule;
+};
+
+//由工作线程更新，主线程每秒读一次
+struct NfqStat {
+    unsigned long long packets;
+    unsigned long long bytes;       //original length, not the copied part
+    unsigned long long gso;         //packets left unsegmented by NFQA_CFG_F_GSO
+    unsigned long long accepted;
+    unsigned long long dropped;
+    unsigned long long recvs;       //recvmmsg calls that returned packets
+    unsigned long long verdict_msgs;
+    unsigned long long lat_ns;      //sum of recv -> verdict sent, per packet
+    unsigned long long lat_max_ns;
+    unsigned long long overruns;    //ENOBUFS: the kernel could not deliver to the socket
+};
+
+struct NfqWorker {
+    unsigned int queue;
+    int cpu;
+    int fd;
+    int gso;                        //NFQA_CFG_F_GSO accepted by the kernel
+    unsigned int seq;
+    pthread_t tid;
+    const struct NfqRules *rules;
+    struct NfqStat stat;
+    char vbuf[NFQ_BATCH * NFQ_VERDICT_SIZE];
+    size_t vlen;
+    char rbuf[NFQ_BATCH][NFQ_MSG_SIZE];
+    struct iovec iov[NFQ_BATCH];
+    struct mmsghdr mmsg[NFQ_BATCH];
+};
+
+static volatile sig_atomic_t g_nfq_stop = 0;
+
+static void NfqSignal(int sig) {
+    g_nfq_stop = 1;
+}
+
+static unsigned long long NowNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 在 buf 中开始一个 nfnetlink_queue 消息，buf 须已清零 */
+static struct nlmsghdr *NfqMsgStart(char *buf, unsigned char type, unsigned short flags, unsigned int queue) {
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    struct nfgenmsg *nfg;
+
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+    nlh->nlmsg_type = (NFNL_SUBSYS_QUEUE << 8) | type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+    nfg = (struct nfgenmsg *)NLMSG_DATA(nlh);
+    nfg->nfgen_family = AF_UNSPEC;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons(queue);
+    return nlh;
+}
+
+static void NfqPut(struct nlmsghdr *nlh, unsigned short type, const void *data, size_t len) {
+    struct nlattr *nla = (struct nlattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + len;
+    memcpy((char *)nla + NLA_HDRLEN, data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+/* 追加一条判决；批量判决对本队列 id 不大于 id 的所有报文生效 */
+static void NfqVerdictAppend(struct NfqWorker *w, unsigned int id, unsigned int verdict, int batch) {
+    struct nfqnl_msg_verdict_hdr vh;
+    struct nlmsghdr *nlh;
+
+    memset(w->vbuf + w->vlen, 0, NFQ_VERDICT_SIZE);
+    nlh = NfqMsgStart(w->vbuf + w->vlen, batch ? NFQNL_MSG_VERDICT_BATCH : NFQNL_MSG_VERDICT, 0, w->queue);
+    vh.verdict = htonl(verdict);
+    vh.id = htonl(id);
+    NfqPut(nlh, NFQA_VERDICT_HDR, &vh, sizeof(vh));
+    w->vlen += NLMSG_ALIGN(nlh->nlmsg_len);
+    ++w->stat.verdict_msgs;
+}
+
+static int NfqVerdictFlush(struct NfqWorker *w) {
+    int iRet = 0;
+
+    if(w->vlen != 0 && send(w->fd, w->vbuf, w->vlen, 0) < 0) {
+        iRet = -errno;
+    }
+    w->vlen = 0;
+    return iRet;
+}
+
+/* 与内核 ClsArrayLookup 相同的逐项首次匹配，返回 enum Rule */
+static int NfqClassify(const struct NfqRules *rules, const struct RuleSpec *packet) {
+    const struct NfqTable *table = &rules->table[packet->type - PACKAGE_TYPE_TCP];
+    const struct ClsEntry *entry, *end;
+
+    for(entry = table->entry, end = entry + table->count; entry < end; ++entry) {
+        if((packet->srcip & entry->srcmask) == entry->srcip
+                && (packet->dstip & entry->dstmask) == entry->dstip
+                && (packet->srcport & entry->srcpmask) == entry->srcport
+                && (packet->dstport & entry->dstpmask) == entry->dstport) {
+            return entry->action;
+        }
+    }
+    return rules->default_rule;
+}
+
+/* 按 hook 的方式取报文五元组，hook 不处理的协议直接放行；后续分片与内核的孤儿分片一样放行 */
+static unsigned int NfqPacketVerdict(const struct NfqRules *rules, const unsigned char *data, unsigned int len) {
+    struct RuleSpec packet;
+    unsigned int ihl;
+
+    if(len < 20 || (data[0] >> 4) != 4) {
+        return NF_ACCEPT;
+    }
+    switch(data[9]) {
+        case IPPROTO_ICMP: packet.type = PACKAGE_TYPE_ICMP; break;
+        case IPPROTO_TCP: packet.type = PACKAGE_TYPE_TCP; break;
+        case IPPROTO_UDP: packet.type = PACKAGE_TYPE_UDP; break;
+        default: return NF_ACCEPT;
+    }
+    if(packet.type != PACKAGE_TYPE_ICMP && ((data[6] & 0x1f) | data[7]) != 0) {
+        return NF_ACCEPT;   //later fragment, no ports; it cannot be reassembled unless the first one passed
+    }
+    packet.srcip = (unsigned int)data[12] << 24 | data[13] << 16 | data[14] << 8 | data[15];
+    packet.dstip = (unsigned int)data[16] << 24 | data[17] << 16 | data[18] << 8 | data[19];
+    packet.srcport = packet.dstport = 0;
+    ihl = (data[0] & 0x0f) * 4;
+    if(packet.type != PACKAGE_TYPE_ICMP && ihl >= 20 && len >= ihl + 4) {
+        packet.srcport = data[ihl] << 8 | data[ihl + 1];
+        packet.dstport = data[ihl + 2] << 8 | data[ihl + 3];
+    }
+
+    return NfqClassify(rules, &packet) == RULE_PERMIT ? NF_ACCEPT : NF_DROP;
+}
+
+/*
+ * 处理一个报文消息，返回判决，*id 为报文 id；不是报文消息返回-1。
+ */
+static int NfqHandlePacket(struct NfqWorker *w, const struct nlmsghdr *nlh, unsigned int *id) {
+    const struct nlattr *tb[NFQA_MAX + 1];
+    const struct nfqnl_msg_packet_hdr *ph;
+    const unsigned char *data = NULL;
+    unsigned int len = 0, verdict;
+    int attrlen = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct nfgenmsg));
+
+    if(nlh->nlmsg_type != ((NFNL_SUBSYS_QUEUE << 8) | NFQNL_MSG_PACKET) || attrlen < 0) {
+        return -1;
+    }
+    NlParse(tb, NFQA_MAX, (const char *)NLMSG_DATA(nlh) + sizeof(struct nfgenmsg), attrlen);
+    if(tb[NFQA_PACKET_HDR] == NULL) {
+        return -1;
+    }
+    ph = (const struct nfqnl_msg_packet_hdr *)((const char *)tb[NFQA_PACKET_HDR] + NLA_HDRLEN);
+    *id = ntohl(ph->packet_id);
+    if(tb[NFQA_PAYLOAD] != NULL) {
+        data = (const unsigned char *)tb[NFQA_PAYLOAD] + NLA_HDRLEN;
+        len = tb[NFQA_PAYLOAD]->nla_len - NLA_HDRLEN;
+    }
+    if(tb[NFQA_SKB_INFO] != NULL && (ntohl(NlGetU32(tb[NFQA_SKB_INFO])) & NFQA_SKB_GSO)) {
+        ++w->stat.gso;
+    }
+
+    verdict = data ? NfqPacketVerdict(w->rules, data, len) : NF_ACCEPT;
+    ++w->stat.packets;
+    w->stat.bytes += tb[NFQA_CAP_LEN] ? ntohl(NlGetU32(tb[NFQA_CAP_LEN])) : len;
+    if(verdict == NF_ACCEPT) {
+        ++w->stat.accepted;
+    }
+    else {
+        ++w->stat.dropped;
+    }
+    return verdict;
+}
+
+/* 发送一条配置消息并等待应答；期间到达的报文逐个判决 */
+static int NfqConfig(struct NfqWorker *w, struct nlmsghdr *req) {
+    char buf[NFQ_MSG_SIZE * 4];
+    struct nlmsghdr *nlh;
+    unsigned int id;
+    ssize_t len;
+    int verdict;
+
+    req->nlmsg_flags |= NLM_F_ACK;
+    req->nlmsg_seq = ++w->seq;
+    if(send(w->fd, req, req->nlmsg_len, 0) < 0) {
+        return -errno;
+    }
+    for(;;) {
+        len = recv(w->fd, buf, sizeof(buf), 0);
+        if(len < 0) {
+            if(errno == EINTR || errno == ENOBUFS) {
+                continue;
+            }
+            return -errno;
+        }
+        for(nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            if(nlh->nlmsg_type == NLMSG_ERROR && nlh->nlmsg_seq == req->nlmsg_seq) {
+                return ((const struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+            }
+            if((verdict = NfqHandlePacket(w, nlh, &id)) >= 0) {
+                NfqVerdictAppend(w, id, verdict, 0);
+                NfqVerdictFlush(w);
+            }
+        }
+    }
+}
+
+/*
+ * 打开套接字并绑定队列：复制报文头部、队列长度、GSO。
+ * 内核不支持 GSO 标志时不用它，报文仍会被分段后逐个送来。
+ */
+static int NfqOpen(struct NfqWorker *w) {
+    char buf[256];
+    struct sockaddr_nl addr;
+    struct nlmsghdr *nlh;
+    struct nfqnl_msg_config_cmd cmd;
+    struct nfqnl_msg_config_params params;
+    struct timeval tv = { 0, 200000 };  //wake up to check for stop
+    unsigned int value;
+    int size = NFQ_RCVBUF, iRet;
+
+    w->fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_NETFILTER);
+    if(w->fd < 0) {
+        return -errno;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if(bind(w->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        return -errno;
+    }
+    if(setsockopt(w->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0) {
+        setsockopt(w->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    memset(buf, 0, sizeof(buf));
+    nlh = NfqMsgStart(buf, NFQNL_MSG_CONFIG, 0, w->queue);
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.command = NFQNL_CFG_CMD_BIND;
+    cmd.pf = htons(AF_INET);
+    NfqPut(nlh, NFQA_CFG_CMD, &cmd, sizeof(cmd));
+    params.copy_range = htonl(NFQ_COPY_RANGE);
+    params.copy_mode = NFQNL_COPY_PACKET;
+    NfqPut(nlh, NFQA_CFG_PARAMS, &params, sizeof(params));
+    value = htonl(NFQ_QUEUE_MAXLEN);
+    NfqPut(nlh, NFQA_CFG_QUEUE_MAXLEN, &value, sizeof(value));
+    if((iRet = NfqConfig(w, nlh)) != 0) {
+        return iRet;
+    }
+
+    memset(buf, 0, sizeof(buf));
+    nlh = NfqMsgStart(buf, NFQNL_MSG_CONFIG, 0, w->queue);
+    value = htonl(NFQA_CFG_F_GSO);
+    NfqPut(nlh, NFQA_CFG_MASK, &value, sizeof(value));
+    NfqPut(nlh, NFQA_CFG_FLAGS, &value, sizeof(value));
+    w->gso = NfqConfig(w, nlh) == 0;
+
+    memset(&w->stat, 0, sizeof(w->stat));
+    return 0;
+}
+
+/* 接收一批，判决按连续相同者合并，整批一次发送 */
+static void *NfqWorkerRun(void *arg) {
+    struct NfqWorker *w = (struct NfqWorker *)arg;
+    struct nlmsghdr *nlh;
+    unsigned long long start, lat;
+    unsigned int id, run_id = 0, run_len = 0, run_verdict = 0, got;
+    int n, i, len, verdict;
+
+    for(i = 0; i < NFQ_BATCH; ++i) {
+        w->iov[i].iov_base = w->rbuf[i];
+        w->iov[i].iov_len = NFQ_MSG_SIZE;
+        memset(&w->mmsg[i], 0, sizeof(w->mmsg[i]));
+        w->mmsg[i].msg_hdr.msg_iov = &w->iov[i];
+        w->mmsg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while(!g_nfq_stop) {
+        n = recvmmsg(w->fd, w->mmsg, NFQ_BATCH, MSG_WAITFORONE, NULL);
+        if(n <= 0) {
+            if(n < 0 && errno == ENOBUFS) {
+                ++w->stat.overruns;
+            }
+            continue;   //timeout, signal or overrun
+        }
+        start = NowNs();
+        got = 0;
+        for(i = 0; i < n; ++i) {
+            len = w->mmsg[i].msg_len;
+            for(nlh = (struct nlmsghdr *)w->rbuf[i]; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+                if((verdict = NfqHandlePacket(w, nlh, &id)) < 0) {
+                    continue;
+                }
+                ++got;
+                if(run_len != 0 && (unsigned int)verdict != run_verdict) {
+                    NfqVerdictAppend(w, run_id, run_verdict, run_len > 1);
+                    run_len = 0;
+                }
+                run_verdict = verdict;
+                run_id = id;
+                ++run_len;
+            }
+        }
+        if(run_len != 0) {
+            NfqVerdictAppend(w, run_id, run_verdict, run_len > 1);
+            run_len = 0;
+        }
+        NfqVerdictFlush(w);
+        if(got == 0) {
+            continue;
+        }
+        lat = NowNs() - start;
+        ++w->stat.recvs;
+        w->stat.lat_ns += lat * got;
+        if(lat > w->stat.lat_max_ns) {
+            w->stat.lat_max_ns = lat;
+        }
+    }
+    return NULL;
+}
+
+/* 用户态规则集：与 compile 命令相同的镜像，直接使用其中的分类器表 */
+static int NfqLoadRules(const char *path, int default_rule, struct NfqRules *rules) {
+    const struct RuleImageHeader *hdr;
+    struct RuleSpecArray array;
+    size_t len;
+    int fail, i, p;
+
+    memset(&array, 0, sizeof(array));
+    if((fail = RuleSpecLoadConf(path, &array)) != 0) {
+        if(fail > 0) {
+            printf("%d invalid lines in %s\n", fail, path);
+        }
+        free(array.rules);
+        return -1;
+    }
+    for(i = 0; i < array.count; ++i) {
+        if(array.rules[i].action == RULE_QUEUE || array.rules[i].action == RULE_REFUSE) {
+            printf("rule %d: 'Q' and 'F' are not accepted in a queue rule file.\n", array.count - i);
+            free(array.rules);
+            return -1;
+        }
+    }
+    rules->image = RuleImageBuild(array.rules, array.count, default_rule, &len);
+    free(array.rules);
+    if(rules->image == NULL) {
+        printf("build rule tables FAILED!\n");
+        return -1;
+    }
+    hdr = (const struct RuleImageHeader *)rules->image;
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        rules->table[p].entry = (const struct ClsEntry *)((const char *)rules->image + hdr->table_offset[p]);
+        rules->table[p].count = hdr->table_count[p];
+    }
+    rules->default_rule = default_rule;
+    printf("%d rules loaded, default %s\n", array.count, default_rule == RULE_PERMIT ? "PERMIT" : "REJECT");
+    return 0;
+}
+
+static void NfqPrint(const struct NfqWorker *w, const struct NfqStat *cur, const struct NfqStat *pre,
+                     double secs) {
+    unsigned long long packets = cur->packets - pre->packets;
+    unsigned long long recvs = cur->recvs - pre->recvs;
+
+    printf("%5u %4d %10.0f %9.1f %7.1f %9.2f %9.1f %10llu %10llu %8llu %8llu\n",
+           w->queue, w->cpu, packets / secs, (cur->bytes - pre->bytes) * 8 / secs / 1e6,
+           recvs ? (double)packets / recvs : 0.0,
+           packets ? (cur->lat_ns - pre->lat_ns) / 1e3 / packets : 0.0, cur->lat_max_ns / 1e3,
+           cur->accepted, cur->dropped, cur->gso, cur->overruns);
+}
+
+/*
+ * tinyfw_nf queue <conf file> [queues] [first queue] [P|R]
+ * 队列数默认1，起始队列默认0，与模块参数 queue_total、queue_num 对应。
+ * 每秒打印各队列的速率与延迟（收到一批到整批判决发出），Ctrl-C 结束并打印总计。
+ */
+int DoQueue(int argc, char *argv[]) {
+    static struct NfqWorker workers[NFQ_MAX_QUEUES];
+    struct NfqStat pre[NFQ_MAX_QUEUES], cur, total;
+    struct NfqRules rules;
+    unsigned long long last, now;
+    unsigned long queues = 1, first = 0;
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    long ncpu;
+    int def = RULE_PERMIT, started = 0, i, iRet;
+    double elapsed = 0;
+
+    if(argc < 1) {
+        printf("a rule file path args is needed.\n");
+        return -1;
+    }
+    if(argc > 1) {
+        queues = strtoul(argv[1], NULL, 10);
+    }
+    if(argc > 2) {
+        first = strtoul(argv[2], NULL, 10);
+    }
+    if(queues == 0 || queues > NFQ_MAX_QUEUES || first + queues > 0x10000) {
+        printf("queues must be in 1~%d and end below 65536.\n", NFQ_MAX_QUEUES);
+        return -1;
+    }
+    if(argc > 3) {
+        if(strcmp(argv[3], "R") == 0) {
+            def = RULE_REJECT;
+        }
+        else if(strcmp(argv[3], "P") != 0) {
+            printf("ONLY 'P' or 'R' is accepted as default rule.\n");
+            return -1;
+        }
+    }
+    if(NfqLoadRules(argv[0], def, &rules) != 0) {
+        return -1;
+    }
+
+    signal(SIGINT, NfqSignal);
+    signal(SIGTERM, NfqSignal);
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    for(i = 0; i < (int)queues; ++i) {
+        workers[i].queue = first + i;
+        workers[i].cpu = ncpu > 0 ? i % ncpu : -1;
+        workers[i].rules = &rules;
+        if((iRet = NfqOpen(&workers[i])) != 0) {
+            printf("bind queue %u FAILED! (%s)\n", workers[i].queue, strerror(-iRet));
+            if(workers[i].fd >= 0) {
+                close(workers[i].fd);
+            }
+            break;
+        }
+        pthread_attr_init(&attr);
+        if(workers[i].cpu >= 0) {
+            CPU_ZERO(&cpus);
+            CPU_SET(workers[i].cpu, &cpus);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        iRet = pthread_create(&workers[i].tid, &attr, NfqWorkerRun, &workers[i]);
+        pthread_attr_destroy(&attr);
+        if(iRet != 0) {
+            printf("start worker of queue %u FAILED!\n", workers[i].queue);
+            close(workers[i].fd);
+            break;
+        }
+        ++started;
+    }
+    if(started == (int)queues) {
+        printf("listening on queues %lu~%lu%s, load the module with queue_num=%lu queue_total=%lu\n",
+               first, first + queues - 1, workers[0].gso ? " (gso)" : "", first, queues);
+        printf("%5s %4s %10s %9s %7s %9s %9s %10s %10s %8s %8s\n", "queue", "cpu", "pps", "Mbps",
+               "batch", "lat us", "max us", "accepted", "dropped", "gso", "overrun");
+        fflush(stdout);
+    }
+    else {
+        g_nfq_stop = 1;
+    }
+
+    memset(pre, 0, sizeof(pre));
+    last = NowNs();
+    while(!g_nfq_stop) {
+        sleep(1);
+        now = NowNs();
+        elapsed += (now - last) / 1e9;
+        for(i = 0; i < started; ++i) {
+            cur = workers[i].stat;
+            NfqPrint(&workers[i], &cur, &pre[i], (now - last) / 1e9);
+            pre[i] = cur;
+        }
+        last = now;
+        fflush(stdout);
+    }
+
+    memset(&total, 0, sizeof(total));
+    for(i = 0; i < started; ++i) {
+        pthread_join(workers[i].tid, NULL);
+        close(workers[i].fd);
+        total.packets += workers[i].stat.packets;
+        total.accepted += workers[i].stat.accepted;
+        total.dropped += workers[i].stat.dropped;
+        total.gso += workers[i].stat.gso;
+        total.recvs += workers[i].stat.recvs;
+        total.verdict_msgs += workers[i].stat.verdict_msgs;
+        total.lat_ns += workers[i].stat.lat_ns;
+        total.overruns += workers[i].stat.overruns;
+    }
+    free(rules.image);
+    if(started != (int)queues) {
+        return -1;
+    }
+    printf("total: %llu packets in %.1fs, %llu accepted, %llu dropped, %llu gso, "
+           "%.1f packets per recv, %.1f per verdict message, avg latency %.2f us, %llu overruns\n",
+           total.packets, elapsed, total.accepted, total.dropped, total.gso,
+           total.recvs ? (double)total.packets / total.recvs : 0.0,
+           total.verdict_msgs ? (double)total.packets / total.verdict_msgs : 0.0,
+           total.packets ? total.lat_ns / 1e3 / total.packets : 0.0, total.overruns);
+    return 0;
+}
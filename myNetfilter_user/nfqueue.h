@@ -0,0 +1,6 @@
+#ifndef NFQUEUE_H
+#define NFQUEUE_H
+
+int DoQueue(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,165 @@
+// 生成预编译规则集镜像（格式见 common.h 中 struct RuleImageHeader）
+//
+// 规则在用户态解析、校验，并按协议编译好分类器表，
+// 模块以 rule_image=<path> 加载时只需读文件和逐项检查。
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common.h"
+#include "rule_spec.h"
+#include "rule_image.h"
+
+/* crc32 (zlib)，crc 初值为0，可分段累加 */
+unsigned int Crc32(unsigned int crc, const void *buf, size_t len) {
+    static unsigned int table[256];
+    const unsigned char *p = (const unsigned char *)buf;
+    unsigned int c;
+    int i, j;
+
+    if(table[1] == 0) {
+        for(i = 0; i < 256; ++i) {
+            for(c = i, j = 0; j < 8; ++j) {
+                c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while(len--) {
+        crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static int RuleInProto(const struct RuleSpec *rule, int proto_idx) {
+    return rule->type == PACKAGE_TYPE_ANY || rule->type == proto_idx + PACKAGE_TYPE_TCP;
+}
+
+/* 与内核 ClsCompile 一致 */
+static void ClsCompile(struct ClsEntry *entry, const struct RuleSpec *rule, int proto_idx, unsigned int id) {
+    memset(entry, 0, sizeof(*entry));
+    entry->srcmask = (rule->srcip == IP_ANY) ? 0 : rule->srcmask;
+    entry->srcip = rule->srcip & entry->srcmask;
+    entry->dstmask = (rule->dstip == IP_ANY) ? 0 : rule->dstmask;
+    entry->dstip = rule->dstip & entry->dstmask;
+    if(proto_idx != PACKAGE_TYPE_ICMP - PACKAGE_TYPE_TCP) {
+        entry->srcpmask = (rule->srcport == PORT_ANY) ? 0 : 0xffff;
+        entry->srcport = rule->srcport & entry->srcpmask;
+        entry->dstpmask = (rule->dstport == PORT_ANY) ? 0 : 0xffff;
+        entry->dstport = rule->dstport & entry->dstpmask;
+    }
+    entry->id = id;
+    entry->action = rule->action;
+}
+
+/*
+ * 由匹配顺序的规则数组生成镜像，返回 malloc 的缓冲区，失败返回NULL。
+ */
+void *RuleImageBuild(const struct RuleSpec *rules, int count, int default_rule, size_t *o_len) {
+    struct RuleImageHeader *hdr;
+    struct ClsEntry *table;
+    unsigned int table_count[CLS_PROTO_NUM] = {0};
+    size_t len;
+    char *buf;
+    int i, p, k;
+
+    for(i = 0; i < count; ++i) {
+        for(p = 0; p < CLS_PROTO_NUM; ++p) {
+            table_count[p] += RuleInProto(&rules[i], p);
+        }
+    }
+    len = sizeof(*hdr) + sizeof(struct RuleSpec) * count;
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        len += sizeof(struct ClsEntry) * table_count[p];
+    }
+    if(len > 0xffffffffUL || (buf = (char *)calloc(1, len)) == NULL) {
+        return NULL;
+    }
+
+    hdr = (struct RuleImageHeader *)buf;
+    hdr->magic = RULE_IMAGE_MAGIC;
+    hdr->version = RULE_IMAGE_VERSION;
+    hdr->header_size = sizeof(*hdr);
+    hdr->total_size = len;
+    hdr->default_rule = default_rule;
+    hdr->rule_count = count;
+    hdr->rule_offset = sizeof(*hdr);
+    hdr->entry_size = sizeof(struct ClsEntry);
+    memcpy(buf + hdr->rule_offset, rules, sizeof(struct RuleSpec) * count);
+
+    len = hdr->rule_offset + sizeof(struct RuleSpec) * count;
+    for(p = 0; p < CLS_PROTO_NUM; ++p) {
+        hdr->table_count[p] = table_count[p];
+        hdr->table_offset[p] = len;
+        table = (struct ClsEntry *)(buf + len);
+        for(i = 0, k = 0; i < count; ++i) {
+            if(RuleInProto(&rules[i], p)) {
+                ClsCompile(&table[k++], &rules[i], p, i);
+            }
+        }
+        len += sizeof(struct ClsEntry) * table_count[p];
+    }
+
+    hdr->crc = Crc32(0, buf, len);  //crc field is still 0 here
+    *o_len = len;
+    return buf;
+}
+
+/*
+ * tinyfw_nf compile <conf file> <image file> [P|R]
+ * 规则顺序与 conf 命令加载同一文件的结果相同。
+ */
+int DoCompile(const char *conf_path, const char *image_path, const char *default_rule) {
+    struct RuleSpecArray rules;
+    FILE *fp;
+    void *image;
+    size_t len;
+    int fail, def = RULE_PERMIT;
+
+    if(default_rule != NULL) {
+        if(strcmp(default_rule, "R") == 0) {
+            def = RULE_REJECT;
+        }
+        else if(strcmp(default_rule, "P") != 0) {
+            printf("ONLY 'P' or 'R' is accepted as default rule.\n");
+            return -1;
+        }
+    }
+
+    memset(&rules, 0, sizeof(rules));
+    if((fail = RuleSpecLoadConf(conf_path, &rules)) != 0) {
+        if(fail > 0) {
+            printf("%d invalid lines, nothing written\n", fail);
+        }
+        free(rules.rules);
+        return -1;
+    }
+
+    image = RuleImageBuild(rules.rules, rules.count, def, &len);
+    free(rules.rules);
+    if(image == NULL) {
+        printf("build rule image FAILED!\n");
+        return -1;
+    }
+    if((fp = fopen(image_path, "wb")) == NULL || fwrite(image, 1, len, fp) != len) {
+        printf("write rule image FAILED!\n");
+        if(fp != NULL) {
+            fclose(fp);
+        }
+        free(image);
+        return -1;
+    }
+    if(fclose(fp) != 0) {
+        printf("write rule image FAILED!\n");
+        free(image);
+        return -1;
+    }
+    free(image);
+
+    printf("%d rules compiled, %lu bytes, default %s\n", rules.count, (unsigned long)len,
+           def == RULE_PERMIT ? "PERMIT" : "REJECT");
+    return 0;
+}
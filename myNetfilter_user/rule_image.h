@@ -0,0 +1,12 @@
+#ifndef RULE_IMAGE_H
+#define RULE_IMAGE_H
+
+#include <stddef.h>
+
+#include "../common.h"
+
+unsigned int Crc32(unsigned int crc, const void *buf, size_t len);
+void *RuleImageBuild(const struct RuleSpec *rules, int count, int default_rule, size_t *o_len);
+int DoCompile(const char *conf_path, const char *image_path, const char *default_rule);
+
+#endif
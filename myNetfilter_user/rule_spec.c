@@ -0,0 +1,225 @@
+// 规则二进制形式(struct RuleSpec)与文本描述之间的转换
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common.h"
+#include "rule_spec.h"
+#include "conf_parse.h"
+
+static const char g_type_char[] = { 'A', 'T', 'U', 'I' };
+static const char g_action_char[] = { 'P', 'R', 'Q', 'F' };
+
+static int MaskLen(unsigned int mask) {
+    int len = 0;
+
+    while(mask & 0x80000000) {
+        mask <<= 1;
+        ++len;
+    }
+    return len;
+}
+
+static int IpPortFormat(char *buf, size_t size, unsigned int ip, unsigned int mask, unsigned int port) {
+    int n;
+
+    if(ip == IP_ANY) {
+        n = snprintf(buf, size, "A:");
+    }
+    else {
+        n = snprintf(buf, size, "%u.%u.%u.%u/%d:", ip >> 24, (ip >> 16) & 0xff,
+                     (ip >> 8) & 0xff, ip & 0xff, MaskLen(mask));
+    }
+    if(n < 0 || (size_t)n >= size) {
+        return -1;
+    }
+    if(port == PORT_ANY) {
+        n += snprintf(buf + n, size - n, "A");
+    }
+    else {
+        n += snprintf(buf + n, size - n, "%u", port);
+    }
+    return n;
+}
+
+/*
+ * 按内核 ParseRule 接受的格式输出规则，例如 "T 10.0.0.0/8:A A:80 R"。
+ * 返回写入的字符数，失败返回-1。
+ */
+int RuleSpecFormat(char *buf, size_t size, const struct RuleSpec *rule) {
+    int n, m;
+
+    if(rule->type >= sizeof(g_type_char) || rule->action >= sizeof(g_action_char) || size < 4) {
+        return -1;
+    }
+    buf[0] = g_type_char[rule->type];
+    buf[1] = ' ';
+    n = 2;
+    if((m = IpPortFormat(buf + n, size - n, rule->srcip, rule->srcmask, rule->srcport)) < 0) {
+        return -1;
+    }
+    n += m;
+    if((size_t)n + 1 >= size) {
+        return -1;
+    }
+    buf[n++] = ' ';
+    if((m = IpPortFormat(buf + n, size - n, rule->dstip, rule->dstmask, rule->dstport)) < 0) {
+        return -1;
+    }
+    n += m;
+    m = snprintf(buf + n, size - n, " %c", g_action_char[rule->action]);
+    if(m < 0 || (size_t)(n + m) >= size) {
+        return -1;
+    }
+
+    return n + m;
+}
+
+static const char *SkipBlank(const char *cur) {
+    while(*cur == ' ' || *cur == '\t') {
+        ++cur;
+    }
+    return cur;
+}
+
+/* 与内核 GetIpPort 保持一致的 "IP/mask:PORT" 解析 */
+static int ParseIpPort(const char **p_cur, unsigned int *ip, unsigned int *ipmask, unsigned int *port) {
+    const char *cur = SkipBlank(*p_cur);
+    unsigned int temp;
+    int i, j;
+
+    *ip = 0;
+    if(*cur != 'A') {
+        for(j = 3; j >= 0; --j) {
+            for(i = 0, temp = 0; i < 3 && *cur >= '0' && *cur <= '9'; ++i, ++cur) {
+                temp = temp * 10 + (*cur - '0');
+            }
+            if(*cur != (j != 0 ? '.' : '/') || temp > 0xff) {
+                return -1;
+            }
+            *ip |= temp << (8 * j);
+            ++cur;
+        }
+        for(i = 0, temp = 0; i < 2 && *cur >= '0' && *cur <= '9'; ++i, ++cur) {
+            temp = temp * 10 + (*cur - '0');
+        }
+        if(temp > 32) {
+            return -1;
+        }
+        *ipmask = (temp == 0) ? 0 : (0xffffffffU << (32 - temp));
+        *ip &= *ipmask;
+    }
+    else {
+        *ip = IP_ANY;
+        *ipmask = 0;
+        ++cur;
+    }
+
+    if(*cur++ != ':') {
+        return -1;
+    }
+    if(*cur != 'A') {
+        for(i = 0, temp = 0; i < 8 && *cur >= '0' && *cur <= '9'; ++i, ++cur) {
+            temp = temp * 10 + (*cur - '0');
+        }
+        //内核 RuleValidate 拒绝超出范围的端口，整个镜像会因一行而装入失败
+        if(temp > 0xffff) {
+            return -1;
+        }
+        *port = temp;
+    }
+    else {
+        *port = PORT_ANY;
+        ++cur;
+    }
+
+    *p_cur = cur;
+    return 0;
+}
+
+/*
+ * 解析一条文本规则，语法与内核 ParseRule 相同：
+ *   <type> <srcip>/<mask>:<port> <dstip>/<mask>:<port> <rule>
+ * 动作字符之后只允许空白。成功返回0，失败返回-1。
+ */
+int RuleSpecParse(const char *str, struct RuleSpec *rule) {
+    const char *cur = SkipBlank(str);
+
+    memset(rule, 0, sizeof(*rule));
+    switch(*cur) {
+        case 'A': rule->type = PACKAGE_TYPE_ANY; break;
+        case 'I': rule->type = PACKAGE_TYPE_ICMP; break;
+        case 'T': rule->type = PACKAGE_TYPE_TCP; break;
+        case 'U': rule->type = PACKAGE_TYPE_UDP; break;
+        default: return -1;
+    }
+    ++cur;
+    if(*cur != ' ' && *cur != '\t') {
+        return -1;
+    }
+    if(ParseIpPort(&cur, &rule->srcip, &rule->srcmask, &rule->srcport) != 0
+            || (*cur != ' ' && *cur != '\t')) {
+        return -1;
+    }
+    if(ParseIpPort(&cur, &rule->dstip, &rule->dstmask, &rule->dstport) != 0
+            || (*cur != ' ' && *cur != '\t')) {
+        return -1;
+    }
+    cur = SkipBlank(cur);
+    switch(*cur) {
+        case 'P': rule->action = RULE_PERMIT; break;
+        case 'R': rule->action = RULE_REJECT; break;
+        case 'Q': rule->action = RULE_QUEUE; break;
+        case 'F': rule->action = RULE_REFUSE; break;
+        default: return -1;
+    }
+    cur = SkipBlank(cur + 1);
+    if(*cur != '\0' && *cur != '\r' && *cur != '\n') {
+        return -1;
+    }
+
+    return 0;
+}
+
+int RuleSpecEqual(const struct RuleSpec *a, const struct RuleSpec *b) {
+    return a->type == b->type && a->action == b->action
+        && a->srcip == b->srcip && a->srcmask == b->srcmask && a->srcport == b->srcport
+        && a->dstip == b->dstip && a->dstmask == b->dstmask && a->dstport == b->dstport;
+}
+
+int RuleSpecArrayPush(struct RuleSpecArray *array, const struct RuleSpec *rule) {
+    struct RuleSpec *temp;
+
+    if(array->count == array->cap) {
+        array->cap = array->cap ? array->cap * 2 : 1024;
+        temp = (struct RuleSpec *)realloc(array->rules, sizeof(struct RuleSpec) * array->cap);
+        if(temp == NULL) {
+            return -1;
+        }
+        array->rules = temp;
+    }
+    array->rules[array->count++] = *rule;
+    return 0;
+}
+
+/*
+ * 读取配置文件（并行解析，见 conf_parse.c）。文件中后出现的规则优先级更高
+ * （与 conf 逐条插入表头的结果一致），因此得到的数组（匹配顺序）是文件行序的逆序。
+ * 无法解析的行给出行号并跳过，空行忽略。返回无效行数，出错返回-1。
+ */
+int RuleSpecLoadConf(const char *path, struct RuleSpecArray *array) {
+    struct RuleSpec rule;
+    int fail, first = array->count, last, i;
+
+    if((fail = ConfParseFile(path, array, 0)) < 0) {
+        return -1;
+    }
+    for(i = first, last = array->count - 1; i < last; ++i, --last) {
+        rule = array->rules[i];
+        array->rules[i] = array->rules[last];
+        array->rules[last] = rule;
+    }
+    return fail;
+}
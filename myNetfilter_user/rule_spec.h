@@ -0,0 +1,22 @@
+#ifndef RULE_SPEC_H
+#define RULE_SPEC_H
+
+#include <stddef.h>
+
+#include "../common.h"
+
+int RuleSpecFormat(char *buf, size_t size, const struct RuleSpec *rule);
+int RuleSpecParse(const char *str, struct RuleSpec *rule);
+int RuleSpecEqual(const struct RuleSpec *a, const struct RuleSpec *b);
+
+struct RuleSpecArray {
+    struct RuleSpec *rules;
+    int count;
+    int cap;
+    unsigned int generation;    //set when filled from the kernel
+};
+
+int RuleSpecArrayPush(struct RuleSpecArray *array, const struct RuleSpec *rule);
+int RuleSpecLoadConf(const char *path, struct RuleSpecArray *array);
+
+#endif
@@ -0,0 +1,164 @@
+// 限时开启 tinyfw:tinyfw_classify 跟踪点并打印事件
+//
+// 使用独立的 ftrace 实例（instances/tinyfw_nf.<pid>），不影响全局跟踪缓冲区，
+// 过滤在内核中按字段完成，只有目标地址或端口的报文会产生事件。
+//
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "../common.h"
+#include "trace.h"
+
+#define TRACE_EVENT_DIR "events/tinyfw/tinyfw_classify"
+#define TRACE_DEFAULT_SECONDS 10
+#define TRACE_MAX_SECONDS 3600
+
+static const char *g_tracefs[] = {
+    "/sys/kernel/tracing",
+    "/sys/kernel/debug/tracing",
+};
+
+static volatile sig_atomic_t g_trace_stop = 0;
+
+static void TraceSignal(int sig) {
+    g_trace_stop = 1;
+}
+
+static int WriteFile(const char *dir, const char *name, const char *value) {
+    char path[256];
+    int fd, iRet = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if((fd = open(path, O_WRONLY | O_TRUNC)) < 0) {
+        return -errno;
+    }
+    if(write(fd, value, strlen(value)) != (ssize_t)strlen(value)) {
+        iRet = -errno;
+    }
+    close(fd);
+    return iRet;
+}
+
+/* 目标为点分十进制地址时按 saddr/daddr 过滤，否则按端口过滤 */
+static int BuildFilter(const char *target, char *filter, size_t size) {
+    struct in_addr addr;
+    char *end;
+    unsigned long port;
+
+    if(strchr(target, '.') != NULL) {
+        if(inet_pton(AF_INET, target, &addr) != 1) {
+            return -1;
+        }
+        snprintf(filter, size, "saddr == %u || daddr == %u", ntohl(addr.s_addr), ntohl(addr.s_addr));
+        return 0;
+    }
+    port = strtoul(target, &end, 10);
+    if(*target == '\0' || *end != '\0' || port > 0xffff) {
+        return -1;
+    }
+    snprintf(filter, size, "sport == %lu || dport == %lu", port, port);
+    return 0;
+}
+
+int DoTrace(const char *str_target, const char *str_seconds) {
+    char root[128], inst[192], filter[128], buf[4096];
+    struct pollfd pfd;
+    struct timespec now, deadline;
+    unsigned long seconds = TRACE_DEFAULT_SECONDS;
+    unsigned int i;
+    ssize_t len;
+    int iRet, remain, events = 0;
+
+    if(BuildFilter(str_target, filter, sizeof(filter)) != 0) {
+        printf("an IPv4 address or a port is needed.\n");
+        return -1;
+    }
+    if(str_seconds != NULL) {
+        seconds = strtoul(str_seconds, NULL, 10);
+        if(seconds == 0 || seconds > TRACE_MAX_SECONDS) {
+            printf("seconds must be in 1~%d.\n", TRACE_MAX_SECONDS);
+            return -1;
+        }
+    }
+
+    root[0] = '\0';
+    for(i = 0; i < sizeof(g_tracefs) / sizeof(g_tracefs[0]); ++i) {
+        snprintf(buf, sizeof(buf), "%s/" TRACE_EVENT_DIR, g_tracefs[i]);
+        if(access(buf, F_OK) == 0) {
+            snprintf(root, sizeof(root), "%s", g_tracefs[i]);
+            break;
+        }
+    }
+    if(root[0] == '\0') {
+        printf("tracepoint tinyfw:tinyfw_classify not found, is tracefs mounted and the module loaded?\n");
+        return -1;
+    }
+
+    snprintf(inst, sizeof(inst), "%s/instances/tinyfw_nf.%d", root, (int)getpid());
+    if(mkdir(inst, 0700) != 0) {
+        printf("create trace instance FAILED! (%s)\n", strerror(errno));
+        return -1;
+    }
+    snprintf(buf, sizeof(buf), "%s/" TRACE_EVENT_DIR, inst);
+    if((iRet = WriteFile(buf, "filter", filter)) != 0
+            || (iRet = WriteFile(buf, "enable", "1")) != 0) {
+        printf("enable tracepoint FAILED! (%s)\n", strerror(-iRet));
+        rmdir(inst);
+        return -1;
+    }
+
+    snprintf(buf, sizeof(buf), "%s/trace_pipe", inst);
+    pfd.fd = open(buf, O_RDONLY | O_NONBLOCK);
+    pfd.events = POLLIN;
+    if(pfd.fd < 0) {
+        printf("open trace_pipe FAILED! (%s)\n", strerror(errno));
+        snprintf(buf, sizeof(buf), "%s/" TRACE_EVENT_DIR, inst);
+        WriteFile(buf, "enable", "0");
+        rmdir(inst);
+        return -1;
+    }
+
+    signal(SIGINT, TraceSignal);
+    signal(SIGTERM, TraceSignal);
+    printf("tracing %s for %lu seconds (filter: %s)...\n", str_target, seconds, filter);
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += seconds;
+    while(!g_trace_stop) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remain = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+        if(remain <= 0) {
+            break;
+        }
+        if(poll(&pfd, 1, remain < 200 ? remain : 200) <= 0) {
+            continue;
+        }
+        while((len = read(pfd.fd, buf, sizeof(buf) - 1)) > 0) {
+            buf[len] = '\0';
+            for(i = 0; i < (unsigned int)len; ++i) {
+                events += (buf[i] == '\n');
+            }
+            fputs(buf, stdout);
+        }
+        fflush(stdout);
+    }
+    close(pfd.fd);
+
+    snprintf(buf, sizeof(buf), "%s/" TRACE_EVENT_DIR, inst);
+    WriteFile(buf, "enable", "0");
+    if(rmdir(inst) != 0) {
+        printf("remove trace instance %s FAILED! (%s)\n", inst, strerror(errno));
+    }
+    printf("%d events traced.\n", events);
+    return 0;
+}
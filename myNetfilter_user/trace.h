@@ -0,0 +1,6 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+int DoTrace(const char *str_target, const char *str_seconds);
+
+#endif